@@ -0,0 +1,228 @@
+/* bitrev.c
+ *
+ * bulk decoding of words read from spisnif fifos.
+ * Bit reversal uses a 256 entries table, or NEON/SSSE3 nibble shuffles
+ * when the compiler targets them (-mfpu=neon, -mssse3). Define
+ * BITREV_NO_SIMD to force the table.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "bitrev.h"
+
+#if !defined(BITREV_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define BITREV_NEON64
+#include <arm_neon.h>
+#elif !defined(BITREV_NO_SIMD) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define BITREV_NEON
+#include <arm_neon.h>
+#elif !defined(BITREV_NO_SIMD) && defined(__SSSE3__)
+#define BITREV_SSE
+#include <tmmintrin.h>
+#endif
+
+/* bits reversed byte */
+#define R2(n)   (n), (n) + 2*64, (n) + 1*64, (n) + 3*64
+#define R4(n)   R2(n), R2((n) + 2*16), R2((n) + 1*16), R2((n) + 3*16)
+#define R6(n)   R4(n), R4((n) + 2*4), R4((n) + 1*4), R4((n) + 3*4)
+static const unsigned char rev8[256] = { R6(0), R6(2), R6(1), R6(3) };
+
+/* nibble rendered lsb first */
+static const char nibble_bits[16][4] = {
+    "0000", "1000", "0100", "1100", "0010", "1010", "0110", "1110",
+    "0001", "1001", "0101", "1101", "0011", "1011", "0111", "1111"
+};
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+/* words reversed at once by bitrev16_bulk() on the stack */
+#define BITREV_CHUNK    256
+
+static inline unsigned short bitrev16(unsigned short value)
+{
+    return (rev8[value & 0xFF] << 8) | rev8[value >> 8];
+}
+
+#if defined(BITREV_NEON) || defined(BITREV_SSE)
+/* reversed nibble, in low and high half of a byte */
+static const unsigned char rev4_lo[16] = {
+    0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+    0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+static const unsigned char rev4_hi[16] = {
+    0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
+    0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0
+};
+#endif
+
+#if defined(BITREV_NEON64)
+const char *bitrev_kernel = "neon";
+
+static int bitrev16_simd(unsigned short *dst, const unsigned short *src,
+                         int word_num)
+{
+    uint8x16_t value;
+    int i;
+
+    for (i = 0; i + 8 <= word_num; i += 8) {
+        value = vreinterpretq_u8_u16(vld1q_u16(src + i));
+        value = vrev16q_u8(vrbitq_u8(value));
+        vst1q_u16(dst + i, vreinterpretq_u16_u8(value));
+    }
+    return i;
+}
+
+#elif defined(BITREV_NEON)
+const char *bitrev_kernel = "neon";
+
+static int bitrev16_simd(unsigned short *dst, const unsigned short *src,
+                         int word_num)
+{
+    uint8x8x2_t tbl_lo, tbl_hi;
+    uint8x8_t value, lo, hi;
+    int i;
+
+    tbl_lo.val[0] = vld1_u8(rev4_hi);
+    tbl_lo.val[1] = vld1_u8(rev4_hi + 8);
+    tbl_hi.val[0] = vld1_u8(rev4_lo);
+    tbl_hi.val[1] = vld1_u8(rev4_lo + 8);
+
+    for (i = 0; i + 4 <= word_num; i += 4) {
+        value = vreinterpret_u8_u16(vld1_u16(src + i));
+        lo = vand_u8(value, vdup_n_u8(0x0F));
+        hi = vshr_n_u8(value, 4);
+        value = vorr_u8(vtbl2_u8(tbl_lo, lo), vtbl2_u8(tbl_hi, hi));
+        vst1_u16(dst + i, vreinterpret_u16_u8(vrev16_u8(value)));
+    }
+    return i;
+}
+
+#elif defined(BITREV_SSE)
+const char *bitrev_kernel = "sse";
+
+static int bitrev16_simd(unsigned short *dst, const unsigned short *src,
+                         int word_num)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                       9, 8, 11, 10, 13, 12, 15, 14);
+    const __m128i tbl_lo = _mm_loadu_si128((const __m128i *)rev4_hi);
+    const __m128i tbl_hi = _mm_loadu_si128((const __m128i *)rev4_lo);
+    __m128i value, lo, hi;
+    int i;
+
+    for (i = 0; i + 8 <= word_num; i += 8) {
+        value = _mm_loadu_si128((const __m128i *)(src + i));
+        lo = _mm_and_si128(value, mask);
+        hi = _mm_and_si128(_mm_srli_epi16(value, 4), mask);
+        value = _mm_or_si128(_mm_shuffle_epi8(tbl_lo, lo),
+                             _mm_shuffle_epi8(tbl_hi, hi));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(value, swap));
+    }
+    return i;
+}
+
+#else
+const char *bitrev_kernel = "lut";
+
+static int bitrev16_simd(unsigned short *dst, const unsigned short *src,
+                         int word_num)
+{
+    return 0;
+}
+#endif
+
+void bitrev16_bulk(unsigned short *dst, const unsigned short *src,
+                   int word_num)
+{
+    int i;
+
+    for (i = bitrev16_simd(dst, src, word_num); i < word_num; i++)
+        dst[i] = bitrev16(src[i]);
+}
+
+/* first received bit is lsb, no reversal needed to render it first */
+static inline void render_word(char *dst, unsigned short value)
+{
+    memcpy(dst, nibble_bits[value & 0xF], 4);
+    memcpy(dst + 4, nibble_bits[(value >> 4) & 0xF], 4);
+    memcpy(dst + 8, nibble_bits[(value >> 8) & 0xF], 4);
+    memcpy(dst + 12, nibble_bits[value >> 12], 4);
+}
+
+char *bitrev_render_bits(char *dst, const unsigned short *words, int bit_num)
+{
+    char last[16];
+
+    for (; bit_num >= 16; bit_num -= 16) {
+        render_word(dst, *words++);
+        dst += 16;
+    }
+    if (bit_num > 0) {
+        render_word(last, *words);
+        memcpy(dst, last, bit_num);
+        dst += bit_num;
+    }
+    *dst = '\0';
+
+    return dst;
+}
+
+char *bitrev_render_hex(char *dst, const unsigned short *words, int word_num)
+{
+    unsigned short rev[BITREV_CHUNK];
+    int i, n;
+
+    for (; word_num > 0; word_num -= n, words += n) {
+        n = (word_num < BITREV_CHUNK) ? word_num : BITREV_CHUNK;
+        bitrev16_bulk(rev, words, n);
+        for (i = 0; i < n; i++) {
+            dst[0] = hex_digits[rev[i] >> 12];
+            dst[1] = hex_digits[(rev[i] >> 8) & 0xF];
+            dst[2] = hex_digits[(rev[i] >> 4) & 0xF];
+            dst[3] = hex_digits[rev[i] & 0xF];
+            dst += 4;
+        }
+    }
+    *dst = '\0';
+
+    return dst;
+}
+
+/* a reversed word holds its first bus byte in msb */
+void bitrev_bytes(unsigned char *dst, const unsigned short *words,
+                  int byte_num)
+{
+    unsigned short rev[BITREV_CHUNK];
+    int i, n, word_num = (byte_num + 1)/2;
+
+    for (; word_num > 0; word_num -= n, words += n) {
+        n = (word_num < BITREV_CHUNK) ? word_num : BITREV_CHUNK;
+        bitrev16_bulk(rev, words, n);
+        for (i = 0; i < n; i++) {
+            *dst++ = rev[i] >> 8;
+            if (--byte_num == 0)
+                break;
+            *dst++ = rev[i] & 0xFF;
+            byte_num--;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/* bitrev.h
+ *
+ * bulk decoding of words read from spisnif fifos
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __BITREV_H__
+#define __BITREV_H__
+
+/* fifo_mxsx stores the first received bit in lsb of each word, these
+ * helpers give words and strings in bus order (first bit on the left). */
+
+/* name of the kernel selected at build time: "lut", "sse" or "neon" */
+extern const char *bitrev_kernel;
+
+/* reverse bits of word_num words, dst may be src */
+void bitrev16_bulk(unsigned short *dst, const unsigned short *src,
+                   int word_num);
+
+/* write bit_num '0'/'1' chars and a '\0' in dst (bit_num + 1 bytes).
+ * Return pointer on the '\0'. */
+char *bitrev_render_bits(char *dst, const unsigned short *words, int bit_num);
+
+/* write word_num bus ordered words as 4 hex digits and a '\0' in dst
+ * (4*word_num + 1 bytes). Return pointer on the '\0'. */
+char *bitrev_render_hex(char *dst, const unsigned short *words, int word_num);
+
+/* write byte_num bus ordered bytes of a lane (first bit in msb of first
+ * byte) in dst */
+void bitrev_bytes(unsigned char *dst, const unsigned short *words,
+                  int byte_num);
+
+#endif /* __BITREV_H__ */
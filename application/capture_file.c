@@ -0,0 +1,477 @@
+/* capture_file.c
+ *
+ * streaming pcapng writer for frames captured by spisnif.
+ * Records are packed in a large buffer and written by whole chunks, with
+ * optional O_DIRECT to keep page cache out of long captures. A seek index
+ * and a footer end the file, for capture_reader.c.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE     /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "spisnif.h"
+#include "capture_file.h"
+
+/* options */
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_COMMENT      1
+#define PCAPNG_SHB_USERAPPL     4
+#define PCAPNG_IF_NAME          2
+#define PCAPNG_IF_TSRESOL       9
+#define PCAPNG_ISB_IFDROP       5
+
+#define PAD32(len)  (((len) + 3) & ~3)
+
+/* trailing block length */
+#define EPB_FOOTER_SIZE     4
+/* header, timestamp, isb_ifdrop, opt_comment of ISB_COMMENT_SIZE at
+ * most, end of options and footer */
+#define ISB_COMMENT_SIZE    64
+#define ISB_MAX_SIZE        (20 + 12 + 4 + ISB_COMMENT_SIZE + 4 + 4)
+/* index entries allocated first, doubled when full */
+#define INDEX_FIRST_SIZE    1024
+
+static unsigned char *put32(unsigned char *ptr, uint32_t value)
+{
+    memcpy(ptr, &value, 4);
+    return ptr + 4;
+}
+
+static unsigned char *put16(unsigned char *ptr, uint16_t value)
+{
+    memcpy(ptr, &value, 2);
+    return ptr + 2;
+}
+
+static unsigned char *put_option(unsigned char *ptr, uint16_t code,
+                                 const void *value, uint16_t len)
+{
+    ptr = put16(ptr, code);
+    ptr = put16(ptr, len);
+    if (len)
+        memcpy(ptr, value, len);
+    memset(ptr + len, 0, PAD32(len) - len);
+    return ptr + PAD32(len);
+}
+
+/* write whole chunks of buffer, keep the tail for next flush when
+ * O_DIRECT requires aligned sizes */
+static int capture_file_write_buf(struct capture_file *cf, size_t len)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < len) {
+        ret = write(cf->fd, cf->buf + done, len - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("capture file write error: %s\n", strerror(errno));
+            return -1;
+        }
+        done += ret;
+    }
+
+    memmove(cf->buf, cf->buf + len, cf->len - len);
+    cf->len -= len;
+    return 0;
+}
+
+int capture_file_flush(struct capture_file *cf)
+{
+    size_t len = cf->len;
+
+    if (cf->direct)
+        len -= len % CAPTURE_DIRECT_ALIGN;
+
+    return capture_file_write_buf(cf, len);
+}
+
+static int capture_file_reserve(struct capture_file *cf, size_t len)
+{
+    if (cf->len + len <= CAPTURE_BUF_SIZE)
+        return 0;
+
+    return capture_file_flush(cf);
+}
+
+/* copy len bytes at end of buffer, len at most CAPTURE_BUF_SIZE */
+static int capture_file_append(struct capture_file *cf, const void *data,
+                               size_t len)
+{
+    if (capture_file_reserve(cf, len) < 0)
+        return -1;
+
+    memcpy(cf->buf + cf->len, data, len);
+    cf->len += len;
+    cf->byte_num += len;
+    return 0;
+}
+
+static int capture_file_write_headers(struct capture_file *cf,
+                                      const char * const *names)
+{
+    unsigned char *ptr = cf->buf;
+    unsigned char *block;
+    uint8_t tsresol = 9;    /* nanoseconds */
+    int i;
+
+    /* Section Header Block */
+    block = ptr;
+    ptr = put32(ptr, PCAPNG_SHB_TYPE);
+    ptr = put32(ptr, 0);
+    ptr = put32(ptr, PCAPNG_BYTE_ORDER);
+    ptr = put16(ptr, 1);
+    ptr = put16(ptr, 0);
+    ptr = put32(ptr, 0xFFFFFFFF);   /* section length unknown */
+    ptr = put32(ptr, 0xFFFFFFFF);
+    ptr = put_option(ptr, PCAPNG_SHB_USERAPPL, "spisnif", 7);
+    ptr = put_option(ptr, PCAPNG_OPT_END, NULL, 0);
+    ptr = put32(ptr, ptr - block + 4);
+    put32(block + 4, ptr - block);
+
+    /* Interface Description Blocks */
+    for (i = 0; i < cf->interface_num; i++) {
+        block = ptr;
+        ptr = put32(ptr, PCAPNG_IDB_TYPE);
+        ptr = put32(ptr, 0);
+        ptr = put16(ptr, CAPTURE_LINKTYPE_SPISNIF);
+        ptr = put16(ptr, 0);
+        ptr = put32(ptr, 0);    /* no snap length */
+        ptr = put_option(ptr, PCAPNG_IF_NAME, names[i], strlen(names[i]));
+        ptr = put_option(ptr, PCAPNG_IF_TSRESOL, &tsresol, 1);
+        ptr = put_option(ptr, PCAPNG_OPT_END, NULL, 0);
+        ptr = put32(ptr, ptr - block + 4);
+        put32(block + 4, ptr - block);
+    }
+
+    cf->len = ptr - cf->buf;
+    cf->byte_num = cf->len;
+    /* first packet block is indexed */
+    cf->index_next = cf->byte_num;
+    return 0;
+}
+
+struct capture_file *capture_file_open_interfaces(const char *path, int direct,
+                                                  const char * const *names,
+                                                  int interface_num)
+{
+    struct capture_file *cf;
+    int flags = O_WRONLY|O_CREAT|O_TRUNC;
+    int i;
+
+    if ((interface_num < 1) || (interface_num > CAPTURE_MAX_INTERFACES)) {
+        printf("capture file: %d interfaces, 1 to %d supported\n",
+               interface_num, CAPTURE_MAX_INTERFACES);
+        return NULL;
+    }
+    /* names must fit in the headers written at once in the buffer */
+    for (i = 0; i < interface_num; i++) {
+        if (strlen(names[i]) > CAPTURE_MAX_NAME) {
+            printf("capture file: interface name %s too long\n", names[i]);
+            return NULL;
+        }
+    }
+
+    cf = (struct capture_file *)calloc(1, sizeof(struct capture_file));
+    if (cf == NULL) {
+        printf("can't allocate memory for capture file\n");
+        return NULL;
+    }
+    cf->interface_num = interface_num;
+
+    if (posix_memalign((void **)&cf->buf, CAPTURE_DIRECT_ALIGN,
+                       CAPTURE_BUF_SIZE) != 0) {
+        printf("can't allocate capture file buffer\n");
+        goto free_cf;
+    }
+
+    cf->fd = -1;
+    if (direct) {
+        cf->fd = open(path, flags|O_DIRECT, 0644);
+        if (cf->fd < 0)
+            printf("Warning: O_DIRECT not supported on %s, using buffered writes\n",
+                   path);
+        else
+            cf->direct = 1;
+    }
+    if (cf->fd < 0)
+        cf->fd = open(path, flags, 0644);
+    if (cf->fd < 0) {
+        printf("can't open capture file %s: %s\n", path, strerror(errno));
+        goto free_buf;
+    }
+
+    capture_file_write_headers(cf, names);
+    return cf;
+
+free_buf:
+    free(cf->buf);
+free_cf:
+    free(cf);
+    return NULL;
+}
+
+struct capture_file *capture_file_open(const char *path, int direct)
+{
+    static const char * const names[] = { "spisnif" };
+
+    return capture_file_open_interfaces(path, direct, names, 1);
+}
+
+/* Index entry for the block about to be written at byte_num. Without
+ * memory for the index, capture goes on and readers scan the file. */
+static void capture_file_index(struct capture_file *cf,
+                               unsigned long long frame_num,
+                               unsigned long long ts_ns,
+                               const struct spi_frame *frame)
+{
+    struct capture_index_entry *entry;
+    int size;
+
+    if (cf->index_failed)
+        return;
+
+    if (cf->index_num == cf->index_size) {
+        size = cf->index_size ? 2*cf->index_size : INDEX_FIRST_SIZE;
+        entry = (struct capture_index_entry *)
+                realloc(cf->index, size*sizeof(struct capture_index_entry));
+        if (entry == NULL) {
+            printf("Warning: can't grow capture file index, no index written\n");
+            cf->index_failed = 1;
+            return;
+        }
+        cf->index = entry;
+        cf->index_size = size;
+    }
+
+    entry = &cf->index[cf->index_num++];
+    entry->frame = frame_num;
+    entry->ts_ns = ts_ns;
+    entry->offset = cf->byte_num;
+    entry->ts_start = frame->ts_start;
+    entry->reserved = 0;
+    cf->index_next = cf->byte_num + CAPTURE_INDEX_STEP;
+}
+
+/* index block then footer block, the footer ending the file */
+static int capture_file_write_index(struct capture_file *cf)
+{
+    struct capture_footer footer;
+    uint32_t header[4];
+    uint32_t len;
+    int i;
+
+    footer.magic = CAPTURE_FOOTER_MAGIC;
+    footer.entry_num = cf->index_num;
+    footer.index_offset = cf->byte_num;
+    footer.frame_num = cf->frame_num;
+
+    len = sizeof(header) + cf->index_num*sizeof(struct capture_index_entry) +
+          4;
+    header[0] = CAPTURE_INDEX_TYPE;
+    header[1] = len;
+    header[2] = cf->index_num;
+    header[3] = 0;
+    if (capture_file_append(cf, header, sizeof(header)) < 0)
+        return -1;
+    for (i = 0; i < cf->index_num; i++) {
+        if (capture_file_append(cf, &cf->index[i],
+                                sizeof(struct capture_index_entry)) < 0)
+            return -1;
+    }
+    if (capture_file_append(cf, &len, 4) < 0)
+        return -1;
+
+    len = 8 + sizeof(footer) + 4;
+    header[0] = CAPTURE_FOOTER_TYPE;
+    header[1] = len;
+    if ((capture_file_append(cf, header, 8) < 0) ||
+        (capture_file_append(cf, &footer, sizeof(footer)) < 0) ||
+        (capture_file_append(cf, &len, 4) < 0))
+        return -1;
+    return 0;
+}
+
+/* Interface Statistics Block with LOSS totals of interface: isb_ifdrop
+ * counts lost packets, a comment gives lost bits and overflows */
+static int capture_file_write_stats(struct capture_file *cf, int interface,
+                                    unsigned long long ts_ns)
+{
+    const struct capture_interface *cif = &cf->interfaces[interface];
+    unsigned char *ptr, *block;
+    char comment[ISB_COMMENT_SIZE];
+    uint64_t ifdrop = cif->lost_packets;
+    int len;
+
+    if (capture_file_reserve(cf, ISB_MAX_SIZE) < 0)
+        return -1;
+
+    len = snprintf(comment, sizeof(comment), "%llu bits lost, %llu overflows",
+                   cif->lost_bits, cif->overflows);
+    if (len >= (int)sizeof(comment))
+        len = sizeof(comment) - 1;
+
+    block = ptr = cf->buf + cf->len;
+    ptr = put32(ptr, PCAPNG_ISB_TYPE);
+    ptr = put32(ptr, 0);
+    ptr = put32(ptr, interface);
+    ptr = put32(ptr, ts_ns >> 32);
+    ptr = put32(ptr, ts_ns & 0xFFFFFFFF);
+    ptr = put_option(ptr, PCAPNG_ISB_IFDROP, &ifdrop, 8);
+    ptr = put_option(ptr, PCAPNG_OPT_COMMENT, comment, len);
+    ptr = put_option(ptr, PCAPNG_OPT_END, NULL, 0);
+    ptr = put32(ptr, ptr - block + 4);
+    put32(block + 4, ptr - block);
+
+    cf->len += ptr - block;
+    cf->byte_num += ptr - block;
+    return 0;
+}
+
+/* append one Enhanced Packet Block per frame, all stamped with ts, then
+ * an Interface Statistics Block if the drain found losses */
+int capture_file_write_frames_on(struct capture_file *cf, int interface,
+                                 const struct spi_frame_list *flist,
+                                 const struct timespec *ts)
+{
+    struct capture_interface *cif;
+    const struct spi_frame *frame;
+    struct spisnif_record record;
+    unsigned long long ts_ns;
+    unsigned char *ptr, *block;
+    uint32_t data_len;
+    int i, word_num;
+
+    ts_ns = (unsigned long long)ts->tv_sec*1000000000ULL + ts->tv_nsec;
+
+    for (i = 0; i < flist->frame_num; i++) {
+        frame = &flist->frames[i];
+        word_num = (frame->bit_num == 0) ? 0 : FRAME_WORDS(frame->bit_num);
+
+        record.bit_num = frame->bit_num;
+        record.flags = (frame->cs < 0) ? 0 :
+                       frame->cs << CAPTURE_RECORD_CS_SHIFT;
+        if (frame->lanes == 2)
+            record.flags |= 1 << CAPTURE_RECORD_LANES_SHIFT;
+        else if (frame->lanes == 4)
+            record.flags |= 2 << CAPTURE_RECORD_LANES_SHIFT;
+        record.mosi_words = word_num;
+        record.miso_words = word_num;
+        record.ts_start = frame->ts_start;
+        record.ts_end = frame->ts_end;
+        data_len = sizeof(record) + 2*word_num*sizeof(unsigned short);
+
+        if (capture_file_reserve(cf, EPB_HEADER_SIZE + PAD32(data_len) +
+                                     EPB_FOOTER_SIZE) < 0)
+            return -1;
+        if (cf->byte_num >= cf->index_next)
+            capture_file_index(cf, cf->frame_num + i, ts_ns, frame);
+
+        block = ptr = cf->buf + cf->len;
+        ptr = put32(ptr, PCAPNG_EPB_TYPE);
+        ptr = put32(ptr, EPB_HEADER_SIZE + PAD32(data_len) + EPB_FOOTER_SIZE);
+        ptr = put32(ptr, interface);
+        ptr = put32(ptr, ts_ns >> 32);
+        ptr = put32(ptr, ts_ns & 0xFFFFFFFF);
+        ptr = put32(ptr, data_len);
+        ptr = put32(ptr, data_len);
+
+        memcpy(ptr, &record, sizeof(record));
+        ptr += sizeof(record);
+        if (word_num && frame->rle) {
+            /* records hold expanded lanes, lanes were checked by the
+             * drain */
+            spisnif_rle_expand((unsigned short *)ptr, word_num, frame->mosi,
+                               frame->mosi_words);
+            ptr += word_num*sizeof(unsigned short);
+            spisnif_rle_expand((unsigned short *)ptr, word_num, frame->miso,
+                               frame->miso_words);
+            ptr += word_num*sizeof(unsigned short);
+        } else if (word_num) {
+            memcpy(ptr, frame->mosi, word_num*sizeof(unsigned short));
+            ptr += word_num*sizeof(unsigned short);
+            memcpy(ptr, frame->miso, word_num*sizeof(unsigned short));
+            ptr += word_num*sizeof(unsigned short);
+        }
+        memset(ptr, 0, PAD32(data_len) - data_len);
+        ptr += PAD32(data_len) - data_len;
+        ptr = put32(ptr, ptr - block + 4);
+
+        cf->len += ptr - block;
+        cf->byte_num += ptr - block;
+    }
+    cf->frame_num += flist->frame_num;
+
+    if (flist->loss.packets || flist->loss.overflows) {
+        cif = &cf->interfaces[interface];
+        cif->lost_packets += flist->loss.packets;
+        cif->lost_bits += flist->loss.bits;
+        cif->overflows += flist->loss.overflows;
+        cf->lost_packets += flist->loss.packets;
+        cf->lost_bits += flist->loss.bits;
+        cf->overflows += flist->loss.overflows;
+        return capture_file_write_stats(cf, interface, ts_ns);
+    }
+
+    return 0;
+}
+
+int capture_file_write_frames(struct capture_file *cf,
+                              const struct spi_frame_list *flist,
+                              const struct timespec *ts)
+{
+    return capture_file_write_frames_on(cf, 0, flist, ts);
+}
+
+int capture_file_close(struct capture_file *cf)
+{
+    int ret = 0;
+
+    if (!cf->index_failed)
+        ret = capture_file_write_index(cf);
+    if (ret == 0)
+        ret = capture_file_flush(cf);
+    /* last chunk is not block aligned */
+    if ((ret == 0) && cf->direct && cf->len) {
+        fcntl(cf->fd, F_SETFL, fcntl(cf->fd, F_GETFL) & ~O_DIRECT);
+        ret = capture_file_write_buf(cf, cf->len);
+    }
+
+    if (close(cf->fd) < 0)
+        ret = -1;
+
+    printf("Capture file closed: %llu frames, %llu bytes\n",
+           cf->frame_num, cf->byte_num);
+    if (cf->lost_packets)
+        printf("%llu packets lost (%llu bits), %llu overflows\n",
+               cf->lost_packets, cf->lost_bits, cf->overflows);
+    free(cf->index);
+    free(cf->buf);
+    free(cf);
+    return ret;
+}
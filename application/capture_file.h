@@ -0,0 +1,149 @@
+/* capture_file.h
+ *
+ * streaming pcapng writer for frames captured by spisnif
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __CAPTURE_FILE_H__
+#define __CAPTURE_FILE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "frame_arena.h"
+
+/* pcapng link type used for spisnif frames (LINKTYPE_USER0) */
+#define CAPTURE_LINKTYPE_SPISNIF    147
+
+/* pcapng blocks */
+#define PCAPNG_SHB_TYPE     0x0A0D0D0A
+#define PCAPNG_IDB_TYPE     0x00000001
+#define PCAPNG_ISB_TYPE     0x00000005
+#define PCAPNG_EPB_TYPE     0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+
+/* block header + interface id, timestamp and lengths */
+#define EPB_HEADER_SIZE     28
+
+/* write buffer, flushed in one write() when full */
+#define CAPTURE_BUF_SIZE    (1024*1024)
+/* O_DIRECT writes must be aligned on this size */
+#define CAPTURE_DIRECT_ALIGN    4096
+/* an index entry for the first frame after each step of file bytes */
+#define CAPTURE_INDEX_STEP  (1024*1024)
+/* pcapng interfaces of one file, one per capture instance */
+#define CAPTURE_MAX_INTERFACES  8
+/* interface name length, if_name option */
+#define CAPTURE_MAX_NAME        64
+
+/* seek index and footer, pcapng block types of local use: other pcapng
+ * readers skip them */
+#define CAPTURE_INDEX_TYPE  0x80000001
+#define CAPTURE_FOOTER_TYPE 0x80000002
+#define CAPTURE_FOOTER_MAGIC    0x58444E49  /* "INDX" */
+
+/* Packet data of each Enhanced Packet Block, in section byte order.
+ * bit_num bits are stored in mosi_words words of MOSI followed by
+ * miso_words words of MISO, as read from the fifos (first bit in lsb).
+ * ts_start and ts_end are the component clock counter at CS assert and
+ * deassert, the block timestamp is the host time of the drain. */
+#ifndef __SPISNIF_H__
+/* same layout as the driver record, programs reading the driver include
+ * its spisnif.h first */
+struct spisnif_record {
+    uint16_t bit_num;
+    uint16_t flags;
+    uint16_t mosi_words;
+    uint16_t miso_words;
+    uint32_t ts_start;
+    uint32_t ts_end;
+};
+#endif
+
+/* record flags: CS input index of multi CS components */
+#define CAPTURE_RECORD_CS_SHIFT 8
+#define CAPTURE_RECORD_CS_MASK  (0x7 << CAPTURE_RECORD_CS_SHIFT)
+/* record flags: log2 of data lanes */
+#define CAPTURE_RECORD_LANES_SHIFT  11
+#define CAPTURE_RECORD_LANES_MASK   (0x3 << CAPTURE_RECORD_LANES_SHIFT)
+
+/* Index block data: entry_num then reserved 32 bits, then entries.
+ * Frames are numbered from 0 in file order, ts_ns is the block
+ * timestamp. */
+struct capture_index_entry {
+    uint64_t frame;
+    uint64_t ts_ns;
+    uint64_t offset;    /* Enhanced Packet Block offset in file */
+    uint32_t ts_start;  /* component counter, wraps */
+    uint32_t reserved;
+};
+
+/* footer block data, last block of a closed capture */
+struct capture_footer {
+    uint32_t magic;
+    uint32_t entry_num;
+    uint64_t index_offset;  /* index block offset in file */
+    uint64_t frame_num;
+};
+
+/* LOSS totals of one interface, reported in its Statistics Blocks */
+struct capture_interface {
+    unsigned long long lost_packets;
+    unsigned long long lost_bits;
+    unsigned long long overflows;
+};
+
+struct capture_file {
+    int fd;
+    int direct;
+    unsigned char *buf;
+    size_t len;
+    unsigned long long frame_num;
+    unsigned long long byte_num;
+    struct capture_interface interfaces[CAPTURE_MAX_INTERFACES];
+    int interface_num;
+    /* LOSS totals of all interfaces */
+    unsigned long long lost_packets;
+    unsigned long long lost_bits;
+    unsigned long long overflows;
+    /* seek index, written with the footer at close */
+    struct capture_index_entry *index;
+    int index_num;
+    int index_size;
+    int index_failed;
+    unsigned long long index_next;
+};
+
+struct capture_file *capture_file_open(const char *path, int direct);
+/* file with one interface per name, numbered from 0 in names order */
+struct capture_file *capture_file_open_interfaces(const char *path, int direct,
+                                                  const char * const *names,
+                                                  int interface_num);
+int capture_file_write_frames(struct capture_file *cf,
+                              const struct spi_frame_list *flist,
+                              const struct timespec *ts);
+/* same on interface of a file opened with capture_file_open_interfaces */
+int capture_file_write_frames_on(struct capture_file *cf, int interface,
+                                 const struct spi_frame_list *flist,
+                                 const struct timespec *ts);
+int capture_file_flush(struct capture_file *cf);
+int capture_file_close(struct capture_file *cf);
+
+#endif /* __CAPTURE_FILE_H__ */
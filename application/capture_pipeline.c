@@ -0,0 +1,239 @@
+/* capture_pipeline.c
+ *
+ * hands frame lists drained by one thread to worker threads, so slow
+ * printing or disk writes do not delay the next fifo drain.
+ * Frame lists stay in their arena slot, only pointers go through the
+ * rings, and no lock is shared between the drain thread and the stages.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "capture_pipeline.h"
+
+static int spsc_ring_init(struct spsc_ring *ring, int size)
+{
+    memset(ring, 0, sizeof(struct spsc_ring));
+    ring->lists = (struct spi_frame_list **)
+                  calloc(size, sizeof(struct spi_frame_list *));
+    if (ring->lists == NULL)
+        return -1;
+    if (sem_init(&ring->items, 0, 0) < 0) {
+        free(ring->lists);
+        ring->lists = NULL;
+        return -1;
+    }
+    ring->size = size;
+    return 0;
+}
+
+static void spsc_ring_free(struct spsc_ring *ring)
+{
+    if (ring->lists == NULL)
+        return;
+    sem_destroy(&ring->items);
+    free(ring->lists);
+    ring->lists = NULL;
+}
+
+/* producer side, -1 if full. The list is written before head moves. */
+static int spsc_ring_push(struct spsc_ring *ring, struct spi_frame_list *flist)
+{
+    unsigned int head = ring->head;
+    unsigned int depth;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+        (unsigned int)ring->size)
+        return -1;
+
+    ring->lists[head % ring->size] = flist;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&ring->items);
+
+    depth = head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (depth > __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED))
+        __atomic_store_n(&ring->high_water, depth, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* consumer side, sleeps until a list is queued */
+static struct spi_frame_list *spsc_ring_pop(struct spsc_ring *ring)
+{
+    struct spi_frame_list *flist;
+    unsigned int tail = ring->tail;
+
+    while (sem_wait(&ring->items) < 0) {
+        if (errno != EINTR)
+            return NULL;
+    }
+
+    flist = ring->lists[tail % ring->size];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return flist;
+}
+
+/* A NULL list asks the stage to stop: it is forwarded so every stage
+ * first empties its input ring. */
+static void *pipeline_stage_thread(void *data)
+{
+    struct pipeline_stage *stage = (struct pipeline_stage *)data;
+    struct spi_frame_list *flist;
+
+    for (;;) {
+        flist = spsc_ring_pop(stage->in);
+        if ((flist != NULL) && !stage->failed &&
+            (stage->fn(flist, stage->arg) < 0))
+            __atomic_store_n(&stage->failed, 1, __ATOMIC_RELEASE);
+
+        if (stage->out != NULL)
+            spsc_ring_push(stage->out, flist);
+        else if (flist != NULL)
+            frame_arena_release(stage->pipe->arena, flist);
+
+        if (flist == NULL)
+            break;
+    }
+    return NULL;
+}
+
+int capture_pipeline_init(struct capture_pipeline *pipe,
+                          struct frame_arena *arena)
+{
+    memset(pipe, 0, sizeof(struct capture_pipeline));
+    pipe->arena = arena;
+    return 0;
+}
+
+int capture_pipeline_add_stage(struct capture_pipeline *pipe,
+                               pipeline_stage_fn fn, void *arg)
+{
+    struct pipeline_stage *stage;
+
+    if (pipe->started || (pipe->stage_num == PIPELINE_MAX_STAGES)) {
+        printf("capture_pipeline error: can't add stage\n");
+        return -1;
+    }
+
+    stage = &pipe->stages[pipe->stage_num++];
+    stage->pipe = pipe;
+    stage->fn = fn;
+    stage->arg = arg;
+    return 0;
+}
+
+int capture_pipeline_start(struct capture_pipeline *pipe)
+{
+    struct pipeline_stage *stage;
+    sigset_t all, old;
+    int i, ret;
+
+    if (pipe->stage_num == 0) {
+        printf("capture_pipeline error: no stage\n");
+        return -1;
+    }
+
+    /* every slot and the stop request fit in each ring */
+    for (i = 0; i < pipe->stage_num; i++) {
+        if (spsc_ring_init(&pipe->rings[i], pipe->arena->slot_num + 1) < 0) {
+            printf("can't allocate pipeline rings\n");
+            goto free_rings;
+        }
+    }
+
+    /* stages inherit a blocked signal mask, signals go to the drain
+     * thread and interrupt its waits */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < pipe->stage_num; i++) {
+        stage = &pipe->stages[i];
+        stage->in = &pipe->rings[i];
+        stage->out = (i + 1 < pipe->stage_num) ? &pipe->rings[i + 1] : NULL;
+        ret = pthread_create(&stage->thread, NULL, pipeline_stage_thread,
+                             stage);
+        if (ret != 0) {
+            printf("can't create pipeline thread (%d)\n", ret);
+            /* stop stages already running */
+            spsc_ring_push(&pipe->rings[0], NULL);
+            while (i--)
+                pthread_join(pipe->stages[i].thread, NULL);
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            goto free_rings;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pipe->started = 1;
+    return 0;
+
+free_rings:
+    for (i = 0; i < pipe->stage_num; i++)
+        spsc_ring_free(&pipe->rings[i]);
+    return -1;
+}
+
+int capture_pipeline_push(struct capture_pipeline *pipe,
+                          struct spi_frame_list *flist)
+{
+    if (spsc_ring_push(&pipe->rings[0], flist) < 0) {
+        printf("capture_pipeline error: ring full\n");
+        return -1;
+    }
+    return 0;
+}
+
+int capture_pipeline_failed(struct capture_pipeline *pipe)
+{
+    int i;
+
+    for (i = 0; i < pipe->stage_num; i++) {
+        if (__atomic_load_n(&pipe->stages[i].failed, __ATOMIC_ACQUIRE))
+            return 1;
+    }
+    return 0;
+}
+
+int capture_pipeline_high_water(struct capture_pipeline *pipe, int stage)
+{
+    if (!pipe->started)
+        return 0;
+
+    /* a push racing with the reset is seen in next interval */
+    return __atomic_exchange_n(&pipe->rings[stage].high_water, 0,
+                               __ATOMIC_RELAXED);
+}
+
+void capture_pipeline_stop(struct capture_pipeline *pipe)
+{
+    int i;
+
+    if (!pipe->started)
+        return;
+
+    spsc_ring_push(&pipe->rings[0], NULL);
+    for (i = 0; i < pipe->stage_num; i++)
+        pthread_join(pipe->stages[i].thread, NULL);
+    for (i = 0; i < pipe->stage_num; i++)
+        spsc_ring_free(&pipe->rings[i]);
+    pipe->started = 0;
+}
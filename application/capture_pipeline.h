@@ -0,0 +1,92 @@
+/* capture_pipeline.h
+ *
+ * hands frame lists drained by one thread to worker threads, so slow
+ * printing or disk writes do not delay the next fifo drain
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __CAPTURE_PIPELINE_H__
+#define __CAPTURE_PIPELINE_H__
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "frame_arena.h"
+
+#define PIPELINE_MAX_STAGES 4
+
+/* Lock free ring of frame lists between two threads: only the producer
+ * moves head, only the consumer moves tail. items counts queued lists so
+ * the consumer sleeps while the ring is empty; sem_post() does not enter
+ * the kernel unless the consumer is actually waiting. */
+struct spsc_ring {
+    int size;
+    unsigned int head;
+    unsigned int tail;
+    struct spi_frame_list **lists;
+    sem_t items;
+    /* most lists queued at once, set by the producer */
+    unsigned int high_water;
+};
+
+/* called by the stage thread for each frame list, in drain order.
+ * A negative return stops calling it, lists still go through. */
+typedef int (*pipeline_stage_fn)(struct spi_frame_list *flist, void *arg);
+
+struct capture_pipeline;
+
+struct pipeline_stage {
+    struct capture_pipeline *pipe;
+    pthread_t thread;
+    pipeline_stage_fn fn;
+    void *arg;
+    /* lists come from in, go to out or back to the arena on last stage */
+    struct spsc_ring *in;
+    struct spsc_ring *out;
+    int failed;
+};
+
+/* Drain thread -> stage 0 -> stage 1 ... -> arena. Frame lists are
+ * reserved and committed by the drain thread and released by the last
+ * stage, each ring can hold every arena slot so pushes never wait. */
+struct capture_pipeline {
+    struct frame_arena *arena;
+    int stage_num;
+    int started;
+    struct pipeline_stage stages[PIPELINE_MAX_STAGES];
+    struct spsc_ring rings[PIPELINE_MAX_STAGES];
+};
+
+int capture_pipeline_init(struct capture_pipeline *pipe,
+                          struct frame_arena *arena);
+int capture_pipeline_add_stage(struct capture_pipeline *pipe,
+                               pipeline_stage_fn fn, void *arg);
+int capture_pipeline_start(struct capture_pipeline *pipe);
+/* hand a committed frame list to first stage, drain thread only */
+int capture_pipeline_push(struct capture_pipeline *pipe,
+                          struct spi_frame_list *flist);
+/* 1 once a stage function failed */
+int capture_pipeline_failed(struct capture_pipeline *pipe);
+/* most lists queued at once for a stage since the previous call */
+int capture_pipeline_high_water(struct capture_pipeline *pipe, int stage);
+/* let stages finish queued lists, then join them and free rings */
+void capture_pipeline_stop(struct capture_pipeline *pipe);
+
+#endif /* __CAPTURE_PIPELINE_H__ */
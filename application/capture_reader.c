@@ -0,0 +1,422 @@
+/* capture_reader.c
+ *
+ * random access to pcapng files written by capture_file.c.
+ * The file is mapped, seeks binary search the index of the footer then
+ * walk at most CAPTURE_INDEX_STEP bytes of block headers, so opening a
+ * long capture at a given time or frame does not read it all.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture_reader.h"
+
+/* block type and length, trailing length */
+#define BLOCK_MIN_SIZE      12
+/* Enhanced Packet Block header up to its data, trailing length */
+#define EPB_MIN_SIZE        (EPB_HEADER_SIZE + 4)
+/* type, length, entry_num and reserved */
+#define INDEX_HEADER_SIZE   16
+#define FOOTER_BLOCK_SIZE   (8 + sizeof(struct capture_footer) + 4)
+
+/* blocks are only 32 bits aligned in the file */
+static uint16_t get16(const unsigned char *ptr)
+{
+    uint16_t value;
+
+    memcpy(&value, ptr, 2);
+    return value;
+}
+
+static uint32_t get32(const unsigned char *ptr)
+{
+    uint32_t value;
+
+    memcpy(&value, ptr, 4);
+    return value;
+}
+
+/* 1 with type and length of the block at offset, 0 at end of file or on
+ * a block cut by the end of an unclosed capture, -1 if malformed */
+static int capture_reader_block(struct capture_reader *cr, size_t offset,
+                                uint32_t *type, uint32_t *len)
+{
+    if (offset + BLOCK_MIN_SIZE > cr->size)
+        return 0;
+
+    *type = get32(cr->map + offset);
+    *len = get32(cr->map + offset + 4);
+    if ((*len < BLOCK_MIN_SIZE) || (*len & 3))
+        return -1;
+    if (*len > cr->size - offset)
+        return 0;
+    return 1;
+}
+
+/* block of len bytes at least EPB_MIN_SIZE long */
+static unsigned long long epb_ts(const unsigned char *block)
+{
+    return ((unsigned long long)get32(block + 12) << 32) | get32(block + 16);
+}
+
+/* section and interface headers, as written by capture_file.c */
+static int capture_reader_headers(struct capture_reader *cr)
+{
+    uint32_t type, len;
+    size_t offset;
+
+    if ((capture_reader_block(cr, 0, &type, &len) != 1) ||
+        (type != PCAPNG_SHB_TYPE) || (len < 16))
+        return -1;
+    /* written with host byte order */
+    if (get32(cr->map + 8) != PCAPNG_BYTE_ORDER)
+        return -1;
+
+    /* one interface per capture instance */
+    offset = len;
+    while ((capture_reader_block(cr, offset, &type, &len) == 1) &&
+           (type == PCAPNG_IDB_TYPE)) {
+        if ((len < 20) ||
+            (get16(cr->map + offset + 8) != CAPTURE_LINKTYPE_SPISNIF))
+            return -1;
+        cr->interface_num++;
+        offset += len;
+    }
+    if (cr->interface_num == 0)
+        return -1;
+
+    cr->data_offset = offset;
+    return 0;
+}
+
+/* index pointed by the footer ending the file, -1 if there is none */
+static int capture_reader_load_index(struct capture_reader *cr)
+{
+    struct capture_index_entry *entry;
+    struct capture_footer footer;
+    uint32_t type, len, i;
+    size_t offset;
+
+    if (cr->size < cr->data_offset + FOOTER_BLOCK_SIZE)
+        return -1;
+    offset = cr->size - FOOTER_BLOCK_SIZE;
+    if ((capture_reader_block(cr, offset, &type, &len) != 1) ||
+        (type != CAPTURE_FOOTER_TYPE) || (len != FOOTER_BLOCK_SIZE))
+        return -1;
+    memcpy(&footer, cr->map + offset + 8, sizeof(footer));
+    if ((footer.magic != CAPTURE_FOOTER_MAGIC) ||
+        (footer.index_offset < cr->data_offset) ||
+        (footer.index_offset >= offset))
+        return -1;
+    /* frames need an entry for frame 0, and entries must fit before the
+     * footer: entry_num*sizeof() below can't overflow size_t then */
+    if ((footer.frame_num && !footer.entry_num) ||
+        (footer.entry_num > (offset - footer.index_offset)/
+                            sizeof(struct capture_index_entry)))
+        return -1;
+
+    offset = footer.index_offset;
+    if ((capture_reader_block(cr, offset, &type, &len) != 1) ||
+        (type != CAPTURE_INDEX_TYPE) ||
+        (len != INDEX_HEADER_SIZE +
+                footer.entry_num*sizeof(struct capture_index_entry) + 4) ||
+        (get32(cr->map + offset + 8) != footer.entry_num))
+        return -1;
+
+    /* copied: 64 bits fields may not be aligned in the mapping */
+    cr->index = (struct capture_index_entry *)
+                malloc((footer.entry_num + 1)*sizeof(struct capture_index_entry));
+    if (cr->index == NULL)
+        return -1;
+    memcpy(cr->index, cr->map + offset + INDEX_HEADER_SIZE,
+           footer.entry_num*sizeof(struct capture_index_entry));
+    if (footer.entry_num && (cr->index[0].frame != 0))
+        return -1;
+    /* seeks trust entries: each one points at a packet block before the
+     * index, after the previous entry, with frames in step */
+    for (i = 0; i < footer.entry_num; i++) {
+        entry = &cr->index[i];
+        if ((entry->offset < cr->data_offset) ||
+            (entry->offset > footer.index_offset - EPB_MIN_SIZE) ||
+            (entry->frame >= footer.frame_num) ||
+            ((i > 0) && ((entry->offset <= entry[-1].offset) ||
+                         (entry->frame <= entry[-1].frame))))
+            return -1;
+        if ((capture_reader_block(cr, entry->offset, &type, &len) != 1) ||
+            (type != PCAPNG_EPB_TYPE) || (len < EPB_MIN_SIZE))
+            return -1;
+    }
+    cr->index_num = footer.entry_num;
+    cr->frame_num = footer.frame_num;
+    return 0;
+}
+
+/* unclosed capture: index built the way capture_file.c does, from block
+ * headers */
+static int capture_reader_build_index(struct capture_reader *cr)
+{
+    struct capture_index_entry *entry;
+    unsigned long long frame = 0;
+    size_t offset, next;
+    uint32_t type, len;
+    int size = 0;
+
+    offset = next = cr->data_offset;
+    while (capture_reader_block(cr, offset, &type, &len) == 1) {
+        if (type != PCAPNG_EPB_TYPE) {
+            offset += len;
+            continue;
+        }
+        /* capture_reader_next() stops on it too */
+        if (len < EPB_MIN_SIZE)
+            break;
+
+        if (offset >= next) {
+            if (cr->index_num == size) {
+                size = size ? 2*size : 1024;
+                entry = (struct capture_index_entry *)
+                        realloc(cr->index,
+                                size*sizeof(struct capture_index_entry));
+                if (entry == NULL)
+                    return -1;
+                cr->index = entry;
+            }
+            entry = &cr->index[cr->index_num++];
+            entry->frame = frame;
+            entry->ts_ns = epb_ts(cr->map + offset);
+            entry->offset = offset;
+            entry->ts_start = (len >= EPB_HEADER_SIZE +
+                               sizeof(struct spisnif_record)) ?
+                              get32(cr->map + offset + EPB_HEADER_SIZE + 8) : 0;
+            entry->reserved = 0;
+            next = offset + CAPTURE_INDEX_STEP;
+        }
+        frame++;
+        offset += len;
+    }
+
+    cr->frame_num = frame;
+    return 0;
+}
+
+struct capture_reader *capture_reader_open(const char *path)
+{
+    struct capture_reader *cr;
+    struct stat st;
+    void *map;
+
+    cr = (struct capture_reader *)calloc(1, sizeof(struct capture_reader));
+    if (cr == NULL) {
+        printf("can't allocate memory for capture reader\n");
+        return NULL;
+    }
+
+    cr->fd = open(path, O_RDONLY);
+    if (cr->fd < 0) {
+        printf("can't open capture file %s: %s\n", path, strerror(errno));
+        goto free_cr;
+    }
+    if (fstat(cr->fd, &st) < 0) {
+        printf("can't stat capture file %s: %s\n", path, strerror(errno));
+        goto close_fd;
+    }
+    if (st.st_size < BLOCK_MIN_SIZE) {
+        printf("%s is not a spisnif capture file\n", path);
+        goto close_fd;
+    }
+
+    cr->size = st.st_size;
+    map = mmap(NULL, cr->size, PROT_READ, MAP_SHARED, cr->fd, 0);
+    if (map == MAP_FAILED) {
+        printf("can't map capture file %s: %s\n", path, strerror(errno));
+        goto close_fd;
+    }
+    cr->map = (const unsigned char *)map;
+
+    if (capture_reader_headers(cr) < 0) {
+        printf("%s is not a spisnif capture file\n", path);
+        goto unmap;
+    }
+
+    if (capture_reader_load_index(cr) < 0) {
+        printf("Warning: no valid index in %s, scanning it\n", path);
+        free(cr->index);
+        cr->index = NULL;
+        cr->index_num = 0;
+        if (capture_reader_build_index(cr) < 0) {
+            printf("can't allocate capture file index\n");
+            goto free_index;
+        }
+    }
+    return cr;
+
+free_index:
+    free(cr->index);
+unmap:
+    munmap((void *)cr->map, cr->size);
+close_fd:
+    close(cr->fd);
+free_cr:
+    free(cr);
+    return NULL;
+}
+
+void capture_reader_close(struct capture_reader *cr)
+{
+    munmap((void *)cr->map, cr->size);
+    close(cr->fd);
+    free(cr->index);
+    free(cr);
+}
+
+void capture_reader_rewind(struct capture_reader *cr,
+                           struct capture_cursor *cur)
+{
+    cur->offset = cr->data_offset;
+    cur->frame = 0;
+}
+
+int capture_reader_seek_frame(struct capture_reader *cr,
+                              struct capture_cursor *cur,
+                              unsigned long long frame)
+{
+    uint32_t type, len;
+    int lo = 0, hi = cr->index_num, mid;
+
+    if (frame >= cr->frame_num)
+        return -1;
+
+    /* last entry at or before frame */
+    while (hi - lo > 1) {
+        mid = (lo + hi)/2;
+        if (cr->index[mid].frame <= frame)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    cur->offset = cr->index[lo].offset;
+    cur->frame = cr->index[lo].frame;
+
+    while (cur->frame < frame) {
+        if (capture_reader_block(cr, cur->offset, &type, &len) != 1)
+            return -1;
+        if (type == PCAPNG_EPB_TYPE)
+            cur->frame++;
+        cur->offset += len;
+    }
+    return 0;
+}
+
+int capture_reader_seek_time(struct capture_reader *cr,
+                             struct capture_cursor *cur,
+                             unsigned long long ts_ns)
+{
+    uint32_t type, len;
+    int lo = 0, hi = cr->index_num, mid;
+
+    /* last entry strictly before ts_ns: frames of one drain share their
+     * timestamp and the entry may not be the first of them */
+    if ((cr->index_num == 0) || (cr->index[0].ts_ns >= ts_ns)) {
+        capture_reader_rewind(cr, cur);
+    } else {
+        while (hi - lo > 1) {
+            mid = (lo + hi)/2;
+            if (cr->index[mid].ts_ns < ts_ns)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        cur->offset = cr->index[lo].offset;
+        cur->frame = cr->index[lo].frame;
+    }
+
+    for (;;) {
+        if (capture_reader_block(cr, cur->offset, &type, &len) != 1)
+            return -1;
+        if (type == PCAPNG_EPB_TYPE) {
+            if (len < EPB_MIN_SIZE)
+                return -1;
+            if (epb_ts(cr->map + cur->offset) >= ts_ns)
+                return 0;
+            cur->frame++;
+        }
+        cur->offset += len;
+    }
+}
+
+int capture_reader_next(struct capture_reader *cr,
+                        struct capture_cursor *cur,
+                        struct capture_packet *pkt)
+{
+    const struct spisnif_record *record;
+    const unsigned char *block;
+    uint32_t type, len, data_len;
+    int ret;
+
+    for (;;) {
+        ret = capture_reader_block(cr, cur->offset, &type, &len);
+        if (ret != 1)
+            return ret;
+        if (type == PCAPNG_EPB_TYPE)
+            break;
+        cur->offset += len;
+    }
+    if (len < EPB_MIN_SIZE)
+        return -1;
+
+    block = cr->map + cur->offset;
+    data_len = get32(block + 20);
+    if ((data_len < sizeof(struct spisnif_record)) ||
+        (data_len > len - EPB_HEADER_SIZE - 4))
+        return -1;
+    /* 32 bits aligned as the block is */
+    record = (const struct spisnif_record *)(block + EPB_HEADER_SIZE);
+    if (sizeof(struct spisnif_record) +
+        (record->mosi_words + record->miso_words)*sizeof(unsigned short) >
+        data_len)
+        return -1;
+
+    pkt->frame = cur->frame;
+    pkt->ts_ns = epb_ts(block);
+    pkt->interface = get32(block + 8);
+    pkt->spi.bit_num = record->bit_num;
+    pkt->spi.cs = (record->flags & CAPTURE_RECORD_CS_MASK) >>
+                  CAPTURE_RECORD_CS_SHIFT;
+    pkt->spi.lanes = 1 << ((record->flags & CAPTURE_RECORD_LANES_MASK) >>
+                           CAPTURE_RECORD_LANES_SHIFT);
+    pkt->spi.ts_start = record->ts_start;
+    pkt->spi.ts_end = record->ts_end;
+    pkt->spi.rle = 0;
+    pkt->spi.mosi_words = record->mosi_words;
+    pkt->spi.miso_words = record->miso_words;
+    pkt->spi.mosi = (unsigned short *)(record + 1);
+    pkt->spi.miso = pkt->spi.mosi + record->mosi_words;
+
+    cur->frame++;
+    cur->offset += len;
+    return 1;
+}
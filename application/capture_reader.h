@@ -0,0 +1,81 @@
+/* capture_reader.h
+ *
+ * random access to pcapng files written by capture_file.c
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __CAPTURE_READER_H__
+#define __CAPTURE_READER_H__
+
+#include <stddef.h>
+
+#include "capture_file.h"
+
+/* Whole file mapped read only. The index comes from the footer, or is
+ * rebuilt by walking block headers when the capture was not closed. */
+struct capture_reader {
+    int fd;
+    const unsigned char *map;
+    size_t size;
+    /* first block after section and interface headers */
+    size_t data_offset;
+    int interface_num;
+    struct capture_index_entry *index;
+    int index_num;
+    unsigned long long frame_num;
+};
+
+/* next block to read and its frame number */
+struct capture_cursor {
+    size_t offset;
+    unsigned long long frame;
+};
+
+/* One Enhanced Packet Block. spi.mosi and spi.miso point into the read
+ * only mapping, valid until capture_reader_close(). Single CS captures
+ * are stored as CS 0. */
+struct capture_packet {
+    unsigned long long frame;
+    unsigned long long ts_ns;
+    int interface;      /* capture instance of multi interface files */
+    struct spi_frame spi;
+};
+
+struct capture_reader *capture_reader_open(const char *path);
+void capture_reader_close(struct capture_reader *cr);
+
+/* Place cursor on a frame number, or on the first frame stamped ts_ns or
+ * later (drain timestamps are assumed not to go back). -1 past the end. */
+void capture_reader_rewind(struct capture_reader *cr,
+                           struct capture_cursor *cur);
+int capture_reader_seek_frame(struct capture_reader *cr,
+                              struct capture_cursor *cur,
+                              unsigned long long frame);
+int capture_reader_seek_time(struct capture_reader *cr,
+                             struct capture_cursor *cur,
+                             unsigned long long ts_ns);
+
+/* packet at cursor, cursor then moves past it: 1, 0 at end of file, -1
+ * on a malformed packet block */
+int capture_reader_next(struct capture_reader *cr,
+                        struct capture_cursor *cur,
+                        struct capture_packet *pkt);
+
+#endif /* __CAPTURE_READER_H__ */
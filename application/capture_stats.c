@@ -0,0 +1,129 @@
+/* capture_stats.c
+ *
+ * periodic capture statistics of the drain thread, printed as one line
+ * of key=value fields per interval so that scripts can follow how close
+ * the capture runs to losing packets.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "capture_stats.h"
+
+static void capture_stats_reset(struct capture_stats *stats,
+                                const struct timespec *now)
+{
+    int interval_ms = stats->interval_ms;
+    FILE *out = stats->out;
+
+    memset(stats, 0, sizeof(struct capture_stats));
+    stats->interval_ms = interval_ms;
+    stats->out = out;
+    stats->start = *now;
+}
+
+void capture_stats_init(struct capture_stats *stats, int interval_ms,
+                        FILE *out)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats->interval_ms = interval_ms;
+    stats->out = out;
+    capture_stats_reset(stats, &now);
+}
+
+void capture_stats_drain(struct capture_stats *stats,
+                         const struct spi_frame_list *flist,
+                         struct frame_arena *arena,
+                         unsigned long long drain_ns)
+{
+    int i, used, mosi_words = 0, miso_words = 0;
+
+    /* stored words, as read from fifo_mxsx: rle frames are not expanded */
+    for (i = 0; i < flist->frame_num; i++) {
+        stats->bits += flist->frames[i].bit_num;
+        mosi_words += flist->frames[i].mosi_words;
+        miso_words += flist->frames[i].miso_words;
+    }
+    stats->packets += flist->frame_num;
+    stats->lost_packets += flist->loss.packets;
+    stats->overflows += flist->loss.overflows;
+
+    stats->drains++;
+    stats->drain_ns += drain_ns;
+    if (drain_ns > stats->drain_ns_max)
+        stats->drain_ns_max = drain_ns;
+
+    /* a drain reads what STATUS reported */
+    if (flist->frame_num > stats->fifo_high_water)
+        stats->fifo_high_water = flist->frame_num;
+    if (mosi_words > stats->mxsx_high_water)
+        stats->mxsx_high_water = mosi_words;
+    if (miso_words > stats->mxsx_high_water)
+        stats->mxsx_high_water = miso_words;
+    used = frame_arena_used(arena);
+    if (used > stats->arena_high_water)
+        stats->arena_high_water = used;
+}
+
+void capture_stats_report(struct capture_stats *stats,
+                          struct capture_pipeline *pipe)
+{
+    struct timespec now, wall;
+    unsigned long long elapsed_ns;
+    char line[512];
+    char *ptr = line;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ns = (now.tv_sec - stats->start.tv_sec)*1000000000ULL +
+                 now.tv_nsec - stats->start.tv_nsec;
+    if (elapsed_ns < stats->interval_ms*1000000ULL)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    ptr += sprintf(ptr, "stats time=%ld.%03ld interval_ms=%llu",
+                   (long)wall.tv_sec, wall.tv_nsec/1000000,
+                   elapsed_ns/1000000);
+    ptr += sprintf(ptr, " packets=%llu pps=%.0f bps=%.0f",
+                   stats->packets, stats->packets*1e9/elapsed_ns,
+                   stats->bits*1e9/elapsed_ns);
+    ptr += sprintf(ptr, " drains=%u drain_us_avg=%.1f drain_us_max=%.1f",
+                   stats->drains,
+                   stats->drains ? stats->drain_ns/1e3/stats->drains : 0.0,
+                   stats->drain_ns_max/1e3);
+    ptr += sprintf(ptr, " fifo_hwm=%d mxsx_hwm=%d arena_hwm=%d",
+                   stats->fifo_high_water, stats->mxsx_high_water,
+                   stats->arena_high_water);
+    ptr += sprintf(ptr, " lost=%llu overflows=%llu stalls=%llu",
+                   stats->lost_packets, stats->overflows, stats->stalls);
+    if ((pipe != NULL) && pipe->started) {
+        ptr += sprintf(ptr, " queue_hwm=");
+        for (i = 0; i < pipe->stage_num; i++)
+            ptr += sprintf(ptr, "%s%d", i ? "," : "",
+                           capture_pipeline_high_water(pipe, i));
+    }
+    *ptr++ = '\n';
+    fwrite(line, 1, ptr - line, stats->out);
+    fflush(stats->out);
+
+    capture_stats_reset(stats, &now);
+}
@@ -0,0 +1,64 @@
+/* capture_stats.h
+ *
+ * periodic capture statistics of the drain thread
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __CAPTURE_STATS_H__
+#define __CAPTURE_STATS_H__
+
+#include <stdio.h>
+#include <time.h>
+
+#include "frame_arena.h"
+#include "capture_pipeline.h"
+
+/* Counters of one interval, only touched by the drain thread. High water
+ * marks are the most seen at once during the interval. */
+struct capture_stats {
+    int interval_ms;
+    FILE *out;
+    struct timespec start;      /* CLOCK_MONOTONIC */
+    unsigned long long packets;
+    unsigned long long bits;
+    unsigned long long lost_packets;
+    unsigned long long overflows;
+    unsigned long long stalls;  /* waits for a free arena slot */
+    unsigned int drains;
+    unsigned long long drain_ns;
+    unsigned long long drain_ns_max;
+    int fifo_high_water;        /* STATUS packet_num */
+    int mxsx_high_water;        /* words drained from one fifo_mxsx */
+    int arena_high_water;       /* slots */
+};
+
+void capture_stats_init(struct capture_stats *stats, int interval_ms,
+                        FILE *out);
+/* account one drain that took drain_ns */
+void capture_stats_drain(struct capture_stats *stats,
+                         const struct spi_frame_list *flist,
+                         struct frame_arena *arena,
+                         unsigned long long drain_ns);
+/* once the interval elapsed, print one line and start next interval.
+ * pipe may be NULL or not started. */
+void capture_stats_report(struct capture_stats *stats,
+                          struct capture_pipeline *pipe);
+
+#endif /* __CAPTURE_STATS_H__ */
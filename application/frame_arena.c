@@ -0,0 +1,168 @@
+/* frame_arena.c
+ *
+ * preallocated storage for frames drained from spisnif fifos.
+ * All memory is taken once at startup, capture does not touch the heap.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spisnif.h"
+#include "frame_arena.h"
+
+/* mosi + miso words of a full fifo drain, rle frames are kept as stored */
+#define SLOT_WORDS  (2*FRAME_ARENA_MAX_WORDS)
+
+size_t frame_arena_size(int slot_num)
+{
+    return slot_num*(sizeof(struct spi_frame_list) +
+                     FRAME_ARENA_MAX_FRAMES*sizeof(struct spi_frame) +
+                     SLOT_WORDS*sizeof(unsigned short));
+}
+
+int frame_arena_init(struct frame_arena *arena, int slot_num)
+{
+    int i;
+
+    memset(arena, 0, sizeof(struct frame_arena));
+    if (slot_num < 1) {
+        printf("frame_arena error: %d slots\n", slot_num);
+        return -1;
+    }
+
+    arena->slots = (struct spi_frame_list *)
+                   calloc(slot_num, sizeof(struct spi_frame_list));
+    arena->frames = (struct spi_frame *)
+                    calloc(slot_num*FRAME_ARENA_MAX_FRAMES,
+                           sizeof(struct spi_frame));
+    arena->words = (unsigned short *)
+                   calloc(slot_num*SLOT_WORDS, sizeof(unsigned short));
+    if ((arena->slots == NULL) || (arena->frames == NULL) ||
+        (arena->words == NULL)) {
+        printf("can't allocate memory for frame arena\n");
+        frame_arena_free(arena);
+        return -1;
+    }
+
+    arena->slot_num = slot_num;
+    for (i = 0; i < slot_num; i++) {
+        arena->slots[i].frames = arena->frames + i*FRAME_ARENA_MAX_FRAMES;
+        arena->slots[i].words = arena->words + i*SLOT_WORDS;
+    }
+
+    return 0;
+}
+
+void frame_arena_free(struct frame_arena *arena)
+{
+    free(arena->slots);
+    free(arena->frames);
+    free(arena->words);
+    memset(arena, 0, sizeof(struct frame_arena));
+}
+
+int frame_arena_full(struct frame_arena *arena)
+{
+    return __atomic_load_n(&arena->used, __ATOMIC_ACQUIRE) == arena->slot_num;
+}
+
+/* slots reserved and not released yet, from any thread */
+int frame_arena_used(struct frame_arena *arena)
+{
+    return __atomic_load_n(&arena->used, __ATOMIC_ACQUIRE);
+}
+
+/* Get the next empty slot, NULL if all slots are still in use.
+ * The slot is only handed to consumers after frame_arena_commit(), so
+ * a failed drain can simply drop it. */
+struct spi_frame_list *frame_arena_reserve(struct frame_arena *arena)
+{
+    struct spi_frame_list *flist;
+
+    if (frame_arena_full(arena))
+        return NULL;
+
+    flist = &arena->slots[arena->head];
+    flist->frame_num = 0;
+    flist->word_num = 0;
+
+    return flist;
+}
+
+void frame_arena_commit(struct frame_arena *arena)
+{
+    arena->head = (arena->head + 1) % arena->slot_num;
+    __atomic_add_fetch(&arena->used, 1, __ATOMIC_RELEASE);
+}
+
+/* slots are recycled in the order they were committed */
+void frame_arena_release(struct frame_arena *arena,
+                         struct spi_frame_list *flist)
+{
+    if ((__atomic_load_n(&arena->used, __ATOMIC_ACQUIRE) == 0) ||
+        (flist != &arena->slots[arena->tail])) {
+        printf("frame_arena error: releasing slot out of order\n");
+        return;
+    }
+
+    arena->tail = (arena->tail + 1) % arena->slot_num;
+    __atomic_sub_fetch(&arena->used, 1, __ATOMIC_RELEASE);
+}
+
+/* take word_num words from the slot pool, NULL if it is exhausted */
+unsigned short *frame_list_alloc_words(struct spi_frame_list *flist,
+                                       int word_num)
+{
+    unsigned short *words;
+
+    if (flist->word_num + word_num > SLOT_WORDS)
+        return NULL;
+
+    words = flist->words + flist->word_num;
+    flist->word_num += word_num;
+
+    return words;
+}
+
+/* lanes of drained frames were checked by the drain */
+const struct spi_frame *frame_expand(const struct spi_frame *frame,
+                                     struct spi_frame *expanded,
+                                     unsigned short *words)
+{
+    int word_num;
+
+    if (!frame->rle)
+        return frame;
+
+    word_num = FRAME_WORDS(frame->bit_num);
+    *expanded = *frame;
+    expanded->rle = 0;
+    expanded->mosi_words = word_num;
+    expanded->miso_words = word_num;
+    expanded->mosi = words;
+    expanded->miso = words + word_num;
+    spisnif_rle_expand(expanded->mosi, word_num, frame->mosi,
+                       frame->mosi_words);
+    spisnif_rle_expand(expanded->miso, word_num, frame->miso,
+                       frame->miso_words);
+    return expanded;
+}
@@ -0,0 +1,130 @@
+/* frame_arena.h
+ *
+ * preallocated storage for frames drained from spisnif fifos
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __FRAME_ARENA_H__
+#define __FRAME_ARENA_H__
+
+#include <stddef.h>
+#include <time.h>
+
+/* fifos geometry, must match generics of hdl/spisnif.vhd */
+#define SPISNIF_FIFO_MXSX_SIZE          1024    /* fifo_mosi_size, fifo_miso_size */
+#define SPISNIF_FIFO_MXSX_NUM           1       /* fifo_mosi_num, fifo_miso_num */
+#define SPISNIF_FIFO_PACKET_RAM_SIZE    1024    /* fifo_packet_ram_size */
+#define SPISNIF_FIFO_PACKET_RAM_NUM     3       /* fifo_packet_ram_num */
+#define SPISNIF_FIFO_PINFO_RAM_NUM      4       /* fifo_pinfo_ram_num */
+#define SPISNIF_PACKET_NUM_MAX          0x07FF  /* STATUS packet_num field */
+
+/* words of one fifo_mxsx */
+#define FRAME_ARENA_MAX_WORDS   (SPISNIF_FIFO_MXSX_SIZE*SPISNIF_FIFO_MXSX_NUM)
+/* packets reported by STATUS in one drain */
+#if (SPISNIF_FIFO_PACKET_RAM_SIZE*SPISNIF_FIFO_PACKET_RAM_NUM) < SPISNIF_PACKET_NUM_MAX
+#define FRAME_ARENA_MAX_FRAMES  (SPISNIF_FIFO_PACKET_RAM_SIZE*SPISNIF_FIFO_PACKET_RAM_NUM)
+#else
+#define FRAME_ARENA_MAX_FRAMES  SPISNIF_PACKET_NUM_MAX
+#endif
+
+#define FRAME_ARENA_DEFAULT_SLOTS   16
+
+struct spi_frame {
+    int bit_num;
+    /* CS input index, -1 on a single CS component */
+    int cs;
+    /* data lanes: 1, 2 (dual, data 0 in mosi and 1 in miso) or 4 (quad,
+     * data 0 and 2 in mosi, 1 and 3 in miso, 2 bits per sck edge) */
+    int lanes;
+    /* gls_clk counter at CS assert and deassert */
+    unsigned int ts_start;
+    unsigned int ts_end;
+    /* rle frames are kept as stored in fifos, mosi and miso then hold
+     * mosi_words and miso_words run length encoded words, see
+     * frame_expand() */
+    int rle;
+    int mosi_words;
+    int miso_words;
+    unsigned short *mosi;
+    unsigned short *miso;
+};
+
+/* LOSS counters latched at the end of a drain: packets the component
+ * could not record since previous drain, saturated */
+struct spi_loss {
+    unsigned int packets;
+    unsigned int bits;
+    unsigned int overflows;
+    unsigned int sck_period;    /* half gls_clk periods */
+};
+
+/* one fifo drain, lives in an arena slot */
+struct spi_frame_list {
+    int frame_num;
+    struct spi_frame *frames;
+    struct spi_loss loss;
+    /* host time of the drain */
+    struct timespec ts;
+    /* words pool of the slot: mosi and miso of each frame are stored
+     * one after the other */
+    int word_num;
+    unsigned short *words;
+};
+
+/* fixed ring of slots, each one able to hold a full fifo drain.
+ * Slots are filled at head and released at tail, in order. One thread may
+ * reserve and commit while another one releases: only used is shared. */
+struct frame_arena {
+    int slot_num;
+    int head;
+    int tail;
+    int used;
+    struct spi_frame_list *slots;
+    struct spi_frame *frames;
+    unsigned short *words;
+};
+
+/* words needed to store bit_num bits of one lane */
+#define FRAME_WORDS(bit_num)    (((bit_num) - 1)/16 + 1)
+/* words of one lane of the longest packet, bit_num being 16 bits: rle
+ * frames expand up to it, beyond fifo_mxsx size */
+#define FRAME_MAX_LANE_WORDS    FRAME_WORDS(0xFFFF)
+
+int frame_arena_init(struct frame_arena *arena, int slot_num);
+void frame_arena_free(struct frame_arena *arena);
+size_t frame_arena_size(int slot_num);
+
+int frame_arena_full(struct frame_arena *arena);
+int frame_arena_used(struct frame_arena *arena);
+struct spi_frame_list *frame_arena_reserve(struct frame_arena *arena);
+void frame_arena_commit(struct frame_arena *arena);
+void frame_arena_release(struct frame_arena *arena,
+                         struct spi_frame_list *flist);
+
+unsigned short *frame_list_alloc_words(struct spi_frame_list *flist,
+                                       int word_num);
+
+/* frame itself, or for rle frames a copy of it in expanded with its
+ * lanes expanded in words (2*FRAME_MAX_LANE_WORDS words) */
+const struct spi_frame *frame_expand(const struct spi_frame *frame,
+                                     struct spi_frame *expanded,
+                                     unsigned short *words);
+
+#endif /* __FRAME_ARENA_H__ */
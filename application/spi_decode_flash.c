@@ -0,0 +1,167 @@
+/* spi_decode_flash.c
+ *
+ * JEDEC SPI NOR flash decoder: one transaction per CS window, command
+ * byte then address, dummy bytes and data.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "spi_decoder.h"
+
+/* address bytes: none, 3, 4, or current addressing mode */
+#define FLASH_ADDR_NONE 0
+#define FLASH_ADDR_3    3
+#define FLASH_ADDR_4    4
+#define FLASH_ADDR_MODE 5
+
+/* effect on decoder state, or status register read */
+#define FLASH_SET_ADDR4     1
+#define FLASH_CLEAR_ADDR4   2
+#define FLASH_STATUS        3
+
+struct flash_cmd {
+    const char *op;
+    unsigned char addr;
+    unsigned char dummy;
+    unsigned char dir;
+    unsigned char effect;
+};
+
+/* Indexed by opcode, NULL op for unknown ones. Dual and quad output
+ * commands send opcode and address on one lane: their data is only right
+ * in packets captured with the matching lanes mode. I/O commands sending
+ * the address on several lanes are left out. */
+static const struct flash_cmd flash_cmds[256] = {
+    [0x01] = { "WRSR",      FLASH_ADDR_NONE, 0, SPI_DIR_WRITE, 0 },
+    [0x02] = { "PP",        FLASH_ADDR_MODE, 0, SPI_DIR_WRITE, 0 },
+    [0x03] = { "READ",      FLASH_ADDR_MODE, 0, SPI_DIR_READ, 0 },
+    [0x04] = { "WRDI",      FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x05] = { "RDSR",      FLASH_ADDR_NONE, 0, SPI_DIR_READ, FLASH_STATUS },
+    [0x06] = { "WREN",      FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x0B] = { "FAST_READ", FLASH_ADDR_MODE, 1, SPI_DIR_READ, 0 },
+    [0x0C] = { "FAST_READ4B", FLASH_ADDR_4,  1, SPI_DIR_READ, 0 },
+    [0x12] = { "PP4B",      FLASH_ADDR_4,    0, SPI_DIR_WRITE, 0 },
+    [0x13] = { "READ4B",    FLASH_ADDR_4,    0, SPI_DIR_READ, 0 },
+    [0x15] = { "RDCR",      FLASH_ADDR_NONE, 0, SPI_DIR_READ, FLASH_STATUS },
+    [0x20] = { "SE",        FLASH_ADDR_MODE, 0, SPI_DIR_NONE, 0 },
+    [0x21] = { "SE4B",      FLASH_ADDR_4,    0, SPI_DIR_NONE, 0 },
+    [0x31] = { "WRSR2",     FLASH_ADDR_NONE, 0, SPI_DIR_WRITE, 0 },
+    [0x32] = { "QPP",       FLASH_ADDR_MODE, 0, SPI_DIR_WRITE, 0 },
+    [0x35] = { "RDSR2",     FLASH_ADDR_NONE, 0, SPI_DIR_READ, FLASH_STATUS },
+    [0x3B] = { "DOR",       FLASH_ADDR_MODE, 1, SPI_DIR_READ, 0 },
+    [0x4B] = { "RDUID",     FLASH_ADDR_NONE, 4, SPI_DIR_READ, 0 },
+    [0x52] = { "BE32K",     FLASH_ADDR_MODE, 0, SPI_DIR_NONE, 0 },
+    [0x5A] = { "RDSFDP",    FLASH_ADDR_3,    1, SPI_DIR_READ, 0 },
+    [0x60] = { "CE",        FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x66] = { "RSTEN",     FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x6B] = { "QOR",       FLASH_ADDR_MODE, 1, SPI_DIR_READ, 0 },
+    [0x70] = { "RDFSR",     FLASH_ADDR_NONE, 0, SPI_DIR_READ, FLASH_STATUS },
+    [0x75] = { "SUSPEND",   FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x7A] = { "RESUME",    FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0x90] = { "REMS",      FLASH_ADDR_3,    0, SPI_DIR_READ, 0 },
+    [0x99] = { "RST",       FLASH_ADDR_NONE, 0, SPI_DIR_NONE, FLASH_CLEAR_ADDR4 },
+    [0x9F] = { "RDID",      FLASH_ADDR_NONE, 0, SPI_DIR_READ, 0 },
+    [0xAB] = { "RES",       FLASH_ADDR_NONE, 3, SPI_DIR_READ, 0 },
+    [0xB7] = { "EN4B",      FLASH_ADDR_NONE, 0, SPI_DIR_NONE, FLASH_SET_ADDR4 },
+    [0xB9] = { "DP",        FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0xC7] = { "CE",        FLASH_ADDR_NONE, 0, SPI_DIR_NONE, 0 },
+    [0xD8] = { "BE",        FLASH_ADDR_MODE, 0, SPI_DIR_NONE, 0 },
+    [0xDC] = { "BE4B",      FLASH_ADDR_4,    0, SPI_DIR_NONE, 0 },
+    [0xE9] = { "EX4B",      FLASH_ADDR_NONE, 0, SPI_DIR_NONE, FLASH_CLEAR_ADDR4 },
+};
+
+/* 4 bytes addressing entered by EN4B, left by EX4B or reset */
+struct flash_state {
+    int addr4;
+};
+
+static void flash_decode(void *data, const struct spi_frame_bytes *fb,
+                         spi_transaction_fn emit, void *arg)
+{
+    struct flash_state *state = (struct flash_state *)data;
+    const struct flash_cmd *cmd;
+    struct spi_transaction trans;
+    int addr_bytes, pos, i;
+
+    if (fb->byte_num == 0)
+        return;
+
+    memset(&trans, 0, sizeof(trans));
+    trans.decoder = "flash";
+    trans.frame = fb->frame;
+    trans.index = fb->index;
+    trans.cmd = fb->mosi[0];
+    cmd = &flash_cmds[trans.cmd];
+    if (cmd->op == NULL) {
+        trans.op = "?";
+        trans.flags = SPI_TRANS_ERROR;
+        trans.dir = SPI_DIR_WRITE;
+        trans.data = fb->mosi + 1;
+        trans.data_len = fb->byte_num - 1;
+        emit(&trans, arg);
+        return;
+    }
+    trans.op = cmd->op;
+
+    addr_bytes = cmd->addr;
+    if (addr_bytes == FLASH_ADDR_MODE)
+        addr_bytes = state->addr4 ? 4 : 3;
+    pos = 1;
+    if (addr_bytes) {
+        if (pos + addr_bytes > fb->byte_num) {
+            trans.flags |= SPI_TRANS_TRUNCATED;
+            emit(&trans, arg);
+            return;
+        }
+        for (i = 0; i < addr_bytes; i++)
+            trans.addr = (trans.addr << 8) | fb->mosi[pos++];
+        trans.flags |= SPI_TRANS_ADDR;
+    }
+    pos += cmd->dummy;
+    if (pos > fb->byte_num)
+        trans.flags |= SPI_TRANS_TRUNCATED;
+
+    trans.dir = cmd->dir;
+    if ((trans.dir != SPI_DIR_NONE) && (pos < fb->byte_num)) {
+        trans.data = ((trans.dir == SPI_DIR_READ) ? fb->miso : fb->mosi) +
+                     pos;
+        trans.data_len = fb->byte_num - pos;
+        /* status registers polled: last value read */
+        if (cmd->effect == FLASH_STATUS) {
+            trans.status = trans.data[trans.data_len - 1];
+            trans.flags |= SPI_TRANS_STATUS;
+        }
+    }
+
+    if (cmd->effect == FLASH_SET_ADDR4)
+        state->addr4 = 1;
+    else if (cmd->effect == FLASH_CLEAR_ADDR4)
+        state->addr4 = 0;
+
+    emit(&trans, arg);
+}
+
+const struct spi_decoder spi_flash_decoder = {
+    .name = "flash",
+    .description = "JEDEC SPI NOR flash commands",
+    .state_size = sizeof(struct flash_state),
+    .decode = flash_decode,
+};
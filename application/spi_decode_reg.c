@@ -0,0 +1,68 @@
+/* spi_decode_reg.c
+ *
+ * register access decoder for sensors and converters whose first byte
+ * is a register address with a read flag in msb (1: read), followed by
+ * auto incremented register values
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "spi_decoder.h"
+
+#define REG_READ_FLAG   0x80
+
+static void reg_decode(void *data, const struct spi_frame_bytes *fb,
+                       spi_transaction_fn emit, void *arg)
+{
+    struct spi_transaction trans;
+
+    if (fb->byte_num == 0)
+        return;
+
+    memset(&trans, 0, sizeof(trans));
+    trans.decoder = "reg";
+    trans.frame = fb->frame;
+    trans.index = fb->index;
+    trans.cmd = fb->mosi[0];
+    trans.addr = trans.cmd & ~REG_READ_FLAG;
+    trans.flags = SPI_TRANS_ADDR;
+    if (trans.cmd & REG_READ_FLAG) {
+        trans.op = "READ";
+        trans.dir = SPI_DIR_READ;
+        trans.data = fb->miso + 1;
+    } else {
+        trans.op = "WRITE";
+        trans.dir = SPI_DIR_WRITE;
+        trans.data = fb->mosi + 1;
+    }
+    trans.data_len = fb->byte_num - 1;
+    if (trans.data_len == 0)
+        trans.flags |= SPI_TRANS_TRUNCATED;
+
+    emit(&trans, arg);
+}
+
+const struct spi_decoder spi_reg_decoder = {
+    .name = "reg",
+    .description = "sensor and converter registers, read flag in address msb",
+    .state_size = 0,
+    .decode = reg_decode,
+};
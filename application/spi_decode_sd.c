@@ -0,0 +1,342 @@
+/* spi_decode_sd.c
+ *
+ * SD card SPI mode decoder: commands with their R1 response, and the
+ * data blocks of block reads and writes, which may span several CS
+ * windows.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "spi_decoder.h"
+
+#define SD_CMD_BYTES        6
+/* 0xFF bytes before the response, NCR */
+#define SD_NCR_MAX          8
+#define SD_CRC_BYTES        2
+#define SD_BLOCK_LEN        512
+
+#define SD_TOKEN_START      0xFE
+#define SD_TOKEN_START_MULTI 0xFC
+#define SD_TOKEN_STOP       0xFD
+#define SD_R1_IDLE          0x01
+
+/* data phase expected after the command */
+#define SD_DATA_NONE    0
+#define SD_DATA_READ    1
+#define SD_DATA_WRITE   2
+
+static const char *const sd_cmds[64] = {
+    [0] = "GO_IDLE_STATE",
+    [1] = "SEND_OP_COND",
+    [6] = "SWITCH_FUNC",
+    [8] = "SEND_IF_COND",
+    [9] = "SEND_CSD",
+    [10] = "SEND_CID",
+    [12] = "STOP_TRANSMISSION",
+    [13] = "SEND_STATUS",
+    [16] = "SET_BLOCKLEN",
+    [17] = "READ_SINGLE_BLOCK",
+    [18] = "READ_MULTIPLE_BLOCK",
+    [24] = "WRITE_BLOCK",
+    [25] = "WRITE_MULTIPLE_BLOCK",
+    [27] = "PROGRAM_CSD",
+    [28] = "SET_WRITE_PROT",
+    [29] = "CLR_WRITE_PROT",
+    [32] = "ERASE_WR_BLK_START",
+    [33] = "ERASE_WR_BLK_END",
+    [38] = "ERASE",
+    [55] = "APP_CMD",
+    [56] = "GEN_CMD",
+    [58] = "READ_OCR",
+    [59] = "CRC_ON_OFF",
+};
+
+static const char *const sd_acmds[64] = {
+    [13] = "SD_STATUS",
+    [22] = "SEND_NUM_WR_BLOCKS",
+    [23] = "SET_WR_BLK_ERASE_COUNT",
+    [41] = "SD_SEND_OP_COND",
+    [42] = "SET_CLR_CARD_DETECT",
+    [51] = "SEND_SCR",
+};
+
+struct sd_state {
+    int app_cmd;
+    int block_len;
+    /* READ_OCR gave CCS: block addresses instead of byte addresses */
+    int block_addr;
+    /* data phase of last command, possibly in a later CS window */
+    int data;
+    int data_multi;
+    int data_len;
+    unsigned int data_cmd;
+    unsigned int data_addr;
+};
+
+/* bytes following R1: R2 for SEND_STATUS, R3 and R7 */
+static int sd_response_extra(unsigned int cmd, int app_cmd)
+{
+    if (app_cmd)
+        return (cmd == 13) ? 1 : 0;
+    if (cmd == 13)
+        return 1;
+    if ((cmd == 8) || (cmd == 58))
+        return 4;
+    return 0;
+}
+
+static void sd_trans_init(struct spi_transaction *trans,
+                          const struct spi_frame_bytes *fb)
+{
+    memset(trans, 0, sizeof(struct spi_transaction));
+    trans->decoder = "sd";
+    trans->frame = fb->frame;
+    trans->index = fb->index;
+}
+
+/* command at pos, return position after its response */
+static int sd_decode_cmd(struct sd_state *state,
+                         const struct spi_frame_bytes *fb, int pos,
+                         spi_transaction_fn emit, void *arg)
+{
+    struct spi_transaction trans;
+    const unsigned char *cmd = fb->mosi + pos;
+    int app_cmd = state->app_cmd;
+    int extra, end, k;
+    unsigned int r1;
+
+    sd_trans_init(&trans, fb);
+    trans.cmd = cmd[0] & 0x3F;
+    trans.op = app_cmd ? sd_acmds[trans.cmd] : sd_cmds[trans.cmd];
+    if (trans.op == NULL)
+        trans.op = app_cmd ? "ACMD?" : "CMD?";
+    trans.addr = ((unsigned int)cmd[1] << 24) | (cmd[2] << 16) |
+                 (cmd[3] << 8) | cmd[4];
+    trans.flags = SPI_TRANS_ADDR;
+    /* end bit */
+    if (!(cmd[5] & 0x01))
+        trans.flags |= SPI_TRANS_ERROR;
+    state->app_cmd = 0;
+
+    /* R1 has its msb low, after up to SD_NCR_MAX 0xFF */
+    end = pos + SD_CMD_BYTES;
+    for (k = end; (k < fb->byte_num) && (k <= end + SD_NCR_MAX); k++) {
+        if (!(fb->miso[k] & 0x80))
+            break;
+    }
+    if ((k >= fb->byte_num) || (k > end + SD_NCR_MAX)) {
+        trans.flags |= SPI_TRANS_TRUNCATED;
+        emit(&trans, arg);
+        return (k > end + SD_NCR_MAX) ? end : fb->byte_num;
+    }
+    r1 = fb->miso[k++];
+    trans.status = r1;
+    trans.flags |= SPI_TRANS_STATUS;
+    if (r1 & ~SD_R1_IDLE)
+        trans.flags |= SPI_TRANS_ERROR;
+
+    extra = sd_response_extra(trans.cmd, app_cmd);
+    if (extra) {
+        trans.dir = SPI_DIR_READ;
+        trans.data = fb->miso + k;
+        trans.data_len = (k + extra <= fb->byte_num) ? extra :
+                         fb->byte_num - k;
+        if (trans.data_len < extra)
+            trans.flags |= SPI_TRANS_TRUNCATED;
+        k += trans.data_len;
+        /* OCR bit 30 */
+        if ((trans.cmd == 58) && !app_cmd && (trans.data_len == extra))
+            state->block_addr = (trans.data[0] & 0x40) ? 1 : 0;
+    }
+    emit(&trans, arg);
+
+    /* rejected commands have no data phase, STOP_TRANSMISSION ends the
+     * pending one */
+    if ((r1 & ~SD_R1_IDLE) || (!app_cmd && (trans.cmd == 12))) {
+        state->data = SD_DATA_NONE;
+        return k;
+    }
+
+    /* state changes and data phases of accepted commands */
+    state->data = SD_DATA_NONE;
+    if (app_cmd) {
+        if ((trans.cmd == 13) || (trans.cmd == 51)) {
+            state->data = SD_DATA_READ;
+            state->data_multi = 0;
+            state->data_len = (trans.cmd == 13) ? 64 : 8;
+        }
+    } else {
+        switch (trans.cmd) {
+        case 55:
+            state->app_cmd = 1;
+            break;
+        case 16:
+            if ((trans.addr > 0) && (trans.addr <= SPI_FRAME_MAX_BYTES))
+                state->block_len = trans.addr;
+            break;
+        case 9:
+        case 10:
+            state->data = SD_DATA_READ;
+            state->data_multi = 0;
+            state->data_len = 16;
+            break;
+        case 17:
+        case 18:
+            state->data = SD_DATA_READ;
+            state->data_multi = (trans.cmd == 18);
+            state->data_len = state->block_len;
+            break;
+        case 24:
+        case 25:
+            state->data = SD_DATA_WRITE;
+            state->data_multi = (trans.cmd == 25);
+            state->data_len = state->block_len;
+            break;
+        }
+    }
+    if (state->data != SD_DATA_NONE) {
+        state->data_cmd = trans.cmd;
+        state->data_addr = trans.addr;
+    }
+    return k;
+}
+
+/* data block of the pending read or write starting with its token at
+ * pos, return position after it */
+static int sd_decode_block(struct sd_state *state,
+                           const struct spi_frame_bytes *fb, int pos,
+                           spi_transaction_fn emit, void *arg)
+{
+    struct spi_transaction trans;
+    const unsigned char *lane;
+    int k, end;
+
+    sd_trans_init(&trans, fb);
+    trans.cmd = state->data_cmd;
+    trans.addr = state->data_addr;
+    trans.flags = SPI_TRANS_ADDR;
+    trans.dir = (state->data == SD_DATA_READ) ? SPI_DIR_READ : SPI_DIR_WRITE;
+    trans.op = (trans.dir == SPI_DIR_READ) ? "DATA_READ" : "DATA_WRITE";
+    lane = (trans.dir == SPI_DIR_READ) ? fb->miso : fb->mosi;
+
+    trans.data = lane + pos + 1;
+    end = pos + 1 + state->data_len + SD_CRC_BYTES;
+    if (end > fb->byte_num) {
+        trans.data_len = fb->byte_num - pos - 1;
+        if (trans.data_len > state->data_len)
+            trans.data_len = state->data_len;
+        trans.flags |= SPI_TRANS_TRUNCATED;
+        state->data = SD_DATA_NONE;
+        emit(&trans, arg);
+        return fb->byte_num;
+    }
+    trans.data_len = state->data_len;
+
+    if (trans.dir == SPI_DIR_WRITE) {
+        /* data response token xxx0sss1, 0x05 when accepted */
+        for (k = end; (k < fb->byte_num) && (fb->miso[k] == 0xFF); k++)
+            ;
+        if (k < fb->byte_num) {
+            trans.status = fb->miso[k] & 0x1F;
+            trans.flags |= SPI_TRANS_STATUS;
+            if (trans.status != 0x05)
+                trans.flags |= SPI_TRANS_ERROR;
+            end = k + 1;
+        } else
+            trans.flags |= SPI_TRANS_TRUNCATED;
+    }
+    emit(&trans, arg);
+
+    if (!state->data_multi)
+        state->data = SD_DATA_NONE;
+    /* next block of a multiple block transfer */
+    state->data_addr += state->block_addr ? 1 : state->data_len;
+    return end;
+}
+
+static void sd_decode(void *data, const struct spi_frame_bytes *fb,
+                      spi_transaction_fn emit, void *arg)
+{
+    struct sd_state *state = (struct sd_state *)data;
+    struct spi_transaction trans;
+    int pos = 0;
+    unsigned char token;
+
+    if (state->block_len == 0)
+        state->block_len = SD_BLOCK_LEN;
+
+    while (pos < fb->byte_num) {
+        if (state->data == SD_DATA_WRITE) {
+            /* host sends data tokens, or stop tran after a multiple
+             * block write */
+            token = fb->mosi[pos];
+            if ((token == SD_TOKEN_START) ||
+                (token == SD_TOKEN_START_MULTI)) {
+                pos = sd_decode_block(state, fb, pos, emit, arg);
+                continue;
+            }
+            if (token == SD_TOKEN_STOP) {
+                state->data = SD_DATA_NONE;
+                pos++;
+                continue;
+            }
+            if ((token & 0xC0) == 0x40)
+                state->data = SD_DATA_NONE;
+            else {
+                pos++;
+                continue;
+            }
+        }
+
+        /* commands, STOP_TRANSMISSION included during a read */
+        if (((fb->mosi[pos] & 0xC0) == 0x40) &&
+            (pos + SD_CMD_BYTES <= fb->byte_num)) {
+            pos = sd_decode_cmd(state, fb, pos, emit, arg);
+            continue;
+        }
+
+        if (state->data == SD_DATA_READ) {
+            token = fb->miso[pos];
+            if (token == SD_TOKEN_START) {
+                pos = sd_decode_block(state, fb, pos, emit, arg);
+                continue;
+            }
+            /* data error token 000xxxxx */
+            if (!(token & 0xE0) && token) {
+                sd_trans_init(&trans, fb);
+                trans.cmd = state->data_cmd;
+                trans.op = "DATA_ERROR";
+                trans.status = token;
+                trans.flags = SPI_TRANS_STATUS | SPI_TRANS_ERROR;
+                emit(&trans, arg);
+                state->data = SD_DATA_NONE;
+            }
+        }
+        pos++;
+    }
+}
+
+const struct spi_decoder sd_spi_decoder = {
+    .name = "sd",
+    .description = "SD card SPI mode commands and data blocks",
+    .state_size = sizeof(struct sd_state),
+    .decode = sd_decode,
+};
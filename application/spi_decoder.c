@@ -0,0 +1,189 @@
+/* spi_decoder.c
+ *
+ * protocol decoders turning captured frames into transactions.
+ * Frames are converted to bus order bytes once, with the bitrev lookup
+ * table, decoders then only walk bytes.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_decoder.h"
+#include "spisnif_capture.h"
+#include "bitrev.h"
+
+/* payload bytes printed per transaction */
+#define SPI_PRINT_DATA_MAX  16
+
+static const struct spi_decoder *spi_decoders[SPI_DECODER_MAX] = {
+    &spi_flash_decoder,
+    &sd_spi_decoder,
+    &spi_reg_decoder,
+};
+
+int spi_decoder_register(const struct spi_decoder *decoder)
+{
+    int i;
+
+    for (i = 0; i < SPI_DECODER_MAX; i++) {
+        if (spi_decoders[i] == NULL) {
+            spi_decoders[i] = decoder;
+            return 0;
+        }
+    }
+    printf("spi_decoder error: no room for decoder %s\n", decoder->name);
+    return -1;
+}
+
+const struct spi_decoder *spi_decoder_find(const char *name)
+{
+    int i;
+
+    for (i = 0; (i < SPI_DECODER_MAX) && (spi_decoders[i] != NULL); i++) {
+        if (strcmp(spi_decoders[i]->name, name) == 0)
+            return spi_decoders[i];
+    }
+    return NULL;
+}
+
+void spi_decoder_list(void)
+{
+    int i;
+
+    for (i = 0; (i < SPI_DECODER_MAX) && (spi_decoders[i] != NULL); i++)
+        printf("        %-8s %s\n", spi_decoders[i]->name,
+               spi_decoders[i]->description);
+}
+
+int spi_decode_init(struct spi_decode_ctx *ctx,
+                    const struct spi_decoder *decoder, int cs,
+                    spi_transaction_fn emit, void *arg)
+{
+    memset(ctx, 0, sizeof(struct spi_decode_ctx));
+    ctx->decoder = decoder;
+    ctx->cs = cs;
+    ctx->emit = emit;
+    ctx->arg = arg;
+
+    ctx->state = calloc(1, decoder->state_size ? decoder->state_size : 1);
+    ctx->mosi = (unsigned char *)malloc(SPI_FRAME_MAX_BYTES);
+    ctx->miso = (unsigned char *)malloc(SPI_FRAME_MAX_BYTES);
+    ctx->words = (unsigned short *)malloc(2*FRAME_MAX_LANE_WORDS*
+                                          sizeof(unsigned short));
+    if ((ctx->state == NULL) || (ctx->mosi == NULL) || (ctx->miso == NULL) ||
+        (ctx->words == NULL)) {
+        printf("can't allocate memory for decoder %s\n", decoder->name);
+        spi_decode_free(ctx);
+        return -1;
+    }
+    return 0;
+}
+
+void spi_decode_free(struct spi_decode_ctx *ctx)
+{
+    free(ctx->state);
+    free(ctx->mosi);
+    free(ctx->miso);
+    free(ctx->words);
+    ctx->state = NULL;
+    ctx->mosi = NULL;
+    ctx->miso = NULL;
+    ctx->words = NULL;
+}
+
+/* count transactions on their way to the user emit function */
+static void spi_decode_emit(const struct spi_transaction *trans, void *arg)
+{
+    struct spi_decode_ctx *ctx = (struct spi_decode_ctx *)arg;
+
+    ctx->transactions++;
+    if (ctx->emit != NULL)
+        ctx->emit(trans, ctx->arg);
+}
+
+void spi_decode_frames(struct spi_decode_ctx *ctx,
+                       const struct spi_frame_list *flist)
+{
+    const struct spi_frame *frame;
+    struct spi_frame expanded;
+    struct spi_frame_bytes fb;
+    int i;
+
+    for (i = 0; i < flist->frame_num; i++) {
+        frame = &flist->frames[i];
+        if ((ctx->cs >= 0) && (frame->cs >= 0) && (frame->cs != ctx->cs))
+            continue;
+        frame = frame_expand(frame, &expanded, ctx->words);
+
+        fb.frame = frame;
+        fb.index = i;
+        if (frame->bit_num == 0) {
+            fb.byte_num = 0;
+        } else if (frame->lanes > 1) {
+            frame_merge_lanes(frame, ctx->mosi);
+            /* bit_num counts bits per lane, quad lanes take 2 per edge */
+            fb.byte_num = ((frame->lanes == 4) ? frame->bit_num/2 :
+                           frame->bit_num)*frame->lanes/8;
+            memcpy(ctx->miso, ctx->mosi, fb.byte_num);
+        } else {
+            fb.byte_num = frame->bit_num/8;
+            bitrev_bytes(ctx->mosi, frame->mosi, fb.byte_num);
+            bitrev_bytes(ctx->miso, frame->miso, fb.byte_num);
+        }
+        fb.mosi = ctx->mosi;
+        fb.miso = ctx->miso;
+
+        ctx->frames++;
+        ctx->decoder->decode(ctx->state, &fb, spi_decode_emit, ctx);
+    }
+}
+
+void spi_transaction_print(const struct spi_transaction *trans, void *arg)
+{
+    char line[128 + 3*SPI_PRINT_DATA_MAX];
+    char *ptr = line;
+    int i;
+
+    ptr += sprintf(ptr, "@%u", trans->frame->ts_start);
+    if (trans->frame->cs >= 0)
+        ptr += sprintf(ptr, " CS%d", trans->frame->cs);
+    ptr += sprintf(ptr, " %s %s (0x%02x)", trans->decoder, trans->op,
+                   trans->cmd);
+    if (trans->flags & SPI_TRANS_ADDR)
+        ptr += sprintf(ptr, " addr 0x%x", trans->addr);
+    if (trans->flags & SPI_TRANS_STATUS)
+        ptr += sprintf(ptr, " status 0x%02x", trans->status);
+    if (trans->dir != SPI_DIR_NONE) {
+        ptr += sprintf(ptr, " %s %d:", (trans->dir == SPI_DIR_READ) ?
+                       "read" : "write", trans->data_len);
+        for (i = 0; (i < trans->data_len) && (i < SPI_PRINT_DATA_MAX); i++)
+            ptr += sprintf(ptr, " %02x", trans->data[i]);
+        if (trans->data_len > SPI_PRINT_DATA_MAX)
+            ptr += sprintf(ptr, " ...");
+    }
+    if (trans->flags & SPI_TRANS_TRUNCATED)
+        ptr += sprintf(ptr, " truncated");
+    if (trans->flags & SPI_TRANS_ERROR)
+        ptr += sprintf(ptr, " error");
+    *ptr++ = '\n';
+    fwrite(line, 1, ptr - line, stdout);
+}
@@ -0,0 +1,121 @@
+/* spi_decoder.h
+ *
+ * protocol decoders turning captured frames into transactions
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __SPI_DECODER_H__
+#define __SPI_DECODER_H__
+
+#include <stddef.h>
+
+#include "frame_arena.h"
+
+#define SPI_DECODER_MAX     8
+/* bytes of one lane, or of merged dual and quad lanes, of the longest
+ * (rle expanded) frame */
+#define SPI_FRAME_MAX_BYTES (4*FRAME_MAX_LANE_WORDS)
+
+/* payload direction */
+#define SPI_DIR_NONE    0
+#define SPI_DIR_WRITE   1   /* host to device, on MOSI */
+#define SPI_DIR_READ    2   /* device to host, on MISO */
+
+/* transaction flags */
+#define SPI_TRANS_ADDR      (1 << 0)    /* addr is valid */
+#define SPI_TRANS_STATUS    (1 << 1)    /* status is valid */
+#define SPI_TRANS_TRUNCATED (1 << 2)    /* frame ended before expected */
+#define SPI_TRANS_ERROR     (1 << 3)    /* malformed or error response */
+
+/* one frame in bus order bytes. Single lane frames have MOSI and MISO
+ * bytes, dual and quad ones have their merged bytes in both. */
+struct spi_frame_bytes {
+    const struct spi_frame *frame;
+    int index;      /* frame index in its list */
+    int byte_num;   /* whole bytes, trailing bits are dropped */
+    const unsigned char *mosi;
+    const unsigned char *miso;
+};
+
+/* One decoded command. Pointers are only valid during the emit call. */
+struct spi_transaction {
+    const char *decoder;
+    const struct spi_frame *frame;
+    int index;
+    const char *op;         /* command mnemonic */
+    unsigned int cmd;
+    unsigned int flags;
+    unsigned int addr;
+    unsigned int status;
+    int dir;
+    const unsigned char *data;
+    int data_len;
+};
+
+typedef void (*spi_transaction_fn)(const struct spi_transaction *trans,
+                                   void *arg);
+
+/* A decoder keeps its state_size bytes of state, zeroed at init, across
+ * frames of one capture. decode() is called for each frame in capture
+ * order and emits 0 or more transactions; it must not keep pointers on
+ * frame bytes. */
+struct spi_decoder {
+    const char *name;
+    const char *description;
+    size_t state_size;
+    void (*decode)(void *state, const struct spi_frame_bytes *fb,
+                   spi_transaction_fn emit, void *arg);
+};
+
+/* built in decoders */
+extern const struct spi_decoder spi_flash_decoder;
+extern const struct spi_decoder sd_spi_decoder;
+extern const struct spi_decoder spi_reg_decoder;
+
+/* add a decoder next to built in ones, -1 if the table is full */
+int spi_decoder_register(const struct spi_decoder *decoder);
+const struct spi_decoder *spi_decoder_find(const char *name);
+void spi_decoder_list(void);
+
+/* one decoder running on the frames of one CS (-1: all frames) */
+struct spi_decode_ctx {
+    const struct spi_decoder *decoder;
+    void *state;
+    int cs;
+    spi_transaction_fn emit;
+    void *arg;
+    unsigned char *mosi;
+    unsigned char *miso;
+    unsigned short *words;  /* lanes of rle frames, expanded */
+    unsigned long long frames;
+    unsigned long long transactions;
+};
+
+int spi_decode_init(struct spi_decode_ctx *ctx,
+                    const struct spi_decoder *decoder, int cs,
+                    spi_transaction_fn emit, void *arg);
+void spi_decode_free(struct spi_decode_ctx *ctx);
+void spi_decode_frames(struct spi_decode_ctx *ctx,
+                       const struct spi_frame_list *flist);
+
+/* emit function printing one line per transaction on stdout */
+void spi_transaction_print(const struct spi_transaction *trans, void *arg);
+
+#endif /* __SPI_DECODER_H__ */
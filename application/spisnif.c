@@ -34,8 +34,17 @@
 #include <errno.h>
 #include <sys/mman.h>	/* memory management */
 #include <sys/utsname.h>
+#include <pthread.h>
+#include <sched.h>
 #include <as_gpio.h>
 
+#include "spisnif_regs.h"
+#include "spisnif_capture.h"
+#include "capture_file.h"
+#include "capture_pipeline.h"
+#include "spi_decoder.h"
+#include "capture_stats.h"
+
 /* for IMX27 */
 #define PLATFORM "APF27"
 #define FPGA_ADDRESS 0xD6000000
@@ -49,41 +58,43 @@
 //# define FPGA_ADDRESS 0x12000000
 //# define FPGA_MAP_SIZE	0x2000
 
-#define WORD_ACCESS (2)
-#define LONG_ACCESS (4)
-
-#define IRQ_BASE                0x00
-#define IRQ_MNGR_MASK_REG       (IRQ_BASE + 0x00)
-#define IRQ_MNGR_PENDING_REG    (IRQ_BASE + 0x02)
-
-#define SPISNIF_BASE            0x10
-#define SPISNIF_CONTROL_REG     (SPISNIF_BASE + 0x00)
-#define SPISNIF_FIFO_MOSI_REG   (SPISNIF_BASE + 0x02)
-#define SPISNIF_FIFO_MISO_REG   (SPISNIF_BASE + 0x04)
-#define SPISNIF_FIFO_PACKET_REG (SPISNIF_BASE + 0x06)
-#define SPISNIF_STATUS_REG      (SPISNIF_BASE + 0x08)
-#define SPISNIF_CONFIG_REG      (SPISNIF_BASE + 0x0a)
-#define SPISNIF_ID_REG          (SPISNIF_BASE + 0x0c)
-
-#define SPISNIF_RESET_FLG   (0x8000)
-
-#define SPISNIF_CONFIG_CSPOL (0x0004)
-#define SPISNIF_CONFIG_CPHA  (0x0002)
-#define SPISNIF_CONFIG_CPOL  (0x0001)
-
+/* SCHED_FIFO priority of the drain thread, workers keep the default */
+#define DRAIN_PRIORITY  50
+/* drain retry period while workers hold every arena slot */
+#define DRAIN_STALL_US  1000
+/* interrupt wait without statistics to report */
+#define IRQ_TIMEOUT_MS  10000
 
 static int keepRunning = 1;
 
-struct spi_frame {
-    int bit_num;
-    unsigned short *mosi;
-    unsigned short *miso;
-};
+/* decode stage: frames and losses report */
+static int print_stage(struct spi_frame_list *flist, void *arg)
+{
+    int print_frames = *(int *)arg;
+
+    printf("%d frames read\n", flist->frame_num);
+    if (flist->loss.packets)
+        printf("%u packets lost (%u bits), %u overflows\n",
+               flist->loss.packets, flist->loss.bits,
+               flist->loss.overflows);
+    if (print_frames)
+        print_frame_list(flist);
+    return 0;
+}
+
+/* decode stage: protocol transactions */
+static int decode_stage(struct spi_frame_list *flist, void *arg)
+{
+    spi_decode_frames((struct spi_decode_ctx *)arg, flist);
+    return 0;
+}
 
-struct spi_frame_list {
-    int frame_num;
-    struct spi_frame **frames;
-};
+/* output stage: pcapng file */
+static int write_stage(struct spi_frame_list *flist, void *arg)
+{
+    return capture_file_write_frames((struct capture_file *)arg, flist,
+                                     &flist->ts);
+}
 
 void intHandler(int dummy) {
     printf("Crl-C captured\n");
@@ -102,200 +113,19 @@ void print_usage()
         printf("        cpol     active\n");
         printf("       -cpol     inactive\n");
         printf("Read frames :\n");
-        printf("$ spisnif\n");
-}
-
-unsigned short spisnif_read(void* ptr_fpga, int addr)
-{
-	return *(unsigned short*)(ptr_fpga+(addr));
-}
-
-void spisnif_write(void* ptr_fpga, int addr,
-                             unsigned short value) {
-
-	*(unsigned short*)(ptr_fpga+(addr)) = value;
-
-}
-
-unsigned short petit_indien(unsigned short value) {
-//    return value;
-    unsigned short walign_value = ((value << 8)&0xFF00) | ((value >> 8)&0x00FF);
-    unsigned short balign_value;
-
-    balign_value = (walign_value << 4)&0xF0F0;
-    balign_value |= (walign_value >> 4)&0x0F0F;
-
-    return  ((balign_value<<3)&0x8888)|
-            ((balign_value<<1)&0x4444)|
-            ((balign_value>>1)&0x2222)|
-            ((balign_value>>3)&0x1111);
-}
-
-struct spi_frame_list *read_frames(void *ptr_fpga) {
-    struct spi_frame_list *flist;
-    unsigned short read_value;
-    int i, j;
-
-    read_value = spisnif_read(ptr_fpga, SPISNIF_STATUS_REG);
-    if ((read_value == 0x8000)||(read_value >= (1<<11))||(read_value == 0))
-        return NULL;
-
-    flist = (struct spi_frame_list *)malloc(sizeof(struct spi_frame_list));
-    if (flist == NULL) {
-        printf("can't allocate memory for struct flist\n");
-        return NULL;
-    }
-
-    flist->frame_num = (int)read_value;
-
-    /* allocate memory for frames */
-    flist->frames = (struct spi_frame **)
-                    malloc(flist->frame_num*sizeof(struct spi_frame *));
-    if (flist->frames == NULL) {
-        printf("can't allocate memory for struct flist->frames\n");
-        goto free_list;
-    }
-    for (i = 0; i < flist->frame_num; i++) {
-        flist->frames[i] = (struct spi_frame *)malloc(sizeof(struct spi_frame));
-        if (flist->frames[i] == NULL) {
-            printf("Error allocating memory for spi_frames[%d]\n", i);
-            return NULL;
-        }
-        read_value = spisnif_read(ptr_fpga, SPISNIF_FIFO_PACKET_REG);
-        if (read_value == 0) {
-            flist->frames[i]->bit_num = 0;
-            //flist->frames[i]->mosi == NULL;
-            //flist->frames[i]->miso == NULL;
-        } else {
-            flist->frames[i]->bit_num = read_value;
-            flist->frames[i]->mosi = (unsigned short *)malloc(((read_value-1)/16+1)*sizeof(unsigned short));
-            if (flist->frames[i]->mosi == NULL) {
-                printf("Error allocating memory for  flist->frames[%d]->mosi\n", i);
-                return NULL;
-            }
-            flist->frames[i]->miso = (unsigned short *)malloc(((read_value-1)/16+1)*sizeof(unsigned short));
-            if (flist->frames[i]->miso == NULL) {
-                printf("Error allocating memory for  flist->frames[%d]->miso\n", i);
-                return NULL;
-            }
-
-            /* read all values */
-            for (j = 0; j < ((flist->frames[i]->bit_num - 1)/16 + 1); j++) {
-                flist->frames[i]->mosi[j] = spisnif_read(ptr_fpga, SPISNIF_FIFO_MOSI_REG);
-                flist->frames[i]->miso[j] = spisnif_read(ptr_fpga, SPISNIF_FIFO_MISO_REG);
-            }
-        }
-    }
-
-    return flist;
-
-free_list:
-    free(flist);
-    return NULL;
-}
-
-char *bit_vector(unsigned short value, int lenght) {
-    char *vector = malloc(17*sizeof(char));
-    unsigned short tmp_value = value;
-    int i;
-
-    if ((lenght > 16) || (lenght < 0)) {
-        printf("bit_vector error lenght %d\n", lenght);
-        return NULL;
-    }
-
-    for (i = 0; i < lenght; i++) {
-        if (tmp_value&0x8000)
-            vector[i] = '1';
-        else
-            vector[i] = '0';
-        tmp_value = tmp_value << 1;
-    }
-    vector[i] = '\0';
-
-    return vector;
-}
-
-void print_frame_list(struct spi_frame_list *flist) {
-    int i;
-    int j;
-    int bit_num_tmp;
-
-    for (i=0; i < flist->frame_num; i++) {
-        bit_num_tmp = flist->frames[i]->bit_num;
-        if(bit_num_tmp != 0) {
-            printf("(%03d)MOSI: ", flist->frames[i]->bit_num);
-            for(j=0; j < ((flist->frames[i]->bit_num-1)/16)+1; j++) {
-                    printf("(%04x)%s",
-                           flist->frames[i]->mosi[j],
-                           bit_vector(
-                                      petit_indien(flist->frames[i]->mosi[j]),
-                                      (bit_num_tmp>15)?16:bit_num_tmp)
-                           );
-                    bit_num_tmp = bit_num_tmp - 16;
-            }
-            printf("\n");
-            bit_num_tmp = flist->frames[i]->bit_num;
-            printf("(%03d)MOSI: ", flist->frames[i]->bit_num);
-            for(j=0; j < ((flist->frames[i]->bit_num-1)/16)+1; j++) {
-                    printf("(%04x)%s",
-                           flist->frames[i]->miso[j],
-                           bit_vector(
-                                      petit_indien(flist->frames[i]->miso[j]),
-                                      (bit_num_tmp>15)?16:bit_num_tmp)
-                           );
-                    bit_num_tmp = bit_num_tmp - 16;
-            }
-            printf("\n\n");
-        } else
-            printf("Void CS\n\n");
-    }
-}
-
-void free_frame_list(struct spi_frame_list *flist) {
-    int i;
-
-    if (flist != NULL) {
-        for (i=0; i < flist->frame_num; i++) {
-            if (flist->frames[i]->bit_num != 0) {
-                free(flist->frames[i]->mosi);
-                free(flist->frames[i]->miso);
-            }
-            free(flist->frames[i]);
-        }
-        free(flist->frames);
-        free(flist);
-    }
-}
-
-void print_map(void* ptr_fpga) {
-    printf("SPISNIF_CONTROL_REG     (%02X) -> %04X\n",
-           SPISNIF_CONTROL_REG     ,spisnif_read(ptr_fpga,SPISNIF_CONTROL_REG));
-    printf("SPISNIF_FIFO_MOSI_REG   (%02X) -> %04X\n",
-           SPISNIF_FIFO_MOSI_REG   ,spisnif_read(ptr_fpga,SPISNIF_FIFO_MOSI_REG));
-    printf("SPISNIF_FIFO_MISO_REG   (%02X) -> %04X\n",
-           SPISNIF_FIFO_MISO_REG   ,spisnif_read(ptr_fpga,SPISNIF_FIFO_MISO_REG));
-    printf("SPISNIF_FIFO_PACKET_REG (%02X) -> %04X\n",
-           SPISNIF_FIFO_PACKET_REG ,spisnif_read(ptr_fpga,SPISNIF_FIFO_PACKET_REG));
-    printf("SPISNIF_STATUS_REG      (%02X) -> %04X\n",
-           SPISNIF_STATUS_REG      ,spisnif_read(ptr_fpga,SPISNIF_STATUS_REG));
-    printf("SPISNIF_CONFIG_REG      (%02X) -> %04X\n",
-           SPISNIF_CONFIG_REG      ,spisnif_read(ptr_fpga,SPISNIF_CONFIG_REG));
-    printf("SPISNIF_ID_REG          (%02X) -> %04X\n",
-           SPISNIF_ID_REG          ,spisnif_read(ptr_fpga,SPISNIF_ID_REG));
-}
-
-void reset_spisnif(void * ptr_fpga) {
-    unsigned short value;
-    value = spisnif_read(ptr_fpga, SPISNIF_CONTROL_REG);
-    spisnif_write(ptr_fpga,
-                  SPISNIF_CONTROL_REG,
-                  value | SPISNIF_RESET_FLG);
-    spisnif_write(ptr_fpga,
-                  SPISNIF_CONTROL_REG,
-                  value);
-    /* acknowledge irq */
-    spisnif_write(ptr_fpga, IRQ_MNGR_PENDING_REG, 0x01);
+        printf("$ spisnif [-p] [-f match:mask [-x]] [-m mask] [-l lanes] [-D decoder[:cs]] [-w file.pcapng [-d]] [-S ms]\n");
+        printf("        -p       print frames\n");
+        printf("        -f m:m   keep frames whose first MOSI word (hex, first\n");
+        printf("                 bit in lsb) matches on mask bits\n");
+        printf("        -x       drop matching frames instead\n");
+        printf("        -m mask  capture CS inputs of mask (hex, CS0 in lsb)\n");
+        printf("        -l num   data lanes: 1, 2 (dual) or 4 (quad)\n");
+        printf("        -D name  print transactions decoded by name, of CS cs\n");
+        printf("                 only with :cs, among:\n");
+        spi_decoder_list();
+        printf("        -w file  log frames to pcapng file\n");
+        printf("        -d       write file with O_DIRECT\n");
+        printf("        -S ms    print capture statistics on stderr every ms\n");
 }
 
 int main(int argc, char *argv[])
@@ -304,7 +134,26 @@ int main(int argc, char *argv[])
 	void* ptr_fpga;
     unsigned short config = 0;
     struct spi_frame_list *flist;
-    int ret;
+    struct frame_arena arena;
+    struct capture_pipeline pipe;
+    struct spi_decode_ctx decode;
+    const struct spi_decoder *decoder = NULL;
+    char decoder_name[16];
+    int decoder_cs = -1;
+    struct sched_param sched;
+    struct capture_file *cf = NULL;
+    struct capture_stats stats;
+    int stats_ms = 0;
+    int wait_ms;
+    char *capture_path = NULL;
+    int capture_direct = 0;
+    int print_frames = 0;
+    unsigned int filter_match = 0, filter_mask = 0;
+    int filter_exclude = 0;
+    unsigned int cs_mask = 0xFF;
+    int lanes = 1;
+    struct timespec ts, start, end;
+    int ret, opt;
     struct utsname uname_value;
     struct as_gpio_device *pf12;
 
@@ -349,7 +198,7 @@ int main(int argc, char *argv[])
 
 
     /* reset component with config given */
-    if (argc == 4) {
+    if ((argc == 4) && (strstr(argv[1], "cspol") != NULL)) {
 
         if (strcmp(argv[1], "cspol") == 0)
             config |= SPISNIF_CONFIG_CSPOL;
@@ -364,8 +213,118 @@ int main(int argc, char *argv[])
         spisnif_write(ptr_fpga, SPISNIF_CONTROL_REG, 0x01);
         reset_spisnif(ptr_fpga);
 
-    /* print usages */
-    } else if (argc==1){
+    } else {
+        while ((opt = getopt(argc, argv, "pf:xm:l:D:w:dS:")) != -1) {
+            switch (opt) {
+            case 'p':
+                print_frames = 1;
+                break;
+            case 'f':
+                if ((sscanf(optarg, "%x:%x", &filter_match, &filter_mask) != 2) ||
+                    (filter_match > 0xFFFF) || (filter_mask > 0xFFFF)) {
+                    print_usage();
+                    goto unmap;
+                }
+                break;
+            case 'x':
+                filter_exclude = 1;
+                break;
+            case 'l':
+                lanes = atoi(optarg);
+                if ((lanes != 1) && (lanes != 2) && (lanes != 4)) {
+                    print_usage();
+                    goto unmap;
+                }
+                break;
+            case 'm':
+                if ((sscanf(optarg, "%x", &cs_mask) != 1) || (cs_mask > 0xFF)) {
+                    print_usage();
+                    goto unmap;
+                }
+                break;
+            case 'D':
+                if (sscanf(optarg, "%15[^:]:%d", decoder_name, &decoder_cs) < 1) {
+                    print_usage();
+                    goto unmap;
+                }
+                decoder = spi_decoder_find(decoder_name);
+                if (decoder == NULL) {
+                    print_usage();
+                    goto unmap;
+                }
+                break;
+            case 'w':
+                capture_path = optarg;
+                break;
+            case 'd':
+                capture_direct = 1;
+                break;
+            case 'S':
+                stats_ms = atoi(optarg);
+                if (stats_ms < 1) {
+                    print_usage();
+                    goto unmap;
+                }
+                break;
+            default:
+                print_usage();
+                goto unmap;
+            }
+        }
+        if (optind != argc) {
+            print_usage();
+            goto unmap;
+        }
+
+        ret = frame_arena_init(&arena, FRAME_ARENA_DEFAULT_SLOTS);
+        if (ret < 0)
+            goto unmap;
+        printf("Capture arena: %lu bytes\n",
+               (unsigned long)frame_arena_size(FRAME_ARENA_DEFAULT_SLOTS));
+
+        if ((decoder != NULL) &&
+            (spi_decode_init(&decode, decoder, decoder_cs,
+                             spi_transaction_print, NULL) < 0))
+            goto free_arena;
+
+        if (capture_path != NULL) {
+            cf = capture_file_open(capture_path, capture_direct);
+            if (cf == NULL)
+                goto free_decode;
+        }
+
+        filter_spisnif(ptr_fpga, filter_match, filter_mask, filter_exclude);
+        spisnif_write(ptr_fpga, SPISNIF_CS_MASK_REG, cs_mask);
+        /* lanes mode, 0 single, 1 dual, 2 quad */
+        config = spisnif_read(ptr_fpga, SPISNIF_CONFIG_REG) &
+            (SPISNIF_CONFIG_CSPOL | SPISNIF_CONFIG_CPHA | SPISNIF_CONFIG_CPOL);
+        config |= ((lanes == 4) ? 2 : lanes - 1) << SPISNIF_CONFIG_LANES_SHIFT;
+        spisnif_write(ptr_fpga, SPISNIF_CONFIG_REG, config);
+        if ((spisnif_read(ptr_fpga, SPISNIF_CONFIG_REG) & SPISNIF_CONFIG_LANES) !=
+            (config & SPISNIF_CONFIG_LANES)) {
+            printf("Error: component has less than %d data lanes\n", lanes);
+            keepRunning = 0;
+        }
+
+        /* drain thread only reads the fifos, printing and writing run in
+         * their own threads */
+        capture_pipeline_init(&pipe, &arena);
+        capture_pipeline_add_stage(&pipe, print_stage, &print_frames);
+        if (decoder != NULL)
+            capture_pipeline_add_stage(&pipe, decode_stage, &decode);
+        if (cf != NULL)
+            capture_pipeline_add_stage(&pipe, write_stage, cf);
+        if (capture_pipeline_start(&pipe) < 0)
+            goto close_file;
+        sched.sched_priority = DRAIN_PRIORITY;
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
+        if (ret != 0)
+            printf("Warning: Can't raise drain thread priority (%d)\n", ret);
+
+        capture_stats_init(&stats, stats_ms, stderr);
+        /* statistics are reported on quiet buses too */
+        wait_ms = (stats_ms && (stats_ms < IRQ_TIMEOUT_MS)) ? stats_ms :
+                  IRQ_TIMEOUT_MS;
 
         printf("Launching spi sniffing ...\n");
         /* activate IRQ */
@@ -373,10 +332,11 @@ int main(int argc, char *argv[])
         spisnif_write(ptr_fpga, IRQ_MNGR_MASK_REG, 0x01);
         while(keepRunning) {
 
-            ret = as_gpio_wait_event(pf12, 10000);
-            if (ret == -ETIMEDOUT)
-                printf("timeout\n");
-            else if(ret < 0) {
+            ret = as_gpio_wait_event(pf12, wait_ms);
+            if (ret == -ETIMEDOUT) {
+                if (!stats_ms)
+                    printf("timeout\n");
+            } else if(ret < 0) {
                 printf("Event error %d\n", ret);
                 keepRunning = 0;
             } else {
@@ -384,19 +344,51 @@ int main(int argc, char *argv[])
                 spisnif_write(ptr_fpga, IRQ_MNGR_MASK_REG, 0x01);
             }
 
-            flist = read_frames(ptr_fpga);
-            if (flist != NULL) {
-                printf("%d frames read\n", flist->frame_num);
-                //print_frame_list(flist);
-                free_frame_list(flist);
-            } else
+            /* workers still hold every slot: packets wait in the fifos,
+             * and are counted in LOSS once those are full */
+            while (frame_arena_full(&arena) && keepRunning) {
+                stats.stalls++;
+                usleep(DRAIN_STALL_US);
+            }
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            ret = read_frames(ptr_fpga, &arena, &flist);
+            if (ret > 0) {
+                flist->ts = ts;
+                if (stats_ms) {
+                    clock_gettime(CLOCK_MONOTONIC, &end);
+                    capture_stats_drain(&stats, flist, &arena,
+                        (end.tv_sec - start.tv_sec)*1000000000ULL +
+                        end.tv_nsec - start.tv_nsec);
+                }
+                if (capture_pipeline_push(&pipe, flist) < 0)
+                    keepRunning = 0;
+            } else if ((ret < 0) &&
+                       !(spisnif_read(ptr_fpga, SPISNIF_STATUS_REG) &
+                         SPISNIF_STATUS_PING_PONG)) {
+                /* resync the stream, ping pong banks are rewound by
+                 * next swap and reset would wipe the capturing one */
                 reset_spisnif(ptr_fpga);
+            }
+            if (capture_pipeline_failed(&pipe))
+                keepRunning = 0;
+            if (stats_ms)
+                capture_stats_report(&stats, &pipe);
         }
-
-    } else {
-        print_usage();
+        capture_pipeline_stop(&pipe);
+
+close_file:
+        if (cf != NULL)
+            capture_file_close(cf);
+free_decode:
+        if (decoder != NULL)
+            spi_decode_free(&decode);
+free_arena:
+        frame_arena_free(&arena);
     }
 
+unmap:
     munmap(ptr_fpga, FPGA_MAP_SIZE);
     close(ffpga);
 close_gpio:
@@ -0,0 +1,632 @@
+/* spisnif_bench.c
+ *
+ * runs the capture path (read_frames, decoding, capture file) against
+ * the host model of spisnif_sim.c and reports its throughput, with
+ * optional check of every frame against the generated traffic
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "spisnif_regs.h"
+#include "spisnif_capture.h"
+#include "spisnif_sim.h"
+#include "capture_file.h"
+#include "capture_reader.h"
+#include "capture_stats.h"
+#include "capture_pipeline.h"
+#include "spi_decoder.h"
+#include "bitrev.h"
+
+#define BENCH_PACKETS   100000
+#define BENCH_BATCH     64
+#define BENCH_BIT_MIN   8
+#define BENCH_BIT_MAX   64
+/* random seeks timed in the capture file */
+#define BENCH_SEEKS     1000
+
+/* frames check, run after each drain or by a pipeline stage */
+struct bench_check {
+    int check_frames;
+    int print_frames;
+    int bit_min;
+    int bit_max;
+    int cs_num;
+    unsigned int cs_mask;
+    int lanes;
+    int len_bits;   /* descriptor bit count field */
+    unsigned short filter_ctrl;
+    unsigned int filter_match, filter_mask;
+    unsigned int seq;
+    unsigned long long bits;
+    unsigned long long errors;
+    /* rle frames, lanes words as drained and once expanded */
+    unsigned long long rle_stored, rle_expanded;
+};
+
+/* protocol decoder timed on the captured frames */
+struct bench_decode {
+    struct spi_decode_ctx ctx;
+    unsigned long long ns;
+};
+
+void print_usage()
+{
+        printf("Benchmark capture code on simulated component :\n");
+        printf("$ spisnif_bench [-n packets] [-t trig] [-b bits] [-B bits] [-f match:mask [-x]] [-s cs_num [-m mask]] [-l lanes] [-r] [-c] [-p] [-w file.pcapng [-d] [-R]] [-D decoder] [-P] [-S ms]\n");
+        printf("        -n num   packets to capture (%d)\n", BENCH_PACKETS);
+        printf("        -t num   irq_pnum_trig, packets per drain (%d)\n",
+               BENCH_BATCH);
+        printf("        -b bits  minimum packet length (%d)\n", BENCH_BIT_MIN);
+        printf("        -B bits  maximum packet length (%d)\n", BENCH_BIT_MAX);
+        printf("        -f m:m   keep packets whose first MOSI word matches\n");
+        printf("        -x       drop matching packets instead\n");
+        printf("        -s num   CS inputs of the model, 1 to 8 (1)\n");
+        printf("        -m mask  captured CS inputs (hex)\n");
+        printf("        -l num   data lanes of the model: 1, 2 (dual) or 4 (quad)\n");
+        printf("        -r       rle generic of the model, lanes run length encoded\n");
+        printf("        -c       check frames against generated traffic\n");
+        printf("        -p       print frames\n");
+        printf("        -w file  log frames to pcapng file\n");
+        printf("        -d       write file with O_DIRECT\n");
+        printf("        -R       read file back, check it and time seeks\n");
+        printf("        -D name  time decoder name on the frames, among:\n");
+        spi_decoder_list();
+        printf("        -P       check, print, decode and write in pipeline threads\n");
+        printf("        -S ms    print capture statistics on stderr every ms\n");
+}
+
+static unsigned long long elapsed_ns(const struct timespec *start,
+                                     const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec)*1000000000ULL +
+           end->tv_nsec - start->tv_nsec;
+}
+
+/* bitrev kernel against a plain bit loop, all words at odd offsets */
+static int check_bitrev(void)
+{
+    static unsigned short src[0x10001], dst[0x10001];
+    unsigned char bytes[4];
+    unsigned short ref;
+    int i, bit, errors = 0;
+
+    for (i = 0; i < 0x10000; i++)
+        src[i + 1] = i;
+    bitrev16_bulk(dst + 1, src + 1, 0x10000);
+    for (i = 0; i < 0x10000; i++) {
+        ref = 0;
+        for (bit = 0; bit < 16; bit++)
+            if (i & (1 << bit))
+                ref |= 0x8000 >> bit;
+        if (dst[i + 1] != ref)
+            errors++;
+    }
+    /* decoder bytes, first bus byte in low bits of word */
+    bitrev_bytes(bytes, src + 0x1235, 3);
+    if ((bytes[0] != 0x2C) || (bytes[1] != 0x48) || (bytes[2] != 0xAC))
+        errors++;
+
+    return errors;
+}
+
+/* dual and quad frames: bytes merged from the lanes against the bytes
+ * sent, 0 when equal */
+static int check_lanes(const struct spi_frame *frame, unsigned int seq)
+{
+    static unsigned char bytes[4*FRAME_MAX_LANE_WORDS];
+    int n, byte_num, bit_num;
+    unsigned char sent;
+
+    /* bits sent over all lanes, quad bit_num counts 2 bits per edge */
+    bit_num = ((frame->lanes == 4) ? frame->bit_num/2 : frame->bit_num)*
+              frame->lanes;
+    byte_num = frame_merge_lanes(frame, bytes);
+    if (byte_num != (bit_num + 7)/8)
+        return -1;
+    for (n = 0; n < byte_num; n++) {
+        sent = spisnif_sim_byte(seq, n);
+        /* last byte is padded with 0 */
+        if ((n == byte_num - 1) && (bit_num % 8))
+            sent &= 0xFF << (8 - bit_num % 8);
+        if (bytes[n] != sent)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void check_frames(struct bench_check *chk,
+                         const struct spi_frame_list *flist)
+{
+    static unsigned short words[2*FRAME_MAX_LANE_WORDS];
+    const struct spi_frame *frame;
+    struct spi_frame expanded;
+    int i, bit_num;
+
+    for (i = 0; i < flist->frame_num; i++) {
+        /* rle frames are checked expanded, round trip of the model
+         * encoder and spisnif_rle_expand() */
+        frame = frame_expand(&flist->frames[i], &expanded, words);
+        if (flist->frames[i].rle) {
+            chk->rle_stored += flist->frames[i].mosi_words +
+                               flist->frames[i].miso_words;
+            chk->rle_expanded += 2*FRAME_WORDS(frame->bit_num);
+        }
+        chk->bits += frame->bit_num;
+        /* filtered packets use a seq number too */
+        for (;;) {
+            bit_num = spisnif_sim_bit_num(chk->seq, chk->bit_min,
+                                          chk->bit_max, chk->lanes);
+            if ((chk->cs_mask & (1 << spisnif_sim_cs(chk->seq, chk->cs_num))) &&
+                !(bit_num >> chk->len_bits) &&
+                spisnif_sim_filter_hit(chk->seq, bit_num, chk->lanes,
+                                       chk->filter_ctrl, chk->filter_match,
+                                       chk->filter_mask))
+                break;
+            chk->seq++;
+        }
+        if (chk->check_frames &&
+            ((frame->bit_num != bit_num) || (frame->lanes != chk->lanes) ||
+             (frame->cs != ((chk->cs_num > 1) ?
+                 spisnif_sim_cs(chk->seq, chk->cs_num) : -1)) ||
+             spisnif_sim_check_frame(frame, chk->seq) ||
+             ((frame->lanes > 1) && check_lanes(frame, chk->seq)))) {
+            if (chk->errors++ < 10)
+                printf("Error: frame %u differs from generated one\n",
+                       chk->seq);
+        }
+        chk->seq++;
+    }
+}
+
+static int check_stage(struct spi_frame_list *flist, void *arg)
+{
+    struct bench_check *chk = (struct bench_check *)arg;
+
+    if (chk->print_frames)
+        print_frame_list(flist);
+    check_frames(chk, flist);
+    return 0;
+}
+
+static int decode_stage(struct spi_frame_list *flist, void *arg)
+{
+    struct bench_decode *dec = (struct bench_decode *)arg;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    spi_decode_frames(&dec->ctx, flist);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    dec->ns += elapsed_ns(&start, &end);
+    return 0;
+}
+
+static int write_stage(struct spi_frame_list *flist, void *arg)
+{
+    return capture_file_write_frames((struct capture_file *)arg, flist,
+                                     &flist->ts);
+}
+
+/* Read the capture file back through its index: every frame is checked
+ * as captured ones are, then random frame and time seeks are timed and
+ * checked against the frames they land on. */
+static int bench_read_file(const char *path, const struct bench_check *ref,
+                           unsigned long long captured)
+{
+    struct bench_check chk = *ref;
+    struct capture_reader *cr;
+    struct capture_cursor cur;
+    struct capture_packet pkt;
+    struct spi_frame_list flist;
+    struct timespec start, end;
+    unsigned long long open_ns, read_ns, frame_ns = 0, time_ns = 0;
+    unsigned long long frame, ts_ns, frame_num = 0;
+    int i, ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr = capture_reader_open(path);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (cr == NULL)
+        return -1;
+    open_ns = elapsed_ns(&start, &end);
+
+    chk.seq = 0;
+    chk.bits = 0;
+    chk.errors = 0;
+    memset(&flist, 0, sizeof(flist));
+    flist.frame_num = 1;
+    flist.frames = &pkt.spi;
+    capture_reader_rewind(cr, &cur);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((ret = capture_reader_next(cr, &cur, &pkt)) == 1) {
+        /* single CS captures are stored as CS 0 */
+        if (chk.cs_num == 1)
+            pkt.spi.cs = -1;
+        check_frames(&chk, &flist);
+        frame_num++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_ns = elapsed_ns(&start, &end);
+    if ((ret < 0) || (frame_num != captured) ||
+        (cr->frame_num != captured)) {
+        printf("Error: capture file holds %llu frames (index %llu), %llu captured\n",
+               frame_num, cr->frame_num, captured);
+        chk.errors++;
+    }
+
+    for (i = 0; (i < BENCH_SEEKS) && frame_num; i++) {
+        frame = ((unsigned long long)rand() << 16 ^ rand()) % frame_num;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = capture_reader_seek_frame(cr, &cur, frame);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        frame_ns += elapsed_ns(&start, &end);
+        if ((ret < 0) || (capture_reader_next(cr, &cur, &pkt) != 1) ||
+            (pkt.frame != frame)) {
+            if (chk.errors++ < 10)
+                printf("Error: seek to frame %llu failed\n", frame);
+            continue;
+        }
+
+        /* first frame of that drain */
+        ts_ns = pkt.ts_ns;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = capture_reader_seek_time(cr, &cur, ts_ns);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        time_ns += elapsed_ns(&start, &end);
+        if ((ret < 0) || (capture_reader_next(cr, &cur, &pkt) != 1) ||
+            (pkt.ts_ns != ts_ns) || (pkt.frame > frame) ||
+            ((pkt.frame > 0) &&
+             ((capture_reader_seek_frame(cr, &cur, pkt.frame - 1) < 0) ||
+              (capture_reader_next(cr, &cur, &pkt) != 1) ||
+              (pkt.ts_ns >= ts_ns)))) {
+            if (chk.errors++ < 10)
+                printf("Error: seek to time of frame %llu failed\n", frame);
+        }
+    }
+
+    printf("capture file: %d index entries, open %.1f us, read %.1f ns/packet\n",
+           cr->index_num, open_ns/1e3,
+           frame_num ? (double)read_ns/frame_num : 0.0);
+    if (i)
+        printf("seek: %.1f us to a frame, %.1f us to a time\n",
+               frame_ns/1e3/i, time_ns/1e3/i);
+    if (chk.errors)
+        printf("%llu errors in capture file\n", chk.errors);
+    capture_reader_close(cr);
+    return chk.errors ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct spisnif_sim sim;
+    static struct bench_check chk;
+    static struct bench_decode dec;
+    const struct spi_decoder *decoder = NULL;
+    struct spi_frame_list *flist;
+    struct frame_arena arena;
+    struct capture_pipeline pipe;
+    struct capture_file *cf = NULL;
+    struct capture_stats stats;
+    int stats_ms = 0;
+    char *capture_path = NULL;
+    int capture_direct = 0;
+    int use_pipeline = 0;
+    int read_back = 0;
+    int packet_total = BENCH_PACKETS;
+    int batch = BENCH_BATCH;
+    int filter_exclude = 0;
+    int rle = 0;
+    unsigned long long captured = 0, drain_ns = 0, stalls = 0;
+    unsigned long long reg_reads;
+    unsigned long long lost_packets = 0, lost_bits = 0, overflows = 0;
+    unsigned int sck_period = SPISNIF_LOSS_NO_SCK;
+    struct spi_loss loss;
+    struct timespec start, end;
+    int i, opt, drained, ret = EXIT_FAILURE;
+
+    chk.bit_min = BENCH_BIT_MIN;
+    chk.bit_max = BENCH_BIT_MAX;
+    chk.cs_num = 1;
+    chk.cs_mask = 0xFF;
+    chk.lanes = 1;
+
+    while ((opt = getopt(argc, argv, "n:t:b:B:f:xs:m:l:rcpw:dRD:PS:")) != -1) {
+        switch (opt) {
+        case 'n':
+            packet_total = atoi(optarg);
+            break;
+        case 't':
+            batch = atoi(optarg);
+            break;
+        case 'b':
+            chk.bit_min = atoi(optarg);
+            break;
+        case 'B':
+            chk.bit_max = atoi(optarg);
+            break;
+        case 'f':
+            if ((sscanf(optarg, "%x:%x", &chk.filter_match,
+                        &chk.filter_mask) != 2) ||
+                (chk.filter_match > 0xFFFF) || (chk.filter_mask > 0xFFFF)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'x':
+            filter_exclude = 1;
+            break;
+        case 's':
+            chk.cs_num = atoi(optarg);
+            break;
+        case 'm':
+            if ((sscanf(optarg, "%x", &chk.cs_mask) != 1) ||
+                (chk.cs_mask > 0xFF)) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'l':
+            chk.lanes = atoi(optarg);
+            break;
+        case 'r':
+            rle = 1;
+            break;
+        case 'c':
+            chk.check_frames = 1;
+            break;
+        case 'p':
+            chk.print_frames = 1;
+            break;
+        case 'w':
+            capture_path = optarg;
+            break;
+        case 'd':
+            capture_direct = 1;
+            break;
+        case 'R':
+            read_back = 1;
+            break;
+        case 'D':
+            decoder = spi_decoder_find(optarg);
+            if (decoder == NULL) {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            use_pipeline = 1;
+            break;
+        case 'S':
+            stats_ms = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if ((optind != argc) || (packet_total < 1) ||
+        (batch < 1) || (batch > SPISNIF_STATUS_PACKET_NUM) ||
+        (chk.bit_min < 1) || (chk.bit_max < chk.bit_min) ||
+        (chk.bit_max > 0xFFFF) || (chk.cs_num < 1) || (chk.cs_num > 8) ||
+        ((chk.lanes != 1) && (chk.lanes != 2) && (chk.lanes != 4)) ||
+        ((chk.lanes == 4) && (chk.bit_min < 2)) || (stats_ms < 0)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    spisnif_sim_init(&sim);
+    sim.cs_num = chk.cs_num;
+    sim.lanes = chk.lanes;
+    sim.rle = rle;
+    chk.len_bits = 16 - spisnif_sim_cs_bits(chk.cs_num) -
+                   ((chk.lanes > 1) ? 2 : 0);
+    if (check_bitrev() != 0) {
+        printf("Error: %s bitrev kernel differs from bit loop\n",
+               bitrev_kernel);
+        return EXIT_FAILURE;
+    }
+
+    if (frame_arena_init(&arena, FRAME_ARENA_DEFAULT_SLOTS) < 0)
+        return EXIT_FAILURE;
+
+    if ((decoder != NULL) &&
+        (spi_decode_init(&dec.ctx, decoder, -1,
+                         chk.print_frames ? spi_transaction_print : NULL,
+                         NULL) < 0))
+        goto free_arena;
+
+    if (capture_path != NULL) {
+        cf = capture_file_open(capture_path, capture_direct);
+        if (cf == NULL)
+            goto free_decode;
+    }
+
+    printf("Benchmarking %d packets of %d to %d bits, %d per drain, %s bitrev%s",
+           packet_total, chk.bit_min, chk.bit_max, batch, bitrev_kernel,
+           use_pipeline ? ", pipeline" : "");
+    if (chk.lanes > 1)
+        printf(", %d lanes", chk.lanes);
+    if (sim.rle)
+        printf(", rle");
+    printf("\n");
+
+    /* same setup as spisnif main() */
+    spisnif_write(&sim, SPISNIF_CONTROL_REG, batch);
+    reset_spisnif(&sim);
+    spisnif_write(&sim, IRQ_MNGR_PENDING_REG, 0x01);
+    spisnif_write(&sim, IRQ_MNGR_MASK_REG, 0x01);
+    filter_spisnif(&sim, chk.filter_match, chk.filter_mask, filter_exclude);
+    spisnif_write(&sim, SPISNIF_CS_MASK_REG, chk.cs_mask);
+    /* lanes mode, 0 single, 1 dual, 2 quad */
+    spisnif_write(&sim, SPISNIF_CONFIG_REG,
+                  ((chk.lanes == 4) ? 2 : chk.lanes - 1) <<
+                  SPISNIF_CONFIG_LANES_SHIFT);
+    chk.filter_ctrl = spisnif_read(&sim, SPISNIF_FILTER_CTRL_REG);
+
+    /* measured path is then the drain alone, as on the board */
+    capture_pipeline_init(&pipe, &arena);
+    if (use_pipeline) {
+        capture_pipeline_add_stage(&pipe, check_stage, &chk);
+        if (decoder != NULL)
+            capture_pipeline_add_stage(&pipe, decode_stage, &dec);
+        if (cf != NULL)
+            capture_pipeline_add_stage(&pipe, write_stage, cf);
+        if (capture_pipeline_start(&pipe) < 0)
+            goto close_file;
+    }
+    reg_reads = sim.reg_reads;
+    capture_stats_init(&stats, stats_ms, stderr);
+
+    while (captured + sim.dropped + sim.filtered + sim.too_long <
+           (unsigned long long)packet_total) {
+        i = packet_total - captured - sim.dropped - sim.filtered -
+            sim.too_long;
+        spisnif_sim_generate(&sim, (i < batch) ? i : batch, chk.bit_min,
+                             chk.bit_max);
+        if (!spisnif_sim_irq_pending(&sim) && (i >= batch) &&
+            !chk.filter_mask &&
+            ((chk.cs_mask & ((1 << chk.cs_num) - 1)) == (1 << chk.cs_num) - 1))
+            printf("Warning: no interrupt after %d packets\n", batch);
+        spisnif_write(&sim, IRQ_MNGR_PENDING_REG, 0x01);
+
+        /* workers hold every slot, the model keeps its packets */
+        while (frame_arena_full(&arena)) {
+            stalls++;
+            stats.stalls++;
+            sched_yield();
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        drained = read_frames(&sim, &arena, &flist);
+        if (drained <= 0) {
+            if ((drained < 0) && !(spisnif_read(&sim, SPISNIF_STATUS_REG) &
+                               SPISNIF_STATUS_PING_PONG))
+                reset_spisnif(&sim);
+            continue;
+        }
+        clock_gettime(CLOCK_REALTIME, &flist->ts);
+        captured += flist->frame_num;
+        lost_packets += flist->loss.packets;
+        lost_bits += flist->loss.bits;
+        overflows += flist->loss.overflows;
+        if (flist->loss.sck_period < sck_period)
+            sck_period = flist->loss.sck_period;
+        if (use_pipeline) {
+            if ((capture_pipeline_push(&pipe, flist) < 0) ||
+                capture_pipeline_failed(&pipe))
+                break;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            drain_ns += elapsed_ns(&start, &end);
+            if (stats_ms) {
+                capture_stats_drain(&stats, flist, &arena,
+                                    elapsed_ns(&start, &end));
+                capture_stats_report(&stats, &pipe);
+            }
+            continue;
+        }
+
+        if (chk.print_frames)
+            print_frame_list(flist);
+        if ((cf != NULL) && (write_stage(flist, cf) < 0))
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        drain_ns += elapsed_ns(&start, &end);
+        if (stats_ms) {
+            capture_stats_drain(&stats, flist, &arena,
+                                elapsed_ns(&start, &end));
+            capture_stats_report(&stats, NULL);
+        }
+
+        check_frames(&chk, flist);
+        if (decoder != NULL)
+            decode_stage(flist, &dec);
+        frame_arena_release(&arena, flist);
+    }
+    capture_pipeline_stop(&pipe);
+    reg_reads = sim.reg_reads - reg_reads;
+    /* losses after the last drain */
+    read_loss(&sim, &loss);
+    lost_packets += loss.packets;
+    lost_bits += loss.bits;
+    overflows += loss.overflows;
+    if (loss.sck_period < sck_period)
+        sck_period = loss.sck_period;
+
+    printf("%llu packets captured, %llu dropped", captured, sim.dropped);
+    if (sim.filtered)
+        printf(", %llu filtered", sim.filtered);
+    if (sim.too_long)
+        printf(", %llu too long", sim.too_long);
+    if (chk.check_frames)
+        printf(", %llu errors", chk.errors);
+    printf("\n");
+    if (chk.rle_expanded)
+        printf("rle: %llu words stored for %llu expanded (%.1f%%)\n",
+               chk.rle_stored, chk.rle_expanded,
+               chk.rle_stored*100.0/chk.rle_expanded);
+    if (lost_packets || overflows)
+        printf("LOSS: %llu packets (%llu bits), %llu overflows\n",
+               lost_packets, lost_bits, overflows);
+    if (chk.check_frames && (lost_packets != sim.dropped + sim.too_long)) {
+        printf("Error: LOSS counts %llu packets, model lost %llu\n",
+               lost_packets, sim.dropped + sim.too_long);
+        chk.errors++;
+    }
+    if (chk.check_frames && captured && (chk.bit_min > 1) &&
+        (sck_period != 2*sim.clk_per_bit)) {
+        printf("Error: sck period measured %u half clocks, sent %u\n",
+               sck_period, 2*sim.clk_per_bit);
+        chk.errors++;
+    }
+    if (captured && drain_ns) {
+        printf("%.1f ns/packet, %.0f packets/s, %.2f Mbit/s per lane\n",
+               (double)drain_ns/captured, captured*1e9/drain_ns,
+               chk.bits*1e3/drain_ns);
+        printf("%.1f register reads/packet\n", (double)reg_reads/captured);
+    }
+    if (decoder != NULL && captured)
+        printf("%s decoder: %.1f ns/packet, %llu transactions\n",
+               decoder->name, (double)dec.ns/captured,
+               dec.ctx.transactions);
+    if (stalls)
+        printf("%llu waits for a free arena slot\n", stalls);
+    ret = (chk.errors || sim.dropped) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+close_file:
+    if (cf != NULL) {
+        capture_file_close(cf);
+        if (read_back && (ret == EXIT_SUCCESS) &&
+            (bench_read_file(capture_path, &chk, captured) < 0))
+            ret = EXIT_FAILURE;
+    }
+free_decode:
+    if (decoder != NULL)
+        spi_decode_free(&dec.ctx);
+free_arena:
+    frame_arena_free(&arena);
+    return ret;
+}
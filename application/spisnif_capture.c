@@ -0,0 +1,336 @@
+/* spisnif_capture.c
+ *
+ * fifos draining and frames printing, on top of register accessors
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "spisnif.h"
+#include "spisnif_regs.h"
+#include "spisnif_capture.h"
+#include "bitrev.h"
+
+/* Freeze capture bank for reading, return -1 if the component did not
+ * swap banks in time */
+static int swap_banks(void *ptr_fpga) {
+    unsigned short value;
+    int i;
+
+    value = spisnif_read(ptr_fpga, SPISNIF_CONTROL_REG) &
+        ~(SPISNIF_RESET_FLG | SPISNIF_IRQ_ACK_FLG | SPISNIF_SWAP_FLG);
+    spisnif_write(ptr_fpga, SPISNIF_CONTROL_REG, value | SPISNIF_SWAP_FLG);
+    spisnif_write(ptr_fpga, SPISNIF_CONTROL_REG, value);
+    for (i = 0; i < SPISNIF_SWAP_POLLS; i++) {
+        if (!(spisnif_read(ptr_fpga, SPISNIF_CONTROL_REG) & SPISNIF_SWAP_FLG))
+            return 0;
+    }
+    return -1;
+}
+
+/* Read stored words of both rle lanes from stream window into the slot
+ * pool of flist, the frame is kept as stored */
+static int read_rle_lanes(void *ptr_fpga, struct spi_frame_list *flist,
+                          struct spi_frame *frame, int word_num) {
+    int j;
+
+    frame->rle = 1;
+    frame->mosi_words = spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+    frame->miso_words = spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+    if ((frame->mosi_words > FRAME_ARENA_MAX_WORDS) ||
+        (frame->miso_words > FRAME_ARENA_MAX_WORDS))
+        return -1;
+    frame->mosi = frame_list_alloc_words(flist, frame->mosi_words +
+                                                frame->miso_words);
+    if (frame->mosi == NULL)
+        return -1;
+    frame->miso = frame->mosi + frame->mosi_words;
+    for (j = 0; j < frame->mosi_words + frame->miso_words; j++)
+        frame->mosi[j] = spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+
+    if (spisnif_rle_expand(NULL, word_num, frame->mosi, frame->mosi_words) < 0)
+        return -1;
+    return spisnif_rle_expand(NULL, word_num, frame->miso, frame->miso_words);
+}
+
+/* Latch and clear LOSS counters into loss. */
+void read_loss(void *ptr_fpga, struct spi_loss *loss) {
+    spisnif_write(ptr_fpga, SPISNIF_LOSS_REG, SPISNIF_LOSS_CLEAR);
+    loss->packets = spisnif_read(ptr_fpga, SPISNIF_LOSS_REG);
+    loss->bits = (unsigned int)spisnif_read(ptr_fpga, SPISNIF_LOSS_REG) << 16;
+    loss->bits |= spisnif_read(ptr_fpga, SPISNIF_LOSS_REG);
+    loss->overflows = spisnif_read(ptr_fpga, SPISNIF_LOSS_REG);
+    loss->sck_period = spisnif_read(ptr_fpga, SPISNIF_LOSS_REG);
+}
+
+/* Drain fifos into the next free slot of arena, set *pflist to it.
+ * Return 1 when packets were drained, 0 when fifos are empty or no slot
+ * is free (packets wait in fifos), -1 if fifos are inconsistent; the slot
+ * is committed only when the whole drain succeeded. */
+int read_frames(void *ptr_fpga, struct frame_arena *arena,
+                struct spi_frame_list **pflist) {
+    struct spi_frame_list *flist;
+    struct spi_frame *frame;
+    unsigned short read_value, config;
+    int i, j, word_num, rle, cs_shift, lane_shift;
+
+    /* reserve before a swap freezes a bank that could not be read */
+    flist = frame_arena_reserve(arena);
+    if (flist == NULL)
+        return 0;
+
+    /* full fifos drop new packets and count them in LOSS, packets
+     * already recorded are still good */
+    read_value = spisnif_read(ptr_fpga, SPISNIF_STATUS_REG);
+    if (read_value & SPISNIF_STATUS_PING_PONG) {
+        /* read the bank captured so far while capture goes on in the
+         * other one */
+        if (swap_banks(ptr_fpga) < 0) {
+            printf("Error: bank swap timeout\n");
+            return -1;
+        }
+        read_value = spisnif_read(ptr_fpga, SPISNIF_STATUS_REG);
+    }
+
+    if (read_value & SPISNIF_STATUS_EMPTY)
+        return 0;
+    read_value &= SPISNIF_STATUS_PACKET_NUM;
+    if (read_value == 0)
+        return 0;
+
+    if (read_value > FRAME_ARENA_MAX_FRAMES) {
+        printf("Error: %d packets is more than fifo_packet can hold\n",
+               read_value);
+        return -1;
+    }
+
+    flist->frame_num = (int)read_value;
+    config = spisnif_read(ptr_fpga, SPISNIF_CONFIG_REG);
+    rle = config & SPISNIF_CONFIG_RLE;
+    /* multi CS: descriptor msb hold the CS index, then with lanes above
+     * 1 the packet lanes mode */
+    cs_shift = 16 - ((config & SPISNIF_CONFIG_CS_BITS) >>
+                     SPISNIF_CONFIG_CS_SHIFT);
+    lane_shift = (config & SPISNIF_CONFIG_LANE_FLD) ? cs_shift - 2 : cs_shift;
+
+    for (i = 0; i < flist->frame_num; i++) {
+        frame = &flist->frames[i];
+        /* stream window gives descriptor, start and end timestamps (msw
+         * first), with rle MOSI and MISO stored words numbers, then all
+         * MOSI words and all MISO words */
+        read_value = spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+        frame->cs = (cs_shift < 16) ? (read_value >> cs_shift) : -1;
+        frame->lanes = 1 << (((read_value & ((1 << cs_shift) - 1))) >>
+                             lane_shift);
+        read_value &= (1 << lane_shift) - 1;
+        frame->bit_num = read_value;
+        frame->ts_start = (unsigned int)
+            spisnif_read(ptr_fpga, SPISNIF_STREAM_REG) << 16;
+        frame->ts_start |= spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+        frame->ts_end = (unsigned int)
+            spisnif_read(ptr_fpga, SPISNIF_STREAM_REG) << 16;
+        frame->ts_end |= spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+        frame->rle = 0;
+        frame->mosi_words = 0;
+        frame->miso_words = 0;
+        if (read_value == 0) {
+            frame->mosi = NULL;
+            frame->miso = NULL;
+            if (rle) {
+                /* both words numbers are 0 */
+                spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+                spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+            }
+            continue;
+        }
+
+        word_num = FRAME_WORDS(frame->bit_num);
+        if (rle) {
+            if (read_rle_lanes(ptr_fpga, flist, frame, word_num) < 0) {
+                printf("Error: frame %d rle words do not expand to %d bits\n",
+                       i, frame->bit_num);
+                return -1;
+            }
+            continue;
+        }
+
+        frame->mosi = frame_list_alloc_words(flist, 2*word_num);
+        if (frame->mosi == NULL) {
+            printf("Error: frame %d (%d bits) overflows fifo_mxsx size\n",
+                   i, frame->bit_num);
+            return -1;
+        }
+        frame->miso = frame->mosi + word_num;
+        frame->mosi_words = word_num;
+        frame->miso_words = word_num;
+
+        /* read all values */
+        for (j = 0; j < 2*word_num; j++)
+            frame->mosi[j] = spisnif_read(ptr_fpga, SPISNIF_STREAM_REG);
+    }
+
+    /* the component rewinds its fifos once drained, between packets */
+    read_loss(ptr_fpga, &flist->loss);
+
+    frame_arena_commit(arena);
+    *pflist = flist;
+    return 1;
+}
+
+/* "(bits)LANE: " header, bits, " (" hex ")\n" of the longest lane, also
+ * holds the " XX" bytes of merged lanes */
+#define FRAME_LINE_SIZE (16 + FRAME_MAX_LANE_WORDS*(16 + 4) + 4)
+
+static void print_lane(const char *lane, int bit_num,
+                       const unsigned short *words) {
+    static char line[FRAME_LINE_SIZE];
+    char *ptr;
+
+    ptr = line + sprintf(line, "(%03d)%s: ", bit_num, lane);
+    ptr = bitrev_render_bits(ptr, words, bit_num);
+    *ptr++ = ' ';
+    *ptr++ = '(';
+    ptr = bitrev_render_hex(ptr, words, FRAME_WORDS(bit_num));
+    *ptr++ = ')';
+    *ptr++ = '\n';
+    fwrite(line, 1, ptr - line, stdout);
+}
+
+/* bit i of a lane as stored in fifo words, first received bit in lsb */
+static int lane_bit(const unsigned short *words, int i) {
+    return (words[i/16] >> (i % 16)) & 1;
+}
+
+/* dual and quad frames: rebuild the bytes sent over the lanes, highest
+ * data lane first on each sck edge, first edge in msb. Return bytes. */
+int frame_merge_lanes(const struct spi_frame *frame, unsigned char *bytes) {
+    int edge, edge_num, bit, n = 0;
+
+    edge_num = (frame->lanes == 4) ? frame->bit_num/2 : frame->bit_num;
+    memset(bytes, 0, (edge_num*frame->lanes + 7)/8);
+    for (edge = 0; edge < edge_num; edge++) {
+        if (frame->lanes == 4) {
+            bit = lane_bit(frame->miso, 2*edge + 1) << 3 |
+                  lane_bit(frame->mosi, 2*edge + 1) << 2 |
+                  lane_bit(frame->miso, 2*edge) << 1 |
+                  lane_bit(frame->mosi, 2*edge);
+        } else {
+            bit = lane_bit(frame->miso, edge) << 1 |
+                  lane_bit(frame->mosi, edge);
+        }
+        bytes[n/8] |= (bit << (8 - frame->lanes)) >> (n % 8);
+        n += frame->lanes;
+    }
+    return (n + 7)/8;
+}
+
+static void print_data(const struct spi_frame *frame) {
+    static unsigned char bytes[4*FRAME_MAX_LANE_WORDS];
+    static char line[FRAME_LINE_SIZE];
+    char *ptr;
+    int i, byte_num;
+
+    byte_num = frame_merge_lanes(frame, bytes);
+    ptr = line + sprintf(line, "(%03d)DATA x%d:", frame->bit_num, frame->lanes);
+    for (i = 0; i < byte_num; i++)
+        ptr += sprintf(ptr, " %02X", bytes[i]);
+    *ptr++ = '\n';
+    fwrite(line, 1, ptr - line, stdout);
+}
+
+void print_frame_list(struct spi_frame_list *flist) {
+    static unsigned short words[2*FRAME_MAX_LANE_WORDS];
+    const struct spi_frame *frame;
+    struct spi_frame expanded;
+    int i;
+
+    for (i=0; i < flist->frame_num; i++) {
+        frame = frame_expand(&flist->frames[i], &expanded, words);
+        printf("@%u +%u cycles", frame->ts_start,
+               frame->ts_end - frame->ts_start);
+        if (frame->cs >= 0)
+            printf(" CS%d", frame->cs);
+        fputc('\n', stdout);
+        if ((frame->bit_num != 0) && (frame->lanes > 1)) {
+            print_data(frame);
+            fputc('\n', stdout);
+        } else if (frame->bit_num != 0) {
+            print_lane("MOSI", frame->bit_num, frame->mosi);
+            print_lane("MISO", frame->bit_num, frame->miso);
+            fputc('\n', stdout);
+        } else
+            fputs("Void CS\n\n", stdout);
+    }
+}
+
+void print_map(void* ptr_fpga) {
+    printf("SPISNIF_CONTROL_REG     (%02X) -> %04X\n",
+           SPISNIF_CONTROL_REG     ,spisnif_read(ptr_fpga,SPISNIF_CONTROL_REG));
+    printf("SPISNIF_FIFO_MOSI_REG   (%02X) -> %04X\n",
+           SPISNIF_FIFO_MOSI_REG   ,spisnif_read(ptr_fpga,SPISNIF_FIFO_MOSI_REG));
+    printf("SPISNIF_FIFO_MISO_REG   (%02X) -> %04X\n",
+           SPISNIF_FIFO_MISO_REG   ,spisnif_read(ptr_fpga,SPISNIF_FIFO_MISO_REG));
+    printf("SPISNIF_FIFO_PACKET_REG (%02X) -> %04X\n",
+           SPISNIF_FIFO_PACKET_REG ,spisnif_read(ptr_fpga,SPISNIF_FIFO_PACKET_REG));
+    printf("SPISNIF_STATUS_REG      (%02X) -> %04X\n",
+           SPISNIF_STATUS_REG      ,spisnif_read(ptr_fpga,SPISNIF_STATUS_REG));
+    printf("SPISNIF_CONFIG_REG      (%02X) -> %04X\n",
+           SPISNIF_CONFIG_REG      ,spisnif_read(ptr_fpga,SPISNIF_CONFIG_REG));
+    printf("SPISNIF_FIFO_PINFO_REG  (%02X) -> %04X\n",
+           SPISNIF_FIFO_PINFO_REG  ,spisnif_read(ptr_fpga,SPISNIF_FIFO_PINFO_REG));
+    printf("SPISNIF_ID_REG          (%02X) -> %04X\n",
+           SPISNIF_ID_REG          ,spisnif_read(ptr_fpga,SPISNIF_ID_REG));
+    printf("SPISNIF_FILTER_CTRL_REG (%02X) -> %04X\n",
+           SPISNIF_FILTER_CTRL_REG ,spisnif_read(ptr_fpga,SPISNIF_FILTER_CTRL_REG));
+    printf("SPISNIF_FILTER_MATCH_REG(%02X) -> %04X\n",
+           SPISNIF_FILTER_MATCH_REG,spisnif_read(ptr_fpga,SPISNIF_FILTER_MATCH_REG));
+    printf("SPISNIF_FILTER_MASK_REG (%02X) -> %04X\n",
+           SPISNIF_FILTER_MASK_REG ,spisnif_read(ptr_fpga,SPISNIF_FILTER_MASK_REG));
+    printf("SPISNIF_CS_MASK_REG     (%02X) -> %04X\n",
+           SPISNIF_CS_MASK_REG     ,spisnif_read(ptr_fpga,SPISNIF_CS_MASK_REG));
+}
+
+void reset_spisnif(void * ptr_fpga) {
+    unsigned short value;
+    value = spisnif_read(ptr_fpga, SPISNIF_CONTROL_REG) &
+        ~(SPISNIF_RESET_FLG | SPISNIF_IRQ_ACK_FLG | SPISNIF_SWAP_FLG);
+    spisnif_write(ptr_fpga,
+                  SPISNIF_CONTROL_REG,
+                  value | SPISNIF_RESET_FLG);
+    spisnif_write(ptr_fpga,
+                  SPISNIF_CONTROL_REG,
+                  value);
+    /* acknowledge irq */
+    spisnif_write(ptr_fpga, IRQ_MNGR_PENDING_REG, 0x01);
+}
+
+void filter_spisnif(void *ptr_fpga, unsigned short match,
+                    unsigned short mask, int exclude) {
+    unsigned short ctrl = 0;
+
+    if (mask != 0)
+        ctrl |= SPISNIF_FILTER_ENABLE;
+    if (exclude)
+        ctrl |= SPISNIF_FILTER_EXCLUDE;
+    spisnif_write(ptr_fpga, SPISNIF_FILTER_MATCH_REG, match);
+    spisnif_write(ptr_fpga, SPISNIF_FILTER_MASK_REG, mask);
+    spisnif_write(ptr_fpga, SPISNIF_FILTER_CTRL_REG, ctrl);
+}
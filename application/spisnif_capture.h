@@ -0,0 +1,52 @@
+/* spisnif_capture.h
+ *
+ * fifos draining and frames printing, on top of register accessors
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __SPISNIF_CAPTURE_H__
+#define __SPISNIF_CAPTURE_H__
+
+#include "frame_arena.h"
+
+/* drain fifos into the next free slot of arena, set *flist to it. Return
+ * 1 when drained, 0 when empty or no slot is free, -1 on error.
+ * (*flist)->loss holds the LOSS counters latched by the drain. */
+int read_frames(void *ptr_fpga, struct frame_arena *arena,
+                struct spi_frame_list **flist);
+/* latch and clear LOSS counters */
+void read_loss(void *ptr_fpga, struct spi_loss *loss);
+
+/* dual and quad frames: bytes sent over the lanes, in bus order, in
+ * bytes (4*FRAME_MAX_LANE_WORDS bytes). Return bytes number. */
+int frame_merge_lanes(const struct spi_frame *frame, unsigned char *bytes);
+
+void print_frame_list(struct spi_frame_list *flist);
+void print_map(void *ptr_fpga);
+
+/* reset fifos and acknowledge irq manager */
+void reset_spisnif(void *ptr_fpga);
+
+/* keep only packets whose first MOSI word matches match on mask bits,
+ * or drop them if exclude is set; mask 0 disables the filter */
+void filter_spisnif(void *ptr_fpga, unsigned short match,
+                    unsigned short mask, int exclude);
+
+#endif /* __SPISNIF_CAPTURE_H__ */
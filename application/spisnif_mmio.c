@@ -0,0 +1,34 @@
+/* spisnif_mmio.c
+ *
+ * register accessors on the FPGA area mapped from /dev/mem
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include "spisnif_regs.h"
+
+unsigned short spisnif_read(void *ptr_fpga, int addr)
+{
+    return *(volatile unsigned short *)((char *)ptr_fpga + addr);
+}
+
+void spisnif_write(void *ptr_fpga, int addr, unsigned short value)
+{
+    *(volatile unsigned short *)((char *)ptr_fpga + addr) = value;
+}
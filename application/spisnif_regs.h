@@ -0,0 +1,107 @@
+/* spisnif_regs.h
+ *
+ * spisnif register map as seen from the FPGA base address, see
+ * doc/README.md, and register accessors. Accessors are implemented on
+ * /dev/mem by spisnif_mmio.c or by the host model in spisnif_sim.c.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __SPISNIF_REGS_H__
+#define __SPISNIF_REGS_H__
+
+#define IRQ_BASE                0x00
+#define IRQ_MNGR_MASK_REG       (IRQ_BASE + 0x00)
+#define IRQ_MNGR_PENDING_REG    (IRQ_BASE + 0x02)
+
+#define SPISNIF_BASE            0x10
+#define SPISNIF_CONTROL_REG     (SPISNIF_BASE + 0x00)
+#define SPISNIF_FIFO_MOSI_REG   (SPISNIF_BASE + 0x02)
+#define SPISNIF_FIFO_MISO_REG   (SPISNIF_BASE + 0x04)
+#define SPISNIF_FIFO_PACKET_REG (SPISNIF_BASE + 0x06)
+#define SPISNIF_STATUS_REG      (SPISNIF_BASE + 0x08)
+#define SPISNIF_CONFIG_REG      (SPISNIF_BASE + 0x0a)
+#define SPISNIF_FIFO_PINFO_REG  (SPISNIF_BASE + 0x0c)
+#define SPISNIF_ID_REG          (SPISNIF_BASE + 0x0e)
+/* 0x10 to 0x14 all alias the stream window, 0x10 only with dma */
+#define SPISNIF_STREAM_REG      (SPISNIF_BASE + 0x10)
+#define SPISNIF_STREAM_SIZE     0x06
+#define SPISNIF_DMA_CTRL_REG    (SPISNIF_BASE + 0x12)
+#define SPISNIF_DMA_DATA_REG    (SPISNIF_BASE + 0x14)
+#define SPISNIF_LOSS_REG        (SPISNIF_BASE + 0x16)
+#define SPISNIF_FILTER_CTRL_REG  (SPISNIF_BASE + 0x18)
+#define SPISNIF_FILTER_MATCH_REG (SPISNIF_BASE + 0x1a)
+#define SPISNIF_FILTER_MASK_REG  (SPISNIF_BASE + 0x1c)
+#define SPISNIF_CS_MASK_REG      (SPISNIF_BASE + 0x1e)
+
+#define SPISNIF_RESET_FLG   (0x8000)
+#define SPISNIF_IRQ_ACK_FLG (0x4000)
+#define SPISNIF_SWAP_FLG    (0x2000)
+#define SPISNIF_IRQ_PNUM_TRIG_MASK  (0x07FF)
+
+#define SPISNIF_STATUS_EMPTY        (0x8000)
+#define SPISNIF_STATUS_FULL         (0x4000)
+#define SPISNIF_STATUS_MXSX_FULL    (0x2000)
+#define SPISNIF_STATUS_BANK         (0x1000)
+#define SPISNIF_STATUS_PING_PONG    (0x0800)
+#define SPISNIF_STATUS_PACKET_NUM   (0x07FF)
+
+/* LOSS write latches counters, reads then give lost packets, lost bits
+ * msw and lsw, overflows and shortest sck period in half gls_clk periods
+ * (SPISNIF_LOSS_NO_SCK without edges) */
+#define SPISNIF_LOSS_CLEAR  (0x8000)
+#define SPISNIF_LOSS_WORDS  5
+#define SPISNIF_LOSS_NO_SCK (0xFFFF)
+
+#define SPISNIF_FILTER_ENABLE    (0x8000)
+#define SPISNIF_FILTER_EXCLUDE   (0x4000)
+#define SPISNIF_FILTER_TRIGGER   (0x2000)
+#define SPISNIF_FILTER_TRIGGERED (0x1000)
+#define SPISNIF_FILTER_DONE      (0x0800)
+#define SPISNIF_FILTER_POST_MASK (0x07FF)
+
+/* DMA_CTRL: the driver enables the engine, register mode capture needs
+ * it disabled (driver unloaded) */
+#define SPISNIF_DMA_ENABLE  (0x8000)
+#define SPISNIF_DMA_BUSY    (0x4000)
+
+#define SPISNIF_CONFIG_DMA      (0x2000)
+#define SPISNIF_CONFIG_DDR      (0x1000)
+#define SPISNIF_CONFIG_DELAY    (0x0C00)
+#define SPISNIF_CONFIG_DELAY_SHIFT 10
+#define SPISNIF_CONFIG_LANE_FLD (0x0200)
+#define SPISNIF_CONFIG_LANES    (0x0180)
+#define SPISNIF_CONFIG_LANES_SHIFT 7
+#define SPISNIF_CONFIG_CS_BITS  (0x0070)
+#define SPISNIF_CONFIG_CS_SHIFT 4
+#define SPISNIF_CONFIG_RLE   (0x0008)
+#define SPISNIF_CONFIG_CSPOL (0x0004)
+#define SPISNIF_CONFIG_CPHA  (0x0002)
+#define SPISNIF_CONFIG_CPOL  (0x0001)
+
+/* CONTROL polls while a bank swap waits for the end of current packet */
+#define SPISNIF_SWAP_POLLS  1000
+
+/* packet head in stream window: descriptor, start and end timestamps */
+#define SPISNIF_STREAM_HEAD_WORDS   5
+
+unsigned short spisnif_read(void *ptr_fpga, int addr);
+void spisnif_write(void *ptr_fpga, int addr, unsigned short value);
+
+#endif /* __SPISNIF_REGS_H__ */
@@ -0,0 +1,662 @@
+/* spisnif_sim.c
+ *
+ * host model of the spisnif component, behind the same register
+ * accessors as spisnif_mmio.c. It follows hdl/spisnif.vhd: fifo indexes
+ * do not wrap, STATUS flags, irq_pnum_trig/irq_ack locking and the stream
+ * window sequencing behave as on the FPGA. Only the default single bank
+ * mode (ping_pong generic 0) is modelled. Dual and quad lanes store the
+ * bytes sent as spisnif.vhd does, and the rle generic encodes runs as
+ * fifo_mxsx.vhd does.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <string.h>
+
+#include "spisnif_regs.h"
+#include "spisnif_sim.h"
+
+#define SPISNIF_SIM_CLK_PER_BIT 8
+#define SPISNIF_SIM_GAP         100
+
+enum {
+    STREAM_DESC,
+    STREAM_INFO,
+    STREAM_MOSI,
+    STREAM_MISO
+};
+
+/* stateless hash, lets checkers regenerate any packet */
+static unsigned int sim_hash(unsigned int value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352d;
+    value ^= value >> 15;
+    value *= 0x846ca68b;
+    value ^= value >> 16;
+    return value;
+}
+
+static int sim_words(int bit_num)
+{
+    return (bit_num + 15)/16;
+}
+
+/* lanes of packets captured now, from CONFIG LANES */
+static int sim_packet_lanes(struct spisnif_sim *sim)
+{
+    return 1 << ((sim->config & SPISNIF_CONFIG_LANES) >>
+                 SPISNIF_CONFIG_LANES_SHIFT);
+}
+
+/* bits of the descriptor bit count field, below CS index and lanes mode */
+static int sim_len_bits(struct spisnif_sim *sim)
+{
+    return 16 - spisnif_sim_cs_bits(sim->cs_num) - ((sim->lanes > 1) ? 2 : 0);
+}
+
+/* packet info words per packet, timestamps then rle words numbers */
+static int sim_info_words(struct spisnif_sim *sim)
+{
+    return sim->rle ? 6 : 4;
+}
+
+static void sim_reset_fifos(struct spisnif_sim *sim)
+{
+    sim->desc_wr = sim->desc_rd = 0;
+    sim->pinfo_wr = sim->pinfo_rd = 0;
+    sim->mosi_wr = sim->miso_wr = 0;
+    sim->mosi_rd = sim->miso_rd = 0;
+    sim->mxsx_full = 0;
+    sim->room_out = 0;
+    sim->stream_state = STREAM_DESC;
+    sim->stream_count = 0;
+}
+
+static int sim_packet_num(struct spisnif_sim *sim)
+{
+    return sim->desc_wr - sim->desc_rd;
+}
+
+/* fifo_rewind_management of spisnif.vhd, packets are pushed between
+ * host accesses so the bus is always idle here */
+static void sim_rewind_fifos(struct spisnif_sim *sim)
+{
+    if ((sim->desc_wr != 0) && (sim->desc_rd == sim->desc_wr) &&
+        (sim->pinfo_rd == sim->pinfo_wr) &&
+        (sim->mosi_rd == sim->mosi_wr) && (sim->miso_rd == sim->miso_wr) &&
+        (sim->stream_state == STREAM_DESC))
+        sim_reset_fifos(sim);
+}
+
+/* wbs_irq and the irq manager rising edge latch */
+static void sim_update_irq(struct spisnif_sim *sim)
+{
+    int trig = sim->control & SPISNIF_IRQ_PNUM_TRIG_MASK;
+    int line = 0;
+
+    if (sim_packet_num(sim) >= trig) {
+        if (!sim->irq_ack_lock) {
+            line = 1;
+            if (sim->control & SPISNIF_IRQ_ACK_FLG)
+                sim->irq_ack_lock = 1;
+        }
+    } else
+        sim->irq_ack_lock = 0;
+
+    if (line && !sim->irq_line)
+        sim->irq_pending |= 1;
+    sim->irq_line = line;
+}
+
+void spisnif_sim_init(struct spisnif_sim *sim)
+{
+    memset(sim, 0, sizeof(struct spisnif_sim));
+    sim->control = 1;
+    sim->cs_mask = 0xFF;
+    sim->cs_num = 1;
+    sim->lanes = 1;
+    sim->clk_per_bit = SPISNIF_SIM_CLK_PER_BIT;
+    sim->gap = SPISNIF_SIM_GAP;
+    sim->sck_min = SPISNIF_LOSS_NO_SCK;
+    sim_reset_fifos(sim);
+}
+
+/* packet_lost and overflow_event of spisnif.vhd */
+static void sim_count_loss(struct spisnif_sim *sim, int bit_num, int no_room)
+{
+    if (sim->loss_packets < 0xFFFF)
+        sim->loss_packets++;
+    if (sim->loss_bits > 0xFFFFFFFF - bit_num)
+        sim->loss_bits = 0xFFFFFFFF;
+    else
+        sim->loss_bits += bit_num;
+    if (no_room && !sim->room_out && (sim->loss_overflows < 0xFFFF))
+        sim->loss_overflows++;
+    if (no_room)
+        sim->room_out = 1;
+}
+
+int spisnif_sim_bit_num(unsigned int seq, int bit_min, int bit_max,
+                        int lanes)
+{
+    int bit_num = bit_min + sim_hash(seq) % (bit_max - bit_min + 1);
+
+    return (lanes == 4) ? bit_num & ~1 : bit_num;
+}
+
+/* lane idle after the first word of generated packet seq, -1 if none */
+static int sim_filler_lane(unsigned int seq)
+{
+    unsigned int value = sim_hash(seq ^ 0x5BD1E995);
+
+    return (value & 1) ? (int)((value >> 1) & 1) : -1;
+}
+
+unsigned char spisnif_sim_byte(unsigned int seq, int n)
+{
+    if ((n >= 2) && (sim_filler_lane(seq) >= 0))
+        return 0xFF;
+    return sim_hash(~((seq << 12) ^ n)) >> 24;
+}
+
+/* stored bit i of lane (0 MOSI, 1 MISO) with dual or quad lanes. A dual
+ * edge carries 2 bits of a byte, msb first, data 1 in msb. A quad edge
+ * carries a nibble, high one first, data 3 in msb, and its fifo stores
+ * data 0 or 1 then data 2 or 3. */
+static int sim_lane_bit(unsigned int seq, int lanes, int lane, int i)
+{
+    unsigned char byte;
+    int edge;
+
+    if (lanes == 2) {
+        edge = i;
+        byte = spisnif_sim_byte(seq, edge/4);
+        return (byte >> (6 - 2*(edge % 4) + lane)) & 1;
+    }
+    edge = i/2;
+    byte = spisnif_sim_byte(seq, edge/2);
+    if (edge % 2 == 0)
+        byte >>= 4;
+    return (byte >> (lane + 2*(i % 2))) & 1;
+}
+
+unsigned short spisnif_sim_word(unsigned int seq, int lane, int idx,
+                                int bit_num, int lanes)
+{
+    unsigned short value;
+    int i;
+
+    if (lanes > 1) {
+        value = 0;
+        for (i = 0; (i < 16) && (idx*16 + i < bit_num); i++)
+            value |= sim_lane_bit(seq, lanes, lane, idx*16 + i) << i;
+        return value;
+    }
+
+    if ((idx > 0) && (sim_filler_lane(seq) == lane))
+        value = (lane == 0) ? 0xFFFF : 0x0000;
+    else
+        value = sim_hash((seq << 12) ^ (idx << 1) ^ lane);
+    /* bits after the last one are left to 0 */
+    if ((idx == sim_words(bit_num) - 1) && (bit_num % 16))
+        value &= (1 << (bit_num % 16)) - 1;
+
+    return value;
+}
+
+int spisnif_sim_filter_hit(unsigned int seq, int bit_num, int lanes,
+                           unsigned short ctrl, unsigned short match,
+                           unsigned short mask)
+{
+    unsigned short first = 0;
+    int hit;
+
+    if (!(ctrl & SPISNIF_FILTER_ENABLE))
+        return 1;
+    /* bits not received read as 0 */
+    if (bit_num > 0)
+        first = spisnif_sim_word(seq, 0, 0, bit_num, lanes);
+    hit = ((first ^ match) & mask) == 0;
+
+    return (ctrl & SPISNIF_FILTER_EXCLUDE) ? !hit : hit;
+}
+
+int spisnif_sim_cs(unsigned int seq, int cs_num)
+{
+    return seq % cs_num;
+}
+
+int spisnif_sim_cs_bits(int cs_num)
+{
+    int bits = 0;
+
+    while ((1 << bits) < cs_num)
+        bits++;
+    return bits;
+}
+
+/* filter and trigger state on CS deassert, as in spisnif.vhd */
+static int sim_filter_keep(struct spisnif_sim *sim, int bit_num)
+{
+    int post = sim->filter_ctrl & SPISNIF_FILTER_POST_MASK;
+    int keep;
+
+    keep = spisnif_sim_filter_hit(sim->seq, bit_num, sim_packet_lanes(sim),
+                                  sim->filter_ctrl, sim->filter_match,
+                                  sim->filter_mask);
+    if (!(sim->filter_ctrl & SPISNIF_FILTER_ENABLE) ||
+        !(sim->filter_ctrl & SPISNIF_FILTER_TRIGGER))
+        return keep;
+
+    if (sim->filter_ctrl & SPISNIF_FILTER_DONE)
+        return 0;
+    if (sim->filter_ctrl & SPISNIF_FILTER_TRIGGERED)
+        keep = 1;
+    if (keep) {
+        sim->trig_count++;
+        sim->filter_ctrl |= SPISNIF_FILTER_TRIGGERED;
+        if (post && (sim->trig_count == post))
+            sim->filter_ctrl |= SPISNIF_FILTER_DONE;
+    }
+
+    return keep;
+}
+
+/* fifo_mxsx run length encoding of one lane: a word equal to the previous
+ * one is stored, followed by the number of its further copies (saturated
+ * at 0xFFFF), then encoding starts again. Return stored words, -1 if they
+ * do not fit in room. */
+static int sim_rle_encode(unsigned short *dst, int room,
+                          const unsigned short *src, int src_words)
+{
+    int i, n = 0, prev_valid = 0;
+    unsigned short prev = 0;
+    unsigned int count;
+
+    for (i = 0; i < src_words; i++) {
+        if (n == room)
+            return -1;
+        dst[n++] = src[i];
+        if (!prev_valid || src[i] != prev) {
+            prev = src[i];
+            prev_valid = 1;
+            continue;
+        }
+        for (count = 0; (i + 1 < src_words) && (src[i + 1] == prev) &&
+                        (count < 0xFFFF); count++)
+            i++;
+        if (n == room)
+            return -1;
+        dst[n++] = count;
+        prev_valid = 0;
+    }
+
+    return n;
+}
+
+/* write both lanes of packet seq in fifo_mxsx, return -1 if they do not
+ * fit */
+static int sim_store_lanes(struct spisnif_sim *sim, int bit_num, int lanes,
+                           int *mosi_words, int *miso_words)
+{
+    static unsigned short words[FRAME_MAX_LANE_WORDS];
+    int i, word_num = sim_words(bit_num);
+
+    if (!sim->rle) {
+        if ((sim->mosi_wr + word_num > SPISNIF_SIM_MXSX_SIZE) ||
+            (sim->miso_wr + word_num > SPISNIF_SIM_MXSX_SIZE))
+            return -1;
+        for (i = 0; i < word_num; i++) {
+            sim->mosi[sim->mosi_wr + i] = spisnif_sim_word(sim->seq, 0, i,
+                                                           bit_num, lanes);
+            sim->miso[sim->miso_wr + i] = spisnif_sim_word(sim->seq, 1, i,
+                                                           bit_num, lanes);
+        }
+        *mosi_words = word_num;
+        *miso_words = word_num;
+        return 0;
+    }
+
+    for (i = 0; i < word_num; i++)
+        words[i] = spisnif_sim_word(sim->seq, 0, i, bit_num, lanes);
+    *mosi_words = sim_rle_encode(sim->mosi + sim->mosi_wr,
+                                 SPISNIF_SIM_MXSX_SIZE - sim->mosi_wr,
+                                 words, word_num);
+    for (i = 0; i < word_num; i++)
+        words[i] = spisnif_sim_word(sim->seq, 1, i, bit_num, lanes);
+    *miso_words = sim_rle_encode(sim->miso + sim->miso_wr,
+                                 SPISNIF_SIM_MXSX_SIZE - sim->miso_wr,
+                                 words, word_num);
+
+    return ((*mosi_words < 0) || (*miso_words < 0)) ? -1 : 0;
+}
+
+int spisnif_sim_push_packet(struct spisnif_sim *sim, int bit_num)
+{
+    int mosi_words, miso_words;
+    int cs = spisnif_sim_cs(sim->seq, sim->cs_num);
+    int cs_shift = 16 - spisnif_sim_cs_bits(sim->cs_num);
+    int len_bits = sim_len_bits(sim);
+    int lanes = sim_packet_lanes(sim);
+    unsigned int ts_start, ts_end;
+
+    ts_start = sim->timestamp;
+    /* quad lanes take 2 bits per sck edge */
+    ts_end = ts_start + ((lanes == 4) ? bit_num/2 : bit_num)*sim->clk_per_bit;
+    sim->timestamp = ts_end + sim->gap;
+
+    /* sck_measure of spisnif.vhd, on every enabled CS */
+    if ((sim->cs_mask & (1 << cs)) && (bit_num > 1) &&
+        (2*sim->clk_per_bit < sim->sck_min))
+        sim->sck_min = 2*sim->clk_per_bit;
+
+    if (!(sim->cs_mask & (1 << cs)) || !sim_filter_keep(sim, bit_num)) {
+        /* bits are discarded from fifo_mxsx, nothing is left */
+        sim->filtered++;
+        sim->seq++;
+        return 1;
+    }
+    if (bit_num >> len_bits) {
+        sim_count_loss(sim, bit_num, 0);
+        sim->too_long++;
+        sim->seq++;
+        return -1;
+    }
+
+    if ((sim->desc_wr == SPISNIF_SIM_PACKET_SIZE) ||
+        (sim->pinfo_wr + sim_info_words(sim) > SPISNIF_SIM_PINFO_SIZE))
+        goto drop;
+    if (sim_store_lanes(sim, bit_num, lanes, &mosi_words, &miso_words) < 0) {
+        sim->mxsx_full = 1;
+        goto drop;
+    }
+    sim->mosi_wr += mosi_words;
+    sim->miso_wr += miso_words;
+
+    sim->pinfo[sim->pinfo_wr++] = ts_start >> 16;
+    sim->pinfo[sim->pinfo_wr++] = ts_start & 0xFFFF;
+    sim->pinfo[sim->pinfo_wr++] = ts_end >> 16;
+    sim->pinfo[sim->pinfo_wr++] = ts_end & 0xFFFF;
+    if (sim->rle) {
+        sim->pinfo[sim->pinfo_wr++] = mosi_words;
+        sim->pinfo[sim->pinfo_wr++] = miso_words;
+    }
+    sim->desc[sim->desc_wr++] = (cs << cs_shift) | bit_num;
+    if (sim->lanes > 1)
+        sim->desc[sim->desc_wr - 1] |= (lanes >> 1) << len_bits;
+    sim->room_out = 0;
+
+    sim->seq++;
+    sim_update_irq(sim);
+    return 0;
+
+drop:
+    /* seq numbers captured packets only, checkers stay in sync */
+    sim_count_loss(sim, bit_num, 1);
+    sim->dropped++;
+    return -1;
+}
+
+int spisnif_sim_generate(struct spisnif_sim *sim, int packet_num,
+                         int bit_min, int bit_max)
+{
+    int i, pushed = 0;
+
+    for (i = 0; i < packet_num; i++)
+        if (spisnif_sim_push_packet(sim,
+                spisnif_sim_bit_num(sim->seq, bit_min, bit_max,
+                                    sim_packet_lanes(sim))) == 0)
+            pushed++;
+
+    return pushed;
+}
+
+int spisnif_sim_irq_pending(struct spisnif_sim *sim)
+{
+    return sim->irq_pending & sim->irq_mask;
+}
+
+int spisnif_sim_check_frame(const struct spi_frame *frame, unsigned int seq)
+{
+    int i, word_num = sim_words(frame->bit_num);
+
+    for (i = 0; i < word_num; i++) {
+        if (frame->mosi[i] != spisnif_sim_word(seq, 0, i, frame->bit_num,
+                                               frame->lanes))
+            return -1;
+        if (frame->miso[i] != spisnif_sim_word(seq, 1, i, frame->bit_num,
+                                               frame->lanes))
+            return -1;
+    }
+
+    return 0;
+}
+
+static unsigned short sim_pop(const unsigned short *fifo, int *rd, int wr)
+{
+    /* hdl fifos return their last ram output once empty */
+    if (*rd >= wr)
+        return 0;
+    return fifo[(*rd)++];
+}
+
+/* next word of the stream window, see STREAM in doc/README.md */
+static unsigned short sim_stream_read(struct spisnif_sim *sim)
+{
+    unsigned short value = 0;
+
+    switch (sim->stream_state) {
+    case STREAM_DESC:
+        value = sim_pop(sim->desc, &sim->desc_rd, sim->desc_wr);
+        sim->stream_mosi_words = sim_words(value &
+                                           ((1 << sim_len_bits(sim)) - 1));
+        sim->stream_miso_words = sim->stream_mosi_words;
+        sim->stream_count = 0;
+        sim->stream_state = STREAM_INFO;
+        break;
+    case STREAM_INFO:
+        value = sim_pop(sim->pinfo, &sim->pinfo_rd, sim->pinfo_wr);
+        /* rle words numbers are the last info words */
+        if (sim->rle && (sim->stream_count == 4))
+            sim->stream_mosi_words = value;
+        if (sim->rle && (sim->stream_count == 5))
+            sim->stream_miso_words = value;
+        if (++sim->stream_count == sim_info_words(sim)) {
+            sim->stream_count = 0;
+            if (sim->stream_mosi_words)
+                sim->stream_state = STREAM_MOSI;
+            else if (sim->stream_miso_words)
+                sim->stream_state = STREAM_MISO;
+            else
+                sim->stream_state = STREAM_DESC;
+        }
+        break;
+    case STREAM_MOSI:
+        value = sim_pop(sim->mosi, &sim->mosi_rd, sim->mosi_wr);
+        if (++sim->stream_count == sim->stream_mosi_words) {
+            sim->stream_count = 0;
+            sim->stream_state = sim->stream_miso_words ? STREAM_MISO :
+                                                         STREAM_DESC;
+        }
+        break;
+    case STREAM_MISO:
+        value = sim_pop(sim->miso, &sim->miso_rd, sim->miso_wr);
+        if (++sim->stream_count == sim->stream_miso_words) {
+            sim->stream_count = 0;
+            sim->stream_state = STREAM_DESC;
+        }
+        break;
+    }
+
+    return value;
+}
+
+unsigned short spisnif_read(void *ptr_fpga, int addr)
+{
+    struct spisnif_sim *sim = (struct spisnif_sim *)ptr_fpga;
+    unsigned short value = 0;
+    int packet_num;
+
+    sim->reg_reads++;
+
+    if ((addr >= SPISNIF_STREAM_REG) &&
+        (addr < SPISNIF_STREAM_REG + SPISNIF_STREAM_SIZE)) {
+        value = sim_stream_read(sim);
+        sim_rewind_fifos(sim);
+        sim_update_irq(sim);
+        return value;
+    }
+
+    switch (addr) {
+    case IRQ_MNGR_MASK_REG:
+        value = sim->irq_mask;
+        break;
+    case IRQ_MNGR_PENDING_REG:
+        value = sim->irq_pending;
+        break;
+    case SPISNIF_CONTROL_REG:
+        value = sim->control;
+        break;
+    case SPISNIF_FIFO_MOSI_REG:
+        value = sim_pop(sim->mosi, &sim->mosi_rd, sim->mosi_wr);
+        break;
+    case SPISNIF_FIFO_MISO_REG:
+        value = sim_pop(sim->miso, &sim->miso_rd, sim->miso_wr);
+        break;
+    case SPISNIF_FIFO_PACKET_REG:
+        value = sim_pop(sim->desc, &sim->desc_rd, sim->desc_wr);
+        sim_update_irq(sim);
+        break;
+    case SPISNIF_STATUS_REG:
+        packet_num = sim_packet_num(sim);
+        if (packet_num == 0)
+            value |= SPISNIF_STATUS_EMPTY;
+        if ((sim->desc_wr == SPISNIF_SIM_PACKET_SIZE) ||
+            (sim->pinfo_wr == SPISNIF_SIM_PINFO_SIZE))
+            value |= SPISNIF_STATUS_FULL;
+        if (sim->mxsx_full)
+            value |= SPISNIF_STATUS_MXSX_FULL;
+        value |= packet_num & SPISNIF_STATUS_PACKET_NUM;
+        break;
+    case SPISNIF_CONFIG_REG:
+        value = sim->config | (spisnif_sim_cs_bits(sim->cs_num) <<
+                               SPISNIF_CONFIG_CS_SHIFT);
+        if (sim->lanes > 1)
+            value |= SPISNIF_CONFIG_LANE_FLD;
+        if (sim->rle)
+            value |= SPISNIF_CONFIG_RLE;
+        break;
+    case SPISNIF_FIFO_PINFO_REG:
+        value = sim_pop(sim->pinfo, &sim->pinfo_rd, sim->pinfo_wr);
+        break;
+    case SPISNIF_ID_REG:
+        value = SPISNIF_SIM_ID;
+        break;
+    case SPISNIF_FILTER_CTRL_REG:
+        value = sim->filter_ctrl;
+        break;
+    case SPISNIF_FILTER_MATCH_REG:
+        value = sim->filter_match;
+        break;
+    case SPISNIF_FILTER_MASK_REG:
+        value = sim->filter_mask;
+        break;
+    case SPISNIF_CS_MASK_REG:
+        value = sim->cs_mask;
+        break;
+    case SPISNIF_LOSS_REG:
+        value = sim->loss_latched[sim->loss_idx];
+        sim->loss_idx = (sim->loss_idx + 1) % SPISNIF_LOSS_WORDS;
+        break;
+    }
+    sim_rewind_fifos(sim);
+
+    return value;
+}
+
+void spisnif_write(void *ptr_fpga, int addr, unsigned short value)
+{
+    struct spisnif_sim *sim = (struct spisnif_sim *)ptr_fpga;
+    int mode;
+
+    sim->reg_writes++;
+
+    switch (addr) {
+    case IRQ_MNGR_MASK_REG:
+        sim->irq_mask = value;
+        break;
+    case IRQ_MNGR_PENDING_REG:
+        /* write 1 to acknowledge */
+        sim->irq_pending &= ~value;
+        break;
+    case SPISNIF_CONTROL_REG:
+        /* loss_management: packets left in fifo_packet are lost */
+        if ((value & SPISNIF_RESET_FLG) &&
+            !(sim->control & SPISNIF_RESET_FLG)) {
+            sim->loss_packets += sim_packet_num(sim);
+            if (sim->loss_packets > 0xFFFF)
+                sim->loss_packets = 0xFFFF;
+        }
+        sim->control = value;
+        if (value & SPISNIF_RESET_FLG)
+            sim_reset_fifos(sim);
+        break;
+    case SPISNIF_CONFIG_REG:
+        sim->config = value & (SPISNIF_CONFIG_CSPOL | SPISNIF_CONFIG_CPHA |
+                               SPISNIF_CONFIG_CPOL);
+        /* modes beyond lanes generic stay single */
+        mode = (value & SPISNIF_CONFIG_LANES) >> SPISNIF_CONFIG_LANES_SHIFT;
+        if (((mode == 1) && (sim->lanes >= 2)) ||
+            ((mode == 2) && (sim->lanes >= 4)))
+            sim->config |= mode << SPISNIF_CONFIG_LANES_SHIFT;
+        break;
+    case SPISNIF_FILTER_CTRL_REG:
+        /* arms trigger again */
+        sim->filter_ctrl = value & ~(SPISNIF_FILTER_TRIGGERED |
+                                     SPISNIF_FILTER_DONE);
+        sim->trig_count = 0;
+        break;
+    case SPISNIF_FILTER_MATCH_REG:
+        sim->filter_match = value;
+        break;
+    case SPISNIF_FILTER_MASK_REG:
+        sim->filter_mask = value;
+        break;
+    case SPISNIF_CS_MASK_REG:
+        sim->cs_mask = value & 0xFF;
+        break;
+    case SPISNIF_LOSS_REG:
+        sim->loss_latched[0] = sim->loss_packets;
+        sim->loss_latched[1] = sim->loss_bits >> 16;
+        sim->loss_latched[2] = sim->loss_bits & 0xFFFF;
+        sim->loss_latched[3] = sim->loss_overflows;
+        sim->loss_latched[4] = sim->sck_min;
+        sim->loss_idx = 0;
+        if (value & SPISNIF_LOSS_CLEAR) {
+            sim->loss_packets = 0;
+            sim->loss_bits = 0;
+            sim->loss_overflows = 0;
+            sim->sck_min = SPISNIF_LOSS_NO_SCK;
+        }
+        break;
+    }
+
+    sim_update_irq(sim);
+}
@@ -0,0 +1,143 @@
+/* spisnif_sim.h
+ *
+ * host model of the spisnif component register map, with a synthetic SPI
+ * traffic generator, to run the capture code without an APF board
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#ifndef __SPISNIF_SIM_H__
+#define __SPISNIF_SIM_H__
+
+#include "frame_arena.h"
+#include "spisnif_regs.h"
+
+#define SPISNIF_SIM_ID          1
+
+#define SPISNIF_SIM_PACKET_SIZE \
+    (SPISNIF_FIFO_PACKET_RAM_SIZE*SPISNIF_FIFO_PACKET_RAM_NUM)
+#define SPISNIF_SIM_PINFO_SIZE  \
+    (SPISNIF_FIFO_PACKET_RAM_SIZE*SPISNIF_FIFO_PINFO_RAM_NUM)
+#define SPISNIF_SIM_MXSX_SIZE   (SPISNIF_FIFO_MXSX_SIZE*SPISNIF_FIFO_MXSX_NUM)
+
+/* Component state. Like the hdl fifos, write and read indexes do not wrap,
+ * they are rewound once empty. Pass it as ptr_fpga to the register
+ * accessors. */
+struct spisnif_sim {
+    /* registers */
+    unsigned short control;
+    unsigned short config;
+    unsigned short irq_mask;
+    unsigned short irq_pending;
+    int irq_line;
+    int irq_ack_lock;
+    unsigned short filter_ctrl;
+    unsigned short filter_match;
+    unsigned short filter_mask;
+    int trig_count;
+    unsigned short cs_mask;
+    /* cs_num generic, packet seq comes from CS seq % cs_num */
+    int cs_num;
+    /* lanes generic, CONFIG LANES modes above it stay single */
+    int lanes;
+    /* rle generic, lanes are stored run length encoded as fifo_mxsx
+     * does and packet info gets their stored words numbers */
+    int rle;
+
+    /* fifos */
+    unsigned short desc[SPISNIF_SIM_PACKET_SIZE];
+    int desc_wr, desc_rd;
+    unsigned short pinfo[SPISNIF_SIM_PINFO_SIZE];
+    int pinfo_wr, pinfo_rd;
+    unsigned short mosi[SPISNIF_SIM_MXSX_SIZE];
+    unsigned short miso[SPISNIF_SIM_MXSX_SIZE];
+    int mosi_wr, miso_wr, mosi_rd, miso_rd;
+    int mxsx_full;
+
+    /* LOSS counters, saturated, and their latched copy */
+    unsigned int loss_packets;
+    unsigned int loss_bits;
+    unsigned int loss_overflows;
+    unsigned int sck_min;       /* half gls_clk periods */
+    unsigned short loss_latched[SPISNIF_LOSS_WORDS];
+    int loss_idx;
+    int room_out;
+
+    /* stream window sequencing */
+    int stream_state;
+    int stream_count;
+    int stream_mosi_words, stream_miso_words;
+
+    /* traffic generator */
+    unsigned int timestamp;     /* gls_clk cycles */
+    unsigned int clk_per_bit;   /* sck period in gls_clk cycles */
+    unsigned int gap;           /* cycles between packets */
+    unsigned int seq;           /* generated packets */
+
+    /* statistics */
+    unsigned long long reg_reads;
+    unsigned long long reg_writes;
+    unsigned long long dropped;
+    unsigned long long filtered;
+    unsigned long long too_long;
+};
+
+void spisnif_sim_init(struct spisnif_sim *sim);
+
+/* push one packet of bit_num bits as captured on CS deassert, return -1
+ * and count it dropped if it overflows a fifo or too_long if its length
+ * does not fit the descriptor (both counted in LOSS), 1 and count it
+ * filtered if the packet filter or CS_MASK drops it */
+int spisnif_sim_push_packet(struct spisnif_sim *sim, int bit_num);
+/* push packet_num packets of spisnif_sim_bit_num() bits, return pushed */
+int spisnif_sim_generate(struct spisnif_sim *sim, int packet_num,
+                         int bit_min, int bit_max);
+
+/* irq manager pending and unmasked */
+int spisnif_sim_irq_pending(struct spisnif_sim *sim);
+
+/* bit length of generated packet seq, between bit_min and bit_max, even
+ * with quad lanes (2 bits per sck edge) */
+int spisnif_sim_bit_num(unsigned int seq, int bit_min, int bit_max,
+                        int lanes);
+
+/* byte n sent over dual or quad lanes by generated packet seq. One
+ * packet in two idles a lane after its first word (MOSI high as the dummy
+ * bytes of a read, or MISO low), bytes from 2 on then read 0xFF, so rle
+ * sees runs. */
+unsigned char spisnif_sim_byte(unsigned int seq, int n);
+/* word idx of lane (0 MOSI, 1 MISO) of generated packet seq, as stored in
+ * fifo_mxsx for bit_num bits. With 2 or 4 lanes, words hold the bits of
+ * spisnif_sim_byte() bytes as the lanes carry them. */
+unsigned short spisnif_sim_word(unsigned int seq, int lane, int idx,
+                                int bit_num, int lanes);
+/* 1 if generated packet seq passes an include or exclude filter (no
+ * trigger) set to ctrl, match and mask */
+int spisnif_sim_filter_hit(unsigned int seq, int bit_num, int lanes,
+                           unsigned short ctrl, unsigned short match,
+                           unsigned short mask);
+/* CS input of generated packet seq */
+int spisnif_sim_cs(unsigned int seq, int cs_num);
+/* CONFIG cs_bits of cs_num CS inputs */
+int spisnif_sim_cs_bits(int cs_num);
+/* compare frame data with generated packet seq, in frame lanes mode, 0
+ * when equal */
+int spisnif_sim_check_frame(const struct spi_frame *frame, unsigned int seq);
+
+#endif /* __SPISNIF_SIM_H__ */
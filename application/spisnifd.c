@@ -0,0 +1,695 @@
+/* spisnifd.c
+ *
+ * capture daemon for boards carrying several spisnif components: every
+ * instance bound to the spisnif driver is opened, its capture ring mapped
+ * and all of them are waited on with one epoll loop. Records of all
+ * instances are merged in hardware timestamp order before being printed,
+ * decoded or written to one pcapng file (one interface per instance).
+ *
+ * Instances count the same gls_clk from the same FPGA reset, so their
+ * ts_start counters can be compared. They wrap every 2^32 cycles (32 s at
+ * 133 MHz): they are extended to 64 bits with the host monotonic clock,
+ * which only has to be right to a few seconds.
+ *
+ * (c) Copyright 2013 The Armadeus Project - ARMadeus Systems
+ * Fabien Marteau <fabien.marteau@armadeus.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+
+/* driver records, before capture_file.h which shares their layout */
+#include "spisnif.h"
+#include "spisnif_capture.h"
+#include "capture_file.h"
+#include "spi_decoder.h"
+
+#define SPISNIFD_MAX_INSTANCES  CAPTURE_MAX_INTERFACES
+#define SPISNIFD_SYSFS_DRIVER   "/sys/bus/platform/drivers/spisnif"
+#define SPISNIFD_SYSFS_PARAMS   "/sys/module/spisnif/parameters"
+#define SPISNIFD_DEV_DIR        "/dev"
+/* records of an instance wait this long for older ones of the others */
+#define SPISNIFD_WINDOW_MS      50
+
+struct spisnifd_instance {
+    char name[32];          /* platform device, spisnif.N */
+    char path[64];          /* char device node */
+    unsigned int major;
+    unsigned int minor;
+    int fd;
+    struct spisnif_ring_header *ring;
+    size_t map_size;
+    int interface;          /* pcapng interface id */
+    /* oldest record left in the ring and its extended ts_start, the ring
+     * is the merge queue of the instance */
+    struct spisnif_record *head;
+    unsigned long long head_ts;
+    int released;           /* records given back since last pass */
+    struct spi_decode_ctx decode;
+    int decode_init;
+    unsigned short mosi[FRAME_MAX_LANE_WORDS];
+    unsigned short miso[FRAME_MAX_LANE_WORDS];
+    unsigned long long records;
+    unsigned long long bits;
+    unsigned long long lost_packets;
+    unsigned long long lost_bits;
+    unsigned long long overflows;
+    unsigned long long dropped_records;
+    unsigned long long bad_records;
+};
+
+struct spisnifd {
+    struct spisnifd_instance inst[SPISNIFD_MAX_INSTANCES];
+    int inst_num;
+    double clk_per_ns;
+    unsigned long long window;  /* clk cycles */
+    /* last extended timestamp and its host CLOCK_MONOTONIC time */
+    int anchored;
+    unsigned long long anchor_hw;
+    unsigned long long anchor_ns;
+    /* CLOCK_REALTIME of first anchor, to stamp file blocks */
+    unsigned long long epoch_hw;
+    unsigned long long epoch_ns;
+    /* last merged record, later ones older than it came out of order */
+    unsigned long long last_ts;
+    unsigned long long merged;
+    unsigned long long disordered;
+    int print_frames;
+    struct capture_file *cf;
+};
+
+static int keepRunning = 1;
+
+void intHandler(int dummy) {
+    keepRunning = 0;
+}
+
+static unsigned long long clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/* first line of a sysfs file, without its newline */
+static int read_sysfs(const char *path, char *buf, size_t size)
+{
+    FILE *f;
+    char *nl;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    if (fgets(buf, size, f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    nl = strchr(buf, '\n');
+    if (nl != NULL)
+        *nl = '\0';
+    return 0;
+}
+
+static long read_param(const char *name, long def)
+{
+    char path[128], value[32];
+
+    snprintf(path, sizeof(path), "%s/%s", SPISNIFD_SYSFS_PARAMS, name);
+    if (read_sysfs(path, value, sizeof(value)) < 0) {
+        printf("Warning: can't read %s, using %ld\n", path, def);
+        return def;
+    }
+    return strtol(value, NULL, 0);
+}
+
+static int compare_instances(const void *a, const void *b)
+{
+    const struct spisnifd_instance *ia = a, *ib = b;
+
+    return atoi(ia->name + 8) - atoi(ib->name + 8);
+}
+
+static int wanted(const char *name, char **names, int name_num)
+{
+    int i;
+
+    if (name_num == 0)
+        return 1;
+    for (i = 0; i < name_num; i++)
+        if (strcmp(name, names[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* instances bound to the driver, all of them or those named */
+static int spisnifd_discover(struct spisnifd *d, char **names, int name_num)
+{
+    struct spisnifd_instance *inst;
+    struct dirent *entry;
+    char path[128], value[32];
+    DIR *dir;
+
+    dir = opendir(SPISNIFD_SYSFS_DRIVER);
+    if (dir == NULL) {
+        printf("can't open %s: %s, is spisnif driver loaded?\n",
+               SPISNIFD_SYSFS_DRIVER, strerror(errno));
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strncmp(entry->d_name, "spisnif.", 8) != 0) ||
+            (strlen(entry->d_name) >= sizeof(inst->name)) ||
+            !wanted(entry->d_name, names, name_num))
+            continue;
+        if (d->inst_num == SPISNIFD_MAX_INSTANCES) {
+            printf("Warning: only %d instances captured\n",
+                   SPISNIFD_MAX_INSTANCES);
+            break;
+        }
+
+        inst = &d->inst[d->inst_num];
+        snprintf(path, sizeof(path), "%s/%.31s/dev_number",
+                 SPISNIFD_SYSFS_DRIVER, entry->d_name);
+        if ((read_sysfs(path, value, sizeof(value)) < 0) ||
+            (sscanf(value, "%u:%u", &inst->major, &inst->minor) != 2)) {
+            printf("Warning: no device number for %s\n", entry->d_name);
+            continue;
+        }
+        snprintf(inst->name, sizeof(inst->name), "%.31s", entry->d_name);
+        snprintf(inst->path, sizeof(inst->path), "%s/%.31s",
+                 SPISNIFD_DEV_DIR, entry->d_name);
+        d->inst_num++;
+    }
+    closedir(dir);
+
+    if (d->inst_num == 0) {
+        printf("no spisnif instance found\n");
+        return -1;
+    }
+    if (d->inst_num < name_num)
+        printf("Warning: %d of %d instances found\n", d->inst_num, name_num);
+
+    /* interfaces follow instance numbers */
+    qsort(d->inst, d->inst_num, sizeof(struct spisnifd_instance),
+          compare_instances);
+    return 0;
+}
+
+/* the driver does not create nodes: make or fix /dev/spisnif.N */
+static int spisnifd_node(struct spisnifd_instance *inst)
+{
+    dev_t devt = makedev(inst->major, inst->minor);
+    struct stat st;
+
+    if (stat(inst->path, &st) == 0) {
+        if (S_ISCHR(st.st_mode) && (st.st_rdev == devt))
+            return 0;
+        if (unlink(inst->path) < 0) {
+            printf("can't remove stale %s: %s\n", inst->path, strerror(errno));
+            return -1;
+        }
+    }
+    if (mknod(inst->path, S_IFCHR|0600, devt) < 0) {
+        printf("can't create %s: %s\n", inst->path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int spisnifd_open(struct spisnifd_instance *inst, size_t map_size)
+{
+    void *map;
+
+    if (spisnifd_node(inst) < 0)
+        return -1;
+
+    inst->fd = open(inst->path, O_RDONLY|O_NONBLOCK);
+    if (inst->fd < 0) {
+        printf("can't open %s: %s\n", inst->path, strerror(errno));
+        return -1;
+    }
+
+    /* records go to the ring from now on */
+    map = mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, inst->fd, 0);
+    if (map == MAP_FAILED) {
+        printf("can't map %s ring: %s\n", inst->path, strerror(errno));
+        goto close_fd;
+    }
+    inst->ring = (struct spisnif_ring_header *)map;
+    inst->map_size = map_size;
+    if (inst->ring->magic != SPISNIF_RING_MAGIC) {
+        printf("%s: bad ring magic %08X\n", inst->path, inst->ring->magic);
+        goto unmap;
+    }
+    return 0;
+
+unmap:
+    munmap(map, map_size);
+    inst->ring = NULL;
+close_fd:
+    close(inst->fd);
+    inst->fd = -1;
+    return -1;
+}
+
+static void spisnifd_close(struct spisnifd_instance *inst)
+{
+    if (inst->decode_init)
+        spi_decode_free(&inst->decode);
+    if (inst->ring != NULL)
+        munmap(inst->ring, inst->map_size);
+    if (inst->fd >= 0)
+        close(inst->fd);
+}
+
+/* counter value now, as predicted from last anchor */
+static unsigned long long spisnifd_hw_now(struct spisnifd *d,
+                                          unsigned long long now_ns)
+{
+    return d->anchor_hw +
+           (unsigned long long)((now_ns - d->anchor_ns)*d->clk_per_ns);
+}
+
+/* 64 bits value of a counter read at now_ns: the one closest to the
+ * prediction. Records reach the ring a drain latency after ts_start, far
+ * less than half a wrap. */
+static unsigned long long spisnifd_extend(struct spisnifd *d,
+                                          unsigned int ts32,
+                                          unsigned long long now_ns)
+{
+    unsigned long long pred, ts;
+
+    if (!d->anchored) {
+        d->anchored = 1;
+        d->anchor_hw = d->epoch_hw = ts32;
+        d->anchor_ns = now_ns;
+        d->epoch_ns = clock_ns(CLOCK_REALTIME);
+        return ts32;
+    }
+
+    pred = spisnifd_hw_now(d, now_ns);
+    ts = (pred & ~0xFFFFFFFFULL) | ts32;
+    if ((ts > pred + 0x80000000ULL) && (ts >= 0x100000000ULL))
+        ts -= 0x100000000ULL;
+    else if (ts + 0x80000000ULL < pred)
+        ts += 0x100000000ULL;
+
+    /* host and FPGA clocks drift apart, follow the counter */
+    if (ts > d->anchor_hw) {
+        d->anchor_hw = ts;
+        d->anchor_ns = now_ns;
+    }
+    return ts;
+}
+
+/* file timestamp of a counter value, monotonic with it */
+static void spisnifd_file_ts(struct spisnifd *d, unsigned long long hw,
+                             struct timespec *ts)
+{
+    long long delta_ns = (long long)(hw - d->epoch_hw)/d->clk_per_ns;
+    unsigned long long ns = d->epoch_ns + delta_ns;
+
+    ts->tv_sec = ns/1000000000ULL;
+    ts->tv_nsec = ns%1000000000ULL;
+}
+
+/* loss marker: counted, logged, and reported in the file at the time of
+ * last merged record */
+static int spisnifd_loss(struct spisnifd *d, struct spisnifd_instance *inst,
+                         const struct spisnif_record *rec)
+{
+    struct spisnif_loss loss;
+    struct spi_frame_list flist;
+
+    if (rec->mosi_words*2 < sizeof(loss)) {
+        inst->bad_records++;
+        return 0;
+    }
+    memcpy(&loss, rec + 1, sizeof(loss));
+    inst->lost_packets += loss.packets;
+    inst->lost_bits += loss.bits;
+    inst->overflows += loss.overflows;
+    inst->dropped_records += loss.records;
+
+    if (d->print_frames)
+        printf("%s: %u packets lost (%u bits), %u overflows, %u records dropped\n",
+               inst->name, loss.packets, loss.bits, loss.overflows,
+               loss.records);
+
+    if (d->cf == NULL)
+        return 0;
+    memset(&flist, 0, sizeof(flist));
+    /* records dropped by the driver are lost packets too */
+    flist.loss.packets = loss.packets + loss.records;
+    flist.loss.bits = loss.bits;
+    flist.loss.overflows = loss.overflows;
+    spisnifd_file_ts(d, d->last_ts, &flist.ts);
+    return capture_file_write_frames_on(d->cf, inst->interface, &flist,
+                                        &flist.ts);
+}
+
+/* oldest packet record of instance, NULL if its ring is empty */
+static struct spisnif_record *spisnifd_head(struct spisnifd *d,
+                                            struct spisnifd_instance *inst,
+                                            unsigned long long now_ns)
+{
+    struct spisnif_record *rec;
+
+    while (inst->head == NULL) {
+        rec = spisnif_ring_peek(inst->ring);
+        if (rec == NULL)
+            return NULL;
+        if (rec->flags & SPISNIF_RECORD_LOSS) {
+            if (spisnifd_loss(d, inst, rec) < 0)
+                keepRunning = 0;
+            spisnif_ring_release(inst->ring, rec);
+            inst->released++;
+            continue;
+        }
+        inst->head = rec;
+        inst->head_ts = spisnifd_extend(d, rec->ts_start, now_ns);
+    }
+    return inst->head;
+}
+
+/* print, decode and write head record of instance then release it */
+static int spisnifd_emit(struct spisnifd *d, struct spisnifd_instance *inst)
+{
+    struct spisnif_record *rec = inst->head;
+    unsigned short *src = (unsigned short *)(rec + 1);
+    struct spi_frame frame;
+    struct spi_frame_list flist;
+    int ret = 0, words;
+
+    words = rec->bit_num ? FRAME_WORDS(rec->bit_num) : 0;
+    frame.bit_num = rec->bit_num;
+    frame.cs = SPISNIF_RECORD_CS(rec);
+    frame.lanes = SPISNIF_RECORD_LANES(rec);
+    frame.ts_start = rec->ts_start;
+    frame.ts_end = rec->ts_end;
+    frame.rle = 0;
+    frame.mosi_words = words;
+    frame.miso_words = words;
+    if (rec->flags & SPISNIF_RECORD_RLE) {
+        if ((spisnif_rle_expand(inst->mosi, words, src,
+                                rec->mosi_words) < 0) ||
+            (spisnif_rle_expand(inst->miso, words, src + rec->mosi_words,
+                                rec->miso_words) < 0)) {
+            inst->bad_records++;
+            goto release;
+        }
+        frame.mosi = inst->mosi;
+        frame.miso = inst->miso;
+    } else {
+        frame.mosi = src;
+        frame.miso = src + rec->mosi_words;
+    }
+
+    memset(&flist, 0, sizeof(flist));
+    flist.frame_num = 1;
+    flist.frames = &frame;
+    spisnifd_file_ts(d, inst->head_ts, &flist.ts);
+
+    if (inst->head_ts < d->last_ts)
+        d->disordered++;
+    else
+        d->last_ts = inst->head_ts;
+    d->merged++;
+    inst->records++;
+    inst->bits += rec->bit_num;
+
+    if (d->print_frames) {
+        printf("%s ", inst->name);
+        print_frame_list(&flist);
+    }
+    if (inst->decode_init)
+        spi_decode_frames(&inst->decode, &flist);
+    if (d->cf != NULL)
+        ret = capture_file_write_frames_on(d->cf, inst->interface, &flist,
+                                           &flist.ts);
+
+release:
+    spisnif_ring_release(inst->ring, rec);
+    inst->head = NULL;
+    inst->released++;
+    return ret;
+}
+
+/* Emit records in timestamp order while the oldest head is safe: every
+ * instance has a newer one queued, or it is older than the window and a
+ * late record of another instance would have reached its ring by now.
+ * flush emits everything left. */
+static int spisnifd_merge(struct spisnifd *d, int flush)
+{
+    struct spisnifd_instance *inst, *oldest;
+    struct pollfd pfd;
+    unsigned long long now_ns;
+    int i, all;
+
+    for (;;) {
+        now_ns = clock_ns(CLOCK_MONOTONIC);
+        oldest = NULL;
+        all = 1;
+        for (i = 0; i < d->inst_num; i++) {
+            inst = &d->inst[i];
+            if (spisnifd_head(d, inst, now_ns) == NULL)
+                all = 0;
+            else if ((oldest == NULL) || (inst->head_ts < oldest->head_ts))
+                oldest = inst;
+        }
+        if (oldest == NULL)
+            break;
+        if (!all && !flush &&
+            (oldest->head_ts + d->window > spisnifd_hw_now(d, now_ns)))
+            break;
+        if (spisnifd_emit(d, oldest) < 0)
+            return -1;
+    }
+
+    /* the driver resumes a dma drain stalled on a full ring from poll(),
+     * which epoll only calls on wake ups */
+    for (i = 0; i < d->inst_num; i++) {
+        inst = &d->inst[i];
+        if (!inst->released)
+            continue;
+        inst->released = 0;
+        pfd.fd = inst->fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, 0);
+    }
+    return 0;
+}
+
+static int spisnifd_waiting(struct spisnifd *d)
+{
+    int i;
+
+    for (i = 0; i < d->inst_num; i++)
+        if (d->inst[i].head != NULL)
+            return 1;
+    return 0;
+}
+
+static void spisnifd_transaction(const struct spi_transaction *trans,
+                                 void *arg)
+{
+    struct spisnifd_instance *inst = arg;
+
+    printf("%s ", inst->name);
+    spi_transaction_print(trans, NULL);
+}
+
+void print_usage()
+{
+        printf("Merge captures of all spisnif instances:\n");
+        printf("$ spisnifd [-p] [-D decoder[:cs]] [-w file.pcapng [-d]] [-W ms] [spisnif.N ...]\n");
+        printf("        -p       print frames, prefixed by their instance\n");
+        printf("        -D name  print transactions decoded by name, of CS cs\n");
+        printf("                 only with :cs, among:\n");
+        spi_decoder_list();
+        printf("        -w file  log frames to pcapng file, one interface per\n");
+        printf("                 instance\n");
+        printf("        -d       write file with O_DIRECT\n");
+        printf("        -W ms    reorder window (default %d)\n",
+               SPISNIFD_WINDOW_MS);
+        printf("        spisnif.N  instances to capture, all by default\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct spisnifd d;
+    struct spisnifd_instance *inst;
+    struct epoll_event ev, events[SPISNIFD_MAX_INSTANCES];
+    const char *names[SPISNIFD_MAX_INSTANCES];
+    const struct spi_decoder *decoder = NULL;
+    char decoder_name[16];
+    int decoder_cs = -1;
+    char *capture_path = NULL;
+    int capture_direct = 0;
+    int window_ms = SPISNIFD_WINDOW_MS;
+    long ring_size, page_size;
+    int epfd = -1;
+    int i, n, opt, ret = -1;
+
+    while ((opt = getopt(argc, argv, "pD:w:dW:")) != -1) {
+        switch (opt) {
+        case 'p':
+            d.print_frames = 1;
+            break;
+        case 'D':
+            if (sscanf(optarg, "%15[^:]:%d", decoder_name, &decoder_cs) < 1) {
+                print_usage();
+                return -1;
+            }
+            decoder = spi_decoder_find(decoder_name);
+            if (decoder == NULL) {
+                print_usage();
+                return -1;
+            }
+            break;
+        case 'w':
+            capture_path = optarg;
+            break;
+        case 'd':
+            capture_direct = 1;
+            break;
+        case 'W':
+            window_ms = atoi(optarg);
+            if (window_ms < 1) {
+                print_usage();
+                return -1;
+            }
+            break;
+        default:
+            print_usage();
+            return -1;
+        }
+    }
+
+    for (i = 0; i < SPISNIFD_MAX_INSTANCES; i++)
+        d.inst[i].fd = -1;
+    if (spisnifd_discover(&d, argv + optind, argc - optind) < 0)
+        return -1;
+
+    d.clk_per_ns = read_param("clk_rate", 133000000)/1e9;
+    d.window = window_ms*1000000ULL*d.clk_per_ns;
+    /* the driver only maps the whole ring */
+    ring_size = read_param("ring_size", 64*1024);
+    page_size = sysconf(_SC_PAGESIZE);
+    ring_size = (ring_size + page_size - 1) & ~(page_size - 1);
+
+    signal(SIGINT, intHandler);
+    signal(SIGTERM, intHandler);
+
+    epfd = epoll_create(SPISNIFD_MAX_INSTANCES);
+    if (epfd < 0) {
+        printf("can't create epoll instance: %s\n", strerror(errno));
+        goto close;
+    }
+
+    for (i = 0; i < d.inst_num; i++) {
+        inst = &d.inst[i];
+        if (spisnifd_open(inst, page_size + ring_size) < 0)
+            goto close;
+        inst->interface = i;
+        names[i] = inst->name;
+
+        /* the driver wakes readers after each drain leaving records */
+        ev.events = EPOLLIN|EPOLLET;
+        ev.data.ptr = inst;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, inst->fd, &ev) < 0) {
+            printf("can't watch %s: %s\n", inst->path, strerror(errno));
+            goto close;
+        }
+
+        if (decoder != NULL) {
+            if (spi_decode_init(&inst->decode, decoder, decoder_cs,
+                                spisnifd_transaction, inst) < 0)
+                goto close;
+            inst->decode_init = 1;
+        }
+        printf("%s: %s, %u:%u\n", inst->name, inst->path, inst->major,
+               inst->minor);
+    }
+
+    if (capture_path != NULL) {
+        d.cf = capture_file_open_interfaces(capture_path, capture_direct,
+                                            names, d.inst_num);
+        if (d.cf == NULL)
+            goto close;
+    }
+
+    printf("Merging %d instances, %d ms window ...\n", d.inst_num, window_ms);
+    ret = 0;
+    while (keepRunning) {
+        /* wake up to merge held records once their window is over */
+        n = epoll_wait(epfd, events, SPISNIFD_MAX_INSTANCES,
+                       spisnifd_waiting(&d) ? window_ms : -1);
+        if ((n < 0) && (errno != EINTR)) {
+            printf("epoll_wait error: %s\n", strerror(errno));
+            ret = -1;
+            break;
+        }
+        if (spisnifd_merge(&d, 0) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    if ((ret == 0) && (spisnifd_merge(&d, 1) < 0))
+        ret = -1;
+
+    printf("%llu records merged", d.merged);
+    if (d.disordered)
+        printf(", %llu out of order (window too short)", d.disordered);
+    fputc('\n', stdout);
+    for (i = 0; i < d.inst_num; i++) {
+        inst = &d.inst[i];
+        printf("%s: %llu records, %llu bits, %llu packets lost (%llu bits), "
+               "%llu overflows, %llu records dropped",
+               inst->name, inst->records, inst->bits, inst->lost_packets,
+               inst->lost_bits, inst->overflows, inst->dropped_records);
+        if (inst->bad_records)
+            printf(", %llu malformed", inst->bad_records);
+        fputc('\n', stdout);
+    }
+
+    if ((d.cf != NULL) && (capture_file_close(d.cf) < 0))
+        ret = -1;
+close:
+    for (i = 0; i < d.inst_num; i++)
+        spisnifd_close(&d.inst[i]);
+    if (epfd >= 0)
+        close(epfd);
+    return ret;
+}
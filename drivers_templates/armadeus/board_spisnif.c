@@ -36,7 +36,7 @@ static struct resource /*$instance_name$*/_resources[] = {
 	[0] = {
 		.start = ARMADEUS_FPGA_BASE_ADDR + /*$instance_name$*/_BASE,
 		.end = ARMADEUS_FPGA_BASE_ADDR + /*$instance_name$*/_BASE + 0x1F,
-		.flags	= IORESOURCE_MEM,
+		.flags	= IORESOURCE_MEM | IORESOURCE_MEM_16BIT,
 	},
 	[1] = {
 		.start	= IRQ_FPGA(/*$interrupt_number$*/),
@@ -30,76 +30,841 @@
 #include <linux/cdev.h>
 #include <linux/wait.h>
 #include <linux/irq.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
 
 #include <mach/hardware.h>
 #include <mach/fpga.h>
 
+#include "spisnif.h"
+
 #define DRIVER_NAME	"spisnif"
 
-#define SPISNIF_RAMSIZE	1024
+/* words of fifo_mxsx (fifo_mosi_size*fifo_mosi_num) */
+#define SPISNIF_MXSX_WORDS	1024
+/* STATUS packet_num field */
+#define SPISNIF_PACKET_NUM_MAX	0x07FF
+/* stream window packet head: descriptor then start and end timestamps,
+ * msw first */
+#define SPISNIF_STREAM_HEAD_WORDS	5
+/* same on 32 bits wishbone: descriptor, start and end timestamps */
+#define SPISNIF_STREAM32_HEAD_WORDS	3
+/* rle adds MOSI and MISO stored words numbers, one read on 32 bits */
+#define SPISNIF_STREAM_RLE_WORDS	2
+#define SPISNIF_STREAM32_RLE_WORDS	1
+/* STATUS reads in one irq when packets keep coming during the drain */
+#define SPISNIF_DRAIN_LOOPS	4
+/* us to wait for a bank swap, done at the end of current packet */
+#define SPISNIF_SWAP_TIMEOUT_US	1000
+/* us to wait for the dma engine to finish the packet being copied */
+#define SPISNIF_DMA_STOP_TIMEOUT_US	1000
+/* largest record drained, room checked before each dma ring packet */
+#define SPISNIF_RECORD_MAX	(sizeof(struct spisnif_record) + \
+				 2*2*SPISNIF_MXSX_WORDS)
+
+/* interrupt coalescing defaults */
+#define SPISNIF_IRQ_PNUM_MAX		64
+#define SPISNIF_IRQ_MAX_LATENCY_MS	10
+
+/* irq to drain latency histogram: bucket n counts latencies from 2^n us
+ * to 2^(n+1) us, first one from 0, last one up to any */
+#define SPISNIF_LATENCY_BUCKETS	16
+
+#define SPISNIF_WORDS(bit_num)	((bit_num) ? ((bit_num) - 1)/16 + 1 : 0)
 
 /* masks */
-#define SPISNIF_CONTROL_MASK_ACK_FIFO	(0x8000)
-#define SPISNIF_CONTROL_MASK_OS		(0x01C0)
-#define SPISNIF_CONTROL_MASK_EXT_TRIG_NUM	(0x003E)
-#define SPISNIF_CONTROL_MASK_EXT_TRIG_INV	(0x0200)
-#define SPISNIF_CONTROL_MASK_TRIGGER	(0x0001)
-
-#define SPISNIF_STATUS_MASK_FEMPTY6	(1<<13)
-#define SPISNIF_STATUS_MASK_FEMPTY5	(1<<12)
-#define SPISNIF_STATUS_MASK_FEMPTY4	(1<<11)
-#define SPISNIF_STATUS_MASK_FEMPTY3	(1<<10)
-#define SPISNIF_STATUS_MASK_FEMPTY2	(1<<9)
-#define SPISNIF_STATUS_MASK_FEMPTY1	(1<<8)
-#define SPISNIF_STATUS_MASK_RUN		(0x2)
-#define SPISNIF_STATUS_MASK_PFIFOFULL	(0x1)
-
-/* registers addresses */
-#define SPISNIF_REG_CONTROL	(2*0x00)
-#define SPISNIF_REG_STATUS	(2*0x01)
-#define SPISNIF_REG_PRESCALER	(2*0x02)
-
-#define SPISNIF_REG_FIFO_V1	(2*0x04)
-#define SPISNIF_REG_FIFO_V2	(2*0x05)
-#define SPISNIF_REG_FIFO_V3	(2*0x06)
-#define SPISNIF_REG_FIFO_V4	(2*0x07)
-#define SPISNIF_REG_FIFO_V5	(2*0x08)
-#define SPISNIF_REG_FIFO_V6	(2*0x09)
-
-#define SPISNIF_REG_FIFO_SIZE_0	(2*0x0c)
-#define SPISNIF_REG_FIFO_SIZE_1	(2*0x0d)
-#define SPISNIF_REG_DEBUG		(2*0x0e)
-#define SPISNIF_REG_ID		(2*0x0f)
-
+#define SPISNIF_CONTROL_MASK_RESET		(0x8000)
+#define SPISNIF_CONTROL_MASK_IRQ_ACK		(0x4000)
+#define SPISNIF_CONTROL_MASK_SWAP		(0x2000)
+/* written as pulses, never written back */
+#define SPISNIF_CONTROL_MASK_PULSES	(SPISNIF_CONTROL_MASK_RESET | \
+					 SPISNIF_CONTROL_MASK_IRQ_ACK | \
+					 SPISNIF_CONTROL_MASK_SWAP)
+#define SPISNIF_CONTROL_MASK_IRQ_PNUM_TRIG	(0x07FF)
+
+#define SPISNIF_STATUS_MASK_FIFO_EMPTY		(1<<15)
+#define SPISNIF_STATUS_MASK_FIFO_FULL		(1<<14)
+#define SPISNIF_STATUS_MASK_MXSX_FULL		(1<<13)
+#define SPISNIF_STATUS_MASK_BANK		(1<<12)
+#define SPISNIF_STATUS_MASK_PING_PONG		(1<<11)
+#define SPISNIF_STATUS_MASK_PACKET_NUM		(0x07FF)
+
+#define SPISNIF_DMA_MASK_ENABLE		(1<<15)
+#define SPISNIF_DMA_MASK_BUSY		(1<<14)
+/* DMA_DATA indexes of 32 bits values, read and written msw first */
+#define SPISNIF_DMA_BASE		0
+#define SPISNIF_DMA_SIZE		2
+#define SPISNIF_DMA_WR			4
+#define SPISNIF_DMA_RD			6
+
+#define SPISNIF_LOSS_MASK_CLEAR		(1<<15)
+/* LOSS reads after a latch: packets, bits msw and lsw, overflows, and
+ * shortest sck period in half component clock periods */
+#define SPISNIF_LOSS_WORDS		5
+#define SPISNIF_LOSS_NO_SCK		(0xFFFF)
+
+#define SPISNIF_FILTER_MASK_ENABLE	(1<<15)
+#define SPISNIF_FILTER_MASK_EXCLUDE	(1<<14)
+#define SPISNIF_FILTER_MASK_TRIGGER	(1<<13)
+#define SPISNIF_FILTER_MASK_TRIGGERED	(1<<12)
+#define SPISNIF_FILTER_MASK_DONE	(1<<11)
+#define SPISNIF_FILTER_MASK_POST	(0x07FF)
+
+#define SPISNIF_CONFIG_MASK_DMA	(0x2000)
+#define SPISNIF_CONFIG_MASK_DDR	(0x1000)
+#define SPISNIF_CONFIG_MASK_DELAY	(0x0C00)
+#define SPISNIF_CONFIG_MASK_LANE_FLD	(0x0200)
+#define SPISNIF_CONFIG_MASK_LANES	(0x0180)
+#define SPISNIF_CONFIG_MASK_CS_BITS	(0x0070)
+#define SPISNIF_CONFIG_MASK_RLE	(0x0008)
+#define SPISNIF_CONFIG_MASK_CSPOL	(0x0004)
+#define SPISNIF_CONFIG_MASK_CPHA	(0x0002)
+#define SPISNIF_CONFIG_MASK_CPOL	(0x0001)
+
+/* registers numbers, shifted by bus width for addresses */
+#define SPISNIF_REG_CONTROL	(0x00)
+#define SPISNIF_REG_FIFO_MOSI	(0x01)
+#define SPISNIF_REG_FIFO_MISO	(0x02)
+#define SPISNIF_REG_FIFO_PACKET	(0x03)
+#define SPISNIF_REG_STATUS	(0x04)
+#define SPISNIF_REG_CONFIG	(0x05)
+#define SPISNIF_REG_FIFO_PINFO	(0x06)
+#define SPISNIF_REG_ID		(0x07)
+/* 0x08 to 0x0A all alias the stream window, 0x08 only with dma */
+#define SPISNIF_REG_STREAM	(0x08)
+#define SPISNIF_REG_DMA_CTRL	(0x09)
+#define SPISNIF_REG_DMA_DATA	(0x0A)
+#define SPISNIF_REG_LOSS	(0x0B)
+#define SPISNIF_REG_FILTER_CTRL	(0x0C)
+#define SPISNIF_REG_FILTER_MATCH	(0x0D)
+#define SPISNIF_REG_FILTER_MASK	(0x0E)
+#define SPISNIF_REG_CS_MASK	(0x0F)
+
+/* records ring size in bytes, rounded to a power of 2 by kfifo and to
+ * pages for mmap() */
+static int ring_size = 64*1024;
+module_param(ring_size, int, S_IRUGO);
+MODULE_PARM_DESC(ring_size, "size in bytes of the capture ring buffers");
+
+/* memory ring the dma engine copies packets to, 0 drains through the
+ * stream window */
+static int dma_size = 1024*1024;
+module_param(dma_size, int, S_IRUGO);
+MODULE_PARM_DESC(dma_size, "size in bytes of the dma ring (dma generic)");
+
+/* component clock, to convert measured sck periods */
+static int clk_rate = 133000000;
+module_param(clk_rate, int, S_IRUGO);
+MODULE_PARM_DESC(clk_rate, "component clock rate in Hz");
 
 struct spisnif_chip {
 	struct resource		*resource_mem;
 	struct resource		*resource_irq;
 	struct platform_device	*pdev;
 	void __iomem		*reg_base;
+	/* 1 on wishbone16, 2 on wishbone32 (IORESOURCE_MEM_32BIT) */
+	int			reg_shift;
+	/* CONFIG rle: fifo_mxsx words are run length encoded */
+	int			rle;
+	/* CONFIG cs_bits: CS index width in descriptor msb */
+	int			cs_bits;
+	/* CONFIG lanes field: 2 bits lanes mode under CS index */
+	int			lane_bits;
 	/* cdev structures */
 	struct cdev		cdev;
 	dev_t			devt;
 	int			cdev_open;
-	/* interrupts */
-	int			irq_occur;
+	/* capture ring, filled by irq thread, emptied by read() */
+	struct kfifo		fifo;
+	struct mutex		read_lock;
 	wait_queue_head_t	wait_queue;
-
+	struct mutex		drain_lock;
+	/* mmap() ring, used instead of fifo while mapped. The header page is
+	 * writable by userspace: records area and head are only kept here and
+	 * published to it, tail is the only field read back. */
+	struct spisnif_ring_header	*ring;
+	unsigned long		ring_map_size;
+	int			ring_maps;
+	u8			*ring_data;
+	u32			ring_data_size;
+	u32			ring_head;
+	/* one record being queued */
+	struct spisnif_record	*drain_buf;
+	/* wishbone32 stream reads, MISO word in msb and MOSI word in lsb */
+	u32			*pair_buf;
+	/* dma ring, written by the component up to its write offset,
+	 * dma_avail bytes are left to drain after dma_rd */
+	void			*dma_buf;
+	dma_addr_t		dma_handle;
+	u32			dma_size;
+	u32			dma_rd;
+	u32			dma_avail;
+	/* last drain left packets in the dma ring for lack of room */
+	int			dma_stalled;
+	unsigned long		dropped_records;
+	/* LOSS counters totals, and losses not queued as a marker yet */
+	unsigned long long	lost_packets;
+	unsigned long long	lost_bits;
+	unsigned long		fifo_overflows;
+	struct spisnif_loss	loss;
+	/* shortest sck period of last drain with traffic, in half component
+	 * clock periods, 0 before any */
+	u16			sck_period;
+	/* interrupt coalescing: irq_pnum_trig follows packet rate between
+	 * 1 and irq_pnum_max, flush_timer drains partial batches */
+	int			irq_coalesce;
+	int			irq_pnum_trig;
+	int			irq_pnum_max;
+	int			irq_max_latency;	/* ms */
+	struct timer_list	flush_timer;
+	struct work_struct	flush_work;
+	/* set at remove, under drain_lock and flush_lock: the timer is not
+	 * armed nor the work scheduled any more */
+	int			shutdown;
+	spinlock_t		flush_lock;
+	/* capture statistics, updated under drain_lock. Counters only grow,
+	 * high water marks and histogram are cleared by stats_reset */
+	unsigned long long	captured_packets;
+	unsigned long long	captured_bits;
+	unsigned long		drains;
+	unsigned long long	drain_time_total;	/* us */
+	u32			drain_time_max;		/* us */
+	int			fifo_high_water;	/* STATUS packet_num */
+	u32			dma_high_water;		/* dma ring bytes */
+	u32			ring_high_water;	/* capture ring bytes */
+	ktime_t			irq_time;
+	unsigned long		irq_latency[SPISNIF_LATENCY_BUCKETS];
 };
 
-/* wishbone16 accesses */
+/* wishbone16 or wishbone32 accesses, registers are 16 bits wide on both */
 static u16 ad_read_reg(const struct spisnif_chip *ad_chip, int reg)
 {
-	return ioread16(ad_chip->reg_base + reg);
+	if (ad_chip->reg_shift == 2)
+		return ioread32(ad_chip->reg_base + (reg << 2)) & 0xFFFF;
+
+	return ioread16(ad_chip->reg_base + (reg << 1));
 }
 
 static void ad_write_reg(const struct spisnif_chip *ad_chip, int reg, u16 value)
 {
-	iowrite16(value, ad_chip->reg_base + reg);
+	if (ad_chip->reg_shift == 2)
+		iowrite32(value, ad_chip->reg_base + (reg << 2));
+	else
+		iowrite16(value, ad_chip->reg_base + (reg << 1));
+}
+
+static void ad_pulse_control(const struct spisnif_chip *ad_chip, u16 mask)
+{
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL) &
+			~SPISNIF_CONTROL_MASK_PULSES;
+
+	ad_write_reg(ad_chip, SPISNIF_REG_CONTROL, reg_value | mask);
+	ad_write_reg(ad_chip, SPISNIF_REG_CONTROL, reg_value);
+}
+
+static void spisnif_set_irq_pnum_trig(struct spisnif_chip *ad_chip, int trig)
+{
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
+
+	reg_value &= ~(SPISNIF_CONTROL_MASK_PULSES |
+		       SPISNIF_CONTROL_MASK_IRQ_PNUM_TRIG);
+	ad_write_reg(ad_chip, SPISNIF_REG_CONTROL, reg_value | trig);
+	ad_chip->irq_pnum_trig = trig;
+}
+
+/* DMA_CTRL selects the DMA_DATA word, keeping the engine enable bit */
+static void spisnif_dma_select(const struct spisnif_chip *ad_chip, int index)
+{
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_DMA_CTRL) &
+			SPISNIF_DMA_MASK_ENABLE;
+
+	ad_write_reg(ad_chip, SPISNIF_REG_DMA_CTRL, reg_value | index);
+}
+
+/* selecting SPISNIF_DMA_WR latches the write offset and restarts the
+ * interrupt packets count */
+static u32 spisnif_dma_get(const struct spisnif_chip *ad_chip, int index)
+{
+	u32 value;
+
+	spisnif_dma_select(ad_chip, index);
+	value = (u32)ad_read_reg(ad_chip, SPISNIF_REG_DMA_DATA) << 16;
+	return value | ad_read_reg(ad_chip, SPISNIF_REG_DMA_DATA);
+}
+
+static void spisnif_dma_set(const struct spisnif_chip *ad_chip, int index,
+			    u32 value)
+{
+	spisnif_dma_select(ad_chip, index);
+	ad_write_reg(ad_chip, SPISNIF_REG_DMA_DATA, value >> 16);
+	ad_write_reg(ad_chip, SPISNIF_REG_DMA_DATA, value & 0xFFFF);
+}
+
+/* drop whatever the fifos hold, on errors and configuration changes:
+ * the component counts packets left in fifo_packet in LOSS. It rewinds
+ * the fifos itself once drained. With dma, packets already in the dma
+ * ring are dropped too. */
+static void spisnif_reset_fifos(struct spisnif_chip *ad_chip)
+{
+	ad_pulse_control(ad_chip, SPISNIF_CONTROL_MASK_RESET);
+	if (!ad_chip->dma_buf)
+		return;
+
+	ad_chip->dma_rd = spisnif_dma_get(ad_chip, SPISNIF_DMA_WR);
+	ad_chip->dma_avail = 0;
+	ad_chip->dma_stalled = 0;
+	spisnif_dma_set(ad_chip, SPISNIF_DMA_RD, ad_chip->dma_rd);
+}
+
+/* next count stream words, read through the stream window or copied
+ * from the dma ring */
+static int spisnif_stream_read(struct spisnif_chip *ad_chip, void *buf,
+			       int count)
+{
+	u32 len = count << ad_chip->reg_shift;
+	u32 first;
+
+	if (!ad_chip->dma_buf) {
+		if (ad_chip->reg_shift == 2)
+			ioread32_rep(ad_chip->reg_base +
+				     (SPISNIF_REG_STREAM << 2), buf, count);
+		else
+			ioread16_rep(ad_chip->reg_base +
+				     (SPISNIF_REG_STREAM << 1), buf, count);
+		return 0;
+	}
+
+	/* packet would run past the write offset */
+	if (len > ad_chip->dma_avail)
+		return -EIO;
+
+	first = min(len, ad_chip->dma_size - ad_chip->dma_rd);
+	memcpy(buf, ad_chip->dma_buf + ad_chip->dma_rd, first);
+	memcpy(buf + first, ad_chip->dma_buf, len - first);
+	ad_chip->dma_rd = (ad_chip->dma_rd + len) % ad_chip->dma_size;
+	ad_chip->dma_avail -= len;
+	return 0;
+}
+
+/* tail written by userspace, -1 if it is not a record offset */
+static int spisnif_ring_tail(struct spisnif_chip *ad_chip, u32 *tail)
+{
+	*tail = ACCESS_ONCE(ad_chip->ring->tail);
+	if ((*tail >= ad_chip->ring_data_size) || (*tail & 7))
+		return -1;
+	return 0;
+}
+
+/* copy rec at head of the mmap() ring */
+static int spisnif_ring_push(struct spisnif_chip *ad_chip,
+			     const struct spisnif_record *rec, int len)
+{
+	u8 *data = ad_chip->ring_data;
+	struct spisnif_record *pad;
+	u32 size = ad_chip->ring_data_size;
+	u32 head = ad_chip->ring_head;
+	u32 aligned = SPISNIF_RING_ALIGN(len);
+	u32 tail, pos;
+
+	if (spisnif_ring_tail(ad_chip, &tail) < 0)
+		return -EINVAL;
+	/* consumer is done with everything before tail */
+	smp_mb();
+
+	if (head + aligned <= size) {
+		if ((tail > head) ? (head + aligned >= tail) :
+		    ((head + aligned == size) && (tail == 0)))
+			return -ENOSPC;
+		pos = head;
+	} else {
+		/* record does not fit before end of area */
+		if ((tail > head) || (aligned >= tail))
+			return -ENOSPC;
+		pad = (struct spisnif_record *)(data + head);
+		pad->bit_num = 0;
+		pad->flags = SPISNIF_RECORD_PAD;
+		pad->mosi_words = 0;
+		pad->miso_words = 0;
+		pos = 0;
+	}
+
+	memcpy(data + pos, rec, len);
+	smp_wmb();
+	ad_chip->ring_head = (pos + aligned == size) ? 0 : pos + aligned;
+	ACCESS_ONCE(ad_chip->ring->head) = ad_chip->ring_head;
+
+	return 0;
+}
+
+static int spisnif_ring_is_empty(struct spisnif_chip *ad_chip)
+{
+	return ad_chip->ring_head == ACCESS_ONCE(ad_chip->ring->tail);
+}
+
+static int spisnif_has_records(struct spisnif_chip *ad_chip)
+{
+	if (ad_chip->ring_maps)
+		return !spisnif_ring_is_empty(ad_chip);
+
+	return !kfifo_is_empty(&ad_chip->fifo);
+}
+
+/* bytes of records queued in the capture ring, all of it on a bad tail */
+static u32 spisnif_ring_used(struct spisnif_chip *ad_chip)
+{
+	u32 tail;
+
+	if (!ad_chip->ring_maps)
+		return kfifo_len(&ad_chip->fifo);
+
+	if (spisnif_ring_tail(ad_chip, &tail) < 0)
+		return ad_chip->ring_data_size;
+	return (ad_chip->ring_head + ad_chip->ring_data_size - tail) %
+	       ad_chip->ring_data_size;
+}
+
+/* room in the capture ring for the largest record */
+static int spisnif_record_room(struct spisnif_chip *ad_chip)
+{
+	if (!ad_chip->ring_maps)
+		return kfifo_avail(&ad_chip->fifo) >= SPISNIF_RECORD_MAX;
+
+	/* a record may have to skip the end of area */
+	return ad_chip->ring_data_size - spisnif_ring_used(ad_chip) >
+	       2*SPISNIF_RING_ALIGN(SPISNIF_RECORD_MAX);
+}
+
+static int spisnif_push_record(struct spisnif_chip *ad_chip,
+			       const struct spisnif_record *rec, int len)
+{
+	if (ad_chip->ring_maps)
+		return spisnif_ring_push(ad_chip, rec, len);
+
+	if (kfifo_avail(&ad_chip->fifo) < len)
+		return -ENOSPC;
+	kfifo_in(&ad_chip->fifo, rec, len);
+	return 0;
+}
+
+static void spisnif_queue_record(struct spisnif_chip *ad_chip,
+				 const struct spisnif_record *rec, int len)
+{
+	if (spisnif_push_record(ad_chip, rec, len) < 0) {
+		ad_chip->dropped_records++;
+		if (ad_chip->loss.records != U32_MAX)
+			ad_chip->loss.records++;
+		return;
+	}
+	ad_chip->captured_packets++;
+	ad_chip->captured_bits += rec->bit_num;
+}
+
+/* latch and clear LOSS counters, then queue a loss marker if anything
+ * was lost since the previous one. A marker that does not fit is kept
+ * for next drain. */
+static void spisnif_queue_loss(struct spisnif_chip *ad_chip)
+{
+	struct spisnif_record *rec = ad_chip->drain_buf;
+	struct spisnif_loss *loss = &ad_chip->loss;
+	u16 words[SPISNIF_LOSS_WORDS];
+	u32 bits;
+	int i;
+
+	ad_write_reg(ad_chip, SPISNIF_REG_LOSS, SPISNIF_LOSS_MASK_CLEAR);
+	for (i = 0; i < SPISNIF_LOSS_WORDS; i++)
+		words[i] = ad_read_reg(ad_chip, SPISNIF_REG_LOSS);
+	bits = ((u32)words[1] << 16) | words[2];
+
+	ad_chip->lost_packets += words[0];
+	ad_chip->lost_bits += bits;
+	ad_chip->fifo_overflows += words[3];
+	if (words[4] != SPISNIF_LOSS_NO_SCK)
+		ad_chip->sck_period = words[4];
+	loss->packets = min_t(u32, loss->packets + words[0], U16_MAX);
+	loss->overflows = min_t(u32, loss->overflows + words[3], U16_MAX);
+	loss->bits = (loss->bits > U32_MAX - bits) ? U32_MAX : loss->bits + bits;
+
+	if (!loss->packets && !loss->overflows && !loss->records)
+		return;
+
+	rec->bit_num = 0;
+	rec->flags = SPISNIF_RECORD_LOSS;
+	rec->mosi_words = sizeof(struct spisnif_loss)/2;
+	rec->miso_words = 0;
+	rec->ts_start = 0;
+	rec->ts_end = 0;
+	memcpy(rec + 1, loss, sizeof(struct spisnif_loss));
+	if (spisnif_push_record(ad_chip, rec, SPISNIF_RECORD_SIZE(rec)) == 0)
+		memset(loss, 0, sizeof(struct spisnif_loss));
+}
+
+/* descriptor is CS index in cs_bits msb, lanes mode in lane_bits, then
+ * bit count */
+static void spisnif_set_desc(const struct spisnif_chip *ad_chip,
+			     struct spisnif_record *rec, u16 desc)
+{
+	int shift = 16 - ad_chip->cs_bits - ad_chip->lane_bits;
+
+	rec->bit_num = desc & ((1 << shift) - 1);
+	rec->flags = ((desc >> shift) & ((1 << ad_chip->lane_bits) - 1)) <<
+		     SPISNIF_RECORD_LANES_SHIFT;
+	rec->flags |= (desc >> (shift + ad_chip->lane_bits)) <<
+		      SPISNIF_RECORD_CS_SHIFT;
+}
+
+/* read packet_num packets through the stream window, straight into
+ * the record being queued. rle records are queued as stored, userspace
+ * expands them. */
+static int spisnif_drain_packets(struct spisnif_chip *ad_chip, int packet_num)
+{
+	struct spisnif_record *rec = ad_chip->drain_buf;
+	u16 *words = (u16 *)(rec + 1);
+	u16 head[SPISNIF_STREAM_HEAD_WORDS + SPISNIF_STREAM_RLE_WORDS];
+	int head_words = SPISNIF_STREAM_HEAD_WORDS;
+	int i, word_num;
+
+	if (ad_chip->rle)
+		head_words += SPISNIF_STREAM_RLE_WORDS;
+
+	for (i = 0; i < packet_num; i++) {
+		if (spisnif_stream_read(ad_chip, head, head_words) < 0)
+			return -EIO;
+		spisnif_set_desc(ad_chip, rec, head[0]);
+		word_num = SPISNIF_WORDS(rec->bit_num);
+		if (word_num > SPISNIF_MXSX_WORDS)
+			return -EIO;
+
+		rec->mosi_words = word_num;
+		rec->miso_words = word_num;
+		rec->ts_start = ((u32)head[1] << 16) | head[2];
+		rec->ts_end = ((u32)head[3] << 16) | head[4];
+		if (ad_chip->rle) {
+			if ((head[5] > SPISNIF_MXSX_WORDS) ||
+			    (head[6] > SPISNIF_MXSX_WORDS))
+				return -EIO;
+			rec->flags |= SPISNIF_RECORD_RLE;
+			rec->mosi_words = head[5];
+			rec->miso_words = head[6];
+		}
+		if (spisnif_stream_read(ad_chip, words,
+					rec->mosi_words + rec->miso_words) < 0)
+			return -EIO;
+
+		spisnif_queue_record(ad_chip, rec, SPISNIF_RECORD_SIZE(rec));
+	}
+
+	return 0;
+}
+
+/* same on wishbone32, where each stream read after the head gives one
+ * MOSI word and one MISO word: half the bus cycles. With rle the shorter
+ * lane is padded up to the longer one. */
+static int spisnif_drain_packets32(struct spisnif_chip *ad_chip,
+				   int packet_num)
+{
+	struct spisnif_record *rec = ad_chip->drain_buf;
+	u16 *mosi = (u16 *)(rec + 1);
+	u16 *miso;
+	u32 *pairs = ad_chip->pair_buf;
+	u32 head[SPISNIF_STREAM32_HEAD_WORDS + SPISNIF_STREAM32_RLE_WORDS];
+	int head_words = SPISNIF_STREAM32_HEAD_WORDS;
+	int i, j, word_num;
+
+	if (ad_chip->rle)
+		head_words += SPISNIF_STREAM32_RLE_WORDS;
+
+	for (i = 0; i < packet_num; i++) {
+		if (spisnif_stream_read(ad_chip, head, head_words) < 0)
+			return -EIO;
+		spisnif_set_desc(ad_chip, rec, head[0] & 0xFFFF);
+		word_num = SPISNIF_WORDS(rec->bit_num);
+		if (word_num > SPISNIF_MXSX_WORDS)
+			return -EIO;
+
+		rec->mosi_words = word_num;
+		rec->miso_words = word_num;
+		rec->ts_start = head[1];
+		rec->ts_end = head[2];
+		if (ad_chip->rle) {
+			if (((head[3] >> 16) > SPISNIF_MXSX_WORDS) ||
+			    ((head[3] & 0xFFFF) > SPISNIF_MXSX_WORDS))
+				return -EIO;
+			rec->flags |= SPISNIF_RECORD_RLE;
+			rec->mosi_words = head[3] >> 16;
+			rec->miso_words = head[3] & 0xFFFF;
+		}
+		if (spisnif_stream_read(ad_chip, pairs,
+					max(rec->mosi_words,
+					    rec->miso_words)) < 0)
+			return -EIO;
+		miso = mosi + rec->mosi_words;
+		for (j = 0; j < rec->mosi_words; j++)
+			mosi[j] = pairs[j] & 0xFFFF;
+		for (j = 0; j < rec->miso_words; j++)
+			miso[j] = pairs[j] >> 16;
+
+		spisnif_queue_record(ad_chip, rec, SPISNIF_RECORD_SIZE(rec));
+	}
+
+	return 0;
+}
+
+/* ping pong: freeze capture bank for reading, capture goes on in the
+ * other one */
+static int spisnif_swap_banks(struct spisnif_chip *ad_chip)
+{
+	int timeout;
+
+	ad_pulse_control(ad_chip, SPISNIF_CONTROL_MASK_SWAP);
+	for (timeout = 0; timeout < SPISNIF_SWAP_TIMEOUT_US; timeout++) {
+		if (!(ad_read_reg(ad_chip, SPISNIF_REG_CONTROL) &
+		      SPISNIF_CONTROL_MASK_SWAP))
+			return 0;
+		udelay(1);
+	}
+
+	return -ETIMEDOUT;
+}
+
+/* drain all packets pending in the fifos into the capture ring,
+ * return number of packets drained */
+static int spisnif_drain_fifos(struct spisnif_chip *ad_chip)
+{
+	u16 status;
+	int loop, packet_num, ret, drained = 0;
+
+	/* full fifos drop new packets whole and count them in LOSS, packets
+	 * already recorded are drained as usual */
+	for (loop = 0; loop < SPISNIF_DRAIN_LOOPS; loop++) {
+		status = ad_read_reg(ad_chip, SPISNIF_REG_STATUS);
+		if (status & SPISNIF_STATUS_MASK_PING_PONG) {
+			/* frozen bank is read while capture goes on, its
+			 * pointers are rewound by next swap */
+			if (spisnif_swap_banks(ad_chip) < 0) {
+				dev_warn(&ad_chip->pdev->dev,
+					 "bank swap timeout\n");
+				break;
+			}
+			status = ad_read_reg(ad_chip, SPISNIF_REG_STATUS);
+		}
+		/* the component rewinds drained fifos itself, between
+		 * packets: a reset here could drop one completing now */
+		if (status & SPISNIF_STATUS_MASK_FIFO_EMPTY)
+			break;
+
+		packet_num = status & SPISNIF_STATUS_MASK_PACKET_NUM;
+		if (packet_num > ad_chip->fifo_high_water)
+			ad_chip->fifo_high_water = packet_num;
+		if (ad_chip->reg_shift == 2)
+			ret = spisnif_drain_packets32(ad_chip, packet_num);
+		else
+			ret = spisnif_drain_packets(ad_chip, packet_num);
+		if (ret < 0) {
+			dev_err(&ad_chip->pdev->dev,
+				"bad packet descriptors, fifos reset\n");
+			spisnif_reset_fifos(ad_chip);
+			break;
+		}
+		drained += packet_num;
+	}
+
+	return drained;
+}
+
+/* drain the packets the dma engine copied to the dma ring, one at a time
+ * while the capture ring has room for the largest record: the rest waits
+ * there and capture stalls once the dma ring is full too */
+static int spisnif_drain_dma(struct spisnif_chip *ad_chip)
+{
+	u32 wr = spisnif_dma_get(ad_chip, SPISNIF_DMA_WR);
+	int ret, drained = 0;
+
+	if ((wr >= ad_chip->dma_size) ||
+	    (wr & ((1 << ad_chip->reg_shift) - 1))) {
+		dev_err(&ad_chip->pdev->dev, "bad dma write offset\n");
+		spisnif_reset_fifos(ad_chip);
+		return 0;
+	}
+	/* ring content up to wr was written before wr was committed */
+	rmb();
+	ad_chip->dma_avail = (wr + ad_chip->dma_size - ad_chip->dma_rd) %
+			     ad_chip->dma_size;
+	if (ad_chip->dma_avail > ad_chip->dma_high_water)
+		ad_chip->dma_high_water = ad_chip->dma_avail;
+
+	while (ad_chip->dma_avail && spisnif_record_room(ad_chip)) {
+		if (ad_chip->reg_shift == 2)
+			ret = spisnif_drain_packets32(ad_chip, 1);
+		else
+			ret = spisnif_drain_packets(ad_chip, 1);
+		if (ret < 0) {
+			dev_err(&ad_chip->pdev->dev,
+				"bad packet descriptors, fifos reset\n");
+			spisnif_reset_fifos(ad_chip);
+			return drained;
+		}
+		drained++;
+	}
+	ad_chip->dma_stalled = (ad_chip->dma_avail != 0);
+	spisnif_dma_set(ad_chip, SPISNIF_DMA_RD, ad_chip->dma_rd);
+
+	return drained;
+}
+
+/* dma generic: give the component a coherent ring to copy packets to */
+static int spisnif_dma_start(struct spisnif_chip *ad_chip)
+{
+	/* ring holds whole stream words, and a few largest packets */
+	u32 size = dma_size & ~((1 << ad_chip->reg_shift) - 1);
+
+	if (size < 4*SPISNIF_RECORD_MAX)
+		return -EINVAL;
+
+	ad_chip->dma_buf = dma_alloc_coherent(&ad_chip->pdev->dev, size,
+					      &ad_chip->dma_handle,
+					      GFP_KERNEL);
+	if (!ad_chip->dma_buf)
+		return -ENOMEM;
+	ad_chip->dma_size = size;
+	ad_chip->dma_rd = 0;
+	ad_chip->dma_avail = 0;
+
+	/* enabling from disabled and idle clears the ring offsets */
+	spisnif_dma_set(ad_chip, SPISNIF_DMA_BASE, ad_chip->dma_handle);
+	spisnif_dma_set(ad_chip, SPISNIF_DMA_SIZE, size);
+	ad_write_reg(ad_chip, SPISNIF_REG_DMA_CTRL, SPISNIF_DMA_MASK_ENABLE);
+
+	return 0;
+}
+
+/* the packet being copied is completed before the ring is freed */
+static void spisnif_dma_stop(struct spisnif_chip *ad_chip)
+{
+	int timeout;
+
+	if (!ad_chip->dma_buf)
+		return;
+
+	ad_write_reg(ad_chip, SPISNIF_REG_DMA_CTRL, 0);
+	for (timeout = 0; timeout < SPISNIF_DMA_STOP_TIMEOUT_US; timeout++) {
+		if (!(ad_read_reg(ad_chip, SPISNIF_REG_DMA_CTRL) &
+		      SPISNIF_DMA_MASK_BUSY))
+			break;
+		udelay(1);
+	}
+	if (timeout == SPISNIF_DMA_STOP_TIMEOUT_US) {
+		/* stalled on a full ring: drop the packet being copied, the
+		 * engine goes idle and never writes to the freed ring */
+		dev_warn(&ad_chip->pdev->dev, "dma stop timeout\n");
+		spisnif_reset_fifos(ad_chip);
+	}
+
+	dma_free_coherent(&ad_chip->pdev->dev, ad_chip->dma_size,
+			  ad_chip->dma_buf, ad_chip->dma_handle);
+	ad_chip->dma_buf = NULL;
+}
+
+/* drain the fifos, or the dma ring, into the capture ring, return
+ * number of packets drained */
+static int spisnif_drain(struct spisnif_chip *ad_chip)
+{
+	ktime_t start = ktime_get();
+	u32 used, time;
+	int drained;
+
+	if (ad_chip->dma_buf)
+		drained = spisnif_drain_dma(ad_chip);
+	else
+		drained = spisnif_drain_fifos(ad_chip);
+	spisnif_queue_loss(ad_chip);
+
+	time = ktime_us_delta(ktime_get(), start);
+	ad_chip->drains++;
+	ad_chip->drain_time_total += time;
+	if (time > ad_chip->drain_time_max)
+		ad_chip->drain_time_max = time;
+	used = spisnif_ring_used(ad_chip);
+	if (used > ad_chip->ring_high_water)
+		ad_chip->ring_high_water = used;
+
+	if (spisnif_has_records(ad_chip))
+		wake_up_interruptible(&ad_chip->wait_queue);
+
+	return drained;
+}
+
+/*
+ * NAPI like coalescing: when an interrupt finds twice the threshold in the
+ * fifos, packets come faster than we drain and the threshold is doubled.
+ * When flush_timer has to drain a partial batch, traffic slowed down and
+ * the threshold is halved back towards one interrupt per packet.
+ */
+static void spisnif_coalesce(struct spisnif_chip *ad_chip, int drained,
+			     int from_timer)
+{
+	int trig = ad_chip->irq_pnum_trig;
+
+	if (!ad_chip->irq_coalesce)
+		return;
+
+	if (from_timer)
+		trig = max(trig/2, 1);
+	else if (drained >= 2*trig)
+		trig = min(2*trig, ad_chip->irq_pnum_max);
+
+	if (trig != ad_chip->irq_pnum_trig)
+		spisnif_set_irq_pnum_trig(ad_chip, trig);
+
+	/* packets below threshold don't raise interrupt, bound their wait */
+	if ((trig > 1) && !ad_chip->shutdown)
+		mod_timer(&ad_chip->flush_timer,
+			  jiffies + msecs_to_jiffies(ad_chip->irq_max_latency));
+	else
+		del_timer(&ad_chip->flush_timer);
+}
+
+/* drain from process context, unless the device is going away */
+static void spisnif_schedule_flush(struct spisnif_chip *ad_chip)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ad_chip->flush_lock, flags);
+	if (!ad_chip->shutdown)
+		schedule_work(&ad_chip->flush_work);
+	spin_unlock_irqrestore(&ad_chip->flush_lock, flags);
+}
+
+static void spisnif_flush_timer(unsigned long data)
+{
+	struct spisnif_chip *ad_chip = (struct spisnif_chip *)data;
+
+	spisnif_schedule_flush(ad_chip);
+}
+
+static void spisnif_flush(struct work_struct *work)
+{
+	struct spisnif_chip *ad_chip =
+		container_of(work, struct spisnif_chip, flush_work);
+	int drained;
+
+	mutex_lock(&ad_chip->drain_lock);
+	drained = spisnif_drain(ad_chip);
+	spisnif_coalesce(ad_chip, drained, 1);
+	mutex_unlock(&ad_chip->drain_lock);
 }
 
 /* file operations */
-static ssize_t spisnif_open(struct inode *inode, struct file *file)
+static int spisnif_open(struct inode *inode, struct file *file)
 {
 	struct spisnif_chip *ad_chip = container_of(inode->i_cdev, struct spisnif_chip, cdev);
 
@@ -111,7 +876,7 @@ static ssize_t spisnif_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
-static ssize_t spisnif_release(struct inode *inode, struct file *filp) {
+static int spisnif_release(struct inode *inode, struct file *filp) {
 	struct spisnif_chip *ad_chip = filp->private_data; 
 
 	ad_chip->cdev_open = 0;
@@ -119,46 +884,181 @@ static ssize_t spisnif_release(struct inode *inode, struct file *filp) {
 	return 0;
 }
 
+/* copy as many whole records as count allows */
 static ssize_t spisnif_read(struct file *file, char __user *buf, size_t count, loff_t *f_pos) {
 	struct spisnif_chip *ad_chip = file->private_data; 
-	int reg_value;
+	struct spisnif_record rec;
+	unsigned int copied;
+	size_t len;
+	ssize_t done = 0;
+	int ret;
 
-	/* start sampling */
-	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
-	if (reg_value < 0)
-		return -EFAULT ;
+	/* records go to the mmap() ring while it is mapped */
+	if (ad_chip->ring_maps)
+		return -EBUSY;
 
-	ad_write_reg(ad_chip,
-		     SPISNIF_REG_CONTROL,
-		     reg_value|SPISNIF_CONTROL_MASK_TRIGGER);
+	if (mutex_lock_interruptible(&ad_chip->read_lock))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_empty(&ad_chip->fifo)) {
+		mutex_unlock(&ad_chip->read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(ad_chip->wait_queue,
+					     !kfifo_is_empty(&ad_chip->fifo)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&ad_chip->read_lock))
+			return -ERESTARTSYS;
+	}
 
-	/* wait for interrupt */
-	wait_event_interruptible(ad_chip->wait_queue, ad_chip->irq_occur);
-	ad_chip->irq_occur = 0;
+	while (kfifo_out_peek(&ad_chip->fifo, &rec, sizeof(rec)) == sizeof(rec)) {
+		len = SPISNIF_RECORD_SIZE(&rec);
+		if (done + len > count)
+			break;
+		ret = kfifo_to_user(&ad_chip->fifo, buf + done, len, &copied);
+		if (ret < 0) {
+			if (done == 0)
+				done = ret;
+			break;
+		}
+		done += copied;
+	}
+	mutex_unlock(&ad_chip->read_lock);
+
+	/* packets waiting in the dma ring raise no more interrupts */
+	if (ad_chip->dma_stalled)
+		spisnif_schedule_flush(ad_chip);
+
+	/* buffer can't hold the first record */
+	if (done == 0)
+		return -EINVAL;
+
+	return done;
+}
+
+static unsigned int spisnif_poll(struct file *file, poll_table *wait)
+{
+	struct spisnif_chip *ad_chip = file->private_data;
+
+	poll_wait(file, &ad_chip->wait_queue, wait);
+	if (spisnif_has_records(ad_chip))
+		return POLLIN | POLLRDNORM;
+	/* mmap() consumer made room for packets left in the dma ring */
+	if (ad_chip->dma_stalled)
+		spisnif_schedule_flush(ad_chip);
+
+	return 0;
+}
+
+static void spisnif_vm_open(struct vm_area_struct *vma)
+{
+	struct spisnif_chip *ad_chip = vma->vm_private_data;
+
+	mutex_lock(&ad_chip->drain_lock);
+	if (ad_chip->ring_maps++ == 0) {
+		ad_chip->ring_head = 0;
+		ad_chip->ring->magic = SPISNIF_RING_MAGIC;
+		ad_chip->ring->data_offset = PAGE_SIZE;
+		ad_chip->ring->data_size = ad_chip->ring_data_size;
+		ad_chip->ring->head = 0;
+		ad_chip->ring->tail = 0;
+	}
+	mutex_unlock(&ad_chip->drain_lock);
+}
+
+static void spisnif_vm_close(struct vm_area_struct *vma)
+{
+	struct spisnif_chip *ad_chip = vma->vm_private_data;
+
+	mutex_lock(&ad_chip->drain_lock);
+	ad_chip->ring_maps--;
+	mutex_unlock(&ad_chip->drain_lock);
+}
+
+static struct vm_operations_struct spisnif_vm_ops = {
+	.open	= spisnif_vm_open,
+	.close	= spisnif_vm_close,
+};
+
+/* map whole ring: header page and records area */
+static int spisnif_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct spisnif_chip *ad_chip = file->private_data;
+	int ret;
+
+	if ((vma->vm_pgoff != 0) ||
+	    (vma->vm_end - vma->vm_start != ad_chip->ring_map_size))
+		return -EINVAL;
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	ret = remap_vmalloc_range(vma, ad_chip->ring, 0);
+	if (ret)
+		return ret;
+
+	vma->vm_ops = &spisnif_vm_ops;
+	vma->vm_private_data = ad_chip;
+	spisnif_vm_open(vma);
 
 	return 0;
 }
 
 struct file_operations ad_fops = {
 	.read	= spisnif_read,
+	.poll	= spisnif_poll,
+	.mmap	= spisnif_mmap,
 	.open	= spisnif_open,
 	.release= spisnif_release,
 };
 
 static irqreturn_t ad_interrupt(int irq, void *data) {
 	struct spisnif_chip *ad_chip = data;
-	int ret;
 
-	/* acknowledge interrupt */
-	ad_chip->irq_occur = 1;
-	wake_up_interruptible(&ad_chip->wait_queue);
-	/* acknowledge interrupt */
-	ret = ad_read_reg(ad_chip, SPISNIF_REG_STATUS);
+	/* fifos are drained in ad_irq_thread, irq stays masked meanwhile */
+	ad_chip->irq_time = ktime_get();
+	return IRQ_WAKE_THREAD;
+}
+
+/* time from hard irq to drain start, thread scheduling and drain_lock
+ * wait included */
+static void spisnif_irq_latency(struct spisnif_chip *ad_chip)
+{
+	s64 latency = ktime_us_delta(ktime_get(), ad_chip->irq_time);
+	int bucket = 0;
+
+	if (latency > 1)
+		bucket = min(fls64(latency) - 1, SPISNIF_LATENCY_BUCKETS - 1);
+	ad_chip->irq_latency[bucket]++;
+}
+
+static irqreturn_t ad_irq_thread(int irq, void *data) {
+	struct spisnif_chip *ad_chip = data;
+	int drained;
+
+	mutex_lock(&ad_chip->drain_lock);
+	spisnif_irq_latency(ad_chip);
+	/* acknowledge before draining so that packets arriving meanwhile
+	 * raise a new interrupt */
+	ad_pulse_control(ad_chip, SPISNIF_CONTROL_MASK_IRQ_ACK);
+	drained = spisnif_drain(ad_chip);
+	spisnif_coalesce(ad_chip, drained, 0);
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return IRQ_HANDLED;
 }
 
 /* /sys/ operations */
+/* char device number as major:minor, for user space to find its node */
+static ssize_t show_dev_number(struct device *dev,
+			       struct device_attribute *attr,
+			       char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d:%d\n",
+		       MAJOR(ad_chip->devt), MINOR(ad_chip->devt));
+}
+
 static ssize_t show_fifo_base_addr(	struct device *dev,
 					struct device_attribute *attr,
 					char *buf) {
@@ -169,261 +1069,721 @@ static ssize_t show_fifo_base_addr(	struct device *dev,
 	return sprintf(buf, "%d\n", ad_chip->resource_mem->start);
 }
 
-static ssize_t show_fifo_v1_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
-
-	fifo_size = ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_0)&0x001F;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+static ssize_t show_config_bit(struct device *dev, char *buf, u16 mask)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-	return sprintf(buf, "%d\n", fifo_size);
+	return sprintf(buf, "%d\n",
+		       (ad_read_reg(ad_chip, SPISNIF_REG_CONFIG) & mask) ? 1 : 0);
 }
 
-static ssize_t show_fifo_v2_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
+static ssize_t store_config_bit(struct device *dev, const char *buf,
+				size_t size, u16 mask)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 reg_value;
 
-	fifo_size = (ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_0)&0x03E0)>>5;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+	mutex_lock(&ad_chip->drain_lock);
+	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG) & ~mask;
+	if (simple_strtoul(buf, NULL, 10))
+		reg_value |= mask;
+	ad_write_reg(ad_chip, SPISNIF_REG_CONFIG, reg_value);
 
-	return sprintf(buf, "%d\n", fifo_size);
+	/* frames captured with the previous configuration are garbage */
+	spisnif_reset_fifos(ad_chip);
+	mutex_unlock(&ad_chip->drain_lock);
+
+	return size;
 }
 
-static ssize_t show_fifo_v3_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
+static ssize_t show_cpol(struct device *dev,
+			 struct device_attribute *attr,
+			 char *buf)
+{
+	return show_config_bit(dev, buf, SPISNIF_CONFIG_MASK_CPOL);
+}
 
-	fifo_size = (ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_0)&0x7C00)>>10;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+static ssize_t store_cpol(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t size)
+{
+	return store_config_bit(dev, buf, size, SPISNIF_CONFIG_MASK_CPOL);
+}
 
-	return sprintf(buf, "%d\n", fifo_size);
+static ssize_t show_cpha(struct device *dev,
+			 struct device_attribute *attr,
+			 char *buf)
+{
+	return show_config_bit(dev, buf, SPISNIF_CONFIG_MASK_CPHA);
 }
 
-static ssize_t show_fifo_v4_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
+static ssize_t store_cpha(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t size)
+{
+	return store_config_bit(dev, buf, size, SPISNIF_CONFIG_MASK_CPHA);
+}
 
-	fifo_size = ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_1)&0x001F;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+static ssize_t show_cspol(struct device *dev,
+			  struct device_attribute *attr,
+			  char *buf)
+{
+	return show_config_bit(dev, buf, SPISNIF_CONFIG_MASK_CSPOL);
+}
 
-	return sprintf(buf, "%d\n", fifo_size);
+static ssize_t store_cspol(struct device *dev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t size)
+{
+	return store_config_bit(dev, buf, size, SPISNIF_CONFIG_MASK_CSPOL);
 }
 
-static ssize_t show_fifo_v5_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
+/* CONFIG lanes mode as 1, 2 or 4 data lanes */
+static ssize_t show_lanes(struct device *dev,
+			  struct device_attribute *attr,
+			  char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG);
 
-	fifo_size = (ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_1)&0x03E0)>>5;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+	return sprintf(buf, "%d\n",
+		       1 << ((reg_value & SPISNIF_CONFIG_MASK_LANES) >>
+			     __ffs(SPISNIF_CONFIG_MASK_LANES)));
+}
 
-	return sprintf(buf, "%d\n", fifo_size);
+static ssize_t store_lanes(struct device *dev,
+			   struct device_attribute *attr,
+			   const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	unsigned long lanes = simple_strtoul(buf, NULL, 10);
+	ssize_t ret = size;
+	u16 reg_value;
+
+	if ((lanes != 1) && (lanes != 2) && (lanes != 4))
+		return -EINVAL;
+
+	mutex_lock(&ad_chip->drain_lock);
+	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG) &
+		    ~SPISNIF_CONFIG_MASK_LANES;
+	reg_value |= (__ffs(lanes) << __ffs(SPISNIF_CONFIG_MASK_LANES));
+	ad_write_reg(ad_chip, SPISNIF_REG_CONFIG, reg_value);
+	/* component falls back to single lane beyond its lanes generic */
+	if ((ad_read_reg(ad_chip, SPISNIF_REG_CONFIG) &
+	     SPISNIF_CONFIG_MASK_LANES) != (reg_value & SPISNIF_CONFIG_MASK_LANES))
+		ret = -EINVAL;
+
+	spisnif_reset_fifos(ad_chip);
+	mutex_unlock(&ad_chip->drain_lock);
+
+	return ret;
 }
 
-static ssize_t show_fifo_v6_size(	struct device *dev,
-					struct device_attribute *attr,
-					char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int fifo_size = 0;
+/* CONFIG data sampling delay, in half component clock periods after
+ * the sck edge, with both edges sampling only */
+static ssize_t show_sample_delay(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG);
+
+	return sprintf(buf, "%d\n",
+		       (reg_value & SPISNIF_CONFIG_MASK_DELAY) >>
+		       __ffs(SPISNIF_CONFIG_MASK_DELAY));
+}
+
+static ssize_t store_sample_delay(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	unsigned long delay = simple_strtoul(buf, NULL, 10);
+	u16 reg_value;
+
+	if (delay > (SPISNIF_CONFIG_MASK_DELAY >> __ffs(SPISNIF_CONFIG_MASK_DELAY)))
+		return -EINVAL;
+
+	mutex_lock(&ad_chip->drain_lock);
+	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG);
+	if (delay && !(reg_value & SPISNIF_CONFIG_MASK_DDR)) {
+		mutex_unlock(&ad_chip->drain_lock);
+		return -EINVAL;
+	}
+
+	reg_value &= ~SPISNIF_CONFIG_MASK_DELAY;
+	reg_value |= (delay << __ffs(SPISNIF_CONFIG_MASK_DELAY));
+	ad_write_reg(ad_chip, SPISNIF_REG_CONFIG, reg_value);
 
-	fifo_size = (ad_read_reg(ad_chip, SPISNIF_REG_FIFO_SIZE_1)&0x7C00)>>10;
-	fifo_size = fifo_size*SPISNIF_RAMSIZE;
+	/* frames captured with the previous delay are garbage */
+	spisnif_reset_fifos(ad_chip);
+	mutex_unlock(&ad_chip->drain_lock);
 
-	return sprintf(buf, "%d\n", fifo_size);
+	return size;
 }
 
-static ssize_t show_prescaler(struct device *dev,
-			      struct device_attribute *attr,
-			      char *buf)
+/* FILTER_CTRL, each write arms trigger again */
+static ssize_t show_filter_field(struct device *dev, char *buf, u16 mask)
 {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_FILTER_CTRL) & mask;
 
-	return sprintf(buf, "%d\n", ad_read_reg(ad_chip, SPISNIF_REG_PRESCALER));
+	return sprintf(buf, "%d\n", reg_value >> __ffs(mask));
 }
 
-static ssize_t store_prescaler(struct device *dev,
-			       struct device_attribute *attr,
-			       const char *buf, size_t size)
+static ssize_t store_filter_field(struct device *dev, const char *buf,
+				  size_t size, u16 mask)
 {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	unsigned long value = simple_strtoul(buf, NULL, 10);
+	u16 reg_value;
+
+	if (value > (mask >> __ffs(mask)))
+		return -EINVAL;
 
-	ad_write_reg(ad_chip, SPISNIF_REG_PRESCALER, simple_strtoul(buf, NULL, 10));
+	mutex_lock(&ad_chip->drain_lock);
+	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_FILTER_CTRL) &
+		    ~(mask | SPISNIF_FILTER_MASK_TRIGGERED |
+		      SPISNIF_FILTER_MASK_DONE);
+	ad_write_reg(ad_chip, SPISNIF_REG_FILTER_CTRL,
+		     reg_value | (value << __ffs(mask)));
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return size;
 }
 
-static ssize_t show_oversampling(struct device *dev,
-				struct device_attribute *attr,
-				char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+static ssize_t show_filter_enable(struct device *dev,
+				  struct device_attribute *attr,
+				  char *buf)
+{
+	return show_filter_field(dev, buf, SPISNIF_FILTER_MASK_ENABLE);
+}
+
+static ssize_t store_filter_enable(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t size)
+{
+	return store_filter_field(dev, buf, size, SPISNIF_FILTER_MASK_ENABLE);
+}
+
+static ssize_t show_filter_exclude(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	return show_filter_field(dev, buf, SPISNIF_FILTER_MASK_EXCLUDE);
+}
+
+static ssize_t store_filter_exclude(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t size)
+{
+	return store_filter_field(dev, buf, size, SPISNIF_FILTER_MASK_EXCLUDE);
+}
+
+static ssize_t show_filter_trigger(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	return show_filter_field(dev, buf, SPISNIF_FILTER_MASK_TRIGGER);
+}
 
-	return sprintf(buf, "%d\n", (ad_read_reg(ad_chip, SPISNIF_REG_CONTROL)>>6)&0x7);
+static ssize_t store_filter_trigger(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t size)
+{
+	return store_filter_field(dev, buf, size, SPISNIF_FILTER_MASK_TRIGGER);
 }
 
-static ssize_t store_oversampling(struct device *dev,
+static ssize_t show_filter_post(struct device *dev,
 				struct device_attribute *attr,
-				const char *buf, size_t size) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int os;
-	int reg_value;
+				char *buf)
+{
+	return show_filter_field(dev, buf, SPISNIF_FILTER_MASK_POST);
+}
+
+static ssize_t store_filter_post(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t size)
+{
+	return store_filter_field(dev, buf, size, SPISNIF_FILTER_MASK_POST);
+}
+
+static ssize_t show_filter_state(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 reg_value = ad_read_reg(ad_chip, SPISNIF_REG_FILTER_CTRL);
+
+	if (reg_value & SPISNIF_FILTER_MASK_DONE)
+		return sprintf(buf, "done\n");
+	if (reg_value & SPISNIF_FILTER_MASK_TRIGGERED)
+		return sprintf(buf, "triggered\n");
+	return sprintf(buf, "armed\n");
+}
+
+/* FILTER_MATCH and FILTER_MASK, first MOSI word as read in records */
+static ssize_t show_filter_reg(struct device *dev, char *buf, int reg)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "0x%04x\n", ad_read_reg(ad_chip, reg));
+}
 
-	os = simple_strtoul(buf, NULL, 10);
-	os = (os&0x07)<<6;
+static ssize_t store_filter_reg(struct device *dev, const char *buf,
+				size_t size, int reg)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	unsigned long value = simple_strtoul(buf, NULL, 0);
 
-	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
-	if (reg_value < 0)
-		return size;
+	if (value > 0xFFFF)
+		return -EINVAL;
 
-	ad_write_reg(ad_chip,
-		     SPISNIF_REG_CONTROL,
-		     (reg_value&(~SPISNIF_CONTROL_MASK_OS))|os);
+	mutex_lock(&ad_chip->drain_lock);
+	ad_write_reg(ad_chip, reg, value);
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return size;
 }
 
-static ssize_t store_ack_fifo(struct device *dev,
+static ssize_t show_filter_match(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	return show_filter_reg(dev, buf, SPISNIF_REG_FILTER_MATCH);
+}
+
+static ssize_t store_filter_match(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t size)
+{
+	return store_filter_reg(dev, buf, size, SPISNIF_REG_FILTER_MATCH);
+}
+
+static ssize_t show_filter_mask(struct device *dev,
 				struct device_attribute *attr,
-				const char *buf, size_t size) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int reg_value;
+				char *buf)
+{
+	return show_filter_reg(dev, buf, SPISNIF_REG_FILTER_MASK);
+}
 
-	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
-	if (reg_value < 0)
-		return size;
+static ssize_t store_filter_mask(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t size)
+{
+	return store_filter_reg(dev, buf, size, SPISNIF_REG_FILTER_MASK);
+}
+
+/* CS_MASK, one bit per CS input */
+static ssize_t show_cs_mask(struct device *dev,
+			    struct device_attribute *attr,
+			    char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "0x%02x\n",
+		       ad_read_reg(ad_chip, SPISNIF_REG_CS_MASK));
+}
+
+static ssize_t store_cs_mask(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	unsigned long value = simple_strtoul(buf, NULL, 0);
+
+	if (value > 0xFF)
+		return -EINVAL;
 
-	ad_write_reg(ad_chip,
-		     SPISNIF_REG_CONTROL,
-		     reg_value|SPISNIF_CONTROL_MASK_ACK_FIFO);
+	mutex_lock(&ad_chip->drain_lock);
+	ad_write_reg(ad_chip, SPISNIF_REG_CS_MASK, value);
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return size;
 }
 
-static ssize_t show_ext_trig(struct device *dev,
+static ssize_t show_dropped_records(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", ad_chip->dropped_records);
+}
+
+static ssize_t show_fifo_overflows(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", ad_chip->fifo_overflows);
+}
+
+static ssize_t show_lost_packets(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", ad_chip->lost_packets);
+}
+
+static ssize_t show_lost_bits(struct device *dev,
+			      struct device_attribute *attr,
+			      char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", ad_chip->lost_bits);
+}
+
+/* fastest sck seen in last drain with traffic, in Hz */
+static ssize_t show_sck_rate(struct device *dev,
+			     struct device_attribute *attr,
+			     char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	u16 period = ad_chip->sck_period;
+
+	if (!period)
+		return sprintf(buf, "0\n");
+	return sprintf(buf, "%lu\n", (2UL * clk_rate) / period);
+}
+
+static ssize_t show_captured_packets(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", ad_chip->captured_packets);
+}
+
+static ssize_t show_captured_bits(struct device *dev,
+				  struct device_attribute *attr,
+				  char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", ad_chip->captured_bits);
+}
+
+static ssize_t show_drains(struct device *dev,
+			   struct device_attribute *attr,
+			   char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", ad_chip->drains);
+}
+
+static ssize_t show_drain_time_total(struct device *dev,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n", ad_chip->drain_time_total);
+}
+
+static ssize_t show_drain_time_max(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", ad_chip->drain_time_max);
+}
+
+static ssize_t show_fifo_high_water(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", ad_chip->fifo_high_water);
+}
+
+static ssize_t show_dma_high_water(struct device *dev,
+				   struct device_attribute *attr,
+				   char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", ad_chip->dma_high_water);
+}
+
+static ssize_t show_ring_high_water(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", ad_chip->ring_high_water);
+}
+
+/* bucket counts on one line, see SPISNIF_LATENCY_BUCKETS */
+static ssize_t show_irq_latency(struct device *dev,
 				struct device_attribute *attr,
-				char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+				char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < SPISNIF_LATENCY_BUCKETS; i++)
+		len += sprintf(buf + len, "%lu%c", ad_chip->irq_latency[i],
+			       (i == SPISNIF_LATENCY_BUCKETS - 1) ? '\n' : ' ');
+	return len;
+}
 
-	return sprintf(buf, "%d\n",
-		       (ad_read_reg(ad_chip, SPISNIF_REG_CONTROL)&SPISNIF_CONTROL_MASK_EXT_TRIG_NUM)
-		       >>1);
+/* clear high water marks, drain_time_max and irq_latency */
+static ssize_t store_stats_reset(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	if (simple_strtoul(buf, NULL, 10) != 1)
+		return -EINVAL;
+
+	mutex_lock(&ad_chip->drain_lock);
+	ad_chip->drain_time_max = 0;
+	ad_chip->fifo_high_water = 0;
+	ad_chip->dma_high_water = 0;
+	ad_chip->ring_high_water = 0;
+	memset(ad_chip->irq_latency, 0, sizeof(ad_chip->irq_latency));
+	mutex_unlock(&ad_chip->drain_lock);
+
+	return size;
 }
 
-static ssize_t store_ext_trig(struct device *dev,
+/* dma ring bytes left for lack of capture ring room at last drain */
+static ssize_t show_dma_pending(struct device *dev,
 				struct device_attribute *attr,
-				const char *buf, size_t size) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int ext_trig, reg_value;
+				char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-	ext_trig = simple_strtoul(buf, NULL, 10);
-	if ((ext_trig < 0) || (ext_trig > 19))
-		return size;
+	return sprintf(buf, "%u\n", ad_chip->dma_avail);
+}
 
-	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
-	if (reg_value < 0)
-		return size;
+static ssize_t show_irq_coalesce(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-	reg_value = reg_value&(~SPISNIF_CONTROL_MASK_EXT_TRIG_NUM);
+	return sprintf(buf, "%d\n", ad_chip->irq_coalesce);
+}
 
-	ad_write_reg(ad_chip,
-		     SPISNIF_REG_CONTROL,
-		     reg_value | (ext_trig<<1));
+static ssize_t store_irq_coalesce(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+
+	mutex_lock(&ad_chip->drain_lock);
+	ad_chip->irq_coalesce = simple_strtoul(buf, NULL, 10) ? 1 : 0;
+	if (!ad_chip->irq_coalesce) {
+		del_timer(&ad_chip->flush_timer);
+		spisnif_set_irq_pnum_trig(ad_chip, 1);
+	}
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return size;
 }
 
-static ssize_t show_ext_trig_inv(struct device *dev,
-				struct device_attribute *attr,
-				char *buf) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+static ssize_t show_irq_pnum_trig(struct device *dev,
+				  struct device_attribute *attr,
+				  char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-	return sprintf(buf, "%d\n",
-		       (ad_read_reg(ad_chip, SPISNIF_REG_CONTROL)&SPISNIF_CONTROL_MASK_EXT_TRIG_INV)
-		       >>9);
+	return sprintf(buf, "%d\n", ad_chip->irq_pnum_trig);
 }
 
-static ssize_t store_ext_trig_inv(struct device *dev,
-				struct device_attribute *attr,
-				const char *buf, size_t size) {
-	struct platform_device *pdev =
-		container_of(dev, struct platform_device, dev);
-	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
-	int ext_trig_inv, reg_value;
+/* fixed threshold, only meaningful with irq_coalesce at 0 */
+static ssize_t store_irq_pnum_trig(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	int trig;
+
+	trig = simple_strtoul(buf, NULL, 10);
+	if ((trig < 1) || (trig > SPISNIF_PACKET_NUM_MAX))
+		return -EINVAL;
+
+	mutex_lock(&ad_chip->drain_lock);
+	spisnif_set_irq_pnum_trig(ad_chip, trig);
+	mutex_unlock(&ad_chip->drain_lock);
+
+	return size;
+}
+
+static ssize_t show_irq_pnum_max(struct device *dev,
+				 struct device_attribute *attr,
+				 char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-	ext_trig_inv = simple_strtoul(buf, NULL, 10);
-	if ((ext_trig_inv < 0) || (ext_trig_inv > 1))
-		return size;
+	return sprintf(buf, "%d\n", ad_chip->irq_pnum_max);
+}
 
-	reg_value = ad_read_reg(ad_chip, SPISNIF_REG_CONTROL);
-	if (reg_value < 0)
-		return size;
+static ssize_t store_irq_pnum_max(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	int trig_max;
 
-	reg_value = reg_value&(~SPISNIF_CONTROL_MASK_EXT_TRIG_INV);
+	trig_max = simple_strtoul(buf, NULL, 10);
+	if ((trig_max < 1) || (trig_max > SPISNIF_PACKET_NUM_MAX))
+		return -EINVAL;
 
-	ad_write_reg(ad_chip,
-		     SPISNIF_REG_CONTROL,
-		     reg_value | (ext_trig_inv<<9));
+	mutex_lock(&ad_chip->drain_lock);
+	ad_chip->irq_pnum_max = trig_max;
+	if (ad_chip->irq_coalesce && (ad_chip->irq_pnum_trig > trig_max))
+		spisnif_set_irq_pnum_trig(ad_chip, trig_max);
+	mutex_unlock(&ad_chip->drain_lock);
 
 	return size;
 }
 
+static ssize_t show_irq_max_latency(struct device *dev,
+				    struct device_attribute *attr,
+				    char *buf)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
 
-static DEVICE_ATTR(fifo_base_addr, S_IRUGO, show_fifo_base_addr, 0);
-static DEVICE_ATTR(fifo_v1_size, S_IRUGO, show_fifo_v1_size, 0);
-static DEVICE_ATTR(fifo_v2_size, S_IRUGO, show_fifo_v2_size, 0);
-static DEVICE_ATTR(fifo_v3_size, S_IRUGO, show_fifo_v3_size, 0);
-static DEVICE_ATTR(fifo_v4_size, S_IRUGO, show_fifo_v4_size, 0);
-static DEVICE_ATTR(fifo_v5_size, S_IRUGO, show_fifo_v5_size, 0);
-static DEVICE_ATTR(fifo_v6_size, S_IRUGO, show_fifo_v6_size, 0);
+	return sprintf(buf, "%d\n", ad_chip->irq_max_latency);
+}
 
-/* controls */
-static DEVICE_ATTR(oversampling, S_IRUGO | S_IWUGO, show_oversampling, store_oversampling);
-static DEVICE_ATTR(ack_fifo, S_IWUGO, 0, store_ack_fifo);
-static DEVICE_ATTR(ext_trig, S_IRUGO | S_IWUGO, show_ext_trig, store_ext_trig);
-static DEVICE_ATTR(ext_trig_inv, S_IRUGO | S_IWUGO, show_ext_trig_inv, store_ext_trig_inv);
+static ssize_t store_irq_max_latency(struct device *dev,
+				     struct device_attribute *attr,
+				     const char *buf, size_t size)
+{
+	struct spisnif_chip *ad_chip = dev_get_drvdata(dev);
+	int latency;
+
+	latency = simple_strtoul(buf, NULL, 10);
+	if (latency < 1)
+		return -EINVAL;
 
-static DEVICE_ATTR(prescaler, S_IRUGO | S_IWUGO, show_prescaler, store_prescaler);
+	mutex_lock(&ad_chip->drain_lock);
+	ad_chip->irq_max_latency = latency;
+	mutex_unlock(&ad_chip->drain_lock);
+
+	return size;
+}
+
+static DEVICE_ATTR(fifo_base_addr, S_IRUGO, show_fifo_base_addr, 0);
+static DEVICE_ATTR(dev_number, S_IRUGO, show_dev_number, 0);
+
+/* interrupt coalescing */
+static DEVICE_ATTR(irq_coalesce, S_IRUGO | S_IWUSR,
+		   show_irq_coalesce, store_irq_coalesce);
+static DEVICE_ATTR(irq_pnum_trig, S_IRUGO | S_IWUSR,
+		   show_irq_pnum_trig, store_irq_pnum_trig);
+static DEVICE_ATTR(irq_pnum_max, S_IRUGO | S_IWUSR,
+		   show_irq_pnum_max, store_irq_pnum_max);
+static DEVICE_ATTR(irq_max_latency, S_IRUGO | S_IWUSR,
+		   show_irq_max_latency, store_irq_max_latency);
+
+/* SPI protocol configuration */
+static DEVICE_ATTR(cpol, S_IRUGO | S_IWUSR, show_cpol, store_cpol);
+static DEVICE_ATTR(cpha, S_IRUGO | S_IWUSR, show_cpha, store_cpha);
+static DEVICE_ATTR(cspol, S_IRUGO | S_IWUSR, show_cspol, store_cspol);
+static DEVICE_ATTR(lanes, S_IRUGO | S_IWUSR, show_lanes, store_lanes);
+static DEVICE_ATTR(sample_delay, S_IRUGO | S_IWUSR,
+		   show_sample_delay, store_sample_delay);
+
+/* packets filter and trigger */
+static DEVICE_ATTR(filter_enable, S_IRUGO | S_IWUSR,
+		   show_filter_enable, store_filter_enable);
+static DEVICE_ATTR(filter_exclude, S_IRUGO | S_IWUSR,
+		   show_filter_exclude, store_filter_exclude);
+static DEVICE_ATTR(filter_trigger, S_IRUGO | S_IWUSR,
+		   show_filter_trigger, store_filter_trigger);
+static DEVICE_ATTR(filter_post, S_IRUGO | S_IWUSR,
+		   show_filter_post, store_filter_post);
+static DEVICE_ATTR(filter_state, S_IRUGO, show_filter_state, 0);
+static DEVICE_ATTR(filter_match, S_IRUGO | S_IWUSR,
+		   show_filter_match, store_filter_match);
+static DEVICE_ATTR(filter_mask, S_IRUGO | S_IWUSR,
+		   show_filter_mask, store_filter_mask);
+
+/* chip selects */
+static DEVICE_ATTR(cs_mask, S_IRUGO | S_IWUSR, show_cs_mask, store_cs_mask);
+
+/* capture statistics, updated at each drain */
+static DEVICE_ATTR(dropped_records, S_IRUGO, show_dropped_records, 0);
+static DEVICE_ATTR(fifo_overflows, S_IRUGO, show_fifo_overflows, 0);
+static DEVICE_ATTR(lost_packets, S_IRUGO, show_lost_packets, 0);
+static DEVICE_ATTR(lost_bits, S_IRUGO, show_lost_bits, 0);
+static DEVICE_ATTR(sck_rate, S_IRUGO, show_sck_rate, 0);
+static DEVICE_ATTR(dma_pending, S_IRUGO, show_dma_pending, 0);
+static DEVICE_ATTR(captured_packets, S_IRUGO, show_captured_packets, 0);
+static DEVICE_ATTR(captured_bits, S_IRUGO, show_captured_bits, 0);
+static DEVICE_ATTR(drains, S_IRUGO, show_drains, 0);
+static DEVICE_ATTR(drain_time_total, S_IRUGO, show_drain_time_total, 0);
+static DEVICE_ATTR(drain_time_max, S_IRUGO, show_drain_time_max, 0);
+static DEVICE_ATTR(fifo_high_water, S_IRUGO, show_fifo_high_water, 0);
+static DEVICE_ATTR(dma_high_water, S_IRUGO, show_dma_high_water, 0);
+static DEVICE_ATTR(ring_high_water, S_IRUGO, show_ring_high_water, 0);
+static DEVICE_ATTR(irq_latency, S_IRUGO, show_irq_latency, 0);
+static DEVICE_ATTR(stats_reset, S_IWUSR, 0, store_stats_reset);
+
+static struct attribute *spisnif_attrs[] = {
+	&dev_attr_fifo_base_addr.attr,
+	&dev_attr_dev_number.attr,
+	&dev_attr_cpol.attr,
+	&dev_attr_cpha.attr,
+	&dev_attr_cspol.attr,
+	&dev_attr_lanes.attr,
+	&dev_attr_sample_delay.attr,
+	&dev_attr_dropped_records.attr,
+	&dev_attr_fifo_overflows.attr,
+	&dev_attr_lost_packets.attr,
+	&dev_attr_lost_bits.attr,
+	&dev_attr_sck_rate.attr,
+	&dev_attr_dma_pending.attr,
+	&dev_attr_captured_packets.attr,
+	&dev_attr_captured_bits.attr,
+	&dev_attr_drains.attr,
+	&dev_attr_drain_time_total.attr,
+	&dev_attr_drain_time_max.attr,
+	&dev_attr_fifo_high_water.attr,
+	&dev_attr_dma_high_water.attr,
+	&dev_attr_ring_high_water.attr,
+	&dev_attr_irq_latency.attr,
+	&dev_attr_stats_reset.attr,
+	&dev_attr_irq_coalesce.attr,
+	&dev_attr_irq_pnum_trig.attr,
+	&dev_attr_irq_pnum_max.attr,
+	&dev_attr_irq_max_latency.attr,
+	&dev_attr_filter_enable.attr,
+	&dev_attr_filter_exclude.attr,
+	&dev_attr_filter_trigger.attr,
+	&dev_attr_filter_post.attr,
+	&dev_attr_filter_state.attr,
+	&dev_attr_filter_match.attr,
+	&dev_attr_filter_mask.attr,
+	&dev_attr_cs_mask.attr,
+	NULL,
+};
+
+static struct attribute_group spisnif_attr_group = {
+	.attrs = spisnif_attrs,
+};
 
 static int spisnif_probe(struct platform_device *pdev)
 {
 	struct spisnif_chip *ad_chip;
 	struct resource *resource_memory, *resource_irq;
+	u16 config;
 	int ret = 0;
 
 	resource_memory = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -452,6 +1812,7 @@ static int spisnif_probe(struct platform_device *pdev)
 
 	ad_chip->resource_mem = resource_memory;
 	ad_chip->resource_irq = resource_irq;
+	ad_chip->pdev = pdev;
 
 	dev_set_drvdata(&pdev->dev, ad_chip);
 
@@ -461,88 +1822,76 @@ static int spisnif_probe(struct platform_device *pdev)
 		ret = -EIO;
 		goto free_chip;
 	}
-
-	/* Create sysfs */
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_base_addr);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_base_addr\n");
-		goto exit_iounmap;
-	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v1_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v1_size\n");
-		goto error_remove_file_fifo_base_addr;
-	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v2_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v2_size\n");
-		goto error_remove_file_fifo_v1_size;
-	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v3_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v3_size\n");
-		goto error_remove_file_fifo_v2_size;
-	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v4_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v4_size\n");
-		goto error_remove_file_fifo_v3_size;
-	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v5_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v5_size\n");
-		goto error_remove_file_fifo_v4_size;
+	if ((resource_memory->flags & IORESOURCE_MEM_TYPE_MASK) ==
+	    IORESOURCE_MEM_32BIT)
+		ad_chip->reg_shift = 2;
+	else
+		ad_chip->reg_shift = 1;
+	config = ad_read_reg(ad_chip, SPISNIF_REG_CONFIG);
+	ad_chip->rle = (config & SPISNIF_CONFIG_MASK_RLE) ? 1 : 0;
+	ad_chip->cs_bits = (config & SPISNIF_CONFIG_MASK_CS_BITS) >>
+			   __ffs(SPISNIF_CONFIG_MASK_CS_BITS);
+	ad_chip->lane_bits = (config & SPISNIF_CONFIG_MASK_LANE_FLD) ? 2 : 0;
+
+	/* drain buffer */
+	ad_chip->drain_buf = kmalloc(sizeof(struct spisnif_record) +
+				     2*2*SPISNIF_MXSX_WORDS, GFP_KERNEL);
+	if (!ad_chip->drain_buf) {
+		ret = -ENOMEM;
+		goto free_drain_buf;
 	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_fifo_v6_size);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../fifo_v6_size\n");
-		goto error_remove_file_fifo_v5_size;
+	if (ad_chip->reg_shift == 2) {
+		ad_chip->pair_buf = kmalloc(4*SPISNIF_MXSX_WORDS, GFP_KERNEL);
+		if (!ad_chip->pair_buf) {
+			ret = -ENOMEM;
+			goto free_drain_buf;
+		}
 	}
 
-	ret = device_create_file(&pdev->dev, &dev_attr_prescaler);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../prescaler\n");
-		goto error_remove_file_fifo_v6_size;
+	/* capture ring */
+	ret = kfifo_alloc(&ad_chip->fifo, ring_size, GFP_KERNEL);
+	if (ret) {
+		dev_err(&pdev->dev, "Can't allocate %d bytes ring\n", ring_size);
+		goto free_drain_buf;
 	}
-
-	ret = device_create_file(&pdev->dev, &dev_attr_oversampling);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../oversampling\n");
-		goto error_remove_file_prescaler;
+	mutex_init(&ad_chip->read_lock);
+	init_waitqueue_head(&ad_chip->wait_queue);
+	mutex_init(&ad_chip->drain_lock);
+	spin_lock_init(&ad_chip->flush_lock);
+	setup_timer(&ad_chip->flush_timer, spisnif_flush_timer,
+		    (unsigned long)ad_chip);
+	INIT_WORK(&ad_chip->flush_work, spisnif_flush);
+	ad_chip->irq_coalesce = 1;
+	ad_chip->irq_pnum_max = SPISNIF_IRQ_PNUM_MAX;
+	ad_chip->irq_max_latency = SPISNIF_IRQ_MAX_LATENCY_MS;
+
+	ad_chip->ring_map_size = PAGE_SIZE + PAGE_ALIGN(ring_size);
+	ad_chip->ring = vmalloc_user(ad_chip->ring_map_size);
+	if (!ad_chip->ring) {
+		ret = -ENOMEM;
+		dev_err(&pdev->dev, "Can't allocate mmap ring\n");
+		goto free_fifo;
 	}
+	ad_chip->ring_data = (u8 *)ad_chip->ring + PAGE_SIZE;
+	ad_chip->ring_data_size = PAGE_ALIGN(ring_size);
+	ad_chip->ring->magic = SPISNIF_RING_MAGIC;
+	ad_chip->ring->data_offset = PAGE_SIZE;
+	ad_chip->ring->data_size = ad_chip->ring_data_size;
 
-	ret = device_create_file(&pdev->dev, &dev_attr_ack_fifo);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../ack_fifo\n");
-		goto error_remove_file_oversampling;
-	}
-	ret = device_create_file(&pdev->dev, &dev_attr_ext_trig);
-	if (ret < 0) {
-		pr_err("Can't create /sys/../ext_trig\n");
-		goto error_remove_file_ack_fifo;
-	}
-	ret = device_create_file(&pdev->dev, &dev_attr_ext_trig_inv);
+	/* Create sysfs */
+	ret = sysfs_create_group(&pdev->dev.kobj, &spisnif_attr_group);
 	if (ret < 0) {
-		pr_err("Can't create /sys/../ext_trig_inv\n");
-		goto error_remove_file_ext_trig;
+		pr_err("Can't create sysfs attributes\n");
+		goto free_ring;
 	}
 
-	init_waitqueue_head(&ad_chip->wait_queue);
-	/* TODO: check return */
-
 	/* register file */
 	cdev_init(&ad_chip->cdev, &ad_fops);
 	ad_chip->cdev.owner = THIS_MODULE;
-	ret = alloc_chrdev_region(&ad_chip->devt, 0, 5, DRIVER_NAME);
+	ret = alloc_chrdev_region(&ad_chip->devt, 0, 1, DRIVER_NAME);
 	if (ret < 0) {
 		pr_err("Can't allocating major/minor number\n");
-		goto error_remove_file_ext_trig_inv;
+		goto error_remove_group;
 	}
 
 	ret = cdev_add(&ad_chip->cdev, ad_chip->devt, 1);
@@ -556,41 +1905,47 @@ static int spisnif_probe(struct platform_device *pdev)
 
 	/* TODO: check ID */
 
-	ret = request_irq(resource_irq->start, ad_interrupt,
-			  0, "spisnif", ad_chip);
+	spisnif_set_irq_pnum_trig(ad_chip, 1);
+	spisnif_reset_fifos(ad_chip);
+
+	/* without a ring, packets are still read through the stream window */
+	if ((config & SPISNIF_CONFIG_MASK_DMA) && (dma_size > 0)) {
+		ret = spisnif_dma_start(ad_chip);
+		if (ret < 0)
+			dev_warn(&pdev->dev,
+				 "Can't set up %d bytes dma ring (%d)\n",
+				 dma_size, ret);
+		else
+			dev_info(&pdev->dev, "dma ring of %u bytes\n",
+				 ad_chip->dma_size);
+	}
+
+	ret = request_threaded_irq(resource_irq->start, ad_interrupt,
+				   ad_irq_thread, IRQF_ONESHOT,
+				   "spisnif", ad_chip);
 	if (ret) {
 		dev_err(&pdev->dev, "Can't request irq %d\n",
 			resource_irq->start);
-		goto error_unregister_chrdev;
+		goto error_dma_stop;
 	}
 
 	/* end probe */
 	return 0;
 
-/*error_free_irq:*/
-	free_irq(resource_irq->start, ad_chip);
-error_unregister_chrdev:
-	unregister_chrdev(ad_chip->devt, DRIVER_NAME);
-error_unregister_chrdev_region:
-	unregister_chrdev_region(ad_chip->devt, 5);
+error_dma_stop:
+	spisnif_dma_stop(ad_chip);
 	cdev_del(&ad_chip->cdev);
-error_remove_file_ext_trig_inv:
-	device_remove_file(&pdev->dev, &dev_attr_ext_trig_inv);
-error_remove_file_ext_trig:
-	device_remove_file(&pdev->dev, &dev_attr_ext_trig);
-error_remove_file_ack_fifo:
-	device_remove_file(&pdev->dev, &dev_attr_ack_fifo);
-error_remove_file_oversampling:
-	device_remove_file(&pdev->dev, &dev_attr_oversampling);
-error_remove_file_prescaler:
-	device_remove_file(&pdev->dev, &dev_attr_prescaler);
-error_remove_file_fifo_v6_size:
-	device_remove_file(&pdev->dev, &dev_attr_fifo_v6_size);
-error_remove_file_fifo_v5_size:
-	device_remove_file(&pdev->dev, &dev_attr_fifo_v5_size);
-error_remove_file_fifo_base_addr:
-	device_remove_file(&pdev->dev, &dev_attr_fifo_base_addr);
-exit_iounmap:
+error_unregister_chrdev_region:
+	unregister_chrdev_region(ad_chip->devt, 1);
+error_remove_group:
+	sysfs_remove_group(&pdev->dev.kobj, &spisnif_attr_group);
+free_ring:
+	vfree(ad_chip->ring);
+free_fifo:
+	kfifo_free(&ad_chip->fifo);
+free_drain_buf:
+	kfree(ad_chip->pair_buf);
+	kfree(ad_chip->drain_buf);
 	iounmap(ad_chip->reg_base);
 free_chip:
 	kfree(ad_chip);
@@ -604,19 +1959,26 @@ error_exit:
 static int spisnif_remove(struct platform_device *pdev)
 {
 	struct spisnif_chip *ad_chip = dev_get_drvdata(&pdev->dev);
+	unsigned long flags;
 
 	free_irq(ad_chip->resource_irq->start, ad_chip);
-	unregister_chrdev(ad_chip->devt, DRIVER_NAME);
-	unregister_chrdev_region(ad_chip->devt, 5);
+	/* a running flush could arm the timer again, and the timer, read()
+	 * or poll() schedule the flush: stop both first */
+	mutex_lock(&ad_chip->drain_lock);
+	spin_lock_irqsave(&ad_chip->flush_lock, flags);
+	ad_chip->shutdown = 1;
+	spin_unlock_irqrestore(&ad_chip->flush_lock, flags);
+	mutex_unlock(&ad_chip->drain_lock);
+	cancel_work_sync(&ad_chip->flush_work);
+	del_timer_sync(&ad_chip->flush_timer);
+	spisnif_dma_stop(ad_chip);
 	cdev_del(&ad_chip->cdev);
-	device_remove_file(&pdev->dev, &dev_attr_ext_trig_inv);
-	device_remove_file(&pdev->dev, &dev_attr_ext_trig);
-	device_remove_file(&pdev->dev, &dev_attr_ack_fifo);
-	device_remove_file(&pdev->dev, &dev_attr_prescaler);
-	device_remove_file(&pdev->dev, &dev_attr_fifo_v2_size);
-	device_remove_file(&pdev->dev, &dev_attr_fifo_v1_size);
-	device_remove_file(&pdev->dev, &dev_attr_fifo_base_addr);
-	free_irq(ad_chip->resource_irq->start, ad_chip);
+	unregister_chrdev_region(ad_chip->devt, 1);
+	sysfs_remove_group(&pdev->dev.kobj, &spisnif_attr_group);
+	vfree(ad_chip->ring);
+	kfifo_free(&ad_chip->fifo);
+	kfree(ad_chip->pair_buf);
+	kfree(ad_chip->drain_buf);
 	iounmap(ad_chip->reg_base);
 	release_mem_region(ad_chip->resource_mem->start,
 		   resource_size(ad_chip->resource_mem));
@@ -22,5 +22,165 @@
 #ifndef __SPISNIF_H__
 #define __SPISNIF_H__
 
+#include <linux/types.h>
+
+/*
+ * read() on /dev/spisnif returns whole records only, each one is this
+ * header followed by mosi_words MOSI words then miso_words MISO words,
+ * as read from the fifos (first received bit in lsb).
+ * ts_start and ts_end are the component gls_clk counter at CS assert and
+ * deassert, wrapping at 2^32.
+ */
+struct spisnif_record {
+	__u16 bit_num;
+	__u16 flags;
+	__u16 mosi_words;
+	__u16 miso_words;
+	__u32 ts_start;
+	__u32 ts_end;
+};
+
+#define SPISNIF_RECORD_SIZE(rec) (sizeof(struct spisnif_record) + \
+		2*((rec)->mosi_words + (rec)->miso_words))
+
+/* record flags */
+#define SPISNIF_RECORD_PAD	(1<<15)	/* end of ring, next record at 0 */
+#define SPISNIF_RECORD_RLE	(1<<0)	/* words run length encoded */
+#define SPISNIF_RECORD_LOSS	(1<<1)	/* loss marker, see below */
+#define SPISNIF_RECORD_CS_SHIFT	8	/* chip select index, cs_num generic */
+#define SPISNIF_RECORD_CS_MASK	(0x7<<SPISNIF_RECORD_CS_SHIFT)
+#define SPISNIF_RECORD_CS(rec)	\
+	(((rec)->flags & SPISNIF_RECORD_CS_MASK) >> SPISNIF_RECORD_CS_SHIFT)
+#define SPISNIF_RECORD_LANES_SHIFT	11	/* lanes generic above 1 */
+#define SPISNIF_RECORD_LANES_MASK	(0x3<<SPISNIF_RECORD_LANES_SHIFT)
+/* data lanes of the record: 1, 2 (dual) or 4 (quad) */
+#define SPISNIF_RECORD_LANES(rec)	\
+	(1 << (((rec)->flags & SPISNIF_RECORD_LANES_MASK) >> \
+	       SPISNIF_RECORD_LANES_SHIFT))
+
+/*
+ * Dual records hold data 0 in MOSI words and data 1 in MISO words, one bit
+ * per sck edge as in single records. Quad records hold data 0 and 2 in
+ * MOSI words and data 1 and 3 in MISO words, two bits per sck edge, so
+ * bit_num is twice the edges number.
+ */
+
+/*
+ * SPISNIF_RECORD_LOSS records are queued after a drain that found losses
+ * since previous marker: bit_num, miso_words and timestamps are 0 and the
+ * mosi_words words hold a struct spisnif_loss. Counts saturate.
+ */
+struct spisnif_loss {
+	__u16 packets;		/* packets the component could not record */
+	__u16 overflows;	/* times fifos ran out of room */
+	__u32 bits;		/* bits of these packets */
+	__u32 records;		/* records dropped on a full capture ring */
+};
+
+/*
+ * SPISNIF_RECORD_RLE records (component built with rle generic) hold each
+ * lane as stored in fifo_mxsx: a word equal to the previous one is
+ * followed by the number of its further copies, then encoding starts
+ * again. mosi_words and miso_words are stored words, each lane expands
+ * to (bit_num + 15)/16 words.
+ */
+
+/*
+ * mmap() of /dev/spisnif maps a ring made of this header page followed by
+ * data_size bytes of records. While mapped, the driver queues records in
+ * the ring instead of read() buffer: it writes records at head and
+ * userspace consumes them at tail, both are byte offsets in the records
+ * area. Records start on SPISNIF_RING_ALIGN boundaries and never wrap, a
+ * SPISNIF_RECORD_PAD record marks an unused end of area. The driver only
+ * reads tail back: a tail outside the area, or not aligned, makes it drop
+ * records as if the ring was full.
+ */
+#define SPISNIF_RING_MAGIC	0x534E4946	/* "SNIF" */
+#define SPISNIF_RING_ALIGN(len)	(((len) + 7) & ~7)
+
+struct spisnif_ring_header {
+	__u32 magic;
+	__u32 data_offset;	/* from start of mapping */
+	__u32 data_size;
+	__u32 head;		/* written by driver */
+	__u32 tail;		/* written by userspace */
+};
+
+#ifndef __KERNEL__
+/* expand one rle lane of src_words words into dst_words words, or only
+ * check it if dst is NULL, return -1 if src does not expand to dst_words
+ * exactly */
+static inline int spisnif_rle_expand(__u16 *dst, int dst_words,
+				     const __u16 *src, int src_words)
+{
+	int i, n = 0, prev_valid = 0;
+	unsigned int count;
+	__u16 prev = 0;
+
+	for (i = 0; i < src_words; i++) {
+		if (n == dst_words)
+			return -1;
+		if (dst != NULL)
+			dst[n] = src[i];
+		n++;
+		if (!prev_valid || src[i] != prev) {
+			prev = src[i];
+			prev_valid = 1;
+			continue;
+		}
+		/* pair, count of further copies follows */
+		if (++i == src_words)
+			return -1;
+		count = src[i];
+		if (count > (unsigned int)(dst_words - n))
+			return -1;
+		if (dst != NULL) {
+			while (count--)
+				dst[n++] = prev;
+		} else
+			n += count;
+		prev_valid = 0;
+	}
+
+	return (n == dst_words) ? 0 : -1;
+}
+
+/* next record to consume, NULL if ring is empty */
+static inline struct spisnif_record *
+spisnif_ring_peek(struct spisnif_ring_header *hdr)
+{
+	unsigned char *data = (unsigned char *)hdr + hdr->data_offset;
+	struct spisnif_record *rec;
+	__u32 tail = hdr->tail;
+
+	if (tail == *(volatile __u32 *)&hdr->head)
+		return NULL;
+	__sync_synchronize();
+
+	rec = (struct spisnif_record *)(data + tail);
+	if (rec->flags & SPISNIF_RECORD_PAD) {
+		*(volatile __u32 *)&hdr->tail = 0;
+		if (*(volatile __u32 *)&hdr->head == 0)
+			return NULL;
+		rec = (struct spisnif_record *)data;
+	}
+
+	return rec;
+}
+
+/* give rec space back to the driver */
+static inline void spisnif_ring_release(struct spisnif_ring_header *hdr,
+					struct spisnif_record *rec)
+{
+	unsigned char *data = (unsigned char *)hdr + hdr->data_offset;
+	__u32 tail = (unsigned char *)rec - data +
+		     SPISNIF_RING_ALIGN(SPISNIF_RECORD_SIZE(rec));
+
+	if (tail == hdr->data_size)
+		tail = 0;
+	__sync_synchronize();
+	*(volatile __u32 *)&hdr->tail = tail;
+}
+#endif
 
 #endif /* __SPISNIF_H__ */
@@ -28,18 +28,39 @@ use IEEE.numeric_std.all;
 
 Entity fifo_mxsx is
 generic(	ram_num : natural := 1;
-		ram_size : natural := 1024);
+		ram_size : natural := 1024;
+		-- split rams in two banks, written and read alternately
+		ping_pong : boolean := false;
+		-- store runs of identical words as two words and a count
+		rle : boolean := false);
 port (
 	clk : in std_logic;
 	reset : in std_logic;
 	init : in std_logic;
+	-- one cycle pulse per data bit (sck capture edge)
 	write : in std_logic;
 	read_data : in std_logic;
 	data_in : in std_logic;
 	write_enable : in std_logic;
 	is_empty : out std_logic;
 	is_full : out std_logic;
-	data_out : out std_logic_vector(15 downto 0));
+	data_out : out std_logic_vector(15 downto 0);
+	-- ping pong: swap banks, only when write_enable is low
+	swap : in std_logic := '0';
+	-- drop last packet: write index back to its first bit, only when
+	-- write_enable is low
+	discard : in std_logic := '0';
+	-- rle: run count still being written, and words stored for last
+	-- packet once busy is low
+	busy : out std_logic;
+	packet_words : out std_logic_vector(15 downto 0);
+	-- quad lanes: data_in2 is written after data_in on each write pulse,
+	-- pulses must then be 2 cycles apart at least
+	double : in std_logic := '0';
+	data_in2 : in std_logic := '0';
+	-- bits of current packet not stored for lack of room, until next
+	-- packet start
+	lost : out std_logic);
 end entity;
 
 Architecture fifo_mxsx_1 of fifo_mxsx is
@@ -59,24 +80,91 @@ Architecture fifo_mxsx_1 of fifo_mxsx is
 	);
 	end component;
 
+	function bank_words return natural is
+	begin
+		if ping_pong then
+			return (ram_num*ram_size)/2;
+		end if;
+		return ram_num*ram_size;
+	end function;
+	constant bank_size : natural := bank_words;
+
 	-- DATA FIFO
 	signal data_write_idx : integer range 0 to (ram_num*ram_size*16)-1 := 0;
+	-- write index on last packet start, restored on discard
+	signal packet_write_idx : integer range 0 to (ram_num*ram_size*16)-1 := 0;
 	signal data_read_idx : integer range 0 to (ram_num*ram_size)-1 := 0;
+	-- ping pong: write bank, read bank is the other one, and words
+	-- frozen in read bank on swap
+	signal bank : natural range 0 to 1 := 0;
+	signal frozen_words : natural range 0 to bank_size := 0;
+	-- no room for next bit: single bank keeps one free word before read
+	-- index, ping pong bank last word is not readable once frozen
+	signal no_room : std_logic;
+	signal lost_bits : std_logic := '0';
+	-- rams addresses
+	signal write_bit_addr : integer range 0 to (ram_num*ram_size*16)-1 := 0;
+	signal read_word_addr : integer range 0 to (ram_num*ram_size)-1 := 0;
+
+	-- Run length encoding, per packet: a word equal to the previous one
+	-- is stored, and the next word slot is reserved for the number of
+	-- following copies, which are not stored. The count is written bit
+	-- by bit on cycles without data bit write.
+	signal cur_word : std_logic_vector(14 downto 0) := (others => '0');
+	signal prev_word : std_logic_vector(15 downto 0) := (others => '0');
+	signal prev_valid : std_logic := '0';
+	signal in_run : std_logic := '0';
+	signal run_count : unsigned(15 downto 0) := (others => '0');
+	-- reserved count slot, first bit index
+	signal count_idx : integer range 0 to (ram_num*ram_size*16)-1 := 0;
+	signal count_value : std_logic_vector(15 downto 0) := (others => '0');
+	-- count bits left to write
+	signal count_left : natural range 0 to 16 := 0;
+	-- pending count belongs to current packet, cancelled by discard
+	signal count_in_packet : std_logic := '0';
+	signal count_write : std_logic;
+	-- room for a count slot after current word
+	signal run_room : boolean;
+	signal ram_bit_addr : integer range 0 to (ram_num*ram_size*16)-1 := 0;
 
 	-- RAM signals
 	signal read_addr : std_logic_vector(9+ram_num downto 0);
 	signal write_addr : std_logic_vector(ram_num+13 downto 0);
 	signal write_ram : std_logic;
 	signal write_data : std_logic_vector(0 downto 0);
+	-- second bit of a double write, written on next cycle
+	signal write_second : std_logic;
+	signal second_data : std_logic;
+	signal ram_data : std_logic_vector(0 downto 0);
+	signal ram_write : std_logic;
 
 	type word_array is array (natural range <>) of std_logic_vector(15 downto 0);
 	signal rams_out_data : word_array(ram_num - 1 downto 0) := (others => (others => '0'));
 	signal write_rams : std_logic_vector(ram_num-1 downto 0);
 begin
 
+	-- Bank offset, none when ping_pong is off
+	write_bit_addr <= bank*bank_size*16 + data_write_idx;
+	read_word_addr <= (1 - bank)*bank_size + data_read_idx when ping_pong
+			  else data_read_idx;
+
+	-- Data bits have priority over run count bits
+	count_write <= '1' when rle and count_left /= 0 and write_ram = '0' else '0';
+	ram_write <= write_ram or count_write;
+	ram_bit_addr <= bank*bank_size*16 + count_idx + 16 - count_left when count_write = '1'
+			else write_bit_addr;
+	ram_data(0) <= count_value(16 - count_left) when count_write = '1'
+		       else write_data(0);
+
+	busy <= '1' when count_left /= 0 else '0';
+	run_room <= (data_write_idx + 17 < bank_size*16) when ping_pong else
+		    ((data_write_idx/16 + 1) mod ram_size) /= data_read_idx and
+		    ((data_write_idx/16 + 2) mod ram_size) /= data_read_idx;
+	lost <= lost_bits;
+
 	-- Integer to vector conversion for read and write indexes
-	read_addr <= std_logic_vector(to_unsigned(data_read_idx, ram_num+10));
-	write_addr <= std_logic_vector(to_unsigned(data_write_idx, ram_num+14));
+	read_addr <= std_logic_vector(to_unsigned(read_word_addr, ram_num+10));
+	write_addr <= std_logic_vector(to_unsigned(ram_bit_addr, ram_num+14));
 
 	-- Ram instanciation
 	inst_rams : for i in 0 to ram_num-1 generate
@@ -85,33 +173,142 @@ begin
 		port map ( 	clk => clk,
 				write => write_rams(i),
 				addr_1b => write_addr(13 downto 0),
-				din_1b => write_data,
+				din_1b => ram_data,
 				addr_16b => read_addr(9 downto 0),
 				dout_16b => rams_out_data(i));
 
-		write_rams(i) <= 	'1' when (data_write_idx/ram_size=i) and (write_ram = '1')
+		write_rams(i) <= 	'1' when (ram_bit_addr/(ram_size*16)=i) and (ram_write = '1')
 					else '0';
 	end generate inst_rams;
 
 	-- Read datas
-	data_out <= 	rams_out_data(data_read_idx/ram_size) when data_read_idx < ram_num*ram_size
+	data_out <= 	rams_out_data(read_word_addr/ram_size) when read_word_addr < ram_num*ram_size
 			else (others => '0');
 
+	-- Words stored for last packet, the single bank write index wraps
+	packet_words <= std_logic_vector(to_unsigned(
+				((data_write_idx - packet_write_idx) mod (ram_size*16)) / 16, 16));
+
 	-- Increment write index on each write in RAM
 	-- Align write index to the next 16 bits word when write enable is falling (i.e transmission complete)
 	write_index_management : process(clk, reset)
 		variable write_enable_old : std_logic := '0';
+		variable full_word : std_logic_vector(15 downto 0);
 	begin
 		if reset = '1' then
 			data_write_idx <= 0;
+			packet_write_idx <= 0;
+			bank <= 0;
+			frozen_words <= 0;
+			cur_word <= (others => '0');
+			prev_word <= (others => '0');
+			prev_valid <= '0';
+			in_run <= '0';
+			run_count <= (others => '0');
+			count_idx <= 0;
+			count_value <= (others => '0');
+			count_left <= 0;
+			count_in_packet <= '0';
+			lost_bits <= '0';
 			write_enable_old := '0';
 		elsif rising_edge(clk) then
+			if write_enable = '1' and write_enable_old = '0' then
+				packet_write_idx <= data_write_idx;
+			end if;
+
+			if init = '1' or (write_enable = '1' and write_enable_old = '0') then
+				lost_bits <= '0';
+			elsif write_ram = '1' and write_enable = '1' and no_room = '1' then
+				lost_bits <= '1';
+			end if;
+
+			-- Run length encoding state, runs do not span packets
+			full_word := write_data & cur_word;
+			if rle then
+				if count_write = '1' then
+					count_left <= count_left - 1;
+				end if;
+				if write_ram = '1' and write_enable = '1' and (data_write_idx mod 16) < 15 then
+					cur_word(data_write_idx mod 16) <= write_data(0);
+				end if;
+
+				if init = '1' or discard = '1' then
+					in_run <= '0';
+					prev_valid <= '0';
+					-- previous packet count is still written
+					if init = '1' or count_in_packet = '1' then
+						count_left <= 0;
+					end if;
+				elsif write_enable = '1' and write_enable_old = '0' then
+					in_run <= '0';
+					prev_valid <= '0';
+					count_in_packet <= '0';
+				elsif write_enable = '0' and write_enable_old = '1' and in_run = '1' then
+					-- packet ends in a run
+					in_run <= '0';
+					count_value <= std_logic_vector(run_count);
+					count_left <= 16;
+					count_in_packet <= '1';
+				elsif write_ram = '1' and write_enable = '1' and (data_write_idx mod 16) = 15 then
+					if in_run = '0' and prev_valid = '1' and full_word = prev_word and run_room then
+						-- pair stored, count slot reserved after it
+						in_run <= '1';
+						run_count <= (others => '0');
+						count_idx <= (data_write_idx + 1) mod (ram_size*16);
+					elsif in_run = '1' and full_word = prev_word and run_count /= x"FFFE" then
+						run_count <= run_count + 1;
+					elsif in_run = '1' and full_word = prev_word then
+						-- count saturates, run is closed
+						in_run <= '0';
+						prev_valid <= '0';
+						count_value <= x"FFFF";
+						count_left <= 16;
+						count_in_packet <= '1';
+					elsif in_run = '1' then
+						in_run <= '0';
+						prev_word <= full_word;
+						count_value <= std_logic_vector(run_count);
+						count_left <= 16;
+						count_in_packet <= '1';
+					else
+						prev_word <= full_word;
+						prev_valid <= '1';
+					end if;
+				end if;
+			end if;
+
 			if init = '1' then
 				data_write_idx <= 0;
-			elsif write_ram = '1' and write_enable = '1' then --Increase index
+				packet_write_idx <= 0;
+				bank <= 0;
+				frozen_words <= 0;
+			elsif discard = '1' then -- Forget last packet bits
+				data_write_idx <= packet_write_idx;
+			elsif ping_pong and swap = '1' then -- Freeze write bank, capture in the other one
+				bank <= 1 - bank;
+				frozen_words <= data_write_idx / 16;
+				data_write_idx <= 0;
+			elsif rle and write_ram = '1' and write_enable = '1' and
+			      (data_write_idx mod 16) = 15 and
+			      in_run = '1' and full_word = prev_word then
+				-- Copy in a run, overwritten by next word
+				data_write_idx <= data_write_idx - 15;
+			elsif rle and write_ram = '1' and write_enable = '1' and
+			      (data_write_idx mod 16) = 15 and
+			      in_run = '0' and prev_valid = '1' and full_word = prev_word and run_room then
+				-- Skip reserved count slot
+				data_write_idx <= (data_write_idx + 17) mod (ram_size*16);
+			elsif ping_pong then -- Bank indexes saturate, is_full is kept
+				if write_ram = '1' and write_enable = '1' and no_room = '0' then
+					data_write_idx <= data_write_idx + 1;
+				elsif write_enable = '0' and write_enable_old = '1' and (data_write_idx mod 16) > 0 and
+				      data_write_idx < (bank_size - 1)*16 then
+					data_write_idx <= ((data_write_idx / 16) + 1) * 16;
+				end if;
+			elsif write_ram = '1' and write_enable = '1' and no_room = '0' then --Increase index
 				data_write_idx <= (data_write_idx + 1) mod (ram_size*16);
 			elsif write_enable = '0' and write_enable_old = '1' and (data_write_idx mod 16) > 0 then -- Place write index on next 16 bit word
-				data_write_idx <= ((data_write_idx / 16) + 1) * 16;
+				data_write_idx <= (((data_write_idx / 16) + 1) * 16) mod (ram_size*16);
 			end if;
 
 			-- Old value update
@@ -127,7 +324,7 @@ begin
 			data_read_idx <= 0;
 			old_read_data := '0';
 		elsif rising_edge(clk) then
-			if init = '1' then
+			if init = '1' or (ping_pong and swap = '1') then
 				data_read_idx <= 0;
 			elsif read_data = '0' and old_read_data = '1' then -- Increment index
 				data_read_idx <= (data_read_idx + 1) mod ram_size;
@@ -138,31 +335,50 @@ begin
 		end if;
 	end process;
 
-	-- A write in RAM is triggered by a rising edge of "write" signal when "write_enable" is high
+	-- A write in RAM is triggered by a "write" pulse when "write_enable" is high
+	-- With double, data_in2 sampled with the same pulse is written on next cycle
 	write_ram_management : process(clk, reset)
-		variable old_write : std_logic := '0';
 	begin
 		if reset = '1' then
 			write_ram <= '0';
 			write_data <= "0";
-			old_write := '0';
+			write_second <= '0';
+			second_data <= '0';
 		elsif rising_edge(clk) then
-			if (old_write = '0') and (write = '1') and (write_enable = '1') then
+			if (write = '1') and (write_enable = '1') then
 				write_ram <= '1';
 				write_data(0) <= data_in;
+				write_second <= double;
+				second_data <= data_in2;
+			elsif write_second = '1' and write_enable = '1' then
+				write_ram <= '1';
+				write_data(0) <= second_data;
+				write_second <= '0';
 			else
 				write_ram <= '0';
+				write_second <= '0';
 			end if;
-
-			old_write := write;
 		end if;
 	end process;
 
 	-- Data FIFO status signals
-	is_empty <= 	'1' when data_write_idx = data_read_idx*16 else
-	'0';
+	single_bank : if not ping_pong generate
+		is_empty <= 	'1' when data_write_idx = data_read_idx*16 else
+		'0';
+
+		no_room <= 	'1' when ((data_write_idx/16 + 1) mod ram_size) = data_read_idx else
+		'0';
+	end generate single_bank;
+
+	-- Frozen bank is read, write bank is filled
+	two_banks : if ping_pong generate
+		is_empty <= 	'1' when data_read_idx = frozen_words else
+		'0';
+
+		no_room <= 	'1' when data_write_idx >= (bank_size - 1)*16 else
+		'0';
+	end generate two_banks;
 
-	is_full <= 	'1' when ((data_write_idx + 1) mod ram_size) = (data_read_idx*16) else
-	'0';
+	is_full <= no_room;
 
 end architecture fifo_mxsx_1;
@@ -29,7 +29,11 @@ use IEEE.numeric_std.all;
 Entity fifo_packet is
 generic (
     ram_num  : natural := 1;
-    ram_size : natural := 1024
+    ram_size : natural := 1024;
+    -- split rams in two banks, written and read alternately
+    ping_pong : boolean := false;
+    -- words written for each packet, pf_afull is set below that room
+    afull_words : natural := 1
 );
 port (
     gls_reset : in std_logic;
@@ -43,15 +47,35 @@ port (
     db_data : in std_logic_vector(15 downto 0);
     -- pfifo signals
     pf_full : out std_logic;
+    pf_afull : out std_logic;
     pf_empty : out std_logic;
     pf_init : in std_logic;
-    pf_count : out std_logic_vector(10 downto 0));
+    pf_count : out std_logic_vector(10 downto 0);
+    -- ping pong: swap banks, words in write bank
+    pf_swap : in std_logic := '0';
+    pf_wcount : out std_logic_vector(10 downto 0));
 end entity;
 
 Architecture fifo_packet_1 of fifo_packet is
-    -- read/write pointers
-    signal wb_count : natural range 0 to (ram_num * ram_size) := 0;
-    signal db_count : natural range 0 to (ram_num * ram_size) := 0;
+    function bank_words return natural is
+    begin
+        if ping_pong then
+            return (ram_num * ram_size) / 2;
+        end if;
+        return ram_num * ram_size;
+    end function;
+    constant bank_size : natural := bank_words;
+
+    -- read/write pointers, inside bank
+    signal wb_count : natural range 0 to bank_size := 0;
+    signal db_count : natural range 0 to bank_size := 0;
+    -- ping pong: write bank, read bank is the other one, and words
+    -- frozen in read bank on swap
+    signal bank : natural range 0 to 1 := 0;
+    signal frozen_count : natural range 0 to bank_size := 0;
+    -- ram addresses
+    signal wb_addr : natural range 0 to (ram_num * ram_size) := 0;
+    signal db_addr : natural range 0 to (ram_num * ram_size) := 0;
     signal wb_count_slv : std_logic_vector(ram_num + 9 downto 0) := (others => '0');
     signal db_count_slv : std_logic_vector(ram_num + 9 downto 0) := (others => '0');
 
@@ -72,18 +96,39 @@ Architecture fifo_packet_1 of fifo_packet is
     end component xilinx_dual_port_ram;
 
 begin
-    -- Packet count
-    pf_count <= std_logic_vector(to_unsigned(db_count - wb_count, 11));
+    single_bank : if not ping_pong generate
+        -- Packet count
+        pf_count <= std_logic_vector(to_unsigned(db_count - wb_count, 11));
+        pf_wcount <= std_logic_vector(to_unsigned(db_count - wb_count, 11));
+
+        -- Flags
+        wb_over_flag <= '1' when wb_count >= db_count else '0';
+        pf_empty <= '1' when db_count = wb_count else '0';
+
+        db_addr <= db_count;
+        wb_addr <= wb_count;
+    end generate single_bank;
+
+    two_banks : if ping_pong generate
+        -- Packet count of frozen bank
+        pf_count <= std_logic_vector(to_unsigned(frozen_count - wb_count, 11));
+        pf_wcount <= std_logic_vector(to_unsigned(db_count, 11));
+
+        -- Flags
+        wb_over_flag <= '1' when wb_count >= frozen_count else '0';
+        pf_empty <= '1' when frozen_count = wb_count else '0';
 
-    -- Flags
-    wb_over_flag <= '1' when wb_count >= db_count else '0';
-    pf_full <= '1' when db_count = (ram_num * ram_size) else '0';
-    pf_empty <= '1' when db_count = wb_count else '0';
+        db_addr <= bank * bank_size + db_count;
+        wb_addr <= (1 - bank) * bank_size + wb_count;
+    end generate two_banks;
 
-    db_count_slv <= std_logic_vector(to_unsigned(db_count, ram_num+10));
-    wb_count_slv <= std_logic_vector(to_unsigned(wb_count, ram_num+10));
+    pf_full <= '1' when db_count = bank_size else '0';
+    pf_afull <= '1' when db_count + afull_words > bank_size else '0';
 
-    wb_data <= rams_out_data(wb_count / ram_size) when wb_count /=
+    db_count_slv <= std_logic_vector(to_unsigned(db_addr, ram_num+10));
+    wb_count_slv <= std_logic_vector(to_unsigned(wb_addr, ram_num+10));
+
+    wb_data <= rams_out_data(wb_addr / ram_size) when wb_addr /=
                ram_num*ram_size else (others => '0');
 
     -- Rams instanciation
@@ -99,8 +144,8 @@ begin
             dout_a => rams_out_data(i)
         );
 
-        rams_write_en(i) <= '1' when (db_count/ram_size = i) and db_write = '1'
-                            else '0';
+        rams_write_en(i) <= '1' when (db_addr/ram_size = i) and db_write = '1'
+                            and db_count /= bank_size else '0';
     end generate rams_instances;
 
     triggers : process(gls_clk, gls_reset)
@@ -110,10 +155,22 @@ begin
         if gls_reset = '1' then
                 db_count <= 0;
                 wb_count <= 0;
+                bank <= 0;
+                frozen_count <= 0;
         elsif rising_edge(gls_clk) then
             if pf_init = '1' then
                 wb_count <= 0;
                 db_count <= 0;
+                bank <= 0;
+                frozen_count <= 0;
+            elsif ping_pong and pf_swap = '1' then
+                -- freeze write bank for reading, capture in the other one
+                bank <= 1 - bank;
+                frozen_count <= db_count;
+                db_count <= 0;
+                wb_count <= 0;
+                wb_rd_old := wb_rd;
+                db_write_old := db_write;
             else
                 -- wb_rd edges
                 if wb_rd_old = '1' and (wb_rd = '0') then
@@ -124,7 +181,8 @@ begin
                 wb_rd_old := wb_rd;
 
                 -- db_write edges
-                if db_write_old = '1' and (db_write = '0') then
+                if db_write_old = '1' and (db_write = '0') and
+                   db_count /= bank_size then
                     db_count <= db_count + 1;
                 else
                     db_count <= db_count;
@@ -23,7 +23,25 @@ generic(
     fifo_miso_num : natural := 1;
     fifo_mosi_num : natural := 1;
     fifo_packet_ram_num : natural := 3;
-    fifo_packet_ram_size : natural := 1024
+    fifo_packet_ram_size : natural := 1024;
+    -- packet info fifos (timestamps high and low halves) hold 2 words
+    -- per packet each (3 with rle), fifo_pinfo_ram_num/2 rams each
+    fifo_pinfo_ram_num : natural := 4;
+    -- 1: fifos rams are split in two banks swapped on host request
+    ping_pong : natural := 0;
+    -- wishbone data width, 16 or 32
+    wb_size : natural := 16;
+    -- 1: runs of identical words are stored as two words and a count
+    rle : natural := 0;
+    -- chip select inputs sharing the capture path, 1 to 8
+    cs_num : natural := 1;
+    -- data lanes, 1, 2 (dual) or 4 (quad, io2 and io3 inputs used)
+    lanes : natural := 1;
+    -- 1: sck and data inputs sampled on both gls_clk edges
+    ddr_sampling : natural := 0;
+    -- 1: wishbone master copies the packets stream to a ring in memory,
+    -- needs ping_pong 0
+    dma : natural := 0
 );
 port
 (
@@ -31,9 +49,9 @@ port
     gls_reset    : in std_logic;
     gls_clk      : in std_logic;
     -- Wishbone signals
-    wbs_add       : in std_logic_vector(2 downto 0);
-    wbs_writedata : in std_logic_vector(15 downto 0);
-    wbs_readdata  : out std_logic_vector(15 downto 0);
+    wbs_add       : in std_logic_vector(3 downto 0);
+    wbs_writedata : in std_logic_vector(wb_size-1 downto 0);
+    wbs_readdata  : out std_logic_vector(wb_size-1 downto 0);
     wbs_strobe    : in std_logic;
     wbs_cycle     : in std_logic;
     wbs_write     : in std_logic;
@@ -44,7 +62,19 @@ port
     sck  : in std_logic;
     mosi : in std_logic;
     miso : in std_logic;
-    cs   : in std_logic);
+    cs   : in std_logic;
+    -- CS1 to CS7, bit i is CS input i, bits from cs_num up are not used
+    cs_ext : in std_logic_vector(7 downto 1) := (others => '1');
+    -- quad lanes data 2 and 3, mosi and miso are data 0 and 1
+    io2 : in std_logic := '0';
+    io3 : in std_logic := '0';
+    -- dma master, stream words written at ring base + write offset
+    wbm_add       : out std_logic_vector(31 downto 0);
+    wbm_writedata : out std_logic_vector(wb_size-1 downto 0);
+    wbm_strobe    : out std_logic;
+    wbm_cycle     : out std_logic;
+    wbm_write     : out std_logic;
+    wbm_ack       : in std_logic := '0');
 end entity;
 
 ---------------------------------------------------------------------------
@@ -53,7 +83,9 @@ Architecture spisnif_1 of spisnif is
 
 	component fifo_mxsx
 	generic(ram_size : natural := 1024;
-		ram_num : natural := 1);
+		ram_num : natural := 1;
+		ping_pong : boolean := false;
+		rle : boolean := false);
 	port (
 		clk : in std_logic;
 		reset : in std_logic;
@@ -64,13 +96,22 @@ Architecture spisnif_1 of spisnif is
 		write_enable : in std_logic;
 		is_empty : out std_logic;
 		is_full : out std_logic;
-		data_out : out std_logic_vector(15 downto 0));
+		data_out : out std_logic_vector(15 downto 0);
+		swap : in std_logic := '0';
+		discard : in std_logic := '0';
+		busy : out std_logic;
+		packet_words : out std_logic_vector(15 downto 0);
+		double : in std_logic := '0';
+		data_in2 : in std_logic := '0';
+		lost : out std_logic);
 	end component fifo_mxsx;
 	
 	component fifo_packet
 	generic (
 	    ram_num          : natural := 3;
-	    ram_size : natural := 1024
+	    ram_size : natural := 1024;
+	    ping_pong : boolean := false;
+	    afull_words : natural := 1
 	);
 	port (
 	    gls_reset : in std_logic;
@@ -84,9 +125,12 @@ Architecture spisnif_1 of spisnif is
 	    db_data : in std_logic_vector(15 downto 0);
 	    -- pfifo signals
 	    pf_full : out std_logic;
+	    pf_afull : out std_logic;
 	    pf_empty : out std_logic;
 	    pf_init : in std_logic;
-	    pf_count : out std_logic_vector(10 downto 0));
+	    pf_count : out std_logic_vector(10 downto 0);
+	    pf_swap : in std_logic := '0';
+	    pf_wcount : out std_logic_vector(10 downto 0));
 	end component fifo_packet;
 
 	-- Mosi signals
@@ -94,12 +138,18 @@ Architecture spisnif_1 of spisnif is
 	signal fifo_mosi_empty : std_logic;
 	signal fifo_mosi_full : std_logic;
 	signal fifo_mosi_out : std_logic_vector(15 downto 0);
+	signal fifo_mosi_busy : std_logic;
+	signal fifo_mosi_words : std_logic_vector(15 downto 0);
+	signal fifo_mosi_lost : std_logic;
 
 	-- Miso signals
 	signal fifo_miso_read : std_logic;
 	signal fifo_miso_empty : std_logic;
 	signal fifo_miso_full : std_logic;
 	signal fifo_miso_out : std_logic_vector(15 downto 0);
+	signal fifo_miso_busy : std_logic;
+	signal fifo_miso_words : std_logic_vector(15 downto 0);
+	signal fifo_miso_lost : std_logic;
 
 	-- Miso et Mosi
 	signal write_enable : std_logic;
@@ -114,6 +164,85 @@ Architecture spisnif_1 of spisnif is
 	signal fifo_packet_write : std_logic;
 	signal fifo_packet_in : std_logic_vector(15 downto 0);
 
+	-- Packet info signals, timestamps high halves in fifo_pinfo_hi and
+	-- low halves in fifo_pinfo_lo
+	signal fifo_pinfo_out : std_logic_vector(15 downto 0);
+	-- no room left for one more packet info
+	signal fifo_pinfo_afull : std_logic;
+	signal fifo_pinfo_write : std_logic;
+	signal fifo_pinfo_hi_out : std_logic_vector(15 downto 0);
+	signal fifo_pinfo_hi_read : std_logic;
+	signal fifo_pinfo_hi_full : std_logic;
+	signal fifo_pinfo_hi_afull : std_logic;
+	signal fifo_pinfo_hi_empty : std_logic;
+	signal fifo_pinfo_hi_in : std_logic_vector(15 downto 0);
+	signal fifo_pinfo_lo_out : std_logic_vector(15 downto 0);
+	signal fifo_pinfo_lo_read : std_logic;
+	signal fifo_pinfo_lo_full : std_logic;
+	signal fifo_pinfo_lo_afull : std_logic;
+	signal fifo_pinfo_lo_empty : std_logic;
+	signal fifo_pinfo_lo_in : std_logic_vector(15 downto 0);
+	-- 16 bits reads alternate high and low halves, '1' on low half
+	signal pinfo_lo_sel : std_logic;
+	signal pinfo_hi_rd_en : std_logic;
+	signal pinfo_lo_rd_en : std_logic;
+
+	-- Free running gls_clk counter, latched on CS edges
+	signal timestamp : unsigned(31 downto 0);
+	signal ts_start : std_logic_vector(31 downto 0);
+	signal pinfo_start : std_logic_vector(31 downto 0);
+	signal pinfo_end : std_logic_vector(31 downto 0);
+	signal pinfo_bits : std_logic_vector(15 downto 0);
+	-- rle: words stored in each lane, written as third packet info word
+	signal pinfo_mosi_words : std_logic_vector(15 downto 0);
+	signal pinfo_miso_words : std_logic_vector(15 downto 0);
+	-- packet info write sequence, 0 is idle
+	signal pinfo_step : natural range 0 to 7;
+	-- CS deassert pulse
+	signal packet_end : std_logic;
+	-- filtered out packet, its MOSI and MISO bits are dropped
+	signal packet_discard : std_logic;
+
+	-- 32 bits wishbone: stream reads MISO and MOSI words at once and
+	-- whole timestamps, registers read in low half
+	constant wide : boolean := wb_size = 32;
+	-- run length encoded lanes, each lane has its own words number
+	constant rle_mode : boolean := rle /= 0;
+	function pinfo_last_step return natural is
+	begin
+		if rle_mode then
+			return 7;
+		end if;
+		return 5;
+	end function;
+	constant pinfo_last : natural := pinfo_last_step;
+	-- words written in each of fifo_pinfo_hi/lo per packet
+	constant pinfo_words : natural := (pinfo_last - 1) / 2;
+	function stream_info_reads return natural is
+		variable reads : natural := 2;
+	begin
+		if rle_mode then
+			reads := reads + 1;
+		end if;
+		if not wide then
+			reads := reads * 2;
+		end if;
+		return reads;
+	end function;
+	-- Stream window (addresses 8 to 10, 8 only with dma, 11 is LOSS)
+	type stream_state_t is (STREAM_DESC, STREAM_INFO, STREAM_MOSI, STREAM_MISO);
+	signal stream_state : stream_state_t;
+	signal stream_read : std_logic;
+	signal stream_count : unsigned(12 downto 0);
+	signal stream_mosi_words : unsigned(12 downto 0);
+	signal stream_miso_words : unsigned(12 downto 0);
+	signal stream_info_last : unsigned(12 downto 0);
+	signal stream_mosi_left : std_logic;
+	signal stream_miso_left : std_logic;
+	-- current stream word, and host read address in the window
+	signal stream_value : std_logic_vector(31 downto 0);
+	signal stream_window : std_logic;
+
 	-- Config register
 	---------------
 	-- bit 0 is CPOL
@@ -122,26 +251,193 @@ Architecture spisnif_1 of spisnif is
 	signal cpol : std_logic;
 	signal cpha : std_logic;
 	signal cspol : std_logic;
+	-- bit 3 is rle (read only, rle generic)
+	signal rle_flag : std_logic;
 
 	-- Control register
 	---------------
 	-- bits 10 downto 0 is irq_pnum_trig
+	-- bit 13 is swap (ping pong request, read 1 until done)
 	-- bit 14 is irq_ack
 	-- bit 15 is reset
 	signal irq_pnum_trig : std_logic_vector(10 downto 0);
 	signal irq_ack : std_logic;
 	signal fifo_reset : std_logic;
+	signal swap_req : std_logic;
+	-- fifos rewind, on host reset or once all packets were read
+	signal fifo_init : std_logic;
+	signal fifo_rewind : std_logic;
+	-- packets stored since last rewind
+	signal fifo_dirty : std_logic;
+	-- packets counted for the interrupt
+	signal irq_count : std_logic_vector(10 downto 0);
+
+	-- Ping pong banks
+	constant pp_mode : boolean := ping_pong /= 0;
+	signal swap_pending : std_logic;
+	signal bank_swap : std_logic;
+	signal capture_bank : std_logic;
+	signal pp_flag : std_logic;
+	-- packets in capture bank, same as packet_count without ping pong
+	signal capture_count : std_logic_vector(10 downto 0);
+
+	-- DMA
+	---------------
+	-- CONFIG bit 13 is dma (read only)
+	-- With dma generic, stream window is address 8 only and:
+	-- DMA_CTRL (address 9) bit 15 is enable, bit 14 is busy (read only),
+	-- bits 2 downto 0 is DMA_DATA index. Writing it with index 4 latches
+	-- the ring write offset and restarts the interrupt packets count.
+	-- DMA_DATA (address 10) accesses the word at index, then index is
+	-- incremented: ring base address msw and lsw, ring size msw and lsw
+	-- (bytes), write offset msw and lsw (read only, end of the last whole
+	-- packet copied), read offset msw and lsw (host, taken on lsw write).
+	-- While enabled, the engine copies the stream window words of each
+	-- packet at the write offset and waits when the ring is full, fifos
+	-- are rewound once empty between packets. Enabling clears the
+	-- offsets, when busy is low.
+	constant dma_mode : boolean := dma /= 0;
+	constant dma_word_bytes : natural := wb_size/8;
+	type dma_state_t is (DMA_IDLE, DMA_FETCH, DMA_WRITE, DMA_SETTLE);
+	signal dma_state : dma_state_t;
+	signal dma_flag : std_logic;
+	signal dma_enable : std_logic;
+	signal dma_busy : std_logic;
+	signal dma_index : unsigned(2 downto 0);
+	signal dma_base : unsigned(31 downto 0);
+	signal dma_size : unsigned(31 downto 0);
+	signal dma_wr : unsigned(31 downto 0);
+	signal dma_wr_latched : unsigned(31 downto 0);
+	signal dma_rd : unsigned(31 downto 0);
+	signal dma_rd_msw : std_logic_vector(15 downto 0);
+	-- next word offset, dma_wr until the packet is whole
+	signal dma_cur : unsigned(31 downto 0);
+	signal dma_used : unsigned(31 downto 0);
+	signal dma_room : std_logic;
+	-- packets copied since last DMA_CTRL write, saturated
+	signal dma_count : unsigned(10 downto 0);
+	signal dma_data_value : std_logic_vector(15 downto 0);
+	-- stream window word taken by the engine, one cycle
+	signal dma_read : std_logic;
+	-- cycles left for fifos outputs to follow the last read
+	signal dma_settle : natural range 0 to 3;
+	signal dma_abort : std_logic;
+	signal dma_ctrl_write : std_logic;
+	signal dma_data_write : std_logic;
+	signal dma_data_read : std_logic;
+	signal dma_writedata : std_logic_vector(15 downto 0);
+
+	-- Filter registers
+	---------------
+	-- FILTER_CTRL bit 15 is enable
+	-- FILTER_CTRL bit 14 is exclude (drop matching packets)
+	-- FILTER_CTRL bit 13 is trigger mode
+	-- FILTER_CTRL bit 12 is triggered (read only)
+	-- FILTER_CTRL bit 11 is post trigger window done (read only)
+	-- FILTER_CTRL bits 10 downto 0 is post trigger packets, 0 no limit
+	-- FILTER_MATCH and FILTER_MASK apply to the first MOSI word
+	signal filter_enable : std_logic;
+	signal filter_exclude : std_logic;
+	signal filter_trigger : std_logic;
+	signal filter_post : std_logic_vector(10 downto 0);
+	signal filter_match : std_logic_vector(15 downto 0);
+	signal filter_mask : std_logic_vector(15 downto 0);
+	-- FILTER_CTRL written, trigger is armed again
+	signal filter_arm : std_logic;
+	-- first MOSI word of current packet, bits not received yet are 0
+	signal filter_word : std_logic_vector(15 downto 0);
+	type trig_state_t is (TRIG_ARMED, TRIG_RUN, TRIG_DONE);
+	signal trig_state : trig_state_t;
+	signal trig_count : unsigned(10 downto 0);
+	signal triggered : std_logic;
+	signal trig_done : std_logic;
+
+	-- Chip selects
+	---------------
+	-- CS_MASK bits 7 downto 0 enable capture on each CS input
+	-- CONFIG bits 6 downto 4 is CS index width in descriptor (read only)
+	function cs_index_bits return natural is
+	begin
+		if cs_num > 4 then
+			return 3;
+		elsif cs_num > 2 then
+			return 2;
+		elsif cs_num > 1 then
+			return 1;
+		end if;
+		return 0;
+	end function;
+	constant cs_bits : natural := cs_index_bits;
+	signal cs_mask : std_logic_vector(7 downto 0);
+	-- CS input followed by capture, changes between packets only
+	signal cs_sel : natural range 0 to cs_num-1;
+	signal cs_bits_flag : std_logic_vector(2 downto 0);
+
+	-- Data lanes
+	---------------
+	-- CONFIG bits 8 downto 7 is lanes mode: "00" single, "01" dual,
+	-- "10" quad, latched for each packet on CS assert
+	-- CONFIG bit 9 is lanes field in descriptor (read only, lanes > 1)
+	-- In dual mode, fifo_mosi and fifo_miso store data 0 and 1 as in
+	-- single mode. In quad mode, fifo_mosi stores data 0 then data 2 and
+	-- fifo_miso data 1 then data 3 for each sck edge, the bit count is
+	-- then twice the edges number.
+	function lane_field_bits return natural is
+	begin
+		if lanes > 1 then
+			return 2;
+		end if;
+		return 0;
+	end function;
+	constant lane_bits : natural := lane_field_bits;
+	-- longest packet whose bit count fits in the descriptor
+	constant desc_bit_max : natural := 2**(16 - cs_bits - lane_bits) - 1;
+	signal lane_mode : std_logic_vector(1 downto 0);
+	signal packet_lanes : std_logic_vector(1 downto 0);
+	signal quad : std_logic;
+	signal lane_flag : std_logic;
+	signal io2_tmp, io2_sync : std_logic := '0';
+	signal io3_tmp, io3_sync : std_logic := '0';
+
+	-- Loss register
+	---------------
+	-- Saturating counters of packets not recorded (no room left in a
+	-- fifo, too long for the descriptor, or ended while previous packet
+	-- info was written), of their bits, and of overflow events (packets
+	-- dropped for lack of room after a recorded one). Writing LOSS
+	-- latches them, bit 15 clears them at once, then each read returns
+	-- the next latched word: packets, bits high and low halves, events,
+	-- and shortest sck period (x"FFFF" when no edge since clear).
+	type loss_words_t is array (0 to 4) of std_logic_vector(15 downto 0);
+	signal loss_packets : unsigned(15 downto 0);
+	signal loss_bits : unsigned(31 downto 0);
+	signal loss_events : unsigned(15 downto 0);
+	signal loss_latched : loss_words_t;
+	signal loss_idx : natural range 0 to 4;
+	signal loss_write : std_logic;
+	signal loss_clear : std_logic;
+	signal loss_read : std_logic;
+	-- packet end pulses: packet lost, and first one lost for lack of room
+	signal packet_lost : std_logic;
+	signal packet_lost_bits : natural range 0 to 2**16-1;
+	signal overflow_event : std_logic;
+	-- last packet was dropped for lack of room
+	signal room_out : std_logic;
 
 	-- Status register
 	---------------
 	-- bit 10 downto 0 is packet_num
+	-- bit 11 is ping pong mode
+	-- bit 12 is capture bank
 	-- bit 13 is fifo_mxsx_full
-	-- bit 14 is fifo_full
+	-- bit 14 is fifo_full (packet or packet info fifo)
 	-- bit 15 is fifo_empty
 	signal fifo_full : std_logic;
 
-	-- Number of bits received in a packet
+	-- Number of bits received in a packet, saturated, and set once bits
+	-- went past the counter
 	signal bit_count : integer range 0 to 2**16-1 := 0;
+	signal bit_count_over : std_logic;
 
 	-- Number of packet received
 	signal packet_count : std_logic_vector(10 downto 0);
@@ -149,53 +445,137 @@ Architecture spisnif_1 of spisnif is
 	-- Sampled SPI signals
 	signal mosi_tmp, mosi_sync : std_logic := '0';
 	signal miso_tmp, miso_sync : std_logic := '0';
-	signal cs_tmp, cs_sync : std_logic := '0';
+	signal cs_tmp, cs_sync : std_logic_vector(cs_num-1 downto 0) := (others => '1');
 	signal sck_tmp, sck_sync : std_logic := '0';
+	signal fifo_write_old : std_logic := '0';
+
+	-- Both edges sampling
+	---------------
+	-- CONFIG bit 12 is ddr_sampling (read only)
+	-- CONFIG bits 11 downto 10 is data sampling delay, in half gls_clk
+	-- periods after the first sample showing the sck edge
+	-- Inputs are sampled on each gls_clk edge and shifted by pairs
+	-- (rising edge sample first) into half period histories, newest pair
+	-- on top. sck edges are searched in the oldest pair, data bits taken
+	-- up to 3 half periods later, CS inputs are delayed to match.
+	constant ddr_mode : boolean := ddr_sampling /= 0;
+	signal ddr_flag : std_logic;
+	signal sample_delay : std_logic_vector(1 downto 0);
+	signal sck_r, sck_f : std_logic := '0';
+	signal mosi_r, mosi_f : std_logic := '0';
+	signal miso_r, miso_f : std_logic := '0';
+	signal io2_r, io2_f : std_logic := '0';
+	signal io3_r, io3_f : std_logic := '0';
+	signal sck_hist : std_logic_vector(6 downto 0) := (others => '0');
+	signal capture_hist : std_logic_vector(6 downto 0);
+	signal mosi_hist : std_logic_vector(5 downto 0) := (others => '0');
+	signal miso_hist : std_logic_vector(5 downto 0) := (others => '0');
+	signal io2_hist : std_logic_vector(5 downto 0) := (others => '0');
+	signal io3_hist : std_logic_vector(5 downto 0) := (others => '0');
+	signal cs_dly1, cs_dly2 : std_logic_vector(cs_num-1 downto 0) := (others => '1');
+
+	-- One cycle per sck capture edge, with its half period in the cycle,
+	-- the data bits it captures and the CS inputs aligned with them
+	signal bit_strobe : std_logic;
+	signal bit_half : natural range 0 to 1;
+	signal mosi_bit : std_logic;
+	signal miso_bit : std_logic;
+	signal io2_bit : std_logic;
+	signal io3_bit : std_logic;
+	signal cs_capture : std_logic_vector(cs_num-1 downto 0);
+
+	-- Shortest interval between capture edges within a packet, in half
+	-- gls_clk periods, read as LOSS fifth word
+	signal sck_period : unsigned(15 downto 0);
+	signal sck_period_valid : std_logic;
+	signal sck_min : unsigned(15 downto 0);
 
 	-- Wishbone signal
 	signal wbs_strobe_old : std_logic := '0';
 	signal wbs_write_old : std_logic := '0';
 begin
 
-	write_enable <= cs_sync xnor cspol;
+	write_enable <= (cs_capture(cs_sel) xnor cspol) and cs_mask(cs_sel);
 	fifo_write <= (sck_sync xnor cpol) xnor cpha;
 
+	single_rate : if not ddr_mode generate
+		bit_strobe <= fifo_write and not fifo_write_old;
+		bit_half <= 0;
+		mosi_bit <= mosi_sync;
+		miso_bit <= miso_sync;
+		io2_bit <= io2_sync;
+		io3_bit <= io3_sync;
+		cs_capture <= cs_sync;
+	end generate single_rate;
+
+	both_edges : if ddr_mode generate
+		-- capture edge is a rising edge of (sck xnor cpol) xnor cpha
+		capture_hist <= sck_hist when (cpol xor cpha) = '0' else not sck_hist;
+		bit_strobe <= '1' when capture_hist(1 downto 0) = "10" or
+			      capture_hist(2 downto 1) = "10" else '0';
+		bit_half <= 0 when capture_hist(1 downto 0) = "10" else 1;
+		mosi_bit <= mosi_hist(bit_half + to_integer(unsigned(sample_delay)));
+		miso_bit <= miso_hist(bit_half + to_integer(unsigned(sample_delay)));
+		io2_bit <= io2_hist(bit_half + to_integer(unsigned(sample_delay)));
+		io3_bit <= io3_hist(bit_half + to_integer(unsigned(sample_delay)));
+		cs_capture <= cs_dly2;
+	end generate both_edges;
+
 	-- MOSI fifo instance
 	fifo_mosi_inst : fifo_mxsx
 	generic map(	ram_size => fifo_mosi_size,
-			ram_num => fifo_mosi_num)
+			ram_num => fifo_mosi_num,
+			ping_pong => pp_mode,
+			rle => rle_mode)
 	port map(
 		clk => gls_clk,
 		reset => gls_reset,
-		init => fifo_reset,
-		write => fifo_write,
+		init => fifo_init,
+		write => bit_strobe,
 		read_data => fifo_mosi_read,
-		data_in => mosi_sync,
+		data_in => mosi_bit,
+		double => quad,
+		data_in2 => io2_bit,
 		write_enable => write_enable,
 		is_empty => fifo_mosi_empty,
 		is_full => fifo_mosi_full,
-		data_out => fifo_mosi_out);
+		data_out => fifo_mosi_out,
+		swap => bank_swap,
+		discard => packet_discard,
+		busy => fifo_mosi_busy,
+		packet_words => fifo_mosi_words,
+		lost => fifo_mosi_lost);
 
 	-- MISO fifo instance
 	fifo_miso_inst : fifo_mxsx
 	generic map(	ram_size => fifo_miso_size,
-			ram_num => fifo_miso_num)
+			ram_num => fifo_miso_num,
+			ping_pong => pp_mode,
+			rle => rle_mode)
 	port map(
 		clk => gls_clk,
 		reset => gls_reset,
-		init => fifo_reset,
-		write => fifo_write,
+		init => fifo_init,
+		write => bit_strobe,
 		read_data => fifo_miso_read,
-		data_in => miso_sync,
+		data_in => miso_bit,
+		double => quad,
+		data_in2 => io3_bit,
 		write_enable => write_enable,
 		is_empty => fifo_miso_empty,
 		is_full => fifo_miso_full,
-		data_out => fifo_miso_out);
+		data_out => fifo_miso_out,
+		swap => bank_swap,
+		discard => packet_discard,
+		busy => fifo_miso_busy,
+		packet_words => fifo_miso_words,
+		lost => fifo_miso_lost);
 
 	-- Packet fifo instance
 	fifo_packet_inst : fifo_packet
 	generic map(	ram_num => fifo_packet_ram_num,
-			ram_size => fifo_packet_ram_size)
+			ram_size => fifo_packet_ram_size,
+			ping_pong => pp_mode)
 	port map(
 		gls_reset => gls_reset,
 		gls_clk => gls_clk,
@@ -205,9 +585,55 @@ begin
 		db_write => fifo_packet_write,
 		db_data => fifo_packet_in,
 		pf_full => fifo_packet_full,
+		pf_afull => open,
 		pf_empty => fifo_packet_empty,
-		pf_init => fifo_reset,
-		pf_count => packet_count);
+		pf_init => fifo_init,
+		pf_count => packet_count,
+		pf_swap => bank_swap,
+		pf_wcount => capture_count);
+
+	-- Packet info fifos instances
+	fifo_pinfo_hi_inst : fifo_packet
+	generic map(	ram_num => fifo_pinfo_ram_num/2,
+			ram_size => fifo_packet_ram_size,
+			ping_pong => pp_mode,
+			afull_words => pinfo_words)
+	port map(
+		gls_reset => gls_reset,
+		gls_clk => gls_clk,
+		wb_data => fifo_pinfo_hi_out,
+		wb_rd => fifo_pinfo_hi_read,
+		wb_over_flag => open,
+		db_write => fifo_pinfo_write,
+		db_data => fifo_pinfo_hi_in,
+		pf_full => fifo_pinfo_hi_full,
+		pf_afull => fifo_pinfo_hi_afull,
+		pf_empty => fifo_pinfo_hi_empty,
+		pf_init => fifo_init,
+		pf_count => open,
+		pf_swap => bank_swap,
+		pf_wcount => open);
+
+	fifo_pinfo_lo_inst : fifo_packet
+	generic map(	ram_num => fifo_pinfo_ram_num/2,
+			ram_size => fifo_packet_ram_size,
+			ping_pong => pp_mode,
+			afull_words => pinfo_words)
+	port map(
+		gls_reset => gls_reset,
+		gls_clk => gls_clk,
+		wb_data => fifo_pinfo_lo_out,
+		wb_rd => fifo_pinfo_lo_read,
+		wb_over_flag => open,
+		db_write => fifo_pinfo_write,
+		db_data => fifo_pinfo_lo_in,
+		pf_full => fifo_pinfo_lo_full,
+		pf_afull => fifo_pinfo_lo_afull,
+		pf_empty => fifo_pinfo_lo_empty,
+		pf_init => fifo_init,
+		pf_count => open,
+		pf_swap => bank_swap,
+		pf_wcount => open);
 
 	-- Sampling the SPI signals to avoid metastability
 	spi_sampling : process(gls_clk, gls_reset)
@@ -218,38 +644,306 @@ begin
 			mosi_tmp <= '0';
 			miso_tmp <= '0';
 			sck_tmp <= '0';
-			cs_tmp <= '1';
+			cs_tmp <= (others => '1');
 			mosi_sync <= '0';
 			miso_sync <= '0';
+			io2_tmp <= '0';
+			io3_tmp <= '0';
+			io2_sync <= '0';
+			io3_sync <= '0';
 			sck_sync <= '0';
-			cs_sync <= '1';
+			cs_sync <= (others => '1');
+			fifo_write_old <= '0';
 		elsif rising_edge(gls_clk) then
 			mosi_tmp <= mosi;
 			mosi_sync <= mosi_tmp;
 			miso_tmp <= miso;
 			miso_sync <= miso_tmp;
+			io2_tmp <= io2;
+			io2_sync <= io2_tmp;
+			io3_tmp <= io3;
+			io3_sync <= io3_tmp;
 			sck_tmp <= sck;
 			sck_sync <= sck_tmp;
-			cs_tmp <= cs;
+			cs_tmp <= cs_ext(cs_num-1 downto 1) & cs;
 			cs_sync <= cs_tmp;
+			fifo_write_old <= fifo_write;
+		end if;
+	end process;
+
+	-- Both edges sampling: the falling edge samples only get half a
+	-- gls_clk period to settle before being shifted into the histories,
+	-- place them in IOB registers (IDDR) on the target
+	both_edges_sampling : if ddr_mode generate
+		spi_sampling_fall : process(gls_clk)
+		begin
+			if falling_edge(gls_clk) then
+				sck_f <= sck;
+				mosi_f <= mosi;
+				miso_f <= miso;
+				io2_f <= io2;
+				io3_f <= io3;
+			end if;
+		end process;
+
+		spi_sampling_rise : process(gls_clk, gls_reset)
+		begin
+			if gls_reset = '1' then
+				sck_r <= '0';
+				mosi_r <= '0';
+				miso_r <= '0';
+				io2_r <= '0';
+				io3_r <= '0';
+				sck_hist <= (others => '0');
+				mosi_hist <= (others => '0');
+				miso_hist <= (others => '0');
+				io2_hist <= (others => '0');
+				io3_hist <= (others => '0');
+				cs_dly1 <= (others => '1');
+				cs_dly2 <= (others => '1');
+			elsif rising_edge(gls_clk) then
+				sck_r <= sck;
+				mosi_r <= mosi;
+				miso_r <= miso;
+				io2_r <= io2;
+				io3_r <= io3;
+				sck_hist <= sck_f & sck_r & sck_hist(6 downto 2);
+				mosi_hist <= mosi_f & mosi_r & mosi_hist(5 downto 2);
+				miso_hist <= miso_f & miso_r & miso_hist(5 downto 2);
+				io2_hist <= io2_f & io2_r & io2_hist(5 downto 2);
+				io3_hist <= io3_f & io3_r & io3_hist(5 downto 2);
+				-- cs_sync sample is one period old, cs_dly2 three
+				-- periods, as the oldest pair rising edge sample
+				cs_dly1 <= cs_sync;
+				cs_dly2 <= cs_dly1;
+			end if;
+		end process;
+	end generate both_edges_sampling;
+
+
+	-- Chip select selection: between packets, capture follows the lowest
+	-- enabled CS input asserted. Other CS inputs asserted meanwhile are not
+	-- captured, the bus carries one transfer at a time.
+	cs_select : process(gls_clk, gls_reset)
+	begin
+		if gls_reset = '1' then
+			cs_sel <= 0;
+		elsif rising_edge(gls_clk) then
+			if write_enable = '0' then
+				for i in cs_num-1 downto 0 loop
+					if (cs_capture(i) xnor cspol) = '1' and cs_mask(i) = '1' then
+						cs_sel <= i;
+					end if;
+				end loop;
+			end if;
 		end if;
 	end process;
 
+	-- Timestamp counter, wraps every 2**32 gls_clk cycles
+	timestamp_counter : process(gls_clk, gls_reset)
+	begin
+		if gls_reset = '1' then
+			timestamp <= (others => '0');
+		elsif rising_edge(gls_clk) then
+			timestamp <= timestamp + 1;
+		end if;
+	end process;
 
 	-- FIFO packet write management
+	-- On CS deassert, bit count and timestamps are latched then written:
+	-- start then end timestamps in fifo_pinfo_hi/lo (a fifo_packet word
+	-- takes 2 cycles), with rle MOSI and MISO words numbers, and bit count
+	-- in fifo_packet last so that packet_num never counts a packet whose
+	-- info is not readable yet. With rle, bit count waits for the last
+	-- run count to be written in fifo_mxsx.
+	-- With filter enabled, a packet failing the filter is not written and
+	-- its bits are discarded from fifo_mxsx. With several CS inputs, the
+	-- descriptor holds the CS index in its cs_bits msb, with lanes > 1
+	-- followed by the packet lanes mode.
+	-- A packet ending within these 6 (8 with rle) cycles, too long for the
+	-- descriptor bit count field, or finding no room left in fifos is
+	-- lost: discarded like a filtered one and counted in LOSS counters.
 	write_fifo_packet_management : process(gls_clk, gls_reset)
 		variable write_enable_old : std_logic := '0';
+		variable swap_req_old : std_logic := '0';
+		variable hit : std_logic;
+		variable keep : std_logic;
+		variable room : std_logic;
 	begin
 		if gls_reset = '1' then
 			fifo_packet_in <= (others => '0');
+			fifo_packet_write <= '0';
+			fifo_pinfo_hi_in <= (others => '0');
+			fifo_pinfo_lo_in <= (others => '0');
+			fifo_pinfo_write <= '0';
+			ts_start <= (others => '0');
+			packet_lanes <= "00";
+			pinfo_start <= (others => '0');
+			pinfo_end <= (others => '0');
+			pinfo_bits <= (others => '0');
+			pinfo_mosi_words <= (others => '0');
+			pinfo_miso_words <= (others => '0');
+			pinfo_step <= 0;
+			packet_end <= '0';
+			packet_discard <= '0';
+			packet_lost <= '0';
+			packet_lost_bits <= 0;
+			overflow_event <= '0';
+			room_out <= '0';
+			swap_pending <= '0';
+			bank_swap <= '0';
+			capture_bank <= '0';
+			trig_state <= TRIG_ARMED;
+			trig_count <= (others => '0');
 			write_enable_old := '0';
+			swap_req_old := '0';
 		elsif rising_edge(gls_clk) then
+			fifo_packet_write <= '0';
+			fifo_pinfo_write <= '0';
+			packet_end <= '0';
+			packet_discard <= '0';
+			packet_lost <= '0';
+			overflow_event <= '0';
+			bank_swap <= '0';
+
+			-- Ping pong swap, between packets only so that no packet
+			-- spans two banks
+			if not pp_mode or fifo_init = '1' then
+				swap_pending <= '0';
+				capture_bank <= '0';
+			elsif (swap_req_old = '0') and (swap_req = '1') then
+				swap_pending <= '1';
+			elsif (swap_pending = '1') and (write_enable = '0') and
+			      (write_enable_old = '0') and (pinfo_step = 0) then
+				swap_pending <= '0';
+				bank_swap <= '1';
+				capture_bank <= not capture_bank;
+			end if;
+			swap_req_old := swap_req;
 
-			if (write_enable_old = '1') and (write_enable = '0') then
-				fifo_packet_write <= '1';
-				fifo_packet_in <= std_logic_vector(to_unsigned(bit_count, 16));
+			if (write_enable_old = '0') and (write_enable = '1') then
+				ts_start <= std_logic_vector(timestamp);
+				packet_lanes <= lane_mode;
+			end if;
+
+			-- Filter on first MOSI word, then trigger state
+			if ((filter_word xor filter_match) and filter_mask) = x"0000" then
+				hit := not filter_exclude;
+			else
+				hit := filter_exclude;
+			end if;
+			if filter_enable = '0' then
+				keep := '1';
+			elsif filter_trigger = '0' then
+				keep := hit;
+			elsif trig_state = TRIG_RUN then
+				keep := '1';
+			elsif trig_state = TRIG_ARMED then
+				keep := hit;
 			else
-				fifo_packet_write <= '0';
+				keep := '0';
+			end if;
+
+			-- room in every fifo, fifo_mxsx flags bits already lost
+			if fifo_packet_full = '0' and fifo_pinfo_afull = '0' and
+			   fifo_mosi_lost = '0' and fifo_miso_lost = '0' then
+				room := '1';
+			else
+				room := '0';
+			end if;
+
+			-- fifo reset rewinds fifos after each drain, it does not
+			-- arm trigger again
+			if filter_arm = '1' then
+				trig_state <= TRIG_ARMED;
+				trig_count <= (others => '0');
+			end if;
+
+			if fifo_init = '1' then
+				pinfo_step <= 0;
+			elsif (write_enable_old = '1') and (write_enable = '0') and
+			      (pinfo_step = 0) then
+				packet_end <= '1';
+				if keep = '1' and bit_count <= desc_bit_max and
+				   bit_count_over = '0' and room = '1' then
+					pinfo_bits <= std_logic_vector(to_unsigned(bit_count, 16));
+					if cs_bits /= 0 then
+						pinfo_bits(15 downto 16 - cs_bits) <=
+							std_logic_vector(to_unsigned(cs_sel, cs_bits));
+					end if;
+					if lane_bits /= 0 then
+						pinfo_bits(15 - cs_bits downto 14 - cs_bits) <= packet_lanes;
+					end if;
+					pinfo_start <= ts_start;
+					pinfo_end <= std_logic_vector(timestamp);
+					pinfo_step <= 1;
+				else
+					packet_discard <= '1';
+				end if;
+				-- post trigger window, trigger packet included
+				if filter_enable = '1' and filter_trigger = '1' and
+				   filter_arm = '0' and keep = '1' then
+					if unsigned(filter_post) /= 0 and
+					   trig_count + 1 = unsigned(filter_post) then
+						trig_state <= TRIG_DONE;
+					else
+						trig_state <= TRIG_RUN;
+					end if;
+					trig_count <= trig_count + 1;
+				end if;
+			elsif pinfo_step /= 0 then
+				case pinfo_step is
+					when 1 =>	fifo_pinfo_hi_in <= pinfo_start(31 downto 16);
+							fifo_pinfo_lo_in <= pinfo_start(15 downto 0);
+							fifo_pinfo_write <= '1';
+							-- fifo_mxsx write indexes are aligned
+							pinfo_mosi_words <= fifo_mosi_words;
+							pinfo_miso_words <= fifo_miso_words;
+					when 3 =>	fifo_pinfo_hi_in <= pinfo_end(31 downto 16);
+							fifo_pinfo_lo_in <= pinfo_end(15 downto 0);
+							fifo_pinfo_write <= '1';
+					when 5 =>	if rle_mode then
+								fifo_pinfo_hi_in <= pinfo_mosi_words;
+								fifo_pinfo_lo_in <= pinfo_miso_words;
+								fifo_pinfo_write <= '1';
+							else
+								fifo_packet_in <= pinfo_bits;
+								fifo_packet_write <= '1';
+							end if;
+					when 7 =>	fifo_packet_in <= pinfo_bits;
+							fifo_packet_write <= '1';
+					when others =>
+				end case;
+				if pinfo_step = pinfo_last then
+					pinfo_step <= 0;
+				elsif pinfo_step = pinfo_last - 1 and
+				      (fifo_mosi_busy = '1' or fifo_miso_busy = '1') then
+					-- run counts still being written
+					pinfo_step <= pinfo_step;
+				else
+					pinfo_step <= pinfo_step + 1;
+				end if;
+			end if;
+
+			-- Lost packets: ended while previous packet info is written,
+			-- too long, or no room left. The first one lost for lack of
+			-- room after a recorded one is an overflow event.
+			if fifo_init = '1' or bank_swap = '1' then
+				room_out <= '0';
+			elsif (write_enable_old = '1') and (write_enable = '0') and
+			      keep = '1' then
+				if pinfo_step /= 0 or bit_count > desc_bit_max or
+				   bit_count_over = '1' or room = '0' then
+					packet_end <= '1';
+					packet_discard <= '1';
+					packet_lost <= '1';
+					packet_lost_bits <= bit_count;
+				end if;
+				if pinfo_step = 0 and bit_count <= desc_bit_max and
+				   bit_count_over = '0' then
+					room_out <= not room;
+					overflow_event <= not room and not room_out;
+				end if;
 			end if;
 
 			write_enable_old := write_enable;
@@ -257,80 +951,362 @@ begin
 	end process;
 
 	-- Count number of received SPI packets
-	-- Increment on fifo_write rising edge
-	-- reset when a write to fifo_packet is performed
+	-- Increment on each sck capture edge (bit_strobe)
+	-- reset when bit count is latched on CS deassert
+	-- saturate instead of wrapping, longer packets are lost
 	bit_count_proc : process(gls_clk, gls_reset)
-		variable fifo_write_old : std_logic := '0';
 	begin
 		if gls_reset = '1' then
-			fifo_write_old := '0';
 			bit_count <= 0;
+			bit_count_over <= '0';
+			filter_word <= (others => '0');
 		elsif rising_edge(gls_clk) then
-			if fifo_packet_write = '1' or fifo_reset = '1' then
+			if packet_end = '1' or fifo_init = '1' then
 				bit_count <= 0;
-			elsif (fifo_write_old = '0') and (fifo_write = '1') then
-				bit_count <= (bit_count + 1) mod 2**16;
+				bit_count_over <= '0';
+				filter_word <= (others => '0');
+			elsif bit_strobe = '1' then
+				-- first MOSI word, same bit order as fifo_mosi
+				if quad = '1' then
+					if bit_count > 2**16-3 then
+						bit_count <= 2**16-1;
+						bit_count_over <= '1';
+					else
+						bit_count <= bit_count + 2;
+					end if;
+					if write_enable = '1' and bit_count < 15 then
+						filter_word(bit_count) <= mosi_bit;
+						filter_word(bit_count + 1) <= io2_bit;
+					end if;
+				else
+					if bit_count = 2**16-1 then
+						bit_count_over <= '1';
+					else
+						bit_count <= bit_count + 1;
+					end if;
+					if write_enable = '1' and bit_count < 16 then
+						filter_word(bit_count) <= mosi_bit;
+					end if;
+				end if;
 			end if;
+		end if;
+	end process;
 
-			fifo_write_old := fifo_write;
-
+	-- Measure the interval between consecutive sck capture edges of a
+	-- packet, in half gls_clk periods, saturated to 16 bits
+	sck_measure : process(gls_clk, gls_reset)
+		variable cycles : natural range 0 to 2**15;
+		variable last_half : natural range 0 to 1;
+		variable seen : boolean;
+	begin
+		if gls_reset = '1' then
+			cycles := 0;
+			last_half := 0;
+			seen := false;
+			sck_period <= (others => '1');
+			sck_period_valid <= '0';
+		elsif rising_edge(gls_clk) then
+			sck_period_valid <= '0';
+			if cycles < 2**15 then
+				cycles := cycles + 1;
+			end if;
+			if write_enable = '0' then
+				seen := false;
+			elsif bit_strobe = '1' then
+				if seen then
+					if cycles = 2**15 then
+						sck_period <= (others => '1');
+					else
+						sck_period <= to_unsigned(2*cycles + bit_half - last_half, 16);
+					end if;
+					sck_period_valid <= '1';
+				end if;
+				seen := true;
+				last_half := bit_half;
+				cycles := 0;
+			end if;
 		end if;
 	end process;
 
+	-- Stream window, next word of the packet being read
+	stream_word : process(stream_state, fifo_packet_out, fifo_pinfo_hi_out,
+			      fifo_pinfo_lo_out, fifo_pinfo_out, fifo_mosi_out,
+			      fifo_miso_out, stream_mosi_left, stream_miso_left)
+		variable read_value : std_logic_vector(31 downto 0);
+	begin
+		case stream_state is
+			when STREAM_DESC =>	read_value := x"0000" & fifo_packet_out;
+			when STREAM_INFO =>	if wide then
+							read_value := fifo_pinfo_hi_out & fifo_pinfo_lo_out;
+						else
+							read_value := x"0000" & fifo_pinfo_out;
+						end if;
+			when STREAM_MOSI =>	if wide then
+							read_value := fifo_miso_out & fifo_mosi_out;
+							-- rle lanes differ, shorter one padded with 0
+							if stream_mosi_left = '0' then
+								read_value(15 downto 0) := x"0000";
+							end if;
+							if stream_miso_left = '0' then
+								read_value(31 downto 16) := x"0000";
+							end if;
+						else
+							read_value := x"0000" & fifo_mosi_out;
+						end if;
+			when STREAM_MISO =>	read_value := x"0000" & fifo_miso_out;
+		end case;
+		stream_value <= read_value;
+	end process;
+
 	wishbone_read : process(gls_reset, gls_clk)
+		variable read_value : std_logic_vector(31 downto 0);
 	begin
 		if gls_reset = '1' then
 			wbs_readdata <= (others => '0');
 			fifo_mosi_read <= '0';
 			fifo_miso_read <= '0';
 			fifo_packet_read <= '0';
+			fifo_pinfo_hi_read <= '0';
+			fifo_pinfo_lo_read <= '0';
+			stream_read <= '0';
+			loss_read <= '0';
+			dma_data_read <= '0';
 		elsif rising_edge(gls_clk) then
-			-- Wishbone read
-			if wbs_write = '0' and wbs_strobe = '1' then
+			-- Wishbone read, or stream word taken by the dma engine
+			-- (only between host accesses)
+			if dma_read = '1' or
+			   (wbs_write = '0' and wbs_strobe = '1' and stream_window = '1') then
+				wbs_readdata <= stream_value(wb_size-1 downto 0);
+
+				if stream_state = STREAM_MOSI and stream_mosi_left = '1' then
+					fifo_mosi_read <= '1';
+				else
+					fifo_mosi_read <= '0';
+				end if;
+				if stream_state = STREAM_MISO or
+				   (wide and stream_state = STREAM_MOSI and stream_miso_left = '1') then
+					fifo_miso_read <= '1';
+				else
+					fifo_miso_read <= '0';
+				end if;
+				if stream_state = STREAM_DESC then
+					fifo_packet_read <= '1';
+				else
+					fifo_packet_read <= '0';
+				end if;
+				if stream_state = STREAM_INFO then
+					fifo_pinfo_hi_read <= pinfo_hi_rd_en;
+					fifo_pinfo_lo_read <= pinfo_lo_rd_en;
+				else
+					fifo_pinfo_hi_read <= '0';
+					fifo_pinfo_lo_read <= '0';
+				end if;
+				stream_read <= '1';
+				loss_read <= '0';
+				dma_data_read <= '0';
+
+			elsif wbs_write = '0' and wbs_strobe = '1' then
 				-- Read register handling
 				case wbs_add is
 					-- Control
-					when "000" => 	wbs_readdata <= fifo_reset & irq_ack & "000" & irq_pnum_trig;
+					when "0000" => 	read_value := x"0000" & fifo_reset & irq_ack & swap_pending & "00" & irq_pnum_trig;
 					-- Fifos
-					when "001" =>	wbs_readdata <= fifo_mosi_out;
-					when "010" =>	wbs_readdata <= fifo_miso_out;
-					when "011" =>	wbs_readdata <= fifo_packet_out;
+					when "0001" =>	read_value := x"0000" & fifo_mosi_out;
+					when "0010" =>	read_value := x"0000" & fifo_miso_out;
+					when "0011" =>	read_value := x"0000" & fifo_packet_out;
 					-- Status
-					when "100" => 	wbs_readdata <= fifo_packet_empty&fifo_packet_full&fifo_full&"00"&packet_count;
+					when "0100" => 	read_value := x"0000" & fifo_packet_empty&(fifo_packet_full or fifo_pinfo_afull)&fifo_full&capture_bank&pp_flag&packet_count;
 					-- Config
-					when "101" => 	wbs_readdata <= "0000000000000"&cspol&cpha&cpol;
+					when "0101" => 	read_value := x"0000" & "00"&dma_flag&ddr_flag&sample_delay&lane_flag&lane_mode&cs_bits_flag&rle_flag&cspol&cpha&cpol;
+					-- Packet info, whole timestamp on 32 bits wishbone
+					when "0110" =>	if wide then
+								read_value := fifo_pinfo_hi_out & fifo_pinfo_lo_out;
+							else
+								read_value := x"0000" & fifo_pinfo_out;
+							end if;
 					-- Id
-					when "111" =>	wbs_readdata <= std_logic_vector(to_unsigned(Id, 16));
-					when others => 	wbs_readdata <= (others => '0');
+					when "0111" =>	read_value := x"0000" & std_logic_vector(to_unsigned(Id, 16));
+					-- Dma, stream window aliases without dma generic
+					when "1001" =>	read_value := x"0000" & dma_enable & dma_busy & "00000000000" & std_logic_vector(dma_index);
+					when "1010" =>	read_value := x"0000" & dma_data_value;
+					-- Loss counters, latched by last LOSS write
+					when "1011" =>	read_value := x"0000" & loss_latched(loss_idx);
+					-- Filter
+					when "1100" =>	read_value := x"0000" & filter_enable & filter_exclude & filter_trigger & triggered & trig_done & filter_post;
+					when "1101" =>	read_value := x"0000" & filter_match;
+					when "1110" =>	read_value := x"0000" & filter_mask;
+					-- Chip selects enable
+					when "1111" =>	read_value := x"000000" & cs_mask;
+					when others => 	read_value := (others => '0');
 				end case;
+				wbs_readdata <= read_value(wb_size-1 downto 0);
 
 				-- Fifo read signals handling. Index is incremented on falling edges
 				case wbs_add is
-					when "001" =>	fifo_mosi_read <= '1';
+					when "0001" =>	fifo_mosi_read <= '1';
 							fifo_miso_read <= '0';
 							fifo_packet_read <= '0';
+							fifo_pinfo_hi_read <= '0';
+							fifo_pinfo_lo_read <= '0';
 
-					when "010" =>	fifo_mosi_read <= '0';
+					when "0010" =>	fifo_mosi_read <= '0';
 							fifo_miso_read <= '1';
 							fifo_packet_read <= '0';
+							fifo_pinfo_hi_read <= '0';
+							fifo_pinfo_lo_read <= '0';
 
-					when "011" =>	fifo_mosi_read <= '0';
+					when "0011" =>	fifo_mosi_read <= '0';
 							fifo_miso_read <= '0';
 							fifo_packet_read <= '1';
+							fifo_pinfo_hi_read <= '0';
+							fifo_pinfo_lo_read <= '0';
+
+					when "0110" =>	fifo_mosi_read <= '0';
+							fifo_miso_read <= '0';
+							fifo_packet_read <= '0';
+							fifo_pinfo_hi_read <= pinfo_hi_rd_en;
+							fifo_pinfo_lo_read <= pinfo_lo_rd_en;
 
 					when others =>	fifo_mosi_read <= '0';
 							fifo_miso_read <= '0';
 							fifo_packet_read <= '0';
+							fifo_pinfo_hi_read <= '0';
+							fifo_pinfo_lo_read <= '0';
 				end case;
+				stream_read <= '0';
+				if wbs_add = "1011" then
+					loss_read <= '1';
+				else
+					loss_read <= '0';
+				end if;
+				if wbs_add = "1010" then
+					dma_data_read <= '1';
+				else
+					dma_data_read <= '0';
+				end if;
 
 			else
 				fifo_mosi_read <= '0';
 				fifo_miso_read <= '0';
 				fifo_packet_read <= '0';
+				fifo_pinfo_hi_read <= '0';
+				fifo_pinfo_lo_read <= '0';
+				stream_read <= '0';
+				loss_read <= '0';
+				dma_data_read <= '0';
 			end if;
 		end if;
 	end process;
 
+	-- Packet info half selection for 16 bits reads: high half then low
+	-- half of each timestamp, toggles at the end of each read
+	pinfo_half_management : process(gls_reset, gls_clk)
+		variable pinfo_read_old : std_logic := '0';
+	begin
+		if gls_reset = '1' then
+			pinfo_lo_sel <= '0';
+			pinfo_read_old := '0';
+		elsif rising_edge(gls_clk) then
+			if wide or fifo_init = '1' or bank_swap = '1' then
+				pinfo_lo_sel <= '0';
+			elsif (pinfo_read_old = '1') and
+			      (fifo_pinfo_hi_read = '0') and (fifo_pinfo_lo_read = '0') then
+				pinfo_lo_sel <= not pinfo_lo_sel;
+			end if;
+			pinfo_read_old := fifo_pinfo_hi_read or fifo_pinfo_lo_read;
+		end if;
+	end process;
+
+	-- Stream window sequencing, moves to the next word at the end of each
+	-- window read: descriptor, 4 packet info words, MOSI words then MISO
+	-- words. On 32 bits wishbone: descriptor, 2 timestamps, then MISO and
+	-- MOSI words pairs. With rle, packet info ends with MOSI and MISO
+	-- words numbers (one more word on 32 bits), on 32 bits the shorter
+	-- lane is padded. Reading fifos through their own registers
+	-- meanwhile breaks the sequence until next fifo reset.
+	stream_management : process(gls_reset, gls_clk)
+		variable stream_read_old : std_logic := '0';
+		variable mosi_words : unsigned(12 downto 0);
+		variable miso_words : unsigned(12 downto 0);
+	begin
+		if gls_reset = '1' then
+			stream_state <= STREAM_DESC;
+			stream_count <= (others => '0');
+			stream_mosi_words <= (others => '0');
+			stream_miso_words <= (others => '0');
+			stream_read_old := '0';
+		elsif rising_edge(gls_clk) then
+			if fifo_init = '1' or bank_swap = '1' then
+				stream_state <= STREAM_DESC;
+				stream_count <= (others => '0');
+			elsif (stream_read_old = '1') and (stream_read = '0') then
+				case stream_state is
+					when STREAM_DESC =>
+						-- words of each lane, rounded up
+						mosi_words := resize(shift_right(
+							resize(unsigned(fifo_packet_out), 17) + 15, 4), 13);
+						stream_mosi_words <= mosi_words;
+						stream_miso_words <= mosi_words;
+						stream_count <= (others => '0');
+						stream_state <= STREAM_INFO;
+					when STREAM_INFO =>
+						mosi_words := stream_mosi_words;
+						miso_words := stream_miso_words;
+						-- rle words numbers are the last info words
+						if rle_mode and wide and stream_count = stream_info_last then
+							mosi_words := unsigned(fifo_pinfo_hi_out(12 downto 0));
+							miso_words := unsigned(fifo_pinfo_lo_out(12 downto 0));
+						elsif rle_mode and not wide and stream_count = stream_info_last - 1 then
+							mosi_words := unsigned(fifo_pinfo_out(12 downto 0));
+						elsif rle_mode and not wide and stream_count = stream_info_last then
+							miso_words := unsigned(fifo_pinfo_out(12 downto 0));
+						end if;
+						stream_mosi_words <= mosi_words;
+						stream_miso_words <= miso_words;
+
+						if stream_count = stream_info_last then
+							stream_count <= (others => '0');
+							if mosi_words /= 0 or (wide and miso_words /= 0) then
+								stream_state <= STREAM_MOSI;
+							elsif miso_words /= 0 then
+								stream_state <= STREAM_MISO;
+							else
+								stream_state <= STREAM_DESC;
+							end if;
+						else
+							stream_count <= stream_count + 1;
+						end if;
+					when STREAM_MOSI =>
+						-- on 32 bits, pairs until both lanes are read
+						if wide and (stream_count + 1 < stream_mosi_words or
+							     stream_count + 1 < stream_miso_words) then
+							stream_count <= stream_count + 1;
+						elsif wide then
+							stream_count <= (others => '0');
+							stream_state <= STREAM_DESC;
+						elsif stream_count + 1 < stream_mosi_words then
+							stream_count <= stream_count + 1;
+						else
+							stream_count <= (others => '0');
+							if stream_miso_words = 0 then
+								stream_state <= STREAM_DESC;
+							else
+								stream_state <= STREAM_MISO;
+							end if;
+						end if;
+					when STREAM_MISO =>
+						if stream_count + 1 < stream_miso_words then
+							stream_count <= stream_count + 1;
+						else
+							stream_count <= (others => '0');
+							stream_state <= STREAM_DESC;
+						end if;
+				end case;
+			end if;
+			stream_read_old := stream_read;
+		end if;
+	end process;
+
 	wishbone_write : process(gls_reset, gls_clk)
 	begin
 		if (gls_reset = '1') then
@@ -338,26 +1314,339 @@ begin
 			irq_pnum_trig <= "00000000001";
 			irq_ack <= '0';
 			fifo_reset <= '0';
+			swap_req <= '0';
 
 			-- Reset config register
 			cpol <= '0';
 			cpha <= '0';
 			cspol <= '0';
+			lane_mode <= "00";
+			sample_delay <= "00";
+
+			-- Reset filter registers, filter off
+			filter_enable <= '0';
+			filter_exclude <= '0';
+			filter_trigger <= '0';
+			filter_post <= (others => '0');
+			filter_match <= (others => '0');
+			filter_mask <= (others => '0');
+			filter_arm <= '0';
+
+			-- Reset chip selects enable, all captured
+			cs_mask <= (others => '1');
+
+			loss_write <= '0';
+			loss_clear <= '0';
+			dma_ctrl_write <= '0';
+			dma_data_write <= '0';
+			dma_writedata <= (others => '0');
 		elsif (rising_edge(gls_clk)) then
+			filter_arm <= '0';
+			loss_write <= '0';
+			dma_ctrl_write <= '0';
+			dma_data_write <= '0';
 			-- Wishbone write
                         -- Write on falling edge of strobe. Old status of wbs_write must be considered.
 			if wbs_strobe = '1' and wbs_strobe_old = '1' and wbs_write_old = '1' then 				case wbs_add is
 					-- Control register
-					when "000" => 	irq_pnum_trig <= wbs_writedata(10 downto 0);
+					when "0000" => 	irq_pnum_trig <= wbs_writedata(10 downto 0);
 							irq_ack <= wbs_writedata(14);
 							fifo_reset <= wbs_writedata(15);
+							swap_req <= wbs_writedata(13);
 					-- Config
-					when "101" =>	cpol <= wbs_writedata(0);
+					when "0101" =>	cpol <= wbs_writedata(0);
 							cpha <= wbs_writedata(1);
 							cspol <= wbs_writedata(2);
+							-- modes beyond lanes generic stay single
+							if (wbs_writedata(8 downto 7) = "01" and lanes >= 2) or
+							   (wbs_writedata(8 downto 7) = "10" and lanes >= 4) then
+								lane_mode <= wbs_writedata(8 downto 7);
+							else
+								lane_mode <= "00";
+							end if;
+							if ddr_mode then
+								sample_delay <= wbs_writedata(11 downto 10);
+							end if;
+					-- Filter, writing FILTER_CTRL arms trigger again
+					when "1100" =>	filter_post <= wbs_writedata(10 downto 0);
+							filter_trigger <= wbs_writedata(13);
+							filter_exclude <= wbs_writedata(14);
+							filter_enable <= wbs_writedata(15);
+							filter_arm <= '1';
+					when "1101" =>	filter_match <= wbs_writedata(15 downto 0);
+					when "1110" =>	filter_mask <= wbs_writedata(15 downto 0);
+					when "1111" =>	cs_mask <= wbs_writedata(7 downto 0);
+					-- Dma, stream window aliases without dma generic
+					when "1001" =>	if dma_mode then
+								dma_ctrl_write <= '1';
+								dma_writedata <= wbs_writedata(15 downto 0);
+							end if;
+					when "1010" =>	if dma_mode then
+								dma_data_write <= '1';
+								dma_writedata <= wbs_writedata(15 downto 0);
+							end if;
+					-- Loss counters latch, and clear with bit 15
+					when "1011" =>	loss_write <= '1';
+							loss_clear <= wbs_writedata(15);
+					when others =>
+				end case;
+			end if;
+		end if;
+	end process;
+
+	-- Loss counters, saturating. A LOSS write latches them for reading
+	-- and clears them in the same cycle, so that no loss is missed
+	-- between two latches. A host fifo reset drops the packets left in
+	-- fifo_packet, they are counted with their bits unknown.
+	loss_management : process(gls_reset, gls_clk)
+		variable loss_write_old : std_logic := '0';
+		variable loss_read_old : std_logic := '0';
+		variable fifo_reset_old : std_logic := '0';
+		variable packets : unsigned(15 downto 0);
+		variable dropped : unsigned(16 downto 0);
+		variable bits : unsigned(32 downto 0);
+		variable events : unsigned(15 downto 0);
+		variable period : unsigned(15 downto 0);
+	begin
+		if gls_reset = '1' then
+			sck_min <= (others => '1');
+			loss_packets <= (others => '0');
+			loss_bits <= (others => '0');
+			loss_events <= (others => '0');
+			loss_latched <= (others => (others => '0'));
+			loss_idx <= 0;
+			loss_write_old := '0';
+			loss_read_old := '0';
+			fifo_reset_old := '0';
+		elsif rising_edge(gls_clk) then
+			packets := loss_packets;
+			bits := resize(loss_bits, 33);
+			events := loss_events;
+			period := sck_min;
+			if loss_write = '1' and loss_write_old = '0' then
+				loss_latched(0) <= std_logic_vector(loss_packets);
+				loss_latched(1) <= std_logic_vector(loss_bits(31 downto 16));
+				loss_latched(2) <= std_logic_vector(loss_bits(15 downto 0));
+				loss_latched(3) <= std_logic_vector(loss_events);
+				loss_latched(4) <= std_logic_vector(sck_min);
+				loss_idx <= 0;
+				if loss_clear = '1' then
+					packets := (others => '0');
+					bits := (others => '0');
+					events := (others => '0');
+					period := (others => '1');
+				end if;
+			elsif (loss_read_old = '1') and (loss_read = '0') then
+				loss_idx <= (loss_idx + 1) mod 5;
+			end if;
+
+			if sck_period_valid = '1' and sck_period < period then
+				period := sck_period;
+			end if;
+
+			if fifo_reset = '1' and fifo_reset_old = '0' then
+				dropped := resize(packets, 17) + unsigned(packet_count);
+				if dropped(16) = '1' then
+					packets := x"FFFF";
+				else
+					packets := dropped(15 downto 0);
+				end if;
+			end if;
+			if packet_lost = '1' and packets /= x"FFFF" then
+				packets := packets + 1;
+			end if;
+			if packet_lost = '1' then
+				bits := bits + packet_lost_bits;
+				if bits(32) = '1' then
+					bits := (others => '1');
+				end if;
+			end if;
+			if overflow_event = '1' and events /= x"FFFF" then
+				events := events + 1;
+			end if;
+			loss_packets <= packets;
+			loss_bits <= bits(31 downto 0);
+			loss_events <= events;
+			sck_min <= period;
+
+			loss_write_old := loss_write;
+			loss_read_old := loss_read;
+			fifo_reset_old := fifo_reset;
+		end if;
+	end process;
+
+	-- Dma engine: copies whole packets from the stream window to the
+	-- ring in memory through the wishbone master, one word per write
+	-- cycle. Stream reads are one cycle pulses taken between host
+	-- accesses, and fifo outputs get dma_settle cycles to follow.
+	-- A host fifo reset drops the packet being copied. Without dma
+	-- generic, DMA_CTRL is never written and the engine stays idle.
+	dma_management : process(gls_reset, gls_clk)
+		variable ctrl_write_old : std_logic := '0';
+		variable data_write_old : std_logic := '0';
+		variable data_read_old : std_logic := '0';
+		variable count : unsigned(10 downto 0);
+		variable wr : unsigned(31 downto 0);
+	begin
+		if gls_reset = '1' then
+			dma_state <= DMA_IDLE;
+			dma_enable <= '0';
+			dma_index <= (others => '0');
+			dma_base <= (others => '0');
+			dma_size <= (others => '0');
+			dma_wr <= (others => '0');
+			dma_wr_latched <= (others => '0');
+			dma_rd <= (others => '0');
+			dma_rd_msw <= (others => '0');
+			dma_cur <= (others => '0');
+			dma_count <= (others => '0');
+			dma_settle <= 0;
+			dma_abort <= '0';
+			wbm_add <= (others => '0');
+			wbm_writedata <= (others => '0');
+			wbm_strobe <= '0';
+			wbm_cycle <= '0';
+			wbm_write <= '0';
+			ctrl_write_old := '0';
+			data_write_old := '0';
+			data_read_old := '0';
+		elsif rising_edge(gls_clk) then
+			count := dma_count;
+			wr := dma_wr;
+
+			-- Registers
+			if dma_ctrl_write = '1' and ctrl_write_old = '0' then
+				if dma_writedata(15) = '1' and dma_enable = '0' and
+				   dma_state = DMA_IDLE then
+					-- ring starts empty
+					dma_cur <= (others => '0');
+					wr := (others => '0');
+					dma_rd <= (others => '0');
+				end if;
+				dma_enable <= dma_writedata(15);
+				dma_index <= unsigned(dma_writedata(2 downto 0));
+				if dma_writedata(2 downto 0) = "100" then
+					dma_wr_latched <= dma_wr;
+					count := (others => '0');
+				end if;
+			elsif dma_data_write = '1' and data_write_old = '0' then
+				case dma_index is
+					when "000" =>	dma_base(31 downto 16) <= unsigned(dma_writedata);
+					when "001" =>	dma_base(15 downto 0) <= unsigned(dma_writedata);
+					when "010" =>	dma_size(31 downto 16) <= unsigned(dma_writedata);
+					when "011" =>	dma_size(15 downto 0) <= unsigned(dma_writedata);
+					when "110" =>	dma_rd_msw <= dma_writedata;
+					when "111" =>	dma_rd <= unsigned(dma_rd_msw & dma_writedata);
 					when others =>
 				end case;
+				dma_index <= dma_index + 1;
+			elsif (data_read_old = '1') and (dma_data_read = '0') then
+				dma_index <= dma_index + 1;
 			end if;
+
+			-- Engine
+			case dma_state is
+				when DMA_IDLE =>
+					if dma_enable = '0' or fifo_init = '1' then
+						null;
+					elsif fifo_packet_empty = '0' then
+						dma_state <= DMA_FETCH;
+					end if;
+				when DMA_FETCH =>
+					if fifo_reset = '1' then
+						dma_cur <= dma_wr;
+						dma_state <= DMA_IDLE;
+					elsif dma_read = '1' then
+						wbm_add <= std_logic_vector(dma_base + dma_cur);
+						wbm_writedata <= stream_value(wb_size-1 downto 0);
+						wbm_strobe <= '1';
+						wbm_cycle <= '1';
+						wbm_write <= '1';
+						dma_state <= DMA_WRITE;
+					end if;
+				when DMA_WRITE =>
+					if fifo_reset = '1' then
+						dma_abort <= '1';
+					end if;
+					if wbm_ack = '1' then
+						wbm_strobe <= '0';
+						wbm_cycle <= '0';
+						wbm_write <= '0';
+						if dma_cur + dma_word_bytes >= dma_size then
+							dma_cur <= (others => '0');
+						else
+							dma_cur <= dma_cur + dma_word_bytes;
+						end if;
+						dma_settle <= 3;
+						dma_state <= DMA_SETTLE;
+					end if;
+				when DMA_SETTLE =>
+					if fifo_reset = '1' or dma_abort = '1' then
+						dma_abort <= '0';
+						dma_cur <= dma_wr;
+						dma_state <= DMA_IDLE;
+					elsif dma_settle /= 0 then
+						dma_settle <= dma_settle - 1;
+					elsif stream_state = STREAM_DESC then
+						-- whole packet copied
+						wr := dma_cur;
+						if count /= 2**11 - 1 then
+							count := count + 1;
+						end if;
+						dma_state <= DMA_IDLE;
+					else
+						dma_state <= DMA_FETCH;
+					end if;
+			end case;
+			dma_count <= count;
+			dma_wr <= wr;
+
+			ctrl_write_old := dma_ctrl_write;
+			data_write_old := dma_data_write;
+			data_read_old := dma_data_read;
+		end if;
+	end process;
+
+	assert not (dma_mode and pp_mode)
+		report "spisnif: dma needs ping_pong 0" severity failure;
+
+	assert cs_num >= 1 and cs_num <= 8
+		report "spisnif: cs_num must be 1 to 8" severity failure;
+
+	-- fifo_packet pointers do not wrap: rewind the fifos between packets
+	-- once everything recorded was read, by the dma engine or by the host
+	-- (stream window or FIFO_* registers), so that they do not fill up
+	-- under steady traffic. Ping pong banks are rewound by swaps.
+	fifo_rewind_management : process(gls_reset, gls_clk)
+		variable write_enable_old : std_logic := '0';
+		variable pinfo_idle_old : boolean := true;
+	begin
+		if gls_reset = '1' then
+			fifo_rewind <= '0';
+			fifo_dirty <= '0';
+			write_enable_old := '0';
+			pinfo_idle_old := true;
+		elsif rising_edge(gls_clk) then
+			fifo_rewind <= '0';
+			if fifo_init = '1' then
+				fifo_dirty <= '0';
+			elsif fifo_packet_empty = '0' then
+				fifo_dirty <= '1';
+			elsif not pp_mode and fifo_dirty = '1' and
+			      write_enable = '0' and write_enable_old = '0' and
+			      pinfo_step = 0 and pinfo_idle_old and
+			      fifo_mosi_busy = '0' and fifo_miso_busy = '0' and
+			      ((dma_enable = '1' and dma_state = DMA_IDLE) or
+			       (dma_enable = '0' and wbs_strobe = '0' and
+			        stream_state = STREAM_DESC and
+			        fifo_mosi_empty = '1' and fifo_miso_empty = '1' and
+			        fifo_pinfo_hi_empty = '1' and
+			        fifo_pinfo_lo_empty = '1')) then
+				fifo_rewind <= '1';
+				fifo_dirty <= '0';
+			end if;
+			write_enable_old := write_enable;
+			pinfo_idle_old := pinfo_step = 0;
 		end if;
 	end process;
 
@@ -369,7 +1658,7 @@ begin
 			wbs_irq <= '0';
 			irq_ack_lock := '0';
 		elsif (rising_edge(gls_clk)) then
-			if (packet_count >= irq_pnum_trig) then
+			if (irq_count >= irq_pnum_trig) then
 				if irq_ack_lock = '1' then -- Ack previously received
 					wbs_irq <= '0';
 				else -- Ack not received yet
@@ -399,5 +1688,46 @@ begin
 
 	-- Config register mapping
 	fifo_full <= fifo_mosi_full or fifo_miso_full;
+	pp_flag <= '1' when pp_mode else '0';
+
+	-- Trigger state mapping
+	triggered <= '0' when trig_state = TRIG_ARMED else '1';
+	trig_done <= '1' when trig_state = TRIG_DONE else '0';
+
+	-- Packet info mapping
+	fifo_pinfo_afull <= fifo_pinfo_hi_afull or fifo_pinfo_lo_afull;
+	fifo_pinfo_out <= fifo_pinfo_lo_out when pinfo_lo_sel = '1' else fifo_pinfo_hi_out;
+	pinfo_hi_rd_en <= '1' when wide else not pinfo_lo_sel;
+	pinfo_lo_rd_en <= '1' when wide else pinfo_lo_sel;
+	stream_info_last <= to_unsigned(stream_info_reads - 1, 13);
+	stream_mosi_left <= '1' when stream_count < stream_mosi_words else '0';
+	stream_miso_left <= '1' when stream_count < stream_miso_words else '0';
+	rle_flag <= '1' when rle_mode else '0';
+	cs_bits_flag <= std_logic_vector(to_unsigned(cs_bits, 3));
+	lane_flag <= '1' when lane_bits /= 0 else '0';
+	ddr_flag <= '1' when ddr_mode else '0';
+
+	-- Dma mapping
+	dma_flag <= '1' when dma_mode else '0';
+	fifo_init <= fifo_reset or fifo_rewind;
+	irq_count <= std_logic_vector(dma_count) when dma_enable = '1' else capture_count;
+	stream_window <= '1' when dma_enable = '0' and (wbs_add = "1000" or
+			 (not dma_mode and (wbs_add = "1001" or wbs_add = "1010"))) else '0';
+	dma_busy <= '0' when dma_state = DMA_IDLE else '1';
+	dma_used <= dma_cur - dma_rd when dma_cur >= dma_rd else
+		    dma_cur + dma_size - dma_rd;
+	dma_room <= '1' when dma_used + dma_word_bytes < dma_size else '0';
+	dma_read <= '1' when dma_state = DMA_FETCH and dma_room = '1' and
+		    wbs_strobe = '0' and fifo_reset = '0' else '0';
+	with dma_index select
+		dma_data_value <=	std_logic_vector(dma_base(31 downto 16)) when "000",
+					std_logic_vector(dma_base(15 downto 0)) when "001",
+					std_logic_vector(dma_size(31 downto 16)) when "010",
+					std_logic_vector(dma_size(15 downto 0)) when "011",
+					std_logic_vector(dma_wr_latched(31 downto 16)) when "100",
+					std_logic_vector(dma_wr_latched(15 downto 0)) when "101",
+					std_logic_vector(dma_rd(31 downto 16)) when "110",
+					std_logic_vector(dma_rd(15 downto 0)) when others;
+	quad <= '1' when packet_lanes = "10" else '0';
 
 end architecture spisnif_1;
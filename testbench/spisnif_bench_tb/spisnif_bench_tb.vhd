@@ -0,0 +1,871 @@
+--
+-- Copyright (c) Armadeus system 2013
+--
+-- This program is free software; you can redistribute it and/or modify
+-- it under the terms of the GNU Lesser General Public License as published by
+-- the Free Software Foundation; either version 2, or (at your option)
+-- any later version.
+--
+-- This program is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public License
+-- along with this program; if not, write to the Free Software
+-- Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+--*********************************************************************
+--
+-- File          : spisnif_bench_tb.vhd
+-- Created on    : 17/10/2013
+-- Author        : Fabien Marteau <fabien.marteau@armadeus.com>
+--
+--*********************************************************************
+--
+-- Self checking throughput bench: sends PACKETS randomized packets per
+-- step at SCK periods going from SCK_NS_START down to SCK_NS_MIN, drains
+-- them through the stream window as the driver does (on interrupt after
+-- HOST_NS, or every LATENCY_US below irq_pnum_trig) and checks each one.
+-- First MOSI word of each packet is its sequence number, so lost packets
+-- show as gaps that LOSS must account for, and the SCK period LOSS
+-- measures must match the one sent. Reports per step and the fastest
+-- lossless SCK, then "PASS" or "FAIL".
+-- With DMA=1 the component copies the packets to a ring in the memory
+-- modelled here, and the host drains that ring the same way. With LANES
+-- 2 or 4, each SCK period is run in single, dual and then quad mode, quad
+-- only with SCK slower than a quarter of gls_clk. With RLE=1 three
+-- packets in four idle a lane after their first word, each lane is
+-- expanded from its stored words before being checked, and the sweep
+-- stops before SCK reaches a quarter of gls_clk.
+--
+--*********************************************************************
+
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.numeric_std.all;
+
+use work.wishbone_test_pkg.all;
+use work.spigen_pkg.all;
+
+Entity spisnif_bench_tb is
+generic (
+    -- gls_clk period
+    CLK_NS : natural := 10;
+    -- SCK period sweep
+    SCK_NS_START : natural := 400;
+    SCK_NS_STEP  : natural := 40;
+    SCK_NS_MIN   : natural := 40;
+    -- packets per step, lengths and CS deassert time between them
+    PACKETS  : natural := 200;
+    BITS_MIN : natural := 16;
+    BITS_MAX : natural := 128;
+    GAP_NS   : natural := 200;
+    -- host: irq_pnum_trig, interrupt latency, drain period below threshold
+    IRQ_TRIG   : natural := 16;
+    HOST_NS    : natural := 2000;
+    LATENCY_US : natural := 20;
+    WSC        : natural := 5;
+    -- component generics
+    PING_PONG : natural := 0;
+    DDR_SAMPLING : natural := 0;
+    LANES        : natural := 1;
+    RLE          : natural := 0;
+    -- 1: dma to a RING_WORDS words ring, needs PING_PONG 0
+    DMA        : natural := 0;
+    RING_WORDS : natural := 4096;
+    SEED      : natural := 1
+);
+end entity;
+
+Architecture spisnif_bench_tb_1 of spisnif_bench_tb is
+
+    -- registers mapping
+    CONSTANT REG_CONTROL     : std_logic_vector(3 downto 0) := "0000";
+    CONSTANT REG_STATUS      : std_logic_vector(3 downto 0) := "0100";
+    CONSTANT REG_CONFIG      : std_logic_vector(3 downto 0) := "0101";
+    CONSTANT REG_STREAM      : std_logic_vector(3 downto 0) := "1000";
+    CONSTANT REG_DMA_CTRL    : std_logic_vector(3 downto 0) := "1001";
+    CONSTANT REG_DMA_DATA    : std_logic_vector(3 downto 0) := "1010";
+    CONSTANT REG_LOSS        : std_logic_vector(3 downto 0) := "1011";
+    -- CONFIG lanes mode
+    CONSTANT CONFIG_LANES_SHIFT : natural := 7;
+
+    CONSTANT CTRL_RESET : std_logic_vector(4 downto 0) := "10000";
+    CONSTANT CTRL_ACK   : std_logic_vector(4 downto 0) := "01000";
+    CONSTANT CTRL_SWAP  : std_logic_vector(4 downto 0) := "00100";
+    CONSTANT CTRL_NONE  : std_logic_vector(4 downto 0) := "00000";
+
+    -- DMA_CTRL enable and DMA_DATA indexes
+    CONSTANT DMA_ENABLE : std_logic_vector(15 downto 0) := x"8000";
+    CONSTANT DMA_BASE   : std_logic_vector(15 downto 0) := x"0000";
+    CONSTANT DMA_WR     : std_logic_vector(15 downto 0) := x"0004";
+    CONSTANT DMA_RD     : std_logic_vector(15 downto 0) := x"0006";
+    CONSTANT DMA_BUSY   : natural := 14;
+    -- ring address in memory, in bytes
+    CONSTANT RING_BASE : natural := 16#1000#;
+
+    CONSTANT HASH_MUL : unsigned(31 downto 0) := x"9E3779B1";
+    CONSTANT MAX_ERRORS : natural := 10;
+
+    signal imx_clk : std_logic;
+    signal reset : std_logic;
+    signal wbs_add       : std_logic_vector(3 downto 0);
+    signal wbs_writedata : std_logic_vector(15 downto 0);
+    signal wbs_readdata  : std_logic_vector(15 downto 0);
+    signal wbs_strobe    : std_logic;
+    signal wbs_cycle     : std_logic;
+    signal wbs_write     : std_logic;
+    signal wbs_ack       : std_logic;
+     -- interrupt
+    signal wbs_irq     : std_logic;
+    -- spi
+    signal sck  : std_logic;
+    signal mosi : std_logic;
+    signal miso : std_logic;
+    signal cs   : std_logic;
+    signal io2  : std_logic;
+    signal io3  : std_logic;
+    -- dma master
+    signal wbm_add       : std_logic_vector(31 downto 0);
+    signal wbm_writedata : std_logic_vector(15 downto 0);
+    signal wbm_strobe    : std_logic;
+    signal wbm_cycle     : std_logic;
+    signal wbm_write     : std_logic;
+    signal wbm_ack       : std_logic;
+
+    -- dma ring memory
+    type ring_t is array (0 to RING_WORDS - 1) of std_logic_vector(15 downto 0);
+    signal ring : ring_t;
+
+    -- words of each lane of a packet, MOSI then MISO
+    type lane_words_t is array (0 to 1) of natural;
+
+component spisnif
+    generic(
+        ping_pong : natural := 0;
+        ddr_sampling : natural := 0;
+        lanes : natural := 1;
+        rle : natural := 0;
+        dma : natural := 0
+    );
+    port
+    (
+        -- Syscon signals
+        gls_reset    : in std_logic;
+        gls_clk      : in std_logic;
+        -- Wishbone signals
+        wbs_add       : in std_logic_vector(3 downto 0);
+        wbs_writedata : in std_logic_vector(15 downto 0);
+        wbs_readdata  : out std_logic_vector(15 downto 0);
+        wbs_strobe    : in std_logic;
+        wbs_cycle     : in std_logic;
+        wbs_write     : in std_logic;
+        wbs_ack       : out std_logic;
+        -- interrupt
+        wbs_irq     : out std_logic;
+        -- spi
+        sck  : in std_logic;
+        mosi : in std_logic;
+        miso : in std_logic;
+        cs   : in std_logic;
+        -- quad lanes data 2 and 3
+        io2 : in std_logic := '0';
+        io3 : in std_logic := '0';
+        -- dma master
+        wbm_add       : out std_logic_vector(31 downto 0);
+        wbm_writedata : out std_logic_vector(15 downto 0);
+        wbm_strobe    : out std_logic;
+        wbm_cycle     : out std_logic;
+        wbm_write     : out std_logic;
+        wbm_ack       : in std_logic := '0');
+end component;
+
+    signal value : std_logic_vector(15 downto 0);
+    signal irq_pnum_trig : std_logic_vector(10 downto 0);
+
+    -- gls_clk cycles since reset, as the component timestamp counter
+    signal cycles : unsigned(31 downto 0);
+
+    -- host and generator handshake, one step each
+    signal step : natural := 0;
+    signal sck_per : time := 100 ns;
+    signal step_lanes : natural := 1;
+    signal gen_start : std_logic := '0';
+    signal gen_done : std_logic := '0';
+
+    -- random word idx of lane (0 MOSI, 1 MISO) of packet seq in step
+    function hash_word(step_num, seq, lane, idx : natural)
+        return std_logic_vector is
+        variable v : unsigned(31 downto 0);
+    begin
+        v := to_unsigned(seq, 16) & to_unsigned((idx*2 + lane) mod 65536, 16);
+        v := v xor (to_unsigned(SEED mod 65536, 16) &
+                    to_unsigned(step_num mod 65536, 16));
+        v := resize(v * HASH_MUL, 32);
+        v := v xor shift_right(v, 16);
+        v := resize(v * HASH_MUL, 32);
+        return std_logic_vector(v(31 downto 16));
+    end function;
+
+    -- word idx of lane of packet seq in step, bits after bit_num are not
+    -- masked. With RLE, after the first word, MOSI idles high in odd
+    -- packets (dummy bytes of a read) and MISO low in one packet in four.
+    function lane_word(step_num, seq, lane, idx : natural)
+        return std_logic_vector is
+    begin
+        if lane = 0 and idx = 0 then
+            return std_logic_vector(to_unsigned(seq, 16));
+        elsif RLE /= 0 and idx > 0 and lane = 0 and seq mod 2 = 1 then
+            return x"FFFF";
+        elsif RLE /= 0 and idx > 0 and lane = 1 and seq mod 4 = 2 then
+            return x"0000";
+        end if;
+        return hash_word(step_num, seq, lane, idx);
+    end function;
+
+    -- bit length of packet seq in step, even in quad mode (2 bits per edge)
+    function packet_bits(step_num, seq, lanes : natural) return natural is
+        variable bits : natural;
+    begin
+        bits := BITS_MIN + to_integer(unsigned(hash_word(step_num, seq, 1,
+                    32767))) mod (BITS_MAX - BITS_MIN + 1);
+        if lanes = 4 then
+            return bits - bits mod 2;
+        end if;
+        return bits;
+    end function;
+
+    -- word idx as stored in fifo_mxsx: bits after bit_num read as 0
+    function stored_word(step_num, seq, lane, idx, bits : natural)
+        return std_logic_vector is
+        variable w : std_logic_vector(15 downto 0);
+    begin
+        w := lane_word(step_num, seq, lane, idx);
+        if (idx = (bits - 1)/16) and (bits mod 16 /= 0) then
+            w(15 downto bits mod 16) := (others => '0');
+        end if;
+        return w;
+    end function;
+
+    -- lane bits in sending order, first bit is lsb of first word
+    function lane_bits(step_num, seq, lane, bits : natural)
+        return std_logic_vector is
+        variable v : std_logic_vector(0 to bits - 1);
+        variable w : std_logic_vector(15 downto 0);
+    begin
+        for i in 0 to bits - 1 loop
+            if i mod 16 = 0 then
+                w := lane_word(step_num, seq, lane, i/16);
+            end if;
+            v(i) := w(i mod 16);
+        end loop;
+        return v;
+    end function;
+
+    -- quad mode: data of one lane on each edge, from the bits a fifo stores
+    -- (data 0 or 1 then data 2 or 3 of each edge)
+    function edge_bits(v : std_logic_vector; second : natural)
+        return std_logic_vector is
+        variable e : std_logic_vector(0 to v'length/2 - 1);
+    begin
+        for i in e'range loop
+            e(i) := v(v'low + 2*i + second);
+        end loop;
+        return e;
+    end function;
+
+    function ns_image(t : time) return string is
+    begin
+        return integer'image(t / 1 ns)&" ns";
+    end function;
+
+begin
+
+    assert BITS_MIN >= 16
+        report "BITS_MIN must be >= 16, first MOSI word is the sequence number"
+        severity failure;
+    assert (BITS_MAX >= BITS_MIN) and (BITS_MAX <= 16384) and
+           (LANES = 1 or BITS_MAX <= 16383)
+        report "BITS_MAX must be between BITS_MIN and fifo_mxsx size"
+        severity failure;
+    assert LANES = 1 or LANES = 2 or LANES = 4
+        report "LANES must be 1, 2 or 4" severity failure;
+    assert RLE = 0 or SCK_NS_START > 4*CLK_NS
+        report "RLE needs SCK slower than a quarter of gls_clk"
+        severity failure;
+    assert (PACKETS > 0) and (PACKETS <= 65536)
+        report "PACKETS must be between 1 and 65536" severity failure;
+    assert DMA = 0 or (PING_PONG = 0 and RING_WORDS*2 >= 8*(5 + BITS_MAX/8))
+        report "DMA needs PING_PONG 0 and a ring of a few largest packets"
+        severity failure;
+
+	inst_spisnif : spisnif
+	generic map (
+	    ping_pong => PING_PONG,
+	    ddr_sampling => DDR_SAMPLING,
+	    lanes => LANES,
+	    rle => RLE,
+	    dma => DMA)
+	port map (
+	    -- Syscon signals
+	    gls_clk => imx_clk,
+	    gls_reset => reset,
+	    -- Wishbone signals
+	    wbs_add => wbs_add,
+	    wbs_writedata => wbs_writedata,
+	    wbs_readdata => wbs_readdata,
+	    wbs_strobe => wbs_strobe,
+	    wbs_cycle => wbs_cycle,
+	    wbs_write => wbs_write,
+	    wbs_ack => wbs_ack,
+	    -- interrupt
+	    wbs_irq => wbs_irq,
+	    -- spi
+	    sck => sck,
+	    mosi => mosi,
+	    miso => miso,
+	    cs => cs,
+	    io2 => io2,
+	    io3 => io3,
+	    -- dma master
+	    wbm_add => wbm_add,
+	    wbm_writedata => wbm_writedata,
+	    wbm_strobe => wbm_strobe,
+	    wbm_cycle => wbm_cycle,
+	    wbm_write => wbm_write,
+	    wbm_ack => wbm_ack);
+
+    cycle_count : process(imx_clk, reset)
+    begin
+        if reset = '1' then
+            cycles <= (others => '0');
+        elsif rising_edge(imx_clk) then
+            cycles <= cycles + 1;
+        end if;
+    end process cycle_count;
+
+    -- dma ring memory, each write acked on next cycle
+    ring_memory : process(imx_clk, reset)
+        variable idx : integer;
+    begin
+        if reset = '1' then
+            wbm_ack <= '0';
+        elsif rising_edge(imx_clk) then
+            wbm_ack <= '0';
+            if wbm_cycle = '1' and wbm_strobe = '1' and wbm_write = '1' and
+               wbm_ack = '0' then
+                idx := (to_integer(unsigned(wbm_add)) - RING_BASE)/2;
+                assert (idx >= 0) and (idx < RING_WORDS) and
+                       (wbm_add(0) = '0')
+                    report "dma write out of ring at "
+                        &integer'image(to_integer(unsigned(wbm_add)))
+                    severity failure;
+                ring(idx) <= wbm_writedata;
+                wbm_ack <= '1';
+            end if;
+        end if;
+    end process ring_memory;
+
+    -- SPI traffic, CPHA=0 CPOL=0 CSPOL=0. Dual mode stores data 0 and 1
+    -- as single mode does, quad mode sends what each fifo stores over two
+    -- lanes.
+    spi_stimulis : process
+        variable bits : natural;
+    begin
+        sck <= '0';
+        mosi <= '0';
+        miso <= '0';
+        io2 <= '0';
+        io3 <= '0';
+        cs <= '1';
+        gen_done <= '0';
+        loop
+            wait until gen_start = '1';
+            for seq in 0 to PACKETS - 1 loop
+                bits := packet_bits(step, seq, step_lanes);
+                if step_lanes = 4 then
+                    spi_send_quad_frame(
+                        data0 => edge_bits(lane_bits(step, seq, 0, bits), 0),
+                        data1 => edge_bits(lane_bits(step, seq, 1, bits), 0),
+                        data2 => edge_bits(lane_bits(step, seq, 0, bits), 1),
+                        data3 => edge_bits(lane_bits(step, seq, 1, bits), 1),
+                        clock_per => sck_per,
+                        cpol => '0', cpha => '0', cspol => '0',
+                        spi_clock => sck,
+                        spi_io0 => mosi,
+                        spi_io1 => miso,
+                        spi_io2 => io2,
+                        spi_io3 => io3,
+                        spi_cs => cs);
+                else
+                    spi_send_frame(
+                        mosi => lane_bits(step, seq, 0, bits),
+                        miso => lane_bits(step, seq, 1, bits),
+                        clock_per => sck_per,
+                        cpol => '0', cpha => '0', cspol => '0',
+                        spi_clock => sck,
+                        spi_mosi => mosi,
+                        spi_miso => miso,
+                        spi_cs => cs);
+                end if;
+                wait for GAP_NS * 1 ns;
+            end loop;
+            gen_done <= '1';
+            wait until gen_start = '0';
+            gen_done <= '0';
+        end loop;
+    end process spi_stimulis;
+
+    -- host: configure, then one drain loop per SCK period
+    stimulis : process
+        variable sck_ns : natural;
+        variable best_ns : natural;
+        -- lanes of the step, all lanes modes lossless at sck_ns so far
+        variable lanes_now : natural;
+        variable sck_lossless : boolean;
+        variable failed : boolean;
+        -- step results
+        variable next_seq, seq, bits, word_num : natural;
+        variable received, gaps, errors : natural;
+        variable lost_packets, lost_bits, overflows : natural;
+        variable hw_packets, hw_words, drain_words : natural;
+        variable packet_num : natural;
+        variable ts_end : unsigned(31 downto 0);
+        variable latency, latency_max : natural;
+        variable irq_time, irq_latency_max : time;
+        variable irq_seen : boolean;
+        variable loss : std_logic_vector(79 downto 0);
+        variable sck_measured : natural;
+        variable word : std_logic_vector(15 downto 0);
+        variable engine_busy : boolean;
+        -- rle: stored words of each lane, expanded words and run state
+        variable rle_words : lane_words_t;
+        variable expanded : natural;
+        variable prev : std_logic_vector(15 downto 0);
+        variable prev_valid, count_next : boolean;
+        -- dma ring words read, host side, and published by the engine
+        variable ring_rd, ring_wr : natural;
+
+        -- next stream word, from the stream window or the dma ring
+        procedure stream_read(variable w : out std_logic_vector(15 downto 0)) is
+        begin
+            if DMA = 0 then
+                wishbone_read(REG_STREAM,  value,
+                              imx_clk, wbs_strobe, wbs_cycle,
+                              wbs_write, wbs_ack, wbs_add,
+                              wbs_writedata, wbs_readdata, WSC);
+                w := value;
+            else
+                w := ring(ring_rd);
+                ring_rd := (ring_rd + 1) mod RING_WORDS;
+            end if;
+        end procedure;
+
+        -- expanded word idx of lane of the packet being drained
+        procedure check_word(w : std_logic_vector(15 downto 0);
+                             lane, idx : natural) is
+        begin
+            if (seq < next_seq) or (seq >= PACKETS) or (idx >= word_num) or
+               (bits /= packet_bits(step, seq, lanes_now)) or
+               (w /= stored_word(step, seq, lane, idx, bits)) then
+                if errors < MAX_ERRORS then
+                    report "sck "&integer'image(sck_ns)
+                        &" ns: packet "&integer'image(seq)
+                        &" word "&integer'image(idx)
+                        &" lane "&integer'image(lane)
+                        &" differs" severity warning;
+                end if;
+                errors := errors + 1;
+            end if;
+        end procedure;
+
+        -- DMA_DATA word at index, then index goes to the next one
+        procedure dma_select(index : std_logic_vector(15 downto 0)) is
+        begin
+            wishbone_write( REG_DMA_CTRL, DMA_ENABLE or index,
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+        end procedure;
+    begin
+        reset <= '1';
+        irq_pnum_trig <= std_logic_vector(to_unsigned(IRQ_TRIG, 11));
+        wbs_add <= (others => '0');
+        wbs_writedata <= (others => '0');
+        wbs_strobe <= '0';
+        wbs_cycle <= '0';
+        wbs_write <= '0';
+        wait for 1 us;
+        reset <= '0';
+
+        wishbone_write( REG_CONFIG, x"0000",
+                        imx_clk, wbs_strobe, wbs_cycle,
+                        wbs_write, wbs_ack, wbs_add,
+                        wbs_writedata, wbs_readdata, WSC);
+
+        ring_rd := 0;
+        ring_wr := 0;
+        if DMA /= 0 then
+            -- ring base and size, then enable from idle: ring starts empty
+            wishbone_write( REG_DMA_CTRL, DMA_BASE,
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+            for i in 0 to 3 loop
+                if i = 0 then
+                    word := std_logic_vector(to_unsigned(RING_BASE / 65536, 16));
+                elsif i = 1 then
+                    word := std_logic_vector(to_unsigned(RING_BASE mod 65536, 16));
+                elsif i = 2 then
+                    word := std_logic_vector(to_unsigned(RING_WORDS*2 / 65536, 16));
+                else
+                    word := std_logic_vector(to_unsigned(RING_WORDS*2 mod 65536, 16));
+                end if;
+                wishbone_write( REG_DMA_DATA, word,
+                                imx_clk, wbs_strobe, wbs_cycle,
+                                wbs_write, wbs_ack, wbs_add,
+                                wbs_writedata, wbs_readdata, WSC);
+            end loop;
+            dma_select(DMA_BASE);
+        end if;
+
+        best_ns := 0;
+        failed := false;
+        sck_ns := SCK_NS_START;
+        lanes_now := 1;
+        sck_lossless := true;
+        while sck_ns >= SCK_NS_MIN and sck_ns > 0 loop
+            -- rle count bits are written between data bits
+            if RLE /= 0 and sck_ns <= 4*CLK_NS then
+                report "sck "&integer'image(sck_ns)
+                    &" ns: not run, rle needs sck slower than a quarter of gls_clk";
+                exit;
+            end if;
+            sck_per <= sck_ns * 1 ns;
+            step_lanes <= lanes_now;
+            if LANES > 1 then
+                -- lanes mode, "00" single, "01" dual, "10" quad
+                wishbone_write( REG_CONFIG,
+                                std_logic_vector(shift_left(
+                                    to_unsigned(lanes_now/2, 16),
+                                    CONFIG_LANES_SHIFT)),
+                                imx_clk, wbs_strobe, wbs_cycle,
+                                wbs_write, wbs_ack, wbs_add,
+                                wbs_writedata, wbs_readdata, WSC);
+            end if;
+            -- rewind fifos, clear LOSS counters
+            wishbone_write( REG_CONTROL, CTRL_RESET&irq_pnum_trig,
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+            wishbone_write( REG_CONTROL, CTRL_NONE&irq_pnum_trig,
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+            wishbone_write( REG_LOSS, x"8000",
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+
+            next_seq := 0;
+            received := 0;
+            gaps := 0;
+            errors := 0;
+            hw_packets := 0;
+            hw_words := 0;
+            latency_max := 0;
+            irq_latency_max := 0 ns;
+            gen_start <= '1';
+
+            loop
+                if wbs_irq = '0' and gen_done = '0' then
+                    wait until wbs_irq = '1' or gen_done = '1'
+                        for LATENCY_US * 1 us;
+                end if;
+                irq_seen := wbs_irq = '1';
+                irq_time := now;
+                if irq_seen then
+                    wait for HOST_NS * 1 ns;
+                end if;
+
+                if PING_PONG /= 0 then
+                    -- freeze capture bank, wait for the end of the packet
+                    -- being captured
+                    wishbone_write( REG_CONTROL, CTRL_SWAP&irq_pnum_trig,
+                                    imx_clk, wbs_strobe, wbs_cycle,
+                                    wbs_write, wbs_ack, wbs_add,
+                                    wbs_writedata, wbs_readdata, WSC);
+                    wishbone_write( REG_CONTROL, CTRL_NONE&irq_pnum_trig,
+                                    imx_clk, wbs_strobe, wbs_cycle,
+                                    wbs_write, wbs_ack, wbs_add,
+                                    wbs_writedata, wbs_readdata, WSC);
+                    loop
+                        wishbone_read(REG_CONTROL,  value,
+                                      imx_clk, wbs_strobe, wbs_cycle,
+                                      wbs_write, wbs_ack, wbs_add,
+                                      wbs_writedata, wbs_readdata, WSC);
+                        exit when value(13) = '0';
+                    end loop;
+                end if;
+
+                wishbone_read(REG_STATUS,  value,
+                              imx_clk, wbs_strobe, wbs_cycle,
+                              wbs_write, wbs_ack, wbs_add,
+                              wbs_writedata, wbs_readdata, WSC);
+                packet_num := to_integer(unsigned(value(10 downto 0)));
+                if packet_num > hw_packets then
+                    hw_packets := packet_num;
+                end if;
+
+                if DMA /= 0 then
+                    -- STATUS, then engine idle, then write offset: packets
+                    -- found in fifos are in the ring once the engine is idle
+                    wishbone_read(REG_DMA_CTRL,  value,
+                                  imx_clk, wbs_strobe, wbs_cycle,
+                                  wbs_write, wbs_ack, wbs_add,
+                                  wbs_writedata, wbs_readdata, WSC);
+                    engine_busy := value(DMA_BUSY) = '1';
+                    -- latching the write offset restarts interrupt count
+                    dma_select(DMA_WR);
+                    for i in 0 to 1 loop
+                        wishbone_read(REG_DMA_DATA,  value,
+                                      imx_clk, wbs_strobe, wbs_cycle,
+                                      wbs_write, wbs_ack, wbs_add,
+                                      wbs_writedata, wbs_readdata, WSC);
+                        word := value;
+                        if i = 0 then
+                            ring_wr := to_integer(unsigned(word))*65536;
+                        else
+                            ring_wr := (ring_wr + to_integer(unsigned(word)))/2;
+                        end if;
+                    end loop;
+                    exit when packet_num = 0 and not engine_busy and
+                              ring_rd = ring_wr and gen_done = '1';
+                else
+                    exit when packet_num = 0 and gen_done = '1';
+                end if;
+
+                drain_words := 0;
+                for p in 1 to natural'high loop
+                    if DMA = 0 then
+                        exit when p > packet_num;
+                    else
+                        exit when ring_rd = ring_wr;
+                    end if;
+                    -- descriptor, start and end timestamps, MOSI, MISO
+                    stream_read(word);
+                    if LANES > 1 then
+                        -- lanes mode in descriptor msb
+                        if to_integer(unsigned(word(15 downto 14))) /=
+                           lanes_now/2 then
+                            errors := errors + 1;
+                        end if;
+                        word(15 downto 14) := "00";
+                    end if;
+                    bits := to_integer(unsigned(word));
+                    word_num := (bits + 15)/16;
+                    rle_words := (word_num, word_num);
+                    -- with rle, MOSI and MISO stored words follow
+                    for i in 0 to 3 + 2*RLE loop
+                        stream_read(word);
+                        if i = 2 then
+                            ts_end(31 downto 16) := unsigned(word);
+                        elsif i = 3 then
+                            ts_end(15 downto 0) := unsigned(word);
+                        elsif i > 3 then
+                            rle_words(i - 4) := to_integer(unsigned(word));
+                        end if;
+                    end loop;
+                    if rle_words(0) > rle_words(1) then
+                        drain_words := drain_words + rle_words(0);
+                    else
+                        drain_words := drain_words + rle_words(1);
+                    end if;
+                    latency := to_integer(cycles - ts_end);
+                    if latency > latency_max then
+                        latency_max := latency;
+                    end if;
+
+                    seq := next_seq;
+                    for lane in 0 to 1 loop
+                        -- a word equal to the previous one is followed by
+                        -- the number of its further copies
+                        expanded := 0;
+                        prev_valid := false;
+                        count_next := false;
+                        for i in 0 to rle_words(lane) - 1 loop
+                            stream_read(word);
+                            if lane = 0 and i = 0 then
+                                seq := to_integer(unsigned(word));
+                            end if;
+                            if count_next then
+                                for c in 1 to to_integer(unsigned(word)) loop
+                                    check_word(prev, lane, expanded);
+                                    expanded := expanded + 1;
+                                end loop;
+                                count_next := false;
+                                prev_valid := false;
+                            else
+                                check_word(word, lane, expanded);
+                                expanded := expanded + 1;
+                                if RLE /= 0 and prev_valid and word = prev then
+                                    count_next := true;
+                                else
+                                    prev := word;
+                                    prev_valid := true;
+                                end if;
+                            end if;
+                        end loop;
+                        if expanded /= word_num or count_next then
+                            if errors < MAX_ERRORS then
+                                report "sck "&integer'image(sck_ns)
+                                    &" ns: packet "&integer'image(seq)
+                                    &" lane "&integer'image(lane)
+                                    &" expands to "&integer'image(expanded)
+                                    &" words" severity warning;
+                            end if;
+                            errors := errors + 1;
+                        end if;
+                    end loop;
+                    if (seq >= next_seq) and (seq < PACKETS) then
+                        gaps := gaps + seq - next_seq;
+                        next_seq := seq + 1;
+                    end if;
+                    received := received + 1;
+                end loop;
+                if drain_words > hw_words then
+                    hw_words := drain_words;
+                end if;
+
+                if DMA /= 0 then
+                    -- publish the read offset, low word commits it
+                    dma_select(DMA_RD);
+                    for i in 0 to 1 loop
+                        if i = 0 then
+                            word := std_logic_vector(to_unsigned(ring_rd*2 / 65536, 16));
+                        else
+                            word := std_logic_vector(to_unsigned(ring_rd*2 mod 65536, 16));
+                        end if;
+                        wishbone_write( REG_DMA_DATA, word,
+                                        imx_clk, wbs_strobe, wbs_cycle,
+                                        wbs_write, wbs_ack, wbs_add,
+                                        wbs_writedata, wbs_readdata, WSC);
+                    end loop;
+                end if;
+
+                -- acknowledge interrupt
+                wishbone_write( REG_CONTROL, CTRL_ACK&irq_pnum_trig,
+                                imx_clk, wbs_strobe, wbs_cycle,
+                                wbs_write, wbs_ack, wbs_add,
+                                wbs_writedata, wbs_readdata, WSC);
+                wishbone_write( REG_CONTROL, CTRL_NONE&irq_pnum_trig,
+                                imx_clk, wbs_strobe, wbs_cycle,
+                                wbs_write, wbs_ack, wbs_add,
+                                wbs_writedata, wbs_readdata, WSC);
+                if irq_seen and now - irq_time > irq_latency_max then
+                    irq_latency_max := now - irq_time;
+                end if;
+            end loop;
+            gaps := gaps + PACKETS - next_seq;
+
+            -- latch and clear LOSS
+            wishbone_write( REG_LOSS, x"8000",
+                            imx_clk, wbs_strobe, wbs_cycle,
+                            wbs_write, wbs_ack, wbs_add,
+                            wbs_writedata, wbs_readdata, WSC);
+            for i in 4 downto 0 loop
+                wishbone_read(REG_LOSS,  value,
+                              imx_clk, wbs_strobe, wbs_cycle,
+                              wbs_write, wbs_ack, wbs_add,
+                              wbs_writedata, wbs_readdata, WSC);
+                loss(i*16 + 15 downto i*16) := value;
+            end loop;
+            lost_packets := to_integer(unsigned(loss(79 downto 64)));
+            -- saturate to natural range
+            if loss(63) = '1' then
+                lost_bits := natural'high;
+            else
+                lost_bits := to_integer(unsigned(loss(62 downto 32)));
+            end if;
+            overflows := to_integer(unsigned(loss(31 downto 16)));
+            -- shortest sck period, in half gls_clk periods
+            sck_measured := to_integer(unsigned(loss(15 downto 0))) * CLK_NS / 2;
+
+            report "sck "&integer'image(sck_ns)&" ns x"
+                &integer'image(lanes_now)&" ("
+                &integer'image(sck_ns / CLK_NS)&" gls_clk): "
+                &integer'image(received)&"/"&integer'image(PACKETS)
+                &" packets, "&integer'image(lost_packets)&" lost ("
+                &integer'image(lost_bits)&" bits, "
+                &integer'image(overflows)&" overflows), "
+                &integer'image(errors)&" errors, high water "
+                &integer'image(hw_packets)&" packets "
+                &integer'image(hw_words)&" words, latency "
+                &integer'image(latency_max * CLK_NS)&" ns packet "
+                &ns_image(irq_latency_max)&" irq to drained, sck measured "
+                &integer'image(sck_measured)&" ns";
+
+            if errors /= 0 or gaps /= lost_packets then
+                report "sck "&integer'image(sck_ns)&" ns: "
+                    &integer'image(gaps)&" missing packets, LOSS counts "
+                    &integer'image(lost_packets)&", "
+                    &integer'image(errors)&" errors" severity warning;
+                failed := true;
+                sck_lossless := false;
+            elsif abs(sck_measured - sck_ns) > CLK_NS then
+                -- edges seen one sample early or late at most
+                report "sck "&integer'image(sck_ns)&" ns: measured "
+                    &integer'image(sck_measured)&" ns" severity warning;
+                failed := true;
+                sck_lossless := false;
+            elsif lost_packets /= 0 then
+                sck_lossless := false;
+            end if;
+
+            gen_start <= '0';
+            wait until gen_done = '0';
+            step <= step + 1;
+            -- next lanes mode at this sck period, quad needs sck slower
+            -- than a quarter of gls_clk
+            if lanes_now*2 <= LANES and
+               (lanes_now = 1 or sck_ns > 4*CLK_NS) then
+                lanes_now := lanes_now*2;
+            else
+                if sck_lossless then
+                    best_ns := sck_ns;
+                end if;
+                exit when sck_ns < SCK_NS_STEP or SCK_NS_STEP = 0;
+                sck_ns := sck_ns - SCK_NS_STEP;
+                lanes_now := 1;
+                sck_lossless := true;
+            end if;
+        end loop;
+
+        if best_ns /= 0 then
+            report "max lossless sck: "&integer'image(1000000 / best_ns)
+                &" kHz ("&integer'image(best_ns)&" ns, "
+                &integer'image(best_ns / CLK_NS)&" gls_clk cycles)";
+        else
+            report "no lossless sck in sweep";
+        end if;
+
+        if failed then
+            assert false report "*** End of test: FAIL ***" severity failure;
+        else
+            assert false report "*** End of test: PASS ***" severity error;
+        end if;
+        wait;
+    end process stimulis;
+
+    ------------
+    -- clocks --
+    ------------
+    imx_clk_p : process
+    begin
+        imx_clk <= '1';
+        wait for (CLK_NS * 1 ns) / 2;
+        imx_clk <= '0';
+        wait for (CLK_NS * 1 ns) / 2;
+    end process imx_clk_p;
+
+end architecture spisnif_bench_tb_1;
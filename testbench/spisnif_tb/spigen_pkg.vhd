@@ -38,6 +38,22 @@ package spigen_pkg is
                 signal spi_mosi  : out std_logic;
                 signal spi_miso  : out std_logic;
                 signal spi_cs    : out std_logic);
+    -- quad lanes: data 0 to 3 sent on each edge
+    procedure spi_send_quad_frame(
+                data0       : std_logic_vector;
+                data1       : std_logic_vector;
+                data2       : std_logic_vector;
+                data3       : std_logic_vector;
+                clock_per   : time;
+                cpol        : std_logic;
+                cpha        : std_logic;
+                cspol       : std_logic;
+                signal spi_clock : out std_logic;
+                signal spi_io0   : out std_logic;
+                signal spi_io1   : out std_logic;
+                signal spi_io2   : out std_logic;
+                signal spi_io3   : out std_logic;
+                signal spi_cs    : out std_logic);
 end package spigen_pkg;
 
 package body spigen_pkg is
@@ -80,4 +96,53 @@ package body spigen_pkg is
         spi_cs <= not cspol;
     end procedure spi_send_frame;
 
+    procedure spi_send_quad_frame(
+                data0       : std_logic_vector;
+                data1       : std_logic_vector;
+                data2       : std_logic_vector;
+                data3       : std_logic_vector;
+                clock_per   : time;
+                cpol        : std_logic;
+                cpha        : std_logic;
+                cspol       : std_logic;
+                signal spi_clock : out std_logic;
+                signal spi_io0   : out std_logic;
+                signal spi_io1   : out std_logic;
+                signal spi_io2   : out std_logic;
+                signal spi_io3   : out std_logic;
+                signal spi_cs    : out std_logic) is
+    begin
+        assert (data0'high = data1'high) and (data0'high = data2'high) and
+               (data0'high = data3'high) and (data0'low = data1'low) and
+               (data0'low = data2'low) and (data0'low = data3'low)
+            report "ERROR: data lanes must have the same size" severity error;
+
+        spi_cs <= cspol;
+        spi_clock <= cpol;
+        wait for clock_per/2;
+
+        for i in data0'left to data0'right loop
+                spi_clock <= cpol;
+                if (cpha = '0') then --set the data before the first edge
+                        spi_io0 <= data0(i);
+                        spi_io1 <= data1(i);
+                        spi_io2 <= data2(i);
+                        spi_io3 <= data3(i);
+                end if;
+                wait for clock_per/2;
+                if (cpha = '1') then --set the data before second edge
+                        spi_io0 <= data0(i);
+                        spi_io1 <= data1(i);
+                        spi_io2 <= data2(i);
+                        spi_io3 <= data3(i);
+                end if;
+                spi_clock <= not cpol;
+                wait for clock_per/2;
+        end loop;
+        -- end of frame
+        spi_clock <= cpol;
+        wait for clock_per/2;
+        spi_cs <= not cspol;
+    end procedure spi_send_quad_frame;
+
 end package body spigen_pkg;
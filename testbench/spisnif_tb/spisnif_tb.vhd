@@ -39,18 +39,20 @@ Architecture spisnif_tb_1 of spisnif_tb is
     CONSTANT FIFO_BRAM_NUM : natural := 4;
 
     -- registers mapping
-    CONSTANT REG_CONTROL     : std_logic_vector(2 downto 0) := "000";
-    CONSTANT REG_FIFO_MOSI   : std_logic_vector(2 downto 0) := "001";
-    CONSTANT REG_FIFO_MISO   : std_logic_vector(2 downto 0) := "010";
-    CONSTANT REG_FIFO_PACKET : std_logic_vector(2 downto 0) := "011";
-    CONSTANT REG_STATUS      : std_logic_vector(2 downto 0) := "100";
-    CONSTANT REG_CONFIG      : std_logic_vector(2 downto 0) := "101";
---  CONSTANT REG_            : std_logic_vector(2 downto 0) := "110";
-    CONSTANT REG_ID          : std_logic_vector(2 downto 0) := "111";
+    CONSTANT REG_CONTROL     : std_logic_vector(3 downto 0) := "0000";
+    CONSTANT REG_FIFO_MOSI   : std_logic_vector(3 downto 0) := "0001";
+    CONSTANT REG_FIFO_MISO   : std_logic_vector(3 downto 0) := "0010";
+    CONSTANT REG_FIFO_PACKET : std_logic_vector(3 downto 0) := "0011";
+    CONSTANT REG_STATUS      : std_logic_vector(3 downto 0) := "0100";
+    CONSTANT REG_CONFIG      : std_logic_vector(3 downto 0) := "0101";
+    CONSTANT REG_FIFO_PINFO  : std_logic_vector(3 downto 0) := "0110";
+    CONSTANT REG_ID          : std_logic_vector(3 downto 0) := "0111";
+    -- stream window, 8 aliased addresses
+    CONSTANT REG_STREAM      : std_logic_vector(3 downto 0) := "1000";
 
     signal imx_clk : std_logic;
     signal reset : std_logic;
-    signal wbs_add       : std_logic_vector(2 downto 0);
+    signal wbs_add       : std_logic_vector(3 downto 0);
     signal wbs_writedata : std_logic_vector(15 downto 0);
     signal wbs_readdata  : std_logic_vector(15 downto 0);
     signal wbs_strobe    : std_logic;
@@ -72,7 +74,7 @@ component spisnif
         gls_reset    : in std_logic;
         gls_clk      : in std_logic;
         -- Wishbone signals
-        wbs_add       : in std_logic_vector(2 downto 0);
+        wbs_add       : in std_logic_vector(3 downto 0);
         wbs_writedata : in std_logic_vector(15 downto 0);
         wbs_readdata  : out std_logic_vector(15 downto 0);
         wbs_strobe    : in std_logic;
@@ -94,6 +96,8 @@ end component;
     signal cpol  : std_logic;
 
     signal irq_pnum_trig : std_logic_vector(10 downto 0);
+    signal ts_start : std_logic_vector(31 downto 0);
+    signal ts_end : std_logic_vector(31 downto 0);
 
     constant MOSI_VALUE : std_logic_vector := "111111";
     constant MISO_VALUE : std_logic_vector := "010101";
@@ -157,6 +161,15 @@ begin
                        spi_mosi => mosi,
                        spi_miso => miso,
                        spi_cs => cs);
+	wait for 10 us;
+        -- read back through stream window
+        spi_send_frame(mosi => MOSI_VALUE, miso => MISO_VALUE,
+                       clock_per => 20 ns,
+                       cpol => '0', cpha => '0', cspol => '0',
+                       spi_clock => sck,
+                       spi_mosi => mosi,
+                       spi_miso => miso,
+                       spi_cs => cs);
         wait for 1000 ms; -- do not loop
     end process;
 
@@ -250,10 +263,73 @@ begin
                       imx_clk, wbs_strobe, wbs_cycle,
                       wbs_write, wbs_ack, wbs_add,
                       wbs_writedata, wbs_readdata, 5);
+        -- read packets timestamps
+        for i in 0 to 1 loop
+            wishbone_read(REG_FIFO_PINFO,  value,
+                          imx_clk, wbs_strobe, wbs_cycle,
+                          wbs_write, wbs_ack, wbs_add,
+                          wbs_writedata, wbs_readdata, 5);
+            ts_start(31 downto 16) <= value;
+            wishbone_read(REG_FIFO_PINFO,  value,
+                          imx_clk, wbs_strobe, wbs_cycle,
+                          wbs_write, wbs_ack, wbs_add,
+                          wbs_writedata, wbs_readdata, 5);
+            ts_start(15 downto 0) <= value;
+            wishbone_read(REG_FIFO_PINFO,  value,
+                          imx_clk, wbs_strobe, wbs_cycle,
+                          wbs_write, wbs_ack, wbs_add,
+                          wbs_writedata, wbs_readdata, 5);
+            ts_end(31 downto 16) <= value;
+            wishbone_read(REG_FIFO_PINFO,  value,
+                          imx_clk, wbs_strobe, wbs_cycle,
+                          wbs_write, wbs_ack, wbs_add,
+                          wbs_writedata, wbs_readdata, 5);
+            ts_end(15 downto 0) <= value;
+            wait for 1 ns;
+            report "packet "&integer'image(i)&" lasts "
+                &integer'image(to_integer(unsigned(ts_end) - unsigned(ts_start)))
+                &" cycles.";
+            assert unsigned(ts_end) > unsigned(ts_start)
+                report "packet end timestamp is not after start"
+                severity error;
+        end loop;
+
+        wishbone_read(REG_STATUS,  value,
+                      imx_clk, wbs_strobe, wbs_cycle,
+                      wbs_write, wbs_ack, wbs_add,
+                      wbs_writedata, wbs_readdata, 5);
+
+        -- read third packet through stream window
+        wait for 15 us;
+        wishbone_read(REG_STREAM,  value,
+                      imx_clk, wbs_strobe, wbs_cycle,
+                      wbs_write, wbs_ack, wbs_add,
+                      wbs_writedata, wbs_readdata, 5);
+        assert to_integer(unsigned(value)) = MOSI_VALUE'length
+            report "stream descriptor is "&integer'image(to_integer(unsigned(value)))
+            severity error;
+        for i in 0 to 3 loop
+            wishbone_read(REG_STREAM,  value,
+                          imx_clk, wbs_strobe, wbs_cycle,
+                          wbs_write, wbs_ack, wbs_add,
+                          wbs_writedata, wbs_readdata, 5);
+        end loop;
+        wishbone_read(REG_STREAM,  value,
+                      imx_clk, wbs_strobe, wbs_cycle,
+                      wbs_write, wbs_ack, wbs_add,
+                      wbs_writedata, wbs_readdata, 5);
+        report "stream mosi read:"&integer'image(to_integer(unsigned(value)))&".";
+        wishbone_read(REG_STREAM,  value,
+                      imx_clk, wbs_strobe, wbs_cycle,
+                      wbs_write, wbs_ack, wbs_add,
+                      wbs_writedata, wbs_readdata, 5);
+        report "stream miso read:"&integer'image(to_integer(unsigned(value)))&".";
         wishbone_read(REG_STATUS,  value,
                       imx_clk, wbs_strobe, wbs_cycle,
                       wbs_write, wbs_ack, wbs_add,
                       wbs_writedata, wbs_readdata, 5);
+        assert value(10 downto 0) = "00000000000"
+            report "packets left after stream read" severity error;
 
 	wait for 2 us;
         assert false report "*** End of test ***" severity error;